@@ -0,0 +1,105 @@
+
+#include "adaptivesampler.h"
+
+#include "../utils/threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Luminance below which the relative error is measured against this value, so that noise in almost black
+// pixels, which can't be seen, doesn't keep blocks active forever.
+#define ADAPTIVE_ERROR_FLOOR 0.05f
+
+AdaptiveSampler::AdaptiveSampler()
+    : m_width(0), m_height(0), m_blocksX(0), m_blocksY(0), m_activeCount(0), m_maxError(0.0f)
+{
+}
+
+void AdaptiveSampler::resize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+    m_blocksX = (width + ADAPTIVE_BLOCK_SIZE - 1) / ADAPTIVE_BLOCK_SIZE;
+    m_blocksY = (height + ADAPTIVE_BLOCK_SIZE - 1) / ADAPTIVE_BLOCK_SIZE;
+    reset();
+}
+
+void AdaptiveSampler::reset()
+{
+    m_active.assign(size_t(m_blocksX) * m_blocksY, 1);
+    m_errors.assign(size_t(m_blocksX) * m_blocksY, 0.0f);
+    m_activeCount = m_blocksX * m_blocksY;
+    m_maxError = 0.0f;
+}
+
+float AdaptiveSampler::pixelError(float mean, float secondMoment, int samples)
+{
+    if (samples < 2)
+        return INFINITY;
+    // variance of the samples with Bessel's correction, divided by the count for the variance of the mean
+    const float variance = std::max(secondMoment - mean * mean, 0.0f) / float(samples - 1);
+    return sqrtf(variance) / std::max(mean, ADAPTIVE_ERROR_FLOOR);
+}
+
+int AdaptiveSampler::update(const float *beauty, const float *secondMoment, int samples, float threshold,
+                            int minSamples)
+{
+    // blocks are independent, every task takes a row of them
+    parallelFor(m_blocksY, [&](int blockY) {
+        const int y0 = blockY * ADAPTIVE_BLOCK_SIZE;
+        const int y1 = std::min(y0 + ADAPTIVE_BLOCK_SIZE, m_height);
+        for (int blockX = 0; blockX < m_blocksX; blockX++) {
+            const size_t block = size_t(blockY) * m_blocksX + blockX;
+            if (!m_active[block])
+                continue;
+            const int x0 = blockX * ADAPTIVE_BLOCK_SIZE;
+            const int x1 = std::min(x0 + ADAPTIVE_BLOCK_SIZE, m_width);
+
+            // mean error of the pixels, single fireflies shouldn't keep a block active forever
+            float error = 0.0f;
+            for (int y = y0; y < y1; y++)
+                for (int x = x0; x < x1; x++) {
+                    const size_t pixel = size_t(y) * m_width + x;
+                    const float *rgb = beauty + pixel * 4;
+                    const float mean = 0.2126f * rgb[0] + 0.7152f * rgb[1] + 0.0722f * rgb[2];
+                    error += pixelError(mean, secondMoment[pixel], samples);
+                }
+            error /= float((x1 - x0) * (y1 - y0));
+
+            m_errors[block] = error;
+            if (minSamples <= samples && error < threshold)
+                m_active[block] = 0;
+        }
+    });
+
+    m_activeCount = 0;
+    m_maxError = 0.0f;
+    for (size_t block = 0; block < m_active.size(); block++)
+        if (m_active[block]) {
+            m_activeCount++;
+            m_maxError = std::max(m_maxError, m_errors[block]);
+        }
+    return m_activeCount;
+}
+
+bool AdaptiveSampler::regionActive(optix::int2 origin, optix::int2 size) const
+{
+    const int bx1 = std::min((origin.x + size.x + ADAPTIVE_BLOCK_SIZE - 1) / ADAPTIVE_BLOCK_SIZE, m_blocksX);
+    const int by1 = std::min((origin.y + size.y + ADAPTIVE_BLOCK_SIZE - 1) / ADAPTIVE_BLOCK_SIZE, m_blocksY);
+    for (int by = origin.y / ADAPTIVE_BLOCK_SIZE; by < by1; by++)
+        for (int bx = origin.x / ADAPTIVE_BLOCK_SIZE; bx < bx1; bx++)
+            if (blockActive(bx, by))
+                return true;
+    return false;
+}
+
+int AdaptiveSampler::retiredPixels() const
+{
+    int pixels = 0;
+    for (int by = 0; by < m_blocksY; by++)
+        for (int bx = 0; bx < m_blocksX; bx++)
+            if (!blockActive(bx, by))
+                pixels += std::min(ADAPTIVE_BLOCK_SIZE, m_width - bx * ADAPTIVE_BLOCK_SIZE) *
+                          std::min(ADAPTIVE_BLOCK_SIZE, m_height - by * ADAPTIVE_BLOCK_SIZE);
+    return pixels;
+}
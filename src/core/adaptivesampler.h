@@ -0,0 +1,96 @@
+
+#ifndef RENDERER_GPU_ADAPTIVESAMPLER_H
+#define RENDERER_GPU_ADAPTIVESAMPLER_H
+
+#include "../utils/config.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+// Adaptive sampling estimates the noise of the image in blocks of ADAPTIVE_BLOCK_SIZE pixels and retires
+// blocks whose error fell below a threshold. Retired blocks aren't sampled again until the accumulation is
+// reset, so all active pixels keep the same sample count and the film is averaged as before.
+#define ADAPTIVE_BLOCK_SIZE 16
+
+#ifdef __CUDACC__
+#include <optix.h>
+
+// Context global, set by Camera. The second moment is sized like the film and holds the average squared
+// luminance of the samples, blocks cover the image and are non-zero while active. Both are 1x1 when
+// adaptive sampling is off.
+rtBuffer<float, 2> sysSecondMoment;
+rtBuffer<unsigned char, 2> sysActiveBlocks;
+rtDeclareVariable(int, sysAdaptiveSampling, , );
+
+RT_FUNCTION bool pixelActive(const optix::uint2 pixel)
+{
+    return !sysAdaptiveSampling ||
+        sysActiveBlocks[optix::make_uint2(pixel.x / ADAPTIVE_BLOCK_SIZE, pixel.y / ADAPTIVE_BLOCK_SIZE)];
+}
+
+RT_FUNCTION float sampleLuminance(const optix::float3 radiance)
+{
+    return optix::dot(radiance, optix::make_float3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Accumulates the mean squared luminance of sampleCount new samples, sampleIndex counts the previous ones.
+RT_FUNCTION void writeSecondMoment(const optix::uint2 index, const int sampleIndex, const int sampleCount,
+                                   const float squaredLuminance)
+{
+    sysSecondMoment[index] = (0 < sampleIndex) ?
+        optix::lerp(sysSecondMoment[index], squaredLuminance, float(sampleCount) / float(sampleIndex + sampleCount)) :
+        squaredLuminance;
+}
+#endif
+
+#ifndef __CUDACC__
+#include <vector>
+
+// Host side estimator, works on copies of the film so that it can be driven by synthetic images.
+class AdaptiveSampler
+{
+public:
+    AdaptiveSampler();
+
+    // Size of the image in pixels, all blocks become active.
+    void resize(int width, int height);
+    void reset();
+
+    // Estimates the error of every active block from the film (RGBA, rows bottom first) and the second moment
+    // of its luminance after samples samples per pixel. Blocks below threshold are retired once
+    // minSamples are taken. Returns the number of blocks still active.
+    int update(const float *beauty, const float *secondMoment, int samples, float threshold, int minSamples);
+
+    // Relative standard error of the mean luminance of a pixel, dark pixels count as ADAPTIVE_ERROR_FLOOR.
+    static float pixelError(float mean, float secondMoment, int samples);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    int blocksX() const { return m_blocksX; }
+    int blocksY() const { return m_blocksY; }
+    // One byte per block, row by row from the bottom, non-zero while active. Uploaded to sysActiveBlocks.
+    const std::vector<unsigned char> &activeBlocks() const { return m_active; }
+    bool blockActive(int blockX, int blockY) const { return m_active[size_t(blockY) * m_blocksX + blockX] != 0; }
+    // Whether any block overlapping the rectangle is active, retired launches can be skipped.
+    bool regionActive(optix::int2 origin, optix::int2 size) const;
+    // Error of a block at its last update, 0 before the first one.
+    float blockError(int blockX, int blockY) const { return m_errors[size_t(blockY) * m_blocksX + blockX]; }
+
+    int activeBlockCount() const { return m_activeCount; }
+    // Pixels of retired blocks, which are skipped by every further iteration.
+    int retiredPixels() const;
+    // Largest error of the active blocks at the last update.
+    float maxError() const { return m_maxError; }
+
+private:
+    int m_width;
+    int m_height;
+    int m_blocksX;
+    int m_blocksY;
+    int m_activeCount;
+    float m_maxError;
+    std::vector<unsigned char> m_active;
+    std::vector<float> m_errors;
+};
+#endif
+
+#endif //RENDERER_GPU_ADAPTIVESAMPLER_H
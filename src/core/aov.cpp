@@ -0,0 +1,114 @@
+
+#include "aov.h"
+
+#include "../utils/log.h"
+
+#include <sstream>
+
+static const struct
+{
+    int bit;
+    const char *name;
+} aovNames[] = {
+    {AOV_ALBEDO, "albedo"},
+    {AOV_NORMAL, "normal"},
+    {AOV_DEPTH, "depth"},
+    {AOV_ID, "id"},
+    {AOV_SAMPLES, "samples"},
+};
+
+int parseAovMask(const std::string &names)
+{
+    int mask = 0;
+    std::istringstream stream(names);
+    std::string name;
+    while (stream >> name) {
+        bool found = false;
+        for (const auto &aov : aovNames)
+            if (name == aov.name) {
+                mask |= aov.bit;
+                found = true;
+            }
+        if (!found)
+            LogWarning("Unknown AOV layer %s", name.c_str());
+    }
+    return mask;
+}
+
+std::string aovMaskNames(int mask)
+{
+    std::string names;
+    for (const auto &aov : aovNames)
+        if (mask & aov.bit)
+            names += (names.empty() ? "" : " ") + std::string(aov.name);
+    return names;
+}
+
+void packFilmLayers(const MappedAovs &aovs, int mask, int width, int height, FilmLayers &layers)
+{
+    const size_t count = size_t(width) * height;
+    layers.width = width;
+    layers.height = height;
+    layers.mask = mask;
+
+    layers.albedo.clear();
+    if ((mask & AOV_ALBEDO) && aovs.albedo) {
+        layers.albedo.resize(count * 3);
+        for (size_t i = 0; i < count; i++) {
+            layers.albedo[i * 3 + 0] = aovs.albedo[i].x;
+            layers.albedo[i * 3 + 1] = aovs.albedo[i].y;
+            layers.albedo[i * 3 + 2] = aovs.albedo[i].z;
+        }
+    }
+
+    layers.normal.clear();
+    if ((mask & AOV_NORMAL) && aovs.normal) {
+        layers.normal.resize(count * 3);
+        for (size_t i = 0; i < count; i++) {
+            layers.normal[i * 3 + 0] = aovs.normal[i].x;
+            layers.normal[i * 3 + 1] = aovs.normal[i].y;
+            layers.normal[i * 3 + 2] = aovs.normal[i].z;
+        }
+    }
+
+    layers.depth.clear();
+    if ((mask & AOV_DEPTH) && aovs.depth)
+        layers.depth.assign(aovs.depth, aovs.depth + count);
+
+    layers.primitiveID.clear();
+    layers.materialID.clear();
+    if ((mask & AOV_ID) && aovs.ids) {
+        layers.primitiveID.resize(count);
+        layers.materialID.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            layers.primitiveID[i] = aovs.ids[i].x;
+            layers.materialID[i] = aovs.ids[i].y;
+        }
+    }
+
+    layers.samples.clear();
+    if ((mask & AOV_SAMPLES) && aovs.samples)
+        layers.samples.assign(aovs.samples, aovs.samples + count);
+
+    // layers that couldn't be read are reported as disabled
+    layers.mask = (layers.albedo.empty() ? 0 : AOV_ALBEDO) | (layers.normal.empty() ? 0 : AOV_NORMAL) |
+                  (layers.depth.empty() ? 0 : AOV_DEPTH) | (layers.primitiveID.empty() ? 0 : AOV_ID) |
+                  (layers.samples.empty() ? 0 : AOV_SAMPLES);
+}
+
+void maskFilmLayers(FilmLayers &layers, int mask)
+{
+    if (!(mask & AOV_ALBEDO))
+        std::vector<float>().swap(layers.albedo);
+    if (!(mask & AOV_NORMAL))
+        std::vector<float>().swap(layers.normal);
+    if (!(mask & AOV_DEPTH))
+        std::vector<float>().swap(layers.depth);
+    if (!(mask & AOV_ID)) {
+        std::vector<int32_t>().swap(layers.primitiveID);
+        std::vector<int32_t>().swap(layers.materialID);
+    }
+    if (!(mask & AOV_SAMPLES))
+        std::vector<uint32_t>().swap(layers.samples);
+    layers.mask &= mask;
+}
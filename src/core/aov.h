@@ -0,0 +1,92 @@
+
+#ifndef RENDERER_GPU_AOV_H
+#define RENDERER_GPU_AOV_H
+
+#include "../utils/config.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+// Arbitrary output variables are extra film layers filled on the first hit of every camera path. Each layer
+// is enabled by its bit in sysAovMask, layers that are off have 1x1 buffers and aren't written.
+#define AOV_ALBEDO  0x01 // float4, albedo of the hit material including textures, averaged like the beauty
+#define AOV_NORMAL  0x02 // float4, shading normal in world space facing the camera, averaged
+#define AOV_DEPTH   0x04 // float, distance along the camera ray, averaged, AOV_NO_HIT_DEPTH when nothing is hit
+#define AOV_ID      0x08 // int2, primitive and material index of the last sample, -1 when nothing is hit
+#define AOV_SAMPLES 0x10 // unsigned int, samples accumulated in the pixel
+#define AOV_LAYER_COUNT 5
+
+#define AOV_NO_HIT_DEPTH 1e30f
+
+#ifdef __CUDACC__
+#include <optix.h>
+
+// Context global layers, set by Camera and sized like the film.
+rtBuffer<optix::float4, 2> sysAovAlbedo;
+rtBuffer<optix::float4, 2> sysAovNormal;
+rtBuffer<float, 2> sysAovDepth;
+rtBuffer<optix::int2, 2> sysAovIDs;
+rtBuffer<unsigned int, 2> sysAovSamples;
+rtDeclareVariable(int, sysAovMask, , );
+
+// Accumulates the first hit of a path into the enabled layers, sampleIndex counts from 0 like sysIterationIndex.
+RT_FUNCTION void writeAovs(const optix::uint2 index, const int sampleIndex, const optix::float3 albedo,
+                           const optix::float3 normal, const float depth, const int primitiveID, const int materialID)
+{
+    const float weight = 1.0f / float(sampleIndex + 1);
+    if (sysAovMask & AOV_ALBEDO)
+        sysAovAlbedo[index] = (0 < sampleIndex) ?
+            optix::lerp(sysAovAlbedo[index], optix::make_float4(albedo, 1.0f), weight) : optix::make_float4(albedo, 1.0f);
+    if (sysAovMask & AOV_NORMAL)
+        sysAovNormal[index] = (0 < sampleIndex) ?
+            optix::lerp(sysAovNormal[index], optix::make_float4(normal, 0.0f), weight) : optix::make_float4(normal, 0.0f);
+    if (sysAovMask & AOV_DEPTH)
+        sysAovDepth[index] = (0 < sampleIndex) ? optix::lerp(sysAovDepth[index], depth, weight) : depth;
+    if (sysAovMask & AOV_ID)
+        sysAovIDs[index] = optix::make_int2(primitiveID, materialID);
+    if (sysAovMask & AOV_SAMPLES)
+        sysAovSamples[index] = (0 < sampleIndex) ? sysAovSamples[index] + 1 : 1;
+}
+#endif
+
+#ifndef __CUDACC__
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Space separated layer names (albedo, normal, depth, id, samples) to a mask and back.
+int parseAovMask(const std::string &names);
+std::string aovMaskNames(int mask);
+
+// Host copy of the film and its layers, rows bottom first like the film. Vectors of disabled layers are empty.
+struct FilmLayers
+{
+    int width = 0;
+    int height = 0;
+    int mask = 0;
+    std::vector<float> beauty;        // RGBA
+    std::vector<float> albedo;        // RGB
+    std::vector<float> normal;        // XYZ
+    std::vector<float> depth;
+    std::vector<int32_t> primitiveID;
+    std::vector<int32_t> materialID;
+    std::vector<uint32_t> samples;
+};
+
+// Mapped contents of the layer buffers in their device layout, null for disabled layers.
+struct MappedAovs
+{
+    const optix::float4 *albedo = nullptr;
+    const optix::float4 *normal = nullptr;
+    const float *depth = nullptr;
+    const optix::int2 *ids = nullptr;
+    const unsigned int *samples = nullptr;
+};
+
+// Copies the enabled layers of mapped buffers into layers, dropping the padding of the device formats.
+// Buffers hold width x height elements, the beauty is left alone.
+void packFilmLayers(const MappedAovs &aovs, int mask, int width, int height, FilmLayers &layers);
+// Frees the layers that aren't in mask.
+void maskFilmLayers(FilmLayers &layers, int mask);
+#endif
+
+#endif //RENDERER_GPU_AOV_H
@@ -0,0 +1,617 @@
+
+#include "blockcompression.h"
+
+#include "image.h"
+#include "../utils/log.h"
+#include "../utils/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Index of the palette entry closest to value. Palette is planar (one plane of count entries per channel)
+// and count is a multiple of 4, so that four entries are compared at once.
+static int closestEntry(const float *palette, int channels, int count, const float *value, float &error)
+{
+    int best = 0;
+    float bestError = INFINITY;
+#ifdef __SSE2__
+    for (int i = 0; i < count; i += 4) {
+        __m128 distance = _mm_setzero_ps();
+        for (int c = 0; c < channels; c++) {
+            const __m128 d = _mm_sub_ps(_mm_loadu_ps(palette + c * count + i), _mm_set1_ps(value[c]));
+            distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+        }
+        float distances[4];
+        _mm_storeu_ps(distances, distance);
+        for (int j = 0; j < 4; j++)
+            if (distances[j] < bestError) {
+                bestError = distances[j];
+                best = i + j;
+            }
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        float distance = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            const float d = palette[c * count + i] - value[c];
+            distance += d * d;
+        }
+        if (distance < bestError) {
+            bestError = distance;
+            best = i;
+        }
+    }
+#endif
+    error = bestError;
+    return best;
+}
+
+// Extremes of the pixels along their principal axis (power iteration on the covariance matrix).
+static void principalEndpoints(const float (*pixels)[4], int channels, float *low, float *high)
+{
+    float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < channels; c++)
+            mean[c] += pixels[i][c] / 16.0f;
+
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; i++)
+        for (int a = 0; a < channels; a++)
+            for (int b = 0; b < channels; b++)
+                covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float largest = 0.0f;
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++)
+                next[a] += covariance[a][b] * axis[b];
+            largest = std::max(largest, std::fabs(next[a]));
+        }
+        if (largest <= 0.0f)
+            break;
+        for (int c = 0; c < channels; c++)
+            axis[c] = next[c] / largest;
+    }
+
+    float length2 = 0.0f;
+    for (int c = 0; c < channels; c++)
+        length2 += axis[c] * axis[c];
+
+    float tMin = 0.0f, tMax = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++)
+            t += (pixels[i][c] - mean[c]) * axis[c];
+        t /= length2;
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+
+    for (int c = 0; c < channels; c++) {
+        low[c] = std::min(std::max(mean[c] + axis[c] * tMin, 0.0f), 255.0f);
+        high[c] = std::min(std::max(mean[c] + axis[c] * tMax, 0.0f), 255.0f);
+    }
+}
+
+// Least squares endpoints for fixed interpolation weights of the pixels (0 = low, 1 = high).
+static bool fitEndpoints(const float (*pixels)[4], int channels, const float *weights, float *low, float *high)
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    float bx[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+        const float a = 1.0f - weights[i];
+        const float b = weights[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; c++) {
+            ax[c] += a * pixels[i][c];
+            bx[c] += b * pixels[i][c];
+        }
+    }
+
+    const float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+
+    for (int c = 0; c < channels; c++) {
+        low[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+        high[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+static void loadBlock(const unsigned char *pixels, float (*block)[4])
+{
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 4; c++)
+            block[i][c] = float(pixels[i * 4 + c]);
+}
+
+// --- BC1
+
+static unsigned short packColor565(const float *color)
+{
+    const int r = std::min(31, int(color[0] * 31.0f / 255.0f + 0.5f));
+    const int g = std::min(63, int(color[1] * 63.0f / 255.0f + 0.5f));
+    const int b = std::min(31, int(color[2] * 31.0f / 255.0f + 0.5f));
+    return (unsigned short) ((r << 11) | (g << 5) | b);
+}
+
+static void unpackColor565(unsigned short packed, float *color)
+{
+    const int r = (packed >> 11) & 31;
+    const int g = (packed >> 5) & 63;
+    const int b = packed & 31;
+    color[0] = float((r << 3) | (r >> 2));
+    color[1] = float((g << 2) | (g >> 4));
+    color[2] = float((b << 3) | (b >> 2));
+}
+
+static float encodeBC1Endpoints(const float (*pixels)[4], const float *a, const float *b, unsigned char *block,
+    float *weights)
+{
+    unsigned short color0 = packColor565(a);
+    unsigned short color1 = packColor565(b);
+    if (color0 < color1)
+        std::swap(color0, color1); // four color mode needs color0 > color1
+
+    float endpoint0[3], endpoint1[3];
+    unpackColor565(color0, endpoint0);
+    unpackColor565(color1, endpoint1);
+
+    // palette order of the format: endpoint0, endpoint1, 1/3 and 2/3 between them
+    const float paletteWeights[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+    float palette[3 * 4];
+    for (int c = 0; c < 3; c++)
+        for (int i = 0; i < 4; i++)
+            palette[c * 4 + i] = endpoint0[c] + (endpoint1[c] - endpoint0[c]) * paletteWeights[i];
+
+    float error = 0.0f;
+    unsigned int indices = 0;
+    for (int i = 0; i < 16; i++) {
+        float pixelError;
+        const int index = (color0 == color1) ? 0 : closestEntry(palette, 3, 4, pixels[i], pixelError);
+        if (color0 == color1) {
+            pixelError = 0.0f;
+            for (int c = 0; c < 3; c++)
+                pixelError += (endpoint0[c] - pixels[i][c]) * (endpoint0[c] - pixels[i][c]);
+        }
+        error += pixelError;
+        weights[i] = paletteWeights[index];
+        indices |= (unsigned int) index << (2 * i);
+    }
+
+    block[0] = (unsigned char) (color0 & 0xff);
+    block[1] = (unsigned char) (color0 >> 8);
+    block[2] = (unsigned char) (color1 & 0xff);
+    block[3] = (unsigned char) (color1 >> 8);
+    for (int i = 0; i < 4; i++)
+        block[4 + i] = (unsigned char) ((indices >> (8 * i)) & 0xff);
+
+    // weights are relative to the ordered endpoints, swap them back for refitting
+    if (packColor565(a) < packColor565(b))
+        for (int i = 0; i < 16; i++)
+            weights[i] = 1.0f - weights[i];
+    return error;
+}
+
+float encodeBC1Block(const unsigned char *pixels, unsigned char *block)
+{
+    float values[16][4];
+    loadBlock(pixels, values);
+
+    float low[4], high[4], weights[16];
+    principalEndpoints(values, 3, low, high);
+    float error = encodeBC1Endpoints(values, high, low, block, weights);
+
+    // refit endpoints to the chosen indices once
+    unsigned char refined[8];
+    if (0.0f < error && fitEndpoints(values, 3, weights, high, low)) {
+        const float refinedError = encodeBC1Endpoints(values, high, low, refined, weights);
+        if (refinedError < error) {
+            memcpy(block, refined, sizeof(refined));
+            error = refinedError;
+        }
+    }
+    return error;
+}
+
+// --- BC4
+
+float encodeBC4Block(const unsigned char *pixels, int channel, unsigned char *block)
+{
+    int lowest = 255, highest = 0;
+    for (int i = 0; i < 16; i++) {
+        lowest = std::min(lowest, int(pixels[i * 4 + channel]));
+        highest = std::max(highest, int(pixels[i * 4 + channel]));
+    }
+
+    // eight value mode (first endpoint is larger): endpoints followed by six interpolated values
+    float palette[8];
+    palette[0] = float(highest);
+    palette[1] = float(lowest);
+    for (int i = 1; i < 7; i++)
+        palette[i + 1] = (float(7 - i) * float(highest) + float(i) * float(lowest)) / 7.0f;
+
+    float error = 0.0f;
+    uint64_t indices = 0;
+    if (lowest != highest)
+        for (int i = 0; i < 16; i++) {
+            const float value = float(pixels[i * 4 + channel]);
+            float pixelError;
+            const int index = closestEntry(palette, 1, 8, &value, pixelError);
+            error += pixelError;
+            indices |= uint64_t(index) << (3 * i);
+        }
+
+    block[0] = (unsigned char) highest;
+    block[1] = (unsigned char) lowest;
+    for (int i = 0; i < 6; i++)
+        block[2 + i] = (unsigned char) ((indices >> (8 * i)) & 0xff);
+    return error;
+}
+
+// --- BC7 (mode 6: single subset, RGBA endpoints with 7 bits and a p-bit, 4-bit indices)
+
+static const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+class BitWriter
+{
+public:
+    explicit BitWriter(unsigned char *data) : m_data(data), m_position(0) {}
+
+    void write(unsigned int value, int bits)
+    {
+        for (int i = 0; i < bits; i++, m_position++)
+            if ((value >> i) & 1u)
+                m_data[m_position >> 3] |= (unsigned char) (1u << (m_position & 7));
+    }
+
+private:
+    unsigned char *m_data;
+    int m_position;
+};
+
+// Picks 7-bit endpoint and shared p-bit with the lowest error.
+static void quantizeBC7Endpoint(const float *value, int *endpoint, int &pBit)
+{
+    float bestError = INFINITY;
+    for (int p = 0; p < 2; p++) {
+        int quantized[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            quantized[c] = std::min(127, std::max(0, int(std::floor((value[c] - float(p)) / 2.0f + 0.5f))));
+            const float reconstructed = float((quantized[c] << 1) | p);
+            error += (reconstructed - value[c]) * (reconstructed - value[c]);
+        }
+        if (error < bestError) {
+            bestError = error;
+            pBit = p;
+            memcpy(endpoint, quantized, sizeof(quantized));
+        }
+    }
+}
+
+static float encodeBC7Endpoints(const float (*pixels)[4], const float *a, const float *b, unsigned char *block,
+    float *weights)
+{
+    int endpoint[2][4], pBit[2];
+    quantizeBC7Endpoint(a, endpoint[0], pBit[0]);
+    quantizeBC7Endpoint(b, endpoint[1], pBit[1]);
+
+    int expanded[2][4];
+    for (int e = 0; e < 2; e++)
+        for (int c = 0; c < 4; c++)
+            expanded[e][c] = (endpoint[e][c] << 1) | pBit[e];
+
+    float palette[4 * 16];
+    for (int c = 0; c < 4; c++)
+        for (int i = 0; i < 16; i++)
+            palette[c * 16 + i] = float(((64 - bc7Weights[i]) * expanded[0][c] + bc7Weights[i] * expanded[1][c] + 32) >> 6);
+
+    int indices[16];
+    float error = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float pixelError;
+        indices[i] = closestEntry(palette, 4, 16, pixels[i], pixelError);
+        error += pixelError;
+        weights[i] = float(bc7Weights[indices[i]]) / 64.0f;
+    }
+
+    // the first index is stored with its top bit implied to be zero, swap the endpoints if it's set
+    // (the weight table is symmetric, so the decoded palette stays the same)
+    if (indices[0] & 8) {
+        for (int c = 0; c < 4; c++)
+            std::swap(endpoint[0][c], endpoint[1][c]);
+        std::swap(pBit[0], pBit[1]);
+        for (int i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(block, 0, 16);
+    BitWriter writer(block);
+    writer.write(1u << 6, 7); // mode 6
+    for (int c = 0; c < 4; c++) {
+        writer.write((unsigned int) endpoint[0][c], 7);
+        writer.write((unsigned int) endpoint[1][c], 7);
+    }
+    writer.write((unsigned int) pBit[0], 1);
+    writer.write((unsigned int) pBit[1], 1);
+    writer.write((unsigned int) indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        writer.write((unsigned int) indices[i], 4);
+    return error;
+}
+
+float encodeBC7Block(const unsigned char *pixels, unsigned char *block)
+{
+    float values[16][4];
+    loadBlock(pixels, values);
+
+    float low[4], high[4], weights[16];
+    principalEndpoints(values, 4, low, high);
+    float error = encodeBC7Endpoints(values, low, high, block, weights);
+
+    unsigned char refined[16];
+    if (0.0f < error && fitEndpoints(values, 4, weights, low, high)) {
+        const float refinedError = encodeBC7Endpoints(values, low, high, refined, weights);
+        if (refinedError < error) {
+            memcpy(block, refined, sizeof(refined));
+            error = refinedError;
+        }
+    }
+    return error;
+}
+
+// --- images
+
+BlockFormat parseBlockFormat(const std::string &name)
+{
+    if (name.empty() || name == "none")
+        return BLOCK_NONE;
+    if (name == "bc1")
+        return BLOCK_BC1;
+    if (name == "bc4")
+        return BLOCK_BC4;
+    if (name == "bc5")
+        return BLOCK_BC5;
+    if (name == "bc7")
+        return BLOCK_BC7;
+    LogWarning("Unknown texture compression '%s'. Texture is left uncompressed", name.c_str());
+    return BLOCK_NONE;
+}
+
+const char *blockFormatName(BlockFormat format)
+{
+    switch (format) {
+    case BLOCK_BC1:
+        return "bc1";
+    case BLOCK_BC4:
+        return "bc4";
+    case BLOCK_BC5:
+        return "bc5";
+    case BLOCK_BC7:
+        return "bc7";
+    default:
+        return "none";
+    }
+}
+
+int blockBytes(BlockFormat format)
+{
+    return (format == BLOCK_BC1 || format == BLOCK_BC4) ? 8 : 16;
+}
+
+static int formatChannels(BlockFormat format)
+{
+    switch (format) {
+    case BLOCK_BC1:
+        return 3;
+    case BLOCK_BC4:
+        return 1;
+    case BLOCK_BC5:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+static float encodeBlock(const unsigned char *pixels, BlockFormat format, unsigned char *block)
+{
+    switch (format) {
+    case BLOCK_BC1:
+        return encodeBC1Block(pixels, block);
+    case BLOCK_BC4:
+        return encodeBC4Block(pixels, 0, block);
+    case BLOCK_BC5:
+        return encodeBC4Block(pixels, 0, block) + encodeBC4Block(pixels, 1, block + 8);
+    default:
+        return encodeBC7Block(pixels, block);
+    }
+}
+
+// Encodes one mip level, rows of blocks are encoded in parallel.
+// Blocks over the image border repeat the last row and column. Returns sum of squared errors.
+static double encodeLevel(const unsigned char *pixels, int width, int height, BlockFormat format,
+    unsigned char *blocks)
+{
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    const int bytes = blockBytes(format);
+
+    std::vector<double> errors(blocksY, 0.0);
+    parallelFor(blocksY, [&](int row) {
+        unsigned char tile[16 * 4];
+        for (int column = 0; column < blocksX; column++) {
+            for (int y = 0; y < 4; y++)
+                for (int x = 0; x < 4; x++) {
+                    const int sx = std::min(column * 4 + x, width - 1);
+                    const int sy = std::min(row * 4 + y, height - 1);
+                    memcpy(tile + (y * 4 + x) * 4, pixels + (size_t(sy) * width + sx) * 4, 4);
+                }
+            errors[row] += encodeBlock(tile, format, blocks + (size_t(row) * blocksX + column) * bytes);
+        }
+    });
+
+    double error = 0.0;
+    for (auto value : errors)
+        error += value;
+    return error;
+}
+
+// Header of the cache file, the source is identified by its size and modification time.
+struct BlockCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t mipCount;
+    int64_t sourceSize;
+    int64_t sourceTime;
+    float psnr;
+    uint32_t mipFilter;
+};
+
+static const char blockCacheMagic[4] = {'B', 'C', 'C', 'H'};
+static const uint32_t blockCacheVersion = 2;
+
+static std::string cacheFilename(const std::string &sourceFilename, BlockFormat format)
+{
+    return sourceFilename + "." + blockFormatName(format) + ".cache";
+}
+
+static bool sourceStamp(const std::string &filename, int64_t &size, int64_t &time)
+{
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0)
+        return false;
+    size = int64_t(status.st_size);
+    time = int64_t(status.st_mtime);
+    return true;
+}
+
+static bool readCache(const std::string &sourceFilename, CompressedImage &result, size_t expectedSize)
+{
+    BlockCacheHeader expected;
+    if (!sourceStamp(sourceFilename, expected.sourceSize, expected.sourceTime))
+        return false;
+
+    std::ifstream file(cacheFilename(sourceFilename, result.format), std::ios::in | std::ios::binary);
+    if (!file)
+        return false;
+
+    BlockCacheHeader header;
+    if (!file.read((char *) &header, sizeof(header)))
+        return false;
+    if (memcmp(header.magic, blockCacheMagic, sizeof(blockCacheMagic)) != 0 || header.version != blockCacheVersion ||
+        header.format != uint32_t(result.format) || header.width != result.width ||
+        header.height != result.height || header.mipCount != result.mipCount ||
+        header.mipFilter != uint32_t(result.mipFilter) || header.sourceSize != expected.sourceSize ||
+        header.sourceTime != expected.sourceTime)
+        return false;
+
+    result.data.resize(expectedSize);
+    if (!file.read((char *) result.data.data(), expectedSize))
+        return false;
+    result.psnr = header.psnr;
+    return true;
+}
+
+static void writeCache(const std::string &sourceFilename, const CompressedImage &image)
+{
+    BlockCacheHeader header;
+    memcpy(header.magic, blockCacheMagic, sizeof(blockCacheMagic));
+    header.version = blockCacheVersion;
+    header.format = uint32_t(image.format);
+    header.width = image.width;
+    header.height = image.height;
+    header.mipCount = image.mipCount;
+    header.psnr = image.psnr;
+    header.mipFilter = uint32_t(image.mipFilter);
+    if (!sourceStamp(sourceFilename, header.sourceSize, header.sourceTime))
+        return;
+
+    const std::string filename = cacheFilename(sourceFilename, image.format);
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    file.write((const char *) &header, sizeof(header));
+    file.write((const char *) image.data.data(), image.data.size());
+    if (!file)
+        LogWarning("Couldn't write texture cache '%s'", filename.c_str());
+}
+
+bool compressImage(const Image &image, const std::string &sourceFilename, BlockFormat format,
+    CompressedImage &result)
+{
+    if (format == BLOCK_NONE)
+        return false;
+    if (image.format() != Image::RGBA8_SRGB) {
+        LogWarning("Only 8-bit images can be block compressed. '%s' is left uncompressed", sourceFilename.c_str());
+        return false;
+    }
+
+    result.format = format;
+    result.width = image.width();
+    result.height = image.height();
+    result.mipCount = image.mipCount();
+    result.mipFilter = image.mipFilter();
+    result.levelOffsets.clear();
+
+    size_t size = 0;
+    int width = result.width, height = result.height;
+    for (int level = 0; level < result.mipCount; level++) {
+        result.levelOffsets.push_back(size);
+        size += size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    if (readCache(sourceFilename, result, size)) {
+        LogInfo("Image '%s' was read from the %s cache. PSNR %.2f dB",
+                sourceFilename.c_str(), blockFormatName(format), result.psnr);
+        return true;
+    }
+
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    result.data.assign(size, 0);
+    const unsigned char *pixels = image.data();
+    width = result.width;
+    height = result.height;
+    for (int level = 0; level < result.mipCount; level++) {
+        const double error = encodeLevel(pixels, width, height, format, result.data.data() + result.levelOffsets[level]);
+        if (level == 0) {
+            const double samples = double((width + 3) / 4) * ((height + 3) / 4) * 16 * formatChannels(format);
+            const double meanError = error / samples;
+            result.psnr = (0.0 < meanError) ? float(10.0 * std::log10(255.0 * 255.0 / meanError)) : INFINITY;
+        }
+        pixels += size_t(width) * height * 4;
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+    }
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const double milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    const double megapixels = double(image.byteSize()) / 4.0 / 1e6;
+    LogInfo("Image '%s' was encoded to %s in %.1f ms (%.1f Mpixel/s). PSNR %.2f dB",
+            sourceFilename.c_str(), blockFormatName(format), milliseconds,
+            megapixels / std::max(milliseconds * 1e-3, 1e-9), result.psnr);
+
+    writeCache(sourceFilename, result);
+    return true;
+}
@@ -0,0 +1,50 @@
+
+#ifndef RENDERER_GPU_BLOCKCOMPRESSION_H
+#define RENDERER_GPU_BLOCKCOMPRESSION_H
+
+#include "mippyramid.h"
+
+#include <string>
+#include <vector>
+
+class Image;
+
+enum BlockFormat
+{
+    BLOCK_NONE = 0,
+    BLOCK_BC1 = 1, // RGB color, 8 bytes per 4x4 block
+    BLOCK_BC4 = 2, // red channel only (scalar data), 8 bytes per block
+    BLOCK_BC5 = 3, // red and green channels (two channel data), 16 bytes per block
+    BLOCK_BC7 = 4  // RGBA color, 16 bytes per block
+};
+
+struct CompressedImage
+{
+    BlockFormat format;
+    int width;
+    int height;
+    int mipCount;
+    MipFilter mipFilter;              // Of the source levels.
+    std::vector<unsigned char> data;  // Blocks of all mip levels, row by row.
+    std::vector<size_t> levelOffsets;
+    float psnr;                       // Of the finest level in dB, over the channels kept by the format.
+
+    CompressedImage() : format(BLOCK_NONE), width(0), height(0), mipCount(0), mipFilter(MIP_FILTER_BOX), psnr(0.0f) {}
+};
+
+BlockFormat parseBlockFormat(const std::string &name);
+const char *blockFormatName(BlockFormat format);
+int blockBytes(BlockFormat format);
+
+// Encodes all mip levels of an 8-bit image into 4x4 blocks, in parallel over rows of blocks.
+// The result is cached in a file next to sourceFilename and reused while the source doesn't change.
+bool compressImage(const Image &image, const std::string &sourceFilename, BlockFormat format,
+    CompressedImage &result);
+
+// Single block encoders. Pixels are 16 RGBA8 values in row-major order.
+// Return sum of squared errors (8-bit units) over the encoded channels.
+float encodeBC1Block(const unsigned char *pixels, unsigned char *block);
+float encodeBC4Block(const unsigned char *pixels, int channel, unsigned char *block);
+float encodeBC7Block(const unsigned char *pixels, unsigned char *block);
+
+#endif //RENDERER_GPU_BLOCKCOMPRESSION_H
@@ -3,14 +3,38 @@
 #include "../utils/config.h"
 #include "../utils/fileutil.h"
 #include "../utils/log.h"
+#include "../utils/stats.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #include <imgui/imgui.h>
 
+REGISTER_PERMANENT_STATISTIC(float, filmMemory, 0.0f, "Film memory (MB)");
+
+// Buffers of the AOV layers, in the order of their bits.
+static const struct
+{
+    int bit;
+    const char *variable;
+    RTformat format;
+    int bytes;
+} aovLayers[AOV_LAYER_COUNT] = {
+    {AOV_ALBEDO, "sysAovAlbedo", RT_FORMAT_FLOAT4, 16},
+    {AOV_NORMAL, "sysAovNormal", RT_FORMAT_FLOAT4, 16},
+    {AOV_DEPTH, "sysAovDepth", RT_FORMAT_FLOAT, 4},
+    {AOV_ID, "sysAovIDs", RT_FORMAT_INT2, 8},
+    {AOV_SAMPLES, "sysAovSamples", RT_FORMAT_UNSIGNED_INT, 4},
+};
+
 Camera::~Camera()
 {
     m_renderBuffer->destroy();
+    for (auto &buffer : m_aovBuffers)
+        buffer->destroy();
+    m_secondMomentBuffer->destroy();
+    m_activeBlocksBuffer->destroy();
 
     for (auto &program : m_programMap)
         program.second->destroy();
@@ -24,18 +48,158 @@ void Camera::setResolution(int w, int h)
         m_height = (h) ? h : 1;
         m_aspect = float(m_width) / float(m_height);
         m_changed = true;
+        applyResolution();
+    }
+}
 
-        try {
-            m_renderBuffer->setSize(m_width, m_height); // RGBA32F buffer.
-            m_context["resolution"]->setUint(optix::make_uint2(m_width, m_height));
-        }
-        catch (optix::Exception &e) {
-            throw std::runtime_error(string_format("Error while resizing Camera %s",
-                                                   e.getErrorString().c_str()));
+optix::int2 Camera::resolution() const
+{
+    return optix::make_int2(std::max(1, m_width / m_renderScale), std::max(1, m_height / m_renderScale));
+}
+
+void Camera::setRenderScale(int scale)
+{
+    scale = std::max(1, scale);
+    if (m_renderScale != scale) {
+        m_renderScale = scale;
+        m_changed = true;
+        applyResolution();
+    }
+}
+
+void Camera::applyResolution()
+{
+    const optix::int2 size = resolution();
+    try {
+        m_context["resolution"]->setUint(optix::make_uint2(size.x, size.y));
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Error while resizing Camera %s",
+                                               e.getErrorString().c_str()));
+    }
+    setFilmWindow(optix::make_int2(0, 0), size);
+}
+
+void Camera::setFilmWindow(optix::int2 origin, optix::int2 size)
+{
+    try {
+        RTsize width, height;
+        m_renderBuffer->getSize(width, height);
+        if (width != RTsize(size.x) || height != RTsize(size.y))
+            m_renderBuffer->setSize(size.x, size.y); // RGBA32F buffer.
+        int bytesPerPixel = 16;
+        for (int i = 0; i < AOV_LAYER_COUNT; i++) {
+            const bool enabled = (m_aovMask & aovLayers[i].bit) != 0;
+            const optix::int2 layerSize = enabled ? size : optix::make_int2(1, 1);
+            m_aovBuffers[i]->getSize(width, height);
+            if (width != RTsize(layerSize.x) || height != RTsize(layerSize.y))
+                m_aovBuffers[i]->setSize(layerSize.x, layerSize.y);
+            bytesPerPixel += enabled ? aovLayers[i].bytes : 0;
         }
+        const optix::int2 momentSize = m_adaptiveSampling ? size : optix::make_int2(1, 1);
+        m_secondMomentBuffer->getSize(width, height);
+        if (width != RTsize(momentSize.x) || height != RTsize(momentSize.y))
+            m_secondMomentBuffer->setSize(momentSize.x, momentSize.y);
+        bytesPerPixel += m_adaptiveSampling ? 4 : 0;
+        m_context["sysFilmOffset"]->setUint(optix::make_uint2(origin.x, origin.y));
+        filmMemory = float(size.x) * float(size.y) * float(bytesPerPixel) / (1024.0f * 1024.0f);
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Error while resizing film %s",
+                                               e.getErrorString().c_str()));
+    }
+}
+
+void Camera::setAovMask(int mask)
+{
+    if (m_aovMask == mask)
+        return;
+    m_aovMask = mask;
+    m_changed = true; // layers are accumulated from the first sample on
+
+    try {
+        RTsize width, height;
+        m_renderBuffer->getSize(width, height);
+        m_context["sysAovMask"]->setInt(mask);
+        const optix::uint2 offset = m_context["sysFilmOffset"]->getUint2();
+        setFilmWindow(optix::make_int2(offset.x, offset.y), optix::make_int2(int(width), int(height)));
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Error while setting AOV layers %s",
+                                               e.getErrorString().c_str()));
     }
 }
 
+void Camera::setAdaptiveSampling(bool enabled)
+{
+    if (m_adaptiveSampling == enabled)
+        return;
+    m_adaptiveSampling = enabled;
+    m_changed = true;
+
+    try {
+        RTsize width, height;
+        m_renderBuffer->getSize(width, height);
+        m_context["sysAdaptiveSampling"]->setInt(enabled ? 1 : 0);
+        const optix::uint2 offset = m_context["sysFilmOffset"]->getUint2();
+        setFilmWindow(optix::make_int2(offset.x, offset.y), optix::make_int2(int(width), int(height)));
+        if (!enabled)
+            m_activeBlocksBuffer->setSize(1, 1);
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Error while setting adaptive sampling %s",
+                                               e.getErrorString().c_str()));
+    }
+}
+
+void Camera::setActiveBlocks(const AdaptiveSampler &sampler)
+{
+    try {
+        RTsize width, height;
+        m_activeBlocksBuffer->getSize(width, height);
+        if (width != RTsize(sampler.blocksX()) || height != RTsize(sampler.blocksY()))
+            m_activeBlocksBuffer->setSize(sampler.blocksX(), sampler.blocksY());
+        void *data = m_activeBlocksBuffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(data, sampler.activeBlocks().data(), sampler.activeBlocks().size());
+        m_activeBlocksBuffer->unmap();
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Error while uploading active blocks %s",
+                                               e.getErrorString().c_str()));
+    }
+}
+
+void Camera::readAovs(FilmLayers &image)
+{
+    MappedAovs mapped;
+    const void *data[AOV_LAYER_COUNT] = {};
+    RTsize width, height;
+    try {
+        m_renderBuffer->getSize(width, height);
+        for (int i = 0; i < AOV_LAYER_COUNT; i++)
+            if (m_aovMask & aovLayers[i].bit)
+                data[i] = m_aovBuffers[i]->map(0, RT_BUFFER_MAP_READ);
+    }
+    catch (optix::Exception &e) {
+        for (int i = 0; i < AOV_LAYER_COUNT; i++)
+            if (data[i])
+                m_aovBuffers[i]->unmap();
+        throw std::runtime_error(string_format("Error while reading AOV layers %s",
+                                               e.getErrorString().c_str()));
+    }
+
+    mapped.albedo = (const optix::float4 *) data[0];
+    mapped.normal = (const optix::float4 *) data[1];
+    mapped.depth = (const float *) data[2];
+    mapped.ids = (const optix::int2 *) data[3];
+    mapped.samples = (const unsigned int *) data[4];
+    packFilmLayers(mapped, m_aovMask, int(width), int(height), image);
+
+    for (int i = 0; i < AOV_LAYER_COUNT; i++)
+        if (data[i])
+            m_aovBuffers[i]->unmap();
+}
+
 void Camera::orbit(int x, int y)
 {
     if (setDelta(x, y)) {
@@ -115,6 +279,7 @@ void Camera::zoom(float x)
         m_fov = 179.0f;
     }
     m_changed = true;
+    m_lastMotion = std::chrono::high_resolution_clock::now();
 }
 
 bool Camera::setDelta(int x, int y)
@@ -127,6 +292,7 @@ bool Camera::setDelta(int x, int y)
         m_baseY = y;
 
         m_changed = true; // m_changed is only reset when asking for the frustum.
+        m_lastMotion = std::chrono::high_resolution_clock::now();
         return true; // There is a delta.
     }
     return false;
@@ -265,9 +431,10 @@ bool Camera::update()
 }
 
 Camera::Camera()
-    : m_context(nullptr),
+    : m_context(nullptr), m_aovMask(0), m_adaptiveSampling(false),
       m_distance(10.0f) // Some camera defaults for the demo scene.
-    , m_phi(0.75f), m_theta(0.6f), m_fov(60.0f), m_width(1), m_height(1), m_aspect(1.0f), m_baseX(0), m_baseY(0),
+    , m_phi(0.75f), m_theta(0.6f), m_fov(60.0f), m_width(1), m_height(1), m_aspect(1.0f), m_renderScale(1),
+      m_baseX(0), m_baseY(0),
       m_speedRatio(10.0f), m_dx(0), m_dy(0), m_changed(true), m_cameraState(CameraState::CAMERA_STATE_NONE)
 {
     m_center = optix::make_float3(0.0f, 0.0f, 0.0f);
@@ -288,6 +455,22 @@ void Camera::setContext(optix::Context context)
             m_renderBuffer->setFormat(RT_FORMAT_FLOAT4); // RGBA32F
             m_renderBuffer->setSize(m_width, m_height);
             m_context["sysOutputBuffer"]->set(m_renderBuffer);
+            m_context["sysFilmOffset"]->setUint(0, 0);
+
+            // layers stay 1x1 until they are enabled
+            for (int i = 0; i < AOV_LAYER_COUNT; i++) {
+                m_aovBuffers[i] = m_context->createBuffer(RT_BUFFER_OUTPUT, aovLayers[i].format, 1, 1);
+                m_context[aovLayers[i].variable]->set(m_aovBuffers[i]);
+            }
+            m_context["sysAovMask"]->setInt(0);
+            m_aovMask = 0;
+
+            m_secondMomentBuffer = m_context->createBuffer(RT_BUFFER_OUTPUT, RT_FORMAT_FLOAT, 1, 1);
+            m_context["sysSecondMoment"]->set(m_secondMomentBuffer);
+            m_activeBlocksBuffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_BYTE, 1, 1);
+            m_context["sysActiveBlocks"]->set(m_activeBlocksBuffer);
+            m_context["sysAdaptiveSampling"]->setInt(0);
+            m_adaptiveSampling = false;
 
             // Set the ray generation program and the exception program.
             m_programMap["raygeneration"] = m_context->createProgramFromPTXFile(
@@ -8,6 +8,10 @@
 
 #include <pugixml.hpp>
 
+#include "adaptivesampler.h"
+#include "aov.h"
+
+#include <chrono>
 #include <map>
 
 enum CameraState
@@ -31,7 +35,26 @@ public:
 
     optix::Buffer getFilmBuffer() const { return m_renderBuffer; }
     void setResolution(int w, int h);
-    optix::int2 resolution() const { return optix::make_int2(m_width, m_height); }
+    // Rendered resolution, the viewport divided by the render scale.
+    optix::int2 resolution() const;
+    // Renders 1/scale of the viewport in both directions, the aspect ratio of the viewport is kept.
+    void setRenderScale(int scale);
+    int renderScale() const { return m_renderScale; }
+    // When mouse input last moved the camera.
+    std::chrono::high_resolution_clock::time_point lastMotion() const { return m_lastMotion; }
+    // Film covers size pixels of the image starting at origin, the whole image unless buckets are rendered.
+    // Device memory is only allocated for the film, setResolution makes it cover the image again.
+    void setFilmWindow(optix::int2 origin, optix::int2 size);
+    // Enables the AOV layers of the mask, see aov.h. Disabled layers keep 1x1 buffers and aren't written.
+    void setAovMask(int mask);
+    int aovMask() const { return m_aovMask; }
+    // Maps the enabled layers and packs them into image, which gets the size of the film.
+    void readAovs(FilmLayers &image);
+    // Adaptive sampling needs the second moment of every pixel and skips retired blocks, see adaptivesampler.h.
+    void setAdaptiveSampling(bool enabled);
+    bool adaptiveSampling() const { return m_adaptiveSampling; }
+    optix::Buffer getSecondMomentBuffer() const { return m_secondMomentBuffer; }
+    void setActiveBlocks(const AdaptiveSampler &sampler);
 
     void load(const pugi::xml_node &node);
     void save(pugi::xml_node &node);
@@ -49,6 +72,7 @@ private:
     Camera();
     void setContext(optix::Context context);
 
+    void applyResolution();
     bool setDelta(int x, int y);
     void setFocusDistance(float f);
     void orbit(int x, int y);
@@ -61,11 +85,17 @@ private:
 private:
     optix::Context m_context;
     optix::Buffer m_renderBuffer;
+    optix::Buffer m_aovBuffers[AOV_LAYER_COUNT];
+    int m_aovMask;
+    optix::Buffer m_secondMomentBuffer;
+    optix::Buffer m_activeBlocksBuffer;
+    bool m_adaptiveSampling;
     std::map<std::string, optix::Program> m_programMap;
 
     int   m_width;    // Viewport width.
     int   m_height;   // Viewport height.
     float m_aspect;   // m_width / m_height
+    int   m_renderScale;
     int   m_baseX;
     int   m_baseY;
     float m_speedRatio;
@@ -74,6 +104,7 @@ private:
     int           m_dx;
     int           m_dy;
     bool          m_changed;
+    std::chrono::high_resolution_clock::time_point m_lastMotion;
     optix::float3 m_cameraPosition;
     optix::float3 m_cameraU;
     optix::float3 m_cameraV;
@@ -0,0 +1,317 @@
+
+#include "denoiser.h"
+
+#include "../utils/threadpool.h"
+#include "../utils/stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+REGISTER_PERMANENT_STATISTIC(float, denoiseTime, 0.0f, "Denoise time (ms)");
+
+// Rows filtered by one task.
+#define DENOISE_ROWS_PER_TASK 16
+
+// Albedo is clamped to this before it divides the beauty, black materials would blow up their noise.
+static const float ALBEDO_FLOOR = 0.01f;
+// Added to the variance estimate colors are compared relative to, differences in almost black regions can't be seen.
+static const float VARIANCE_FLOOR = 1e-4f;
+// Half width of the window the variance of the illumination is estimated in.
+#define VARIANCE_RADIUS 2
+// B3 spline, the taps of every row and column of the 5x5 kernel.
+static const float KERNEL[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+// Taylor polynomial of 2^f for f in [-0.5, 0.5], relative error below 3e-6 which is plenty for weights.
+// Exponents are clamped to EXP2_MIN, so that weights times the kernel stay clear of slow denormals.
+static const float EXP2_POLYNOMIAL[6] = {1.0f, 0.693147181f, 0.240226507f, 0.0555041087f, 0.00961812911f,
+                                         0.00133335581f};
+static const float LOG2_E = 1.44269504f;
+static const float EXP2_MIN = -80.0f;
+
+// One pass of the filter over planes of width x height.
+struct FilterPass
+{
+    const float *color;
+    const float *variance; // Of the luminance of the input around every pixel.
+    const float *albedo;   // null without guide
+    const float *normal;
+    float *dst;
+    int width;
+    int height;
+    size_t plane;
+    int step;              // Spacing of the taps in pixels.
+    float colorScale;      // Inverse squared sigmas, the color one of this pass is relative to the variance.
+    float albedoScale;
+    float normalScale;
+};
+
+// e^-x for x >= 0, the same approximation as the vector version so that edges and interior match.
+static float edgeWeight(float x)
+{
+    const float t = std::max(-x * LOG2_E, EXP2_MIN);
+    // to nearest even like _mm_cvtps_epi32, floor(t + 0.5) would round exponents half way between up
+    const float i = nearbyintf(t);
+    const float f = t - i;
+    float p = EXP2_POLYNOMIAL[5];
+    for (int k = 4; 0 <= k; k--)
+        p = p * f + EXP2_POLYNOMIAL[k];
+    return std::ldexp(p, int(i));
+}
+
+static void filterPixel(const FilterPass &pass, int x, int y)
+{
+    const size_t center = size_t(y) * pass.width + x;
+    float color[3], albedo[3] = {}, normal[3] = {};
+    for (int c = 0; c < 3; c++) {
+        color[c] = pass.color[c * pass.plane + center];
+        if (pass.albedo)
+            albedo[c] = pass.albedo[c * pass.plane + center];
+        if (pass.normal)
+            normal[c] = pass.normal[c * pass.plane + center];
+    }
+    const float colorScale = pass.colorScale / (pass.variance[center] + VARIANCE_FLOOR);
+
+    float sum[3] = {}, weightSum = 0.0f;
+    for (int j = 0; j < 5; j++) {
+        const int ty = y + (j - 2) * pass.step;
+        if (ty < 0 || pass.height <= ty)
+            continue;
+        for (int i = 0; i < 5; i++) {
+            const int tx = x + (i - 2) * pass.step;
+            if (tx < 0 || pass.width <= tx)
+                continue;
+            const size_t tap = size_t(ty) * pass.width + tx;
+            float colorDistance = 0.0f, albedoDistance = 0.0f, normalDistance = 0.0f;
+            for (int c = 0; c < 3; c++) {
+                const float d = pass.color[c * pass.plane + tap] - color[c];
+                colorDistance += d * d;
+                if (pass.albedo) {
+                    const float a = pass.albedo[c * pass.plane + tap] - albedo[c];
+                    albedoDistance += a * a;
+                }
+                if (pass.normal) {
+                    const float n = pass.normal[c * pass.plane + tap] - normal[c];
+                    normalDistance += n * n;
+                }
+            }
+            const float weight = KERNEL[i] * KERNEL[j] * edgeWeight(colorDistance * colorScale +
+                albedoDistance * pass.albedoScale + normalDistance * pass.normalScale);
+            for (int c = 0; c < 3; c++)
+                sum[c] += weight * pass.color[c * pass.plane + tap];
+            weightSum += weight;
+        }
+    }
+    // the center has a weight of at least KERNEL[2]^2
+    for (int c = 0; c < 3; c++)
+        pass.dst[c * pass.plane + center] = sum[c] / weightSum;
+}
+
+#ifdef __SSE2__
+// Same as edgeWeight for four values.
+static __m128 edgeWeight(__m128 x)
+{
+    const __m128 t = _mm_max_ps(_mm_mul_ps(x, _mm_set1_ps(-LOG2_E)), _mm_set1_ps(EXP2_MIN));
+    const __m128i i = _mm_cvtps_epi32(t);
+    const __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+    __m128 p = _mm_set1_ps(EXP2_POLYNOMIAL[5]);
+    for (int k = 4; 0 <= k; k--)
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(EXP2_POLYNOMIAL[k]));
+    // 2^i built from the exponent bits
+    const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+    return _mm_mul_ps(p, scale);
+}
+
+static __m128 squaredDistance(const float *planes, size_t plane, size_t tap, const __m128 center[3])
+{
+    const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(planes + tap), center[0]);
+    const __m128 d1 = _mm_sub_ps(_mm_loadu_ps(planes + plane + tap), center[1]);
+    const __m128 d2 = _mm_sub_ps(_mm_loadu_ps(planes + 2 * plane + tap), center[2]);
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2));
+}
+
+// Four neighbouring pixels of a row, all of their taps have to be inside the row.
+static void filterPixels4(const FilterPass &pass, int x, int y)
+{
+    const size_t center = size_t(y) * pass.width + x;
+    __m128 color[3], albedo[3], normal[3];
+    for (int c = 0; c < 3; c++) {
+        color[c] = _mm_loadu_ps(pass.color + c * pass.plane + center);
+        albedo[c] = pass.albedo ? _mm_loadu_ps(pass.albedo + c * pass.plane + center) : _mm_setzero_ps();
+        normal[c] = pass.normal ? _mm_loadu_ps(pass.normal + c * pass.plane + center) : _mm_setzero_ps();
+    }
+    const __m128 colorScale = _mm_div_ps(_mm_set1_ps(pass.colorScale),
+                                         _mm_add_ps(_mm_loadu_ps(pass.variance + center), _mm_set1_ps(VARIANCE_FLOOR)));
+    const __m128 albedoScale = _mm_set1_ps(pass.albedoScale);
+    const __m128 normalScale = _mm_set1_ps(pass.normalScale);
+
+    __m128 sum[3] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps()};
+    __m128 weightSum = _mm_setzero_ps();
+    for (int j = 0; j < 5; j++) {
+        const int ty = y + (j - 2) * pass.step;
+        if (ty < 0 || pass.height <= ty)
+            continue;
+        for (int i = 0; i < 5; i++) {
+            const size_t tap = size_t(ty) * pass.width + x + (i - 2) * pass.step;
+            __m128 distance = _mm_mul_ps(squaredDistance(pass.color, pass.plane, tap, color), colorScale);
+            if (pass.albedo)
+                distance = _mm_add_ps(distance,
+                                      _mm_mul_ps(squaredDistance(pass.albedo, pass.plane, tap, albedo), albedoScale));
+            if (pass.normal)
+                distance = _mm_add_ps(distance,
+                                      _mm_mul_ps(squaredDistance(pass.normal, pass.plane, tap, normal), normalScale));
+            const __m128 weight = _mm_mul_ps(_mm_set1_ps(KERNEL[i] * KERNEL[j]), edgeWeight(distance));
+            for (int c = 0; c < 3; c++)
+                sum[c] = _mm_add_ps(sum[c], _mm_mul_ps(weight, _mm_loadu_ps(pass.color + c * pass.plane + tap)));
+            weightSum = _mm_add_ps(weightSum, weight);
+        }
+    }
+    for (int c = 0; c < 3; c++)
+        _mm_storeu_ps(pass.dst + c * pass.plane + center, _mm_div_ps(sum[c], weightSum));
+}
+#endif
+
+static void filterRow(const FilterPass &pass, int y)
+{
+    int x = 0;
+#ifdef __SSE2__
+    // taps of pixels closer than this to the left and right edges fall outside of the image
+    const int reach = 2 * pass.step;
+    for (; x < std::min(reach, pass.width); x++)
+        filterPixel(pass, x, y);
+    for (; x + 3 + reach < pass.width; x += 4)
+        filterPixels4(pass, x, y);
+#endif
+    for (; x < pass.width; x++)
+        filterPixel(pass, x, y);
+}
+
+// Negative values and NaNs become zero.
+static float sanitize(float value)
+{
+    return (0.0f < value) ? value : 0.0f;
+}
+
+void Denoiser::denoise(const float *beauty, const float *albedo, const float *normal, int width, int height,
+                       const DenoiseSettings &settings, float *dst)
+{
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    const size_t plane = size_t(width) * height;
+    if (width != m_width || height != m_height) {
+        m_width = width;
+        m_height = height;
+        m_color[0].assign(plane * 3, 0.0f);
+        m_color[1].assign(plane * 3, 0.0f);
+        m_variance.assign(plane, 0.0f);
+        m_albedo.clear();
+        m_normal.clear();
+    }
+    if (albedo)
+        m_albedo.resize(plane * 3);
+    if (normal)
+        m_normal.resize(plane * 3);
+    const int tasks = (height + DENOISE_ROWS_PER_TASK - 1) / DENOISE_ROWS_PER_TASK;
+
+    // into planes, the beauty divided by the albedo leaves the illumination
+    parallelFor(tasks, [&](int task) {
+        const size_t begin = size_t(task) * DENOISE_ROWS_PER_TASK * width;
+        const size_t end = std::min(plane, begin + size_t(DENOISE_ROWS_PER_TASK) * width);
+        for (size_t p = begin; p < end; p++)
+            for (int c = 0; c < 3; c++) {
+                float value = sanitize(beauty[p * 4 + c]);
+                if (albedo) {
+                    m_albedo[c * plane + p] = albedo[p * 3 + c];
+                    value /= std::max(albedo[p * 3 + c], ALBEDO_FLOOR);
+                }
+                if (normal)
+                    m_normal[c * plane + p] = normal[p * 3 + c];
+                m_color[0][c * plane + p] = value;
+            }
+    });
+
+    // variance of the luminance around every pixel, the second color buffer isn't used before the first pass
+    const float *color = m_color[0].data();
+    float *moments = m_color[1].data();
+    parallelFor(tasks, [&](int task) {
+        const int end = std::min(height, (task + 1) * DENOISE_ROWS_PER_TASK);
+        for (int y = task * DENOISE_ROWS_PER_TASK; y < end; y++)
+            for (int x = 0; x < width; x++) {
+                const int x0 = std::max(0, x - VARIANCE_RADIUS), x1 = std::min(width - 1, x + VARIANCE_RADIUS);
+                float mean = 0.0f, meanSquared = 0.0f;
+                for (size_t p = size_t(y) * width + x0; p <= size_t(y) * width + x1; p++) {
+                    const float luminance = 0.2126f * color[p] + 0.7152f * color[plane + p] +
+                                            0.0722f * color[2 * plane + p];
+                    mean += luminance;
+                    meanSquared += luminance * luminance;
+                }
+                moments[size_t(y) * width + x] = mean / float(x1 - x0 + 1);
+                moments[plane + size_t(y) * width + x] = meanSquared / float(x1 - x0 + 1);
+            }
+    });
+    parallelFor(tasks, [&](int task) {
+        const int end = std::min(height, (task + 1) * DENOISE_ROWS_PER_TASK);
+        for (int y = task * DENOISE_ROWS_PER_TASK; y < end; y++) {
+            const int y0 = std::max(0, y - VARIANCE_RADIUS), y1 = std::min(height - 1, y + VARIANCE_RADIUS);
+            for (int x = 0; x < width; x++) {
+                float mean = 0.0f, meanSquared = 0.0f;
+                for (int ty = y0; ty <= y1; ty++) {
+                    mean += moments[size_t(ty) * width + x];
+                    meanSquared += moments[plane + size_t(ty) * width + x];
+                }
+                mean /= float(y1 - y0 + 1);
+                meanSquared /= float(y1 - y0 + 1);
+                m_variance[size_t(y) * width + x] = std::max(meanSquared - mean * mean, 0.0f);
+            }
+        }
+    });
+
+    // colors are compared more strictly in later passes, their wider taps would blur edges the earlier ones kept
+    FilterPass pass;
+    pass.variance = m_variance.data();
+    pass.albedo = albedo ? m_albedo.data() : nullptr;
+    pass.normal = normal ? m_normal.data() : nullptr;
+    pass.width = width;
+    pass.height = height;
+    pass.plane = plane;
+    pass.albedoScale = 1.0f / std::max(settings.albedoSigma * settings.albedoSigma, 1e-8f);
+    pass.normalScale = 1.0f / std::max(settings.normalSigma * settings.normalSigma, 1e-8f);
+    int source = 0;
+    for (int i = 0; i < settings.iterations; i++) {
+        const float colorSigma = std::ldexp(settings.colorSigma, -i);
+        pass.color = m_color[source].data();
+        pass.dst = m_color[1 - source].data();
+        pass.step = 1 << i;
+        pass.colorScale = 1.0f / std::max(colorSigma * colorSigma, 1e-8f);
+        parallelFor(tasks, [&](int task) {
+            const int end = std::min(height, (task + 1) * DENOISE_ROWS_PER_TASK);
+            for (int y = task * DENOISE_ROWS_PER_TASK; y < end; y++)
+                filterRow(pass, y);
+        });
+        source = 1 - source;
+    }
+
+    // back to RGBA with the albedo multiplied in again
+    color = m_color[source].data();
+    parallelFor(tasks, [&](int task) {
+        const size_t begin = size_t(task) * DENOISE_ROWS_PER_TASK * width;
+        const size_t end = std::min(plane, begin + size_t(DENOISE_ROWS_PER_TASK) * width);
+        for (size_t p = begin; p < end; p++) {
+            for (int c = 0; c < 3; c++)
+                dst[p * 4 + c] = color[c * plane + p] * (albedo ? std::max(albedo[p * 3 + c], ALBEDO_FLOOR) : 1.0f);
+            dst[p * 4 + 3] = beauty[p * 4 + 3];
+        }
+    });
+
+    denoiseTime = std::chrono::duration<float, std::milli>(
+        std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+void Denoiser::denoise(FilmLayers &image, const DenoiseSettings &settings)
+{
+    denoise(image.beauty.data(), image.albedo.empty() ? nullptr : image.albedo.data(),
+            image.normal.empty() ? nullptr : image.normal.data(), image.width, image.height, settings,
+            image.beauty.data());
+}
@@ -0,0 +1,43 @@
+
+#ifndef RENDERER_GPU_DENOISER_H
+#define RENDERER_GPU_DENOISER_H
+
+#include "aov.h"
+
+#include <vector>
+
+struct DenoiseSettings
+{
+    bool files = false;        // Beauty written by renderToFile.
+    bool display = false;      // Progressive display, costs a readback of the guides every frame.
+    int iterations = 5;        // Passes of the filter, the footprint doubles with every one.
+    float colorSigma = 8.0f;   // Color difference in standard deviations of the local noise, halved every pass.
+    float normalSigma = 0.2f;
+    float albedoSigma = 0.1f;
+};
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) for films with few samples. Every pass averages
+// 5x5 taps spaced further apart than in the previous one, weighted by how similar the neighbours are in color,
+// shading normal and albedo. With albedo the illumination is filtered on its own, so textures stay sharp.
+// Runs on the shared thread pool, the buffers are kept between calls.
+class Denoiser
+{
+public:
+    // Beauty is RGBA and dst may be the same buffer, alpha is copied. Albedo and normal are RGB feature layers of
+    // the same size, either can be null. Rows are in film order, the filter doesn't care.
+    void denoise(const float *beauty, const float *albedo, const float *normal, int width, int height,
+                 const DenoiseSettings &settings, float *dst);
+    // Filters the beauty in place, guided by the albedo and normal layers that are present.
+    void denoise(FilmLayers &image, const DenoiseSettings &settings);
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    // Planes of width x height, channel c starts at c * width * height.
+    std::vector<float> m_color[2];
+    std::vector<float> m_variance;
+    std::vector<float> m_albedo;
+    std::vector<float> m_normal;
+};
+
+#endif //RENDERER_GPU_DENOISER_H
@@ -4,6 +4,7 @@
 
 #define FLAG_PATH           0x00000001
 #define FLAG_FRONTFACE      0x00000010
+#define FLAG_AOV            0x00000100 // Camera ray whose hit fills the AOV fields of the PerRayData.
 #define FLAG_TERMINATE      0x80000000
 
 #endif //RENDERER_GPU_FLAGS_H
@@ -2,7 +2,9 @@
 #include "geometrypool.h"
 #include "../utils/config.h"
 #include "../utils/log.h"
+#include "../utils/hash.h"
 
+#include <algorithm>
 #include <iostream>
 
 
@@ -15,6 +17,7 @@ struct MeshData
 {
     std::vector<VertexAttributes> attributes;
     int nTriangles;
+    std::string source; // File or shape type it was loaded from first.
 };
 
 static std::map<std::string, MeshData> meshCache;
@@ -25,25 +28,28 @@ GeometryPool::~GeometryPool()
     for (auto &name : names)
         unloadGeometry(name);
 
+    for (auto &buffer : m_meshBuffers)
+        buffer.second->destroy();
     for (auto &program : m_programMap)
         program.second->destroy();
 }
 
-bool loadGeometryFromFile(const std::string &filename, MeshData &meshData, bool &updated)
+// Mesh of a file, key is its content hash. Files with the same content are imported once.
+static const MeshData *loadGeometryFromFile(const std::string &filename, const std::string &key)
 {
-    if (meshCache.find(filename) != meshCache.end()) {
-        meshData = meshCache[filename];
-        return true;
-    }
+    auto cached = meshCache.find(key);
+    if (cached != meshCache.end())
+        return &cached->second;
 
     Assimp::Importer importer;
     const aiScene *scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         LogError("Unable to load mesh '%s'. Error: ", filename.c_str(), importer.GetErrorString());
-        return false;
+        return nullptr;
     }
 
+    MeshData meshData;
     meshData.nTriangles = 0;
     for (int meshNum = 0; meshNum < scene->mNumMeshes; meshNum++) {
         aiMesh *mesh = scene->mMeshes[meshNum];
@@ -82,19 +88,16 @@ bool loadGeometryFromFile(const std::string &filename, MeshData &meshData, bool
         meshData.nTriangles += nTriangles;
     }
 
-    meshCache[filename] = meshData;
-
+    meshData.source = filename;
     LogInfo("Mesh '%s' was loaded. (%d triangles)", filename.c_str(), meshData.nTriangles);
-    updated = true;
-    return true;
+    return &(meshCache[key] = std::move(meshData));
 }
 
-bool loadShape(const std::string &shapeType, MeshData &meshData, bool &updated)
+static const MeshData *loadShape(const std::string &shapeType)
 {
-    if (meshCache.find(shapeType) != meshCache.end()) {
-        meshData = meshCache[shapeType];
-        return true;
-    }
+    auto cached = meshCache.find(shapeType);
+    if (cached != meshCache.end())
+        return &cached->second;
 
     std::vector<VertexAttributes> attributes;
     std::vector<unsigned int> indices;
@@ -405,19 +408,18 @@ bool loadShape(const std::string &shapeType, MeshData &meshData, bool &updated)
     }
     else {
         LogWarning("Unknown shape type encountered: %s", shapeType.c_str());
-        return false;
+        return nullptr;
     }
 
+    MeshData meshData;
     meshData.attributes.reserve(indices.size());
     for (auto &index : indices)
         meshData.attributes.push_back(attributes[index]);
     meshData.nTriangles = indices.size() / 3;
 
-    meshCache[shapeType] = meshData;
-
+    meshData.source = shapeType;
     LogInfo("Shape '%s' was loaded. (%d triangles)", shapeType.c_str(), meshData.nTriangles);
-    updated = true;
-    return true;
+    return &(meshCache[shapeType] = std::move(meshData));
 }
 
 optix::Geometry GeometryPool::getGeometry(const pugi::xml_node &node, std::string &geometryName)
@@ -433,6 +435,17 @@ optix::Geometry GeometryPool::getGeometry(const pugi::xml_node &node, std::strin
     return m_geometryMap[shape_name].geometry;
 }
 
+const std::vector<VertexAttributes> *GeometryPool::attributes(const std::string &geometryName) const
+{
+    auto geometry = m_geometryMap.find(geometryName);
+    if (geometry == m_geometryMap.end())
+        return nullptr;
+    auto mesh = meshCache.find(geometry->second.mesh_name);
+    if (mesh == meshCache.end())
+        return nullptr;
+    return &mesh->second.attributes;
+}
+
 bool GeometryPool::loadGeometry(const pugi::xml_node &node, const std::string &name)
 {
     GeometryData data;
@@ -447,16 +460,9 @@ bool GeometryPool::loadGeometry(const pugi::xml_node &node, const std::string &n
             data.geometry->setBoundingBoxProgram(m_programMap["boundingBox"]);
 
         }
-        bool bufferEmpty = false;
-        if (!data.buffer) {
-            data.buffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
-            data.buffer->setElementSize(sizeof(VertexAttributes));
-            data.buffer->setSize(0);
-            bufferEmpty = true;
-        }
 
-        MeshData meshData;
-        bool succesfulLoad = false, meshUpdated = false;
+        const MeshData *meshData = nullptr;
+        std::string meshKey;
         std::string shape_type = node.attribute("type").value();
         if (shape_type.empty()) {
             LogWarning("Can't load mesh. No shape type specified");
@@ -465,31 +471,40 @@ bool GeometryPool::loadGeometry(const pugi::xml_node &node, const std::string &n
         }
         else if (shape_type == "mesh") {
             std::string filename = node.child("filename").child_value();
-            if (!filename.empty()) {
-                succesfulLoad = loadGeometryFromFile(filename, meshData, meshUpdated);
-                data.mesh_name = filename;
+            uint64_t contentHash = 0;
+            if (filename.empty())
+                LogWarning("Can't load mesh. No filename specified");
+            else if (!hashFile(filename, contentHash))
+                LogError("Unable to read mesh '%s'", filename.c_str());
+            else {
+                meshKey = string_format("mesh-%016llx", (unsigned long long) contentHash);
+                meshData = loadGeometryFromFile(filename, meshKey);
             }
         }
         else {
-            succesfulLoad = loadShape(shape_type, meshData, meshUpdated);
-            data.mesh_name = shape_type;
+            meshKey = shape_type;
+            meshData = loadShape(shape_type);
         }
 
-        if (!succesfulLoad) {
+        if (!meshData) {
             data.destroy();
             return false;
         }
 
-        if (bufferEmpty || meshUpdated) {
-            data.buffer->setSize(meshData.attributes.size());
-
-            void *dst = data.buffer->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
-            memcpy(dst, meshData.attributes.data(), sizeof(VertexAttributes) * meshData.attributes.size());
-            data.buffer->unmap();
-            data.geometry["attributesBuffer"]->setBuffer(data.buffer);
+        auto buffer = m_meshBuffers.find(meshKey);
+        if (buffer == m_meshBuffers.end()) {
+            optix::Buffer attributes = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+            attributes->setElementSize(sizeof(VertexAttributes));
+            attributes->setSize(meshData->attributes.size());
 
-            data.geometry->setPrimitiveCount(meshData.nTriangles);
+            void *dst = attributes->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+            memcpy(dst, meshData->attributes.data(), sizeof(VertexAttributes) * meshData->attributes.size());
+            attributes->unmap();
+            buffer = m_meshBuffers.emplace(meshKey, attributes).first;
         }
+        data.geometry["attributesBuffer"]->setBuffer(buffer->second);
+        data.geometry->setPrimitiveCount(meshData->nTriangles);
+        data.mesh_name = meshKey;
     }
     catch (optix::Exception &e) {
         LogError("Error occured when creating geometry: %s", e.getErrorString().c_str());
@@ -517,7 +532,8 @@ void GeometryPool::load(const pugi::xml_node &node)
     // get old meshes
     std::vector<std::string> old_mesh_names;
     for (auto &kv : m_geometryMap)
-        if (!kv.second.mesh_name.empty())
+        if (!kv.second.mesh_name.empty() &&
+            std::find(old_mesh_names.begin(), old_mesh_names.end(), kv.second.mesh_name) == old_mesh_names.end())
             old_mesh_names.push_back(kv.second.mesh_name);
 
     // load geometry and initialize OptiX variables
@@ -529,11 +545,20 @@ void GeometryPool::load(const pugi::xml_node &node)
             new_names.push_back(name);
     }
 
-    // get meshes that were loaded
+    // get meshes that were loaded, every geometry after the first one of a mesh reuses its data
     std::vector<std::string> new_mesh_names;
-    for (auto &name : new_names)
-        if (!m_geometryMap[name].mesh_name.empty())
-            new_mesh_names.push_back(m_geometryMap[name].mesh_name);
+    size_t deduplicatedBytes = 0;
+    for (auto &name : new_names) {
+        const std::string &mesh = m_geometryMap[name].mesh_name;
+        if (mesh.empty())
+            continue;
+        if (std::find(new_mesh_names.begin(), new_mesh_names.end(), mesh) != new_mesh_names.end())
+            deduplicatedBytes += meshCache[mesh].attributes.size() * sizeof(VertexAttributes);
+        else
+            new_mesh_names.push_back(mesh);
+    }
+    if (0 < deduplicatedBytes)
+        LogInfo("Deduplicated %.2f MB of meshes", double(deduplicatedBytes) / (1024.0 * 1024.0));
 
     // delete all objects from previous loadings that are missing now
     std::vector<std::string> geomToDelete = difference(old_names, new_names);
@@ -549,8 +574,13 @@ void GeometryPool::load(const pugi::xml_node &node)
     // delete all meshes from previous loadings that are missing now
     std::vector<std::string> meshesToDelete = difference(old_mesh_names, new_mesh_names);
     for (auto &mesh : meshesToDelete){
-        LogInfo("Mesh '%s' was unloaded because it's not used.", mesh.c_str());
+        LogInfo("Mesh '%s' was unloaded because it's not used.", meshCache[mesh].source.c_str());
         meshCache.erase(mesh);
+        auto buffer = m_meshBuffers.find(mesh);
+        if (buffer != m_meshBuffers.end()) {
+            buffer->second->destroy();
+            m_meshBuffers.erase(buffer);
+        }
     }
 
 }
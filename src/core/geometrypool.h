@@ -3,6 +3,7 @@
 #define RENDERER_GPU_GEOMETRYPOOL_H
 
 #include <map>
+#include <vector>
 
 #include <optixu/optixpp_namespace.h>
 #include <optixu/optixu_math_namespace.h>
@@ -14,18 +15,15 @@
 struct GeometryData
 {
     optix::Geometry geometry;
-    optix::Buffer buffer;
-    std::string mesh_name;
+    std::string mesh_name; // Key of the mesh, the content hash of mesh files or the shape type.
 
-    GeometryData() : geometry(nullptr), buffer(nullptr), mesh_name() {}
+    GeometryData() : geometry(nullptr), mesh_name() {}
 
+    // Attribute buffers belong to the pool, they are shared by all geometries of a mesh.
     void destroy() {
         if (geometry && geometry->get())
             geometry->destroy();
-        if (buffer && buffer->get())
-            buffer->destroy();
         geometry = nullptr;
-        buffer = nullptr;
     }
 };
 
@@ -37,6 +35,8 @@ public:
     ~GeometryPool();
 
     optix::Geometry getGeometry(const pugi::xml_node &node, std::string &geometryName);
+    // Triangle soup (three attributes per triangle) of already loaded geometry, nullptr if it's missing.
+    const std::vector<VertexAttributes> *attributes(const std::string &geometryName) const;
 
     bool loadGeometry(const pugi::xml_node &node, const std::string& name);
     bool unloadGeometry(const std::string &name);
@@ -53,6 +53,7 @@ private:
 
     std::map<std::string, optix::Program> m_programMap;
     std::map<std::string, GeometryData> m_geometryMap;
+    std::map<std::string, optix::Buffer> m_meshBuffers; // Attributes of every mesh, uploaded once.
 };
 
 #endif //RENDERER_GPU_GEOMETRYPOOL_H
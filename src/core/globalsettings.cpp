@@ -1,6 +1,7 @@
 
 #include "globalsettings.h"
 
+#include "aov.h"
 #include "../utils/fileutil.h"
 
 GlobalSettings &GlobalSettings::getInstance()
@@ -18,4 +19,34 @@ GlobalSettings::GlobalSettings()
 void GlobalSettings::load(const pugi::xml_node &node)
 {
     worldForwardAxis = readInt(node.child("forward_axis"), 2);
+    textureCacheDirectory = readString(node.child("texture_cache"), "texture_cache");
+    textureCacheSize = readInt(node.child("texture_cache_size"), 2048);
+    virtualTextureBudget = readInt(node.child("virtual_texture_budget"), 256);
+    atlasTextureSize = readInt(node.child("texture_atlas"), 0);
+    atlasPageSize = readInt(node.child("texture_atlas_page_size"), 2048);
+    keepHostTextures = readString(node.child("keep_host_textures"), "true") != "false";
+    outputFile = readString(node.child("output_file"), "result.img");
+    bucketSize = readInt(node.child("bucket_size"), 0);
+    bucketSamples = readInt(node.child("bucket_samples"), 16);
+    sharedFrames = readString(node.child("shared_frames"));
+    toneMap.exposure = readFloat(node.child("exposure"), 0.0f);
+    toneMap.toneOperator = parseToneMapOperator(readString(node.child("tone_map"), "clamp"));
+    toneMap.dither = readString(node.child("dither"), "true") != "false";
+    tileOrder = parseTileOrder(readString(node.child("tile_order"), "rows"));
+    noiseThreshold = readFloat(node.child("noise_threshold"), 0.0f);
+    adaptiveMinSamples = readInt(node.child("adaptive_min_samples"), 16);
+    adaptiveMaxSamples = readInt(node.child("adaptive_max_samples"), 4096);
+    renderTarget.samples = readInt(node.child("samples"), 0);
+    renderTarget.seconds = readFloat(node.child("time_budget"), 0.0f);
+    renderTarget.samplesPerLaunch = readInt(node.child("samples_per_launch"), 1);
+    aovLayers = parseAovMask(readString(node.child("aov")));
+    denoise.files = readString(node.child("denoise"), "false") == "true";
+    denoise.display = readString(node.child("denoise_display"), "false") == "true";
+    denoise.iterations = readInt(node.child("denoise_passes"), 5);
+    denoise.colorSigma = readFloat(node.child("denoise_color_sigma"), 8.0f);
+    denoise.normalSigma = readFloat(node.child("denoise_normal_sigma"), 0.2f);
+    denoise.albedoSigma = readFloat(node.child("denoise_albedo_sigma"), 0.1f);
+    motionScale = readInt(node.child("motion_scale"), 1);
+    motionMaxDepth = readInt(node.child("motion_max_depth"), 0);
+    motionIdleTime = readFloat(node.child("motion_idle_time"), 0.25f);
 }
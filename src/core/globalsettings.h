@@ -5,10 +5,48 @@
 
 #include <pugixml.hpp>
 
+#include "denoiser.h"
+#include "tilescheduler.h"
+#include "tonemapper.h"
+
+#include <functional>
+#include <string>
+
+// When renderToFile stops. Without samples and seconds a single pass is added to the film.
+struct RenderTarget
+{
+    int samples = 0;          // Samples per pixel of the film, 0 for no limit.
+    float seconds = 0.0f;     // Wall clock budget, 0 for no limit. A pass that is started is always finished.
+    int samplesPerLaunch = 1; // Samples every pixel gets from a launch, amortizes launch overhead at high counts.
+    // Called about twice a second on the rendering thread and once at the end, with the samples per pixel.
+    std::function<void(int samples, float seconds)> progress;
+};
+
 class GlobalSettings
 {
 public:
     int worldForwardAxis = 2;
+    std::string textureCacheDirectory = "texture_cache"; // Processed textures ready to be mapped.
+    int textureCacheSize = 2048;                         // Limit in MB, least recently used files go first. 0 disables the cache.
+    int virtualTextureBudget = 256;                      // Size of the tile atlas of virtual textures in MB.
+    int atlasTextureSize = 0;                            // Textures up to this size are packed into atlas pages. 0 disables the atlas.
+    int atlasPageSize = 2048;                            // Size of atlas pages in texels.
+    bool keepHostTextures = true;                        // Host pixels stay in memory after upload, else they are read again when needed.
+    std::string outputFile = "result.img";               // Result of renderToFile, the extension selects the format (img, pfm, hdr, exr, png, jpg).
+    int bucketSize = 0;                                  // Renders exr results bucket by bucket with a film of this size. 0 renders in one piece.
+    int bucketSamples = 16;                              // Samples per pixel of every bucket.
+    std::string sharedFrames;                            // Shared memory ring progressive frames are published to, empty disables it.
+    ToneMapSettings toneMap;                             // Display and 8-bit outputs.
+    TileOrder tileOrder = TILE_ORDER_ROWS;               // Order of the tiles of a pass (rows, hilbert, center).
+    float noiseThreshold = 0.0f;                         // Relative error at which blocks stop being sampled. 0 disables adaptive sampling.
+    int adaptiveMinSamples = 16;                         // Samples of every pixel before its block can retire.
+    int adaptiveMaxSamples = 4096;                       // renderToFile stops here with adaptive sampling, even if noisy.
+    RenderTarget renderTarget;                           // Of the start command when it doesn't name its own.
+    int aovLayers = 0;                                   // AOV_* mask of layers rendered next to the beauty, see aov.h.
+    DenoiseSettings denoise;                             // Adds the albedo and normal layers when enabled, they guide the filter.
+    int motionScale = 1;                                 // Resolution is divided by this while the camera moves. 1 keeps it.
+    int motionMaxDepth = 0;                              // Path length limit while the camera moves. 0 keeps it.
+    float motionIdleTime = 0.25f;                        // Seconds without camera input until full quality is rendered again.
 
 
     void load(const pugi::xml_node &node);
@@ -4,108 +4,379 @@
 #include "../math/basic.h"
 #include "../utils/log.h"
 
+// failure reason is a global in stb_image, images are decoded on several threads at once
+#define STBI_NO_FAILURE_STRINGS
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include <stb_image_resize.h>
 
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
 
-#include <fstream>
+// F16C converts eight halves at once. The build targets baseline x86-64, so the instructions are compiled
+// for these functions only and picked at runtime when the CPU has them.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IMAGE_F16C_DISPATCH
+#include <immintrin.h>
+#endif
 
-Image::Image(int mipCount)
-    : m_pixels(nullptr), m_output_pixels(nullptr), m_width(0), m_height(0), m_mipCount(mipCount)
+// IEEE 754 half precision conversion with round to nearest even.
+static unsigned short floatToHalf(float value)
 {
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
 
+    const unsigned int sign = (bits >> 16) & 0x8000u;
+    const unsigned int exponent = (bits >> 23) & 0xffu;
+    unsigned int mantissa = bits & 0x7fffffu;
+
+    if (exponent == 0xffu) // infinity and NaN
+        return (unsigned short) (sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+
+    const int halfExponent = int(exponent) - 127 + 15;
+    if (31 <= halfExponent) // overflow
+        return (unsigned short) (sign | 0x7c00u);
+
+    if (halfExponent <= 0) { // subnormal or zero
+        if (halfExponent < -10)
+            return (unsigned short) sign;
+        mantissa |= 0x800000u;
+        const unsigned int shift = (unsigned int) (14 - halfExponent);
+        unsigned int half = mantissa >> shift;
+        const unsigned int rest = mantissa & ((1u << shift) - 1u);
+        const unsigned int halfway = 1u << (shift - 1u);
+        if (halfway < rest || (rest == halfway && (half & 1u)))
+            half++;
+        return (unsigned short) (sign | half);
+    }
+
+    unsigned int half = sign | ((unsigned int) halfExponent << 10) | (mantissa >> 13);
+    const unsigned int rest = mantissa & 0x1fffu;
+    if (0x1000u < rest || (rest == 0x1000u && (half & 1u)))
+        half++; // may carry into the exponent, which is still correct
+    return (unsigned short) half;
 }
 
-int nextPower2(int value)
+static float halfToFloat(unsigned short value)
 {
-    return (int)pow(2, ceil(log(value)/log(2)));
+    const unsigned int sign = (unsigned int) (value & 0x8000u) << 16;
+    unsigned int exponent = (value >> 10) & 0x1fu;
+    unsigned int mantissa = value & 0x3ffu;
+
+    unsigned int bits;
+    if (exponent == 0x1fu)
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else {
+        // normalize subnormal
+        exponent = 127 - 15 + 1;
+        while ((mantissa & 0x400u) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
 }
 
-bool Image::load(const std::string &filename)
+static float srgbToLinear(float value)
+{
+    return (value <= 0.04045f) ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+}
+
+// Linear values of all 8-bit sRGB codes.
+static const float *srgbTable()
 {
-    stbi_ldr_to_hdr_gamma(2.2f);
+    static const std::vector<float> table = [] {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; i++)
+            values[i] = srgbToLinear(float(i) / 255.0f);
+        return values;
+    }();
+    return table.data();
+}
 
-    float *data = stbi_loadf(filename.c_str(), &m_width, &m_height, nullptr, 4);
-    if (!data){
-        LogError("Couln't load image file: '%s'", filename.c_str());
-        return false;
-    }
+// Tables to find the nearest 8-bit sRGB code of a linear value: linear values halfway between neighbouring codes,
+// and the first code of 4096 equal steps of the linear range. The steps are smaller than the gaps between
+// thresholds, so a value is either the first code of its step or the next one.
+static const int srgbEncodeSteps = 4096;
+
+struct SrgbEncodeTables
+{
+    float thresholds[256];
+    unsigned char first[srgbEncodeSteps];
+};
+
+static const SrgbEncodeTables &srgbEncodeTables()
+{
+    static const SrgbEncodeTables tables = [] {
+        SrgbEncodeTables t;
+        for (int i = 0; i < 255; i++)
+            t.thresholds[i] = srgbToLinear((float(i) + 0.5f) / 255.0f);
+        t.thresholds[255] = INFINITY;
+        int code = 0;
+        for (int i = 0; i < srgbEncodeSteps; i++) {
+            while (t.thresholds[code] <= float(i) / srgbEncodeSteps)
+                code++;
+            t.first[i] = (unsigned char) code;
+        }
+        return t;
+    }();
+    return tables;
+}
+
+// Without branches, NaN and negative values give 0.
+static inline unsigned char linearToSrgb8(const SrgbEncodeTables &tables, float value)
+{
+    value = (0.0f < value) ? value : 0.0f;
+    value = (value < 1.0f) ? value : 1.0f;
+    const int code = tables.first[std::min(int(value * srgbEncodeSteps), srgbEncodeSteps - 1)];
+    return (unsigned char) (code + (tables.thresholds[code] <= value ? 1 : 0));
+}
+
+// Row conversions used by the mip pyramid builder.
+
+// Largest finite half.
+static const float HALF_MAX = 65504.0f;
+
+#ifdef IMAGE_F16C_DISPATCH
+static bool hasF16C()
+{
+    static const bool supported = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    }();
+    return supported;
+}
+
+// Converts the multiple of 8 values at the start of a row, returns how many.
+__attribute__((target("avx,f16c")))
+static int decodeHalfRowF16C(const unsigned short *texels, int count, float *dst)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (texels + i))));
+    return i;
+}
 
-    int currWidth = nextPower2(m_width);
-    int currHeight = nextPower2(m_height);
+// max_ps returns zero for NaN like the scalar fmaxf.
+__attribute__((target("avx,f16c")))
+static int encodeHalfRowF16C(const float *src, int count, unsigned short *texels)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 halfMax = _mm256_set1_ps(HALF_MAX);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i *) (texels + i),
+                         _mm256_cvtps_ph(_mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), zero), halfMax),
+                                         _MM_FROUND_TO_NEAREST_INT));
+    return i;
+}
+#endif
 
-    int pixelCount = (2 - 1 / (int) pow(2, m_mipCount -1 ));
-    pixelCount = pixelCount * pixelCount * currWidth  * currHeight * 4;
-    m_pixels = new float[pixelCount];
+static void decodeHalfRow(const unsigned char *src, int count, float *dst)
+{
+    const unsigned short *texels = (const unsigned short *) src;
+    int i = 0;
+#ifdef IMAGE_F16C_DISPATCH
+    if (hasF16C())
+        i = decodeHalfRowF16C(texels, count * 4, dst);
+#endif
+    for (; i < count * 4; i++)
+        dst[i] = halfToFloat(texels[i]);
+}
 
-    if (m_width != currWidth || m_height != currHeight) {
-        stbir_resize_float(data, m_width, m_height, 0, m_pixels, currWidth, currHeight, 0, 4);
-        m_width = currWidth;
-        m_height = currHeight;
+// Filters with negative lobes can produce negative values, and HDR suns can exceed the half range. Both are
+// clamped while converting, infinities would break the environment distribution and the filtering of the mips.
+static void encodeHalfRow(const float *src, int count, unsigned char *dst)
+{
+    unsigned short *texels = (unsigned short *) dst;
+    int i = 0;
+#ifdef IMAGE_F16C_DISPATCH
+    if (hasF16C())
+        i = encodeHalfRowF16C(src, count * 4, texels);
+#endif
+    for (; i < count * 4; i++)
+        texels[i] = floatToHalf(fminf(fmaxf(src[i], 0.0f), HALF_MAX));
+}
+
+// Color is converted to linear space, alpha is linear already.
+static void decodeSrgbRow(const unsigned char *src, int count, float *dst)
+{
+    static const std::vector<float> alphaTable = [] {
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; i++)
+            values[i] = float(i) / 255.0f;
+        return values;
+    }();
+    const float *table = srgbTable();
+    const float *alpha = alphaTable.data();
+    for (int i = 0; i < count * 4; i += 4) {
+        dst[i] = table[src[i]];
+        dst[i + 1] = table[src[i + 1]];
+        dst[i + 2] = table[src[i + 2]];
+        dst[i + 3] = alpha[src[i + 3]];
     }
-    else
-        memcpy(m_pixels, data, m_width * m_height * 4 * sizeof(float));
+}
 
-    // TODO get rid of negative values when upsampling and downsampling
-    for (int j = 0; j < m_height; j++)
-        for (int i = 0; i < m_width*4; i++)
-            if (m_pixels[j*m_width*4 + i] < 0.0f)
-                m_pixels[j*m_width*4 + i] = 0.0f;
+static void encodeSrgbRow(const float *src, int count, unsigned char *dst)
+{
+    const SrgbEncodeTables &tables = srgbEncodeTables();
+    for (int i = 0; i < count * 4; i += 4) {
+        dst[i] = linearToSrgb8(tables, src[i]);
+        dst[i + 1] = linearToSrgb8(tables, src[i + 1]);
+        dst[i + 2] = linearToSrgb8(tables, src[i + 2]);
+        const float alpha = (0.0f < src[i + 3]) ? src[i + 3] : 0.0f;
+        dst[i + 3] = (unsigned char) (((alpha < 1.0f) ? alpha : 1.0f) * 255.0f + 0.5f);
+    }
+}
 
+MipLevelFormat Image::levelFormat(Format format)
+{
+    if (format == Image::RGBA16F)
+        return MipLevelFormat{int(4 * sizeof(unsigned short)), decodeHalfRow, encodeHalfRow};
+    return MipLevelFormat{4, decodeSrgbRow, encodeSrgbRow};
+}
 
-    int offset = currHeight * currWidth * 4;
-    for (int level = 1; level < m_mipCount; level++)
-    {
-        currWidth /= 2;
-        currHeight /= 2;
+Image::Image(int mipCount, MipFilter mipFilter)
+    : m_pixels(nullptr), m_ownsPixels(false), m_format(RGBA32F), m_byteSize(0),
+    m_width(0), m_height(0), m_mipCount(mipCount), m_mipFilter(mipFilter)
+{
 
-        if (currWidth == 0 || currHeight == 0){
-            m_mipCount = level;
-            break;
-        }
+}
+
+Image::~Image()
+{
+    clear();
+}
+
+Image::Image(Image &&other)
+    : Image()
+{
+    *this = std::move(other);
+}
+
+Image &Image::operator=(Image &&other)
+{
+    if (this != &other) {
+        clear();
+        m_pixels = other.m_pixels;
+        m_ownsPixels = other.m_ownsPixels;
+        m_mapping = other.m_mapping;
+        m_format = other.m_format;
+        m_byteSize = other.m_byteSize;
+        m_width = other.m_width;
+        m_height = other.m_height;
+        m_mipCount = other.m_mipCount;
+        m_mipFilter = other.m_mipFilter;
+
+        other.m_pixels = nullptr;
+        other.m_ownsPixels = false;
+        other.m_mapping = MappedFile();
+        other.clear();
+    }
+    return *this;
+}
+
+int Image::pixelSize() const
+{
+    switch (m_format) {
+    case RGBA16F:
+        return 4 * sizeof(unsigned short);
+    case RGBA8_SRGB:
+        return 4;
+    default:
+        return 4 * sizeof(float);
+    }
+}
 
-        stbir_resize_float(m_pixels + offset, 2*currWidth, 2*currHeight, 0,
-            m_pixels + offset + currWidth * currHeight * 4, currWidth, currHeight, 0, 4);
-        offset += currWidth * currHeight * 4;
+bool Image::load(const std::string &filename)
+{
+    clear();
+    const bool hdr = stbi_is_hdr(filename.c_str()) != 0;
+    void *data = hdr ? (void *) stbi_loadf(filename.c_str(), &m_width, &m_height, nullptr, 4)
+                     : (void *) stbi_load(filename.c_str(), &m_width, &m_height, nullptr, 4);
+    if (!data){
+        LogError("Couln't load image file: '%s'", filename.c_str());
+        return false;
     }
+    m_format = hdr ? RGBA16F : RGBA8_SRGB;
+    const int bytesPerPixel = pixelSize();
+
+    // levels keep the native size, mip count 0 or less asks for the full chain
+    const int fullCount = fullMipCount(m_width, m_height);
+    if (m_mipCount < 1 || fullCount < m_mipCount)
+        m_mipCount = fullCount;
+
+    m_byteSize = mipChainPixels(m_width, m_height, m_mipCount) * bytesPerPixel;
+    m_pixels = new unsigned char[m_byteSize];
+    m_ownsPixels = true;
+
+    if (hdr)
+        encodeHalfRow((const float *) data, m_width * m_height, m_pixels);
+    else
+        memcpy(m_pixels, data, size_t(m_width) * m_height * bytesPerPixel);
     stbi_image_free(data);
 
-    LogInfo("Image '%s' was loaded. Resolution: %dx%d, %d mipmaps",
-        filename.c_str(), m_width, m_height, m_mipCount);
+    buildMipPyramid(m_pixels, m_width, m_height, m_mipCount, levelFormat(m_format), m_mipFilter);
+
+    LogInfo("Image '%s' was loaded. Resolution: %dx%d, %d mipmaps (%s filter), %s",
+        filename.c_str(), m_width, m_height, m_mipCount, mipFilterName(m_mipFilter), hdr ? "RGBA16F" : "sRGB RGBA8");
 
     return true;
 }
 
 bool Image::load(float *data, int width, int height)
 {
-    m_pixels = data;
+    clear();
+    m_pixels = (unsigned char *) data;
+    m_format = RGBA32F;
     m_width = width;
     m_height = height;
+    m_byteSize = size_t(width) * height * pixelSize();
     return true;
 }
 
-bool Image::write(const std::string &filename)
+void Image::load(const MappedFile &file, size_t offset, Format format, int width, int height, int mipCount)
 {
-    std::ofstream imageFile (filename, std::ios::out | std::ios::binary);
-    imageFile.write ((const char*)m_pixels, sizeof(float) * 4 * m_width * m_height);
-    imageFile.close();
+    clear();
+    m_mapping = file;
+    m_pixels = (unsigned char *) file.data + offset;
+    m_format = format;
+    m_width = width;
+    m_height = height;
+    m_mipCount = mipCount;
+    m_byteSize = mipChainPixels(width, height, mipCount) * pixelSize();
+}
 
-    m_pixels = nullptr;
-    m_width = 0;
-    m_height = 0;
-    return true;
+void Image::decodeRow(int y, float *dst) const
+{
+    if (m_format == RGBA32F)
+        memcpy(dst, (const float *) m_pixels + size_t(y) * m_width * 4, size_t(m_width) * 4 * sizeof(float));
+    else
+        levelFormat(m_format).decode(m_pixels + size_t(y) * m_width * pixelSize(), m_width, dst);
 }
 
 void Image::clear()
 {
-    if (m_pixels)
+    if (m_mapping.data)
+        unmapFile(m_mapping);
+    else if (m_ownsPixels)
         delete [] m_pixels;
+    m_pixels = nullptr;
+    m_ownsPixels = false;
+    m_byteSize = 0;
     m_width = 0;
     m_height = 0;
 }
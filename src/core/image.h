@@ -2,30 +2,69 @@
 #ifndef RENDERER_GPU_IMAGE_H
 #define RENDERER_GPU_IMAGE_H
 
+#include <optixu/optixu_math_namespace.h>
+
+#include "mippyramid.h"
+#include "../utils/mappedfile.h"
+
 #include <string>
 
 class Image
 {
 public:
-    Image(int mipCount = 1);
+    // Storage of the pixels, always four channels.
+    // LDR files stay 8-bit sRGB and HDR files are stored as half floats.
+    enum Format
+    {
+        RGBA32F = 0,
+        RGBA16F = 1,
+        RGBA8_SRGB = 2
+    };
+
+    // Mip count of 0 or less builds the full chain down to 1x1.
+    Image(int mipCount = 1, MipFilter mipFilter = MIP_FILTER_BOX);
+    ~Image();
+
+    // Pixels are owned by one image only, images are shared through ImageStore.
+    Image(const Image &) = delete;
+    Image &operator=(const Image &) = delete;
+    Image(Image &&other);
+    Image &operator=(Image &&other);
 
     bool load(const std::string &filename);
-    bool load(float *data, int width, int height);
-    bool write(const std::string &filename);
+    bool load(float *data, int width, int height); // Wraps data without taking ownership.
+    // Uses mip levels stored at offset of a read-only file mapping, clear() releases the mapping.
+    void load(const MappedFile &file, size_t offset, Format format, int width, int height, int mipCount);
     void clear();
 
-    float *pixelData() const { return m_pixels; }
+    // Linear colors of a row of the finest mip level, whatever the storage format is.
+    // dst receives width() RGBA floats.
+    void decodeRow(int y, float *dst) const;
+
+    unsigned char *data() const { return m_pixels; }
+    float *pixelData() const { return (float *) m_pixels; } // Only valid for RGBA32F.
+    Format format() const { return m_format; }
+    int pixelSize() const;
+    size_t byteSize() const { return m_byteSize; } // All mip levels.
     int width() const { return m_width; }
     int height() const { return m_height; };
     int mipCount() const { return m_mipCount; }
+    MipFilter mipFilter() const { return m_mipFilter; }
+
+    // Row conversions used to filter mip levels of a format.
+    static MipLevelFormat levelFormat(Format format);
 private:
 
-    float *m_pixels;
-    unsigned char *m_output_pixels;
+    unsigned char *m_pixels;
+    bool m_ownsPixels;
+    MappedFile m_mapping;
+    Format m_format;
+    size_t m_byteSize;
     int m_width;
     int m_height;
 
     int m_mipCount;
+    MipFilter m_mipFilter;
 };
 
 
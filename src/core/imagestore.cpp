@@ -0,0 +1,85 @@
+
+#include "imagestore.h"
+
+#include "image.h"
+#include "texturecache.h"
+#include "../utils/hash.h"
+#include "../utils/log.h"
+
+#include <sys/stat.h>
+
+std::shared_ptr<const Image> ImageStore::acquire(const std::string &filename, int mipCount, MipFilter mipFilter)
+{
+    uint64_t hash = 0;
+    if (!contentHash(filename, hash)) {
+        LogError("Couldn't read image file: '%s'", filename.c_str());
+        return nullptr;
+    }
+
+    const Key key(hash, mipCount, int(mipFilter));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_images.find(key);
+        if (found != m_images.end()) {
+            if (auto image = found->second.lock())
+                return image;
+        }
+    }
+
+    // decoded without the lock, other files are decoded on other threads meanwhile
+    std::shared_ptr<Image> image = std::make_shared<Image>(mipCount, mipFilter);
+    if (!loadCachedImage(filename, hash, *image))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::weak_ptr<const Image> &stored = m_images[key];
+    if (auto other = stored.lock())
+        return other; // decoded twice at the same time, the first one wins
+    stored = image;
+    return image;
+}
+
+bool ImageStore::contentHash(const std::string &filename, uint64_t &hash)
+{
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_fileHashes.find(filename);
+        if (found != m_fileHashes.end() && found->second.size == (long long) status.st_size &&
+            found->second.modified == (long long) status.st_mtime) {
+            hash = found->second.hash;
+            return true;
+        }
+    }
+
+    if (!hashFile(filename, hash))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fileHashes[filename] = FileHash{hash, (long long) status.st_size, (long long) status.st_mtime};
+    return true;
+}
+
+size_t ImageStore::hostBytes()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t bytes = 0;
+    for (auto it = m_images.begin(); it != m_images.end();) {
+        if (auto image = it->second.lock()) {
+            bytes += image->byteSize();
+            ++it;
+        }
+        else
+            it = m_images.erase(it);
+    }
+    return bytes;
+}
+
+ImageStore &ImageStore::getInstance()
+{
+    static ImageStore instance;
+    return instance;
+}
@@ -0,0 +1,52 @@
+
+#ifndef RENDERER_GPU_IMAGESTORE_H
+#define RENDERER_GPU_IMAGESTORE_H
+
+#include "mippyramid.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+class Image;
+
+// Decoded images shared by all textures. Images are keyed by the content of their files, so a file referenced
+// under several paths is decoded once. Images are immutable once stored and are freed when the last holder
+// releases them; the store itself only remembers them while they live.
+class ImageStore
+{
+public:
+    // Image of a file with the given mip count and filter, decoded (or mapped from the texture cache)
+    // when nobody holds it. Returns null when the file can't be loaded. Safe to call from several threads.
+    std::shared_ptr<const Image> acquire(const std::string &filename, int mipCount, MipFilter mipFilter);
+
+    // Hash of the content of a file. It is remembered while the size and modification time of the file
+    // stay the same, so asking again is cheap. Safe to call from several threads.
+    bool contentHash(const std::string &filename, uint64_t &hash);
+
+    // Pixels of all living images in bytes.
+    size_t hostBytes();
+
+    static ImageStore &getInstance();
+
+private:
+    ImageStore() {}
+
+    typedef std::tuple<uint64_t, int, int> Key;
+
+    struct FileHash
+    {
+        uint64_t hash;
+        long long size;
+        long long modified;
+    };
+
+    std::mutex m_mutex;
+    std::map<Key, std::weak_ptr<const Image>> m_images;
+    std::map<std::string, FileHash> m_fileHashes;
+};
+
+#endif //RENDERER_GPU_IMAGESTORE_H
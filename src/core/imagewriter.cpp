@@ -0,0 +1,533 @@
+
+#include "imagewriter.h"
+
+#include "image.h"
+#include "globalsettings.h"
+#include "tonemapper.h"
+#include "../utils/log.h"
+#include "../utils/stats.h"
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+REGISTER_PERMANENT_STATISTIC(float, imageWriteLatency, 0.0f, "Image write latency (ms)");
+REGISTER_PERMANENT_STATISTIC(float, imageBytesWritten, 0.0f, "Image bytes written (MB)");
+
+// Writes are queued until this many are pending, then write() waits for the writer.
+static const size_t MAX_PENDING_WRITES = 4;
+static const int JPG_QUALITY = 95;
+
+static std::string extension(const std::string &filename)
+{
+    const size_t dot = filename.find_last_of('.');
+    if (dot == std::string::npos)
+        return "";
+    std::string result = filename.substr(dot + 1);
+    std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return result;
+}
+
+// Output file counting the bytes written through it, also the sink of the stb writers.
+struct OutputFile
+{
+    FILE *file = nullptr;
+    size_t bytes = 0;
+    bool failed = false;
+
+    explicit OutputFile(const std::string &filename)
+    {
+        file = fopen(filename.c_str(), "wb");
+        failed = !file;
+    }
+
+    ~OutputFile()
+    {
+        if (file && fclose(file) != 0)
+            failed = true;
+    }
+
+    void write(const void *data, size_t size)
+    {
+        if (failed)
+            return;
+        failed = fwrite(data, 1, size, file) != size;
+        bytes += size;
+    }
+
+    template <typename T>
+    void write(const T &value) { write(&value, sizeof(T)); }
+
+    void writeString(const char *value) { write(value, strlen(value) + 1); }
+
+    static void stbCallback(void *context, void *data, int size)
+    {
+        ((OutputFile *) context)->write(data, size_t(size));
+    }
+};
+
+// Encoders get the staged pixels bottom row first and return the bytes written, 0 on failure.
+
+static size_t writeRaw(const std::vector<float> &pixels, const std::string &filename)
+{
+    OutputFile file(filename);
+    file.write(pixels.data(), pixels.size() * sizeof(float));
+    return file.failed ? 0 : file.bytes;
+}
+
+static size_t writePFM(const std::vector<float> &pixels, int width, int height, const std::string &filename)
+{
+    OutputFile file(filename);
+    char header[64];
+    // negative scale marks little endian, rows are stored bottom first like the film
+    const int length = snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height);
+    file.write(header, size_t(length));
+
+    std::vector<float> row(size_t(width) * 3);
+    for (int y = 0; y < height && !file.failed; y++) {
+        const float *src = pixels.data() + size_t(y) * width * 4;
+        for (int x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        file.write(row.data(), row.size() * sizeof(float));
+    }
+    return file.failed ? 0 : file.bytes;
+}
+
+static std::vector<float> flipRows(const std::vector<float> &pixels, int width, int height)
+{
+    std::vector<float> flipped(pixels.size());
+    const size_t rowSize = size_t(width) * 4;
+    for (int y = 0; y < height; y++)
+        memcpy(flipped.data() + size_t(height - 1 - y) * rowSize, pixels.data() + size_t(y) * rowSize,
+               rowSize * sizeof(float));
+    return flipped;
+}
+
+static size_t writeHDR(const std::vector<float> &pixels, int width, int height, const std::string &filename)
+{
+    const std::vector<float> flipped = flipRows(pixels, width, height);
+    OutputFile file(filename);
+    if (!file.failed && !stbi_write_hdr_to_func(OutputFile::stbCallback, &file, width, height, 4, flipped.data()))
+        file.failed = true;
+    return file.failed ? 0 : file.bytes;
+}
+
+static size_t writeLDR(const std::vector<float> &pixels, int width, int height, const std::string &filename,
+                       const ToneMapSettings &toneMapSettings, bool jpg)
+{
+    std::vector<unsigned char> encoded(size_t(width) * height * 4);
+    toneMap(pixels.data(), width, height, toneMapSettings, encoded.data(), true);
+
+    OutputFile file(filename);
+    if (!file.failed) {
+        const int result = jpg ?
+            stbi_write_jpg_to_func(OutputFile::stbCallback, &file, width, height, 4, encoded.data(), JPG_QUALITY) :
+            stbi_write_png_to_func(OutputFile::stbCallback, &file, width, height, 4, encoded.data(), width * 4);
+        file.failed |= !result;
+    }
+    return file.failed ? 0 : file.bytes;
+}
+
+static void writeEXRAttribute(OutputFile &file, const char *name, const char *type, const void *value, int size)
+{
+    file.writeString(name);
+    file.writeString(type);
+    file.write(int32_t(size));
+    file.write(value, size_t(size));
+}
+
+enum EXRPixelType
+{
+    EXR_UINT = 0,
+    EXR_HALF = 1,
+    EXR_FLOAT = 2
+};
+
+// Channel of an AOV layer, 32-bit values at data[(y * width + x) * stride + offset] with rows bottom first.
+struct EXRLayerChannel
+{
+    std::string name;
+    EXRPixelType type;
+    const void *data;
+    int stride;
+    int offset;
+};
+
+// Channels of the enabled layers sorted by name, as EXR requires. All of them sort after the beauty's A, B, G, R.
+// Normals can be negative and depths exceed the half range, so layers are stored as 32-bit floats. IDs of
+// pixels without a hit are 0xffffffff.
+static std::vector<EXRLayerChannel> exrLayerChannels(const FilmLayers &image)
+{
+    std::vector<EXRLayerChannel> channels;
+    static const char *rgb[3] = {"albedo.R", "albedo.G", "albedo.B"};
+    static const char *xyz[3] = {"normal.X", "normal.Y", "normal.Z"};
+    for (int c = 0; c < 3; c++) {
+        if (!image.albedo.empty())
+            channels.push_back({rgb[c], EXR_FLOAT, image.albedo.data(), 3, c});
+        if (!image.normal.empty())
+            channels.push_back({xyz[c], EXR_FLOAT, image.normal.data(), 3, c});
+    }
+    if (!image.depth.empty())
+        channels.push_back({"depth.Z", EXR_FLOAT, image.depth.data(), 1, 0});
+    if (!image.primitiveID.empty())
+        channels.push_back({"id.primitive", EXR_UINT, image.primitiveID.data(), 1, 0});
+    if (!image.materialID.empty())
+        channels.push_back({"id.material", EXR_UINT, image.materialID.data(), 1, 0});
+    if (!image.samples.empty())
+        channels.push_back({"samples", EXR_UINT, image.samples.data(), 1, 0});
+    std::sort(channels.begin(), channels.end(),
+              [](const EXRLayerChannel &a, const EXRLayerChannel &b) { return a.name < b.name; });
+    return channels;
+}
+
+static void appendEXRChannel(std::vector<unsigned char> &channels, const std::string &name, EXRPixelType type)
+{
+    channels.insert(channels.end(), name.begin(), name.end());
+    const unsigned char channel[17] = {0,
+                                       (unsigned char) type, 0, 0, 0,
+                                       0, 0, 0, 0, // linear, reserved
+                                       1, 0, 0, 0, // x sampling
+                                       1, 0, 0, 0}; // y sampling
+    channels.insert(channels.end(), channel, channel + sizeof(channel));
+}
+
+// Header of an uncompressed half RGBA file, followed by the channels of AOV layers. Channels are stored
+// alphabetically and the data window starts with the top row. Tile size of 0 makes a scanline file with one
+// line per block.
+static void writeEXRHeader(OutputFile &file, int width, int height, int tileSize,
+                           const std::vector<EXRLayerChannel> &layers = {})
+{
+    file.write(uint32_t(20000630));                 // magic number
+    file.write(uint32_t(tileSize ? 2 | 0x200 : 2)); // version 2, single part scanline or tiled
+
+    std::vector<unsigned char> channels;
+    for (const char *name : {"A", "B", "G", "R"})
+        appendEXRChannel(channels, name, EXR_HALF);
+    for (const EXRLayerChannel &layer : layers)
+        appendEXRChannel(channels, layer.name, layer.type);
+    channels.push_back(0);
+    const int32_t window[4] = {0, 0, width - 1, height - 1};
+    const unsigned char compression = 0;
+    const unsigned char lineOrder = 0; // increasing y
+    const float aspectRatio = 1.0f;
+    const float windowCenter[2] = {0.0f, 0.0f};
+    const float windowWidth = 1.0f;
+
+    writeEXRAttribute(file, "channels", "chlist", channels.data(), int(channels.size()));
+    writeEXRAttribute(file, "compression", "compression", &compression, 1);
+    writeEXRAttribute(file, "dataWindow", "box2i", window, sizeof(window));
+    writeEXRAttribute(file, "displayWindow", "box2i", window, sizeof(window));
+    writeEXRAttribute(file, "lineOrder", "lineOrder", &lineOrder, 1);
+    writeEXRAttribute(file, "pixelAspectRatio", "float", &aspectRatio, sizeof(aspectRatio));
+    writeEXRAttribute(file, "screenWindowCenter", "v2f", windowCenter, sizeof(windowCenter));
+    writeEXRAttribute(file, "screenWindowWidth", "float", &windowWidth, sizeof(windowWidth));
+    if (tileSize) {
+        unsigned char tiles[9] = {}; // size in x and y, one level with rounding down
+        const uint32_t size = uint32_t(tileSize);
+        memcpy(tiles, &size, sizeof(size));
+        memcpy(tiles + 4, &size, sizeof(size));
+        writeEXRAttribute(file, "tiles", "tiledesc", tiles, sizeof(tiles));
+    }
+    file.write((unsigned char) 0);
+}
+
+// Writes one line of linear RGBA as the half channel planes of an EXR block.
+static void writeEXRLine(OutputFile &file, const float *pixels, int width, std::vector<uint16_t> &interleaved,
+                         std::vector<uint16_t> &planar)
+{
+    // negative values are clamped by the half encoder, radiance is never negative anyway
+    static const MipRowEncoder encode = Image::levelFormat(Image::RGBA16F).encode;
+    static const int sourceChannel[4] = {3, 2, 1, 0}; // A, B, G, R
+    interleaved.resize(size_t(width) * 4);
+    planar.resize(size_t(width) * 4);
+    encode(pixels, width, (unsigned char *) interleaved.data());
+    for (int c = 0; c < 4; c++)
+        for (int x = 0; x < width; x++)
+            planar[size_t(c) * width + x] = interleaved[x * 4 + sourceChannel[c]];
+    file.write(planar.data(), planar.size() * sizeof(uint16_t));
+}
+
+// Writes one line of the AOV layers after the beauty, every channel is a plane of 32-bit values.
+static void writeEXRLayerLine(OutputFile &file, const std::vector<EXRLayerChannel> &layers, int width, int y,
+                              std::vector<uint32_t> &plane)
+{
+    plane.resize(size_t(width));
+    for (const EXRLayerChannel &layer : layers) {
+        const unsigned char *src = (const unsigned char *) layer.data;
+        for (int x = 0; x < width; x++)
+            memcpy(&plane[x], src + ((size_t(y) * width + x) * layer.stride + layer.offset) * sizeof(uint32_t),
+                   sizeof(uint32_t));
+        file.write(plane.data(), plane.size() * sizeof(uint32_t));
+    }
+}
+
+static size_t writeEXR(const FilmLayers &image, const std::string &filename)
+{
+    const int width = image.width;
+    const int height = image.height;
+    const std::vector<EXRLayerChannel> layers = exrLayerChannels(image);
+    OutputFile file(filename);
+    writeEXRHeader(file, width, height, 0, layers);
+
+    const int32_t lineSize = width * (4 * int32_t(sizeof(uint16_t)) + int32_t(layers.size() * sizeof(uint32_t)));
+    const uint64_t firstLine = file.bytes + size_t(height) * sizeof(uint64_t);
+    for (int y = 0; y < height; y++)
+        file.write(uint64_t(firstLine + uint64_t(y) * (2 * sizeof(int32_t) + lineSize)));
+
+    std::vector<uint16_t> interleaved, planar;
+    std::vector<uint32_t> plane;
+    for (int y = 0; y < height && !file.failed; y++) {
+        file.write(int32_t(y));
+        file.write(lineSize);
+        writeEXRLine(file, image.beauty.data() + size_t(height - 1 - y) * width * 4, width, interleaved, planar);
+        writeEXRLayerLine(file, layers, width, height - 1 - y, plane);
+    }
+    return file.failed ? 0 : file.bytes;
+}
+
+static size_t encodeImage(const FilmLayers &image, const std::string &filename, const ToneMapSettings &toneMapSettings)
+{
+    const std::vector<float> &pixels = image.beauty;
+    const int width = image.width;
+    const int height = image.height;
+    const std::string format = extension(filename);
+    if (format == "img")
+        return writeRaw(pixels, filename);
+    if (format == "pfm")
+        return writePFM(pixels, width, height, filename);
+    if (format == "hdr")
+        return writeHDR(pixels, width, height, filename);
+    if (format == "exr")
+        return writeEXR(image, filename);
+    if (format == "png")
+        return writeLDR(pixels, width, height, filename, toneMapSettings, false);
+    if (format == "jpg" || format == "jpeg")
+        return writeLDR(pixels, width, height, filename, toneMapSettings, true);
+    return 0;
+}
+
+TiledImageFile::TiledImageFile()
+    : m_width(0), m_height(0), m_tileSize(0), m_nextTile(0)
+{
+}
+
+TiledImageFile::~TiledImageFile()
+{
+    if (m_file)
+        close();
+}
+
+bool TiledImageFile::open(const std::string &filename, int width, int height, int tileSize)
+{
+    m_file.reset(new OutputFile(filename));
+    m_width = width;
+    m_height = height;
+    m_tileSize = tileSize;
+    m_nextTile = 0;
+    writeEXRHeader(*m_file, width, height, tileSize);
+
+    // tiles arrive in the order of the offset table and their sizes are known, so the table is written first
+    const int count = tilesX() * tilesY();
+    uint64_t offset = m_file->bytes + size_t(count) * sizeof(uint64_t);
+    for (int tileY = 0; tileY < tilesY(); tileY++)
+        for (int tileX = 0; tileX < tilesX(); tileX++) {
+            m_file->write(offset);
+            offset += 5 * sizeof(int32_t) + uint64_t(tileExtent(tileX, tileY).x) * tileExtent(tileX, tileY).y * 8;
+        }
+
+    if (m_file->failed)
+        LogError("Unable to write image %s", filename.c_str());
+    return !m_file->failed;
+}
+
+bool TiledImageFile::supportsFormat(const std::string &filename)
+{
+    return extension(filename) == "exr";
+}
+
+optix::int2 TiledImageFile::tileExtent(int tileX, int tileY) const
+{
+    return optix::make_int2(std::min(m_tileSize, m_width - tileX * m_tileSize),
+                            std::min(m_tileSize, m_height - tileY * m_tileSize));
+}
+
+optix::int2 TiledImageFile::tileOrigin(int tileX, int tileY) const
+{
+    return optix::make_int2(tileX * m_tileSize, m_height - tileY * m_tileSize - tileExtent(tileX, tileY).y);
+}
+
+bool TiledImageFile::writeTile(int tileX, int tileY, const float *pixels)
+{
+    if (!m_file || tileY * tilesX() + tileX != m_nextTile) {
+        LogError("Tiles of an image have to be written in order");
+        return false;
+    }
+    m_nextTile++;
+
+    const optix::int2 size = tileExtent(tileX, tileY);
+    m_file->write(int32_t(tileX));
+    m_file->write(int32_t(tileY));
+    m_file->write(int32_t(0)); // level
+    m_file->write(int32_t(0));
+    m_file->write(int32_t(size.x * size.y * 8));
+    for (int y = size.y - 1; 0 <= y && !m_file->failed; y--)
+        writeEXRLine(*m_file, pixels + size_t(y) * size.x * 4, size.x, m_interleaved, m_planar);
+    return !m_file->failed;
+}
+
+bool TiledImageFile::close()
+{
+    if (!m_file)
+        return false;
+    const bool complete = m_nextTile == tilesX() * tilesY();
+    if (!complete)
+        LogError("Image closed with %d of %d tiles written", m_nextTile, tilesX() * tilesY());
+    m_file.reset(); // closes the file, failures are caught by the last write already
+    return complete;
+}
+
+ImageWriter::ImageWriter()
+    : m_busy(false), m_stop(false), m_lastLatency(0.0f), m_bytesWritten(0.0)
+{
+    m_thread = std::thread(&ImageWriter::work, this);
+}
+
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+bool ImageWriter::supportsFormat(const std::string &filename)
+{
+    static const char *formats[] = {"img", "pfm", "hdr", "exr", "png", "jpg", "jpeg"};
+    const std::string format = extension(filename);
+    return std::find_if(std::begin(formats), std::end(formats),
+                        [&format](const char *f) { return format == f; }) != std::end(formats);
+}
+
+void ImageWriter::write(const float *pixels, int width, int height, const std::string &filename, Callback written)
+{
+    if (!supportsFormat(filename)) {
+        LogError("Unknown image format of %s", filename.c_str());
+        if (written)
+            written(false);
+        return;
+    }
+
+    Job job;
+    job.image.width = width;
+    job.image.height = height;
+    job.filename = filename;
+    job.written = std::move(written);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_stagingBuffers.empty()) {
+            job.image.beauty.swap(m_stagingBuffers.back());
+            m_stagingBuffers.pop_back();
+        }
+    }
+
+    job.image.beauty.resize(size_t(width) * height * 4);
+    memcpy(job.image.beauty.data(), pixels, job.image.beauty.size() * sizeof(float));
+    queue(std::move(job));
+}
+
+void ImageWriter::write(FilmLayers &&image, const std::string &filename, Callback written)
+{
+    if (!supportsFormat(filename)) {
+        LogError("Unknown image format of %s", filename.c_str());
+        if (written)
+            written(false);
+        return;
+    }
+    if (image.mask && extension(filename) != "exr")
+        LogWarning("AOV layers are only written to exr files, %s gets the beauty only", filename.c_str());
+
+    Job job;
+    job.image = std::move(image);
+    job.filename = filename;
+    job.written = std::move(written);
+    queue(std::move(job));
+}
+
+void ImageWriter::queue(Job &&job)
+{
+    job.toneMap = GlobalSettings::getInstance().toneMap;
+    job.queueTime = std::chrono::high_resolution_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_jobs.size() < MAX_PENDING_WRITES; });
+        m_jobs.push_back(std::move(job));
+    }
+    m_condition.notify_all();
+    publishStatistics();
+}
+
+void ImageWriter::flush()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_jobs.empty() && !m_busy; });
+    }
+    publishStatistics();
+}
+
+void ImageWriter::publishStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    imageWriteLatency = m_lastLatency;
+    imageBytesWritten = float(m_bytesWritten / (1024.0 * 1024.0));
+}
+
+void ImageWriter::work()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                return; // queue is drained before stopping
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_busy = true;
+        }
+        m_condition.notify_all(); // a slot is free for write()
+
+        const size_t bytes = encodeImage(job.image, job.filename, job.toneMap);
+        const float latency = std::chrono::duration<float, std::milli>(
+            std::chrono::high_resolution_clock::now() - job.queueTime).count();
+        if (bytes == 0)
+            LogError("Unable to write image %s", job.filename.c_str());
+        if (job.written)
+            job.written(bytes != 0);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lastLatency = latency;
+            m_bytesWritten += double(bytes);
+            if (m_stagingBuffers.size() < MAX_PENDING_WRITES)
+                m_stagingBuffers.push_back(std::move(job.image.beauty));
+            m_busy = false;
+        }
+        m_condition.notify_all();
+    }
+}
+
+ImageWriter &ImageWriter::getInstance()
+{
+    static ImageWriter writer;
+    return writer;
+}
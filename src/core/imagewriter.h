@@ -0,0 +1,112 @@
+
+#ifndef RENDERER_GPU_IMAGEWRITER_H
+#define RENDERER_GPU_IMAGEWRITER_H
+
+#include <optixu/optixu_math_namespace.h>
+
+#include "aov.h"
+#include "tonemapper.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct OutputFile;
+
+// Streams an image tile by tile into a tiled OpenEXR file with uncompressed half RGBA, so that the whole image
+// never has to be in memory. Tiles are numbered row by row from the top left and have to be written in that order.
+class TiledImageFile
+{
+public:
+    TiledImageFile();
+    ~TiledImageFile();
+
+    bool open(const std::string &filename, int width, int height, int tileSize);
+    // Pixels are linear RGBA32F of the tile, bottom row first like the film.
+    bool writeTile(int tileX, int tileY, const float *pixels);
+    // Returns false when tiles are missing.
+    bool close();
+
+    static bool supportsFormat(const std::string &filename);
+
+    int tilesX() const { return (m_width + m_tileSize - 1) / m_tileSize; }
+    int tilesY() const { return (m_height + m_tileSize - 1) / m_tileSize; }
+    // Tiles at the right and bottom edges are smaller.
+    optix::int2 tileExtent(int tileX, int tileY) const;
+    // Lower left pixel of a tile in film coordinates, where row 0 is at the bottom.
+    optix::int2 tileOrigin(int tileX, int tileY) const;
+
+private:
+    std::unique_ptr<OutputFile> m_file;
+    int m_width;
+    int m_height;
+    int m_tileSize;
+    int m_nextTile;
+    std::vector<uint16_t> m_interleaved;
+    std::vector<uint16_t> m_planar;
+};
+
+// Writes rendered images on a background thread. Pixels are copied into a staging buffer, so the caller can
+// continue rendering right away. The format follows the extension of the filename:
+//   img       raw RGBA32F, rows as in the film
+//   pfm       portable float map, RGB32F
+//   hdr       Radiance RGBE
+//   exr       OpenEXR, uncompressed half RGBA, plus 32-bit channels of the AOV layers when there are any
+//   png, jpg  8-bit sRGB, tone mapped with the global settings
+class ImageWriter
+{
+public:
+    // Called on the writer thread once the file is complete, with false when it couldn't be written.
+    typedef std::function<void(bool)> Callback;
+
+    ~ImageWriter();
+
+    // Queues linear RGBA32F pixels, bottom row first like the film. Blocks only when too many writes are pending.
+    void write(const float *pixels, int width, int height, const std::string &filename, Callback written = nullptr);
+    // Queues the beauty together with its AOV layers, which only exr files can hold. Other formats get the beauty.
+    void write(FilmLayers &&image, const std::string &filename, Callback written = nullptr);
+    // Waits until all queued images are written.
+    void flush();
+
+    static bool supportsFormat(const std::string &filename);
+    static ImageWriter &getInstance();
+
+private:
+    ImageWriter();
+
+    struct Job
+    {
+        FilmLayers image;
+        std::string filename;
+        Callback written;
+        ToneMapSettings toneMap; // Of 8-bit formats, taken when the image is queued.
+        std::chrono::high_resolution_clock::time_point queueTime;
+    };
+
+    // Waits for a free slot, the image of the job has to be filled already.
+    void queue(Job &&job);
+    void work();
+    // Copies statistics of finished writes to the registered ones, on the calling thread.
+    void publishStatistics();
+
+    std::thread m_thread;
+    std::deque<Job> m_jobs;
+    std::vector<std::vector<float>> m_stagingBuffers; // Recycled to avoid page faults on every write.
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_busy;
+    bool m_stop;
+
+    float m_lastLatency;
+    double m_bytesWritten;
+};
+
+
+#endif //RENDERER_GPU_IMAGEWRITER_H
@@ -0,0 +1,48 @@
+
+#include "inputlatency.h"
+
+InputLatency::InputLatency()
+    : m_inputPending(false), m_passInput(false), m_inputRendered(false)
+{
+}
+
+void InputLatency::motion(Clock::time_point lastMotion)
+{
+    if (lastMotion == m_handledMotion)
+        return;
+    m_handledMotion = lastMotion;
+    if (!m_inputPending) {
+        m_inputPending = true;
+        m_inputTime = lastMotion;
+    }
+}
+
+void InputLatency::passStarted()
+{
+    m_passInput = m_inputPending;
+    m_passInputTime = m_inputTime;
+    m_inputPending = false;
+}
+
+void InputLatency::passDropped()
+{
+    if (m_passInput) {
+        m_inputPending = true;
+        m_inputTime = m_passInputTime;
+    }
+    m_passInput = false;
+}
+
+void InputLatency::passFinished()
+{
+    m_inputRendered |= m_passInput;
+    m_passInput = false;
+}
+
+float InputLatency::presented(Clock::time_point now)
+{
+    if (!m_inputRendered)
+        return -1.0f;
+    m_inputRendered = false;
+    return std::chrono::duration<float, std::milli>(now - m_passInputTime).count();
+}
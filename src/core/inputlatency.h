@@ -0,0 +1,36 @@
+
+#ifndef RENDERER_GPU_INPUTLATENCY_H
+#define RENDERER_GPU_INPUTLATENCY_H
+
+#include <chrono>
+
+// Times camera input from its first motion until a pass that started after it is handed to the display.
+// Motions arriving while a pass runs wait for the next one, a pass dropped for a faster one hands its
+// input on to it.
+class InputLatency
+{
+public:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    InputLatency();
+
+    // Time of the last camera motion, seen between passes.
+    void motion(Clock::time_point lastMotion);
+    // The next pass shows all input up to now.
+    void passStarted();
+    // The running pass was abandoned, its input goes to the next one.
+    void passDropped();
+    void passFinished();
+    // Milliseconds from the input to now when the finished pass showed new input, negative otherwise.
+    float presented(Clock::time_point now);
+
+private:
+    Clock::time_point m_handledMotion; // Last motion seen.
+    Clock::time_point m_inputTime;     // Oldest motion no pass has started with.
+    Clock::time_point m_passInputTime; // Oldest motion shown by the current pass.
+    bool m_inputPending;
+    bool m_passInput;
+    bool m_inputRendered;              // A pass with new input finished and waits for the display.
+};
+
+#endif //RENDERER_GPU_INPUTLATENCY_H
@@ -8,7 +8,8 @@ enum LightType
 {
     ENVIRONMENT   = 0,
     POINT = 1,
-    DIRECTIONAL = 2
+    DIRECTIONAL = 2,
+    MESH = 3
 };
 
 struct LightSample
@@ -36,10 +37,28 @@ struct LightDefinition
     float         area;
     optix::float3 emission;
 
-    // Manual padding to float4 alignment goes here.
-    float         unused0;
+    unsigned int  bvhTrail; // Path to this light in the light hierarchy, bit per level (1 = right child).
+
+    // Mesh lights: range of their triangles in sysEmitterTriangles and sysEmitterAliasTable.
+    int           triangleOffset;
+    int           triangleCount;
+
+    // Manual padding to float4 alignment, 96 bytes.
     float         unused1;
+    float         unused2;
+};
+
+static_assert(sizeof(LightDefinition) % 16 == 0, "LightDefinition has to stay float4 aligned");
 
+// World space triangle of a mesh light. Emits from the side cross(edge1, edge2) points to.
+struct EmitterTriangle
+{
+    optix::float3 vertex0;
+    float         area;
+    optix::float3 edge1;
+    float         unused0;
+    optix::float3 edge2;
+    float         unused1;
 };
 
 #endif //RENDERER_GPU_LIGHTDATA_H
@@ -5,14 +5,124 @@
 #include "../utils/fileutil.h"
 #include "../utils/log.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include <imgui/imgui.h>
 
 #include "texture.h"
+#include "geometrypool.h"
+#include "materialpool.h"
+#include "primitivepool.h"
+
+// Rough estimate of the light contribution, used to pick lights proportionally to it.
+// Infinite lights only deliver power to the scene, so like in pbrt it is their irradiance times the area of
+// the disc of the scene bounding sphere facing them. The environment is approximated as uniform, with
+// irradiance pi times its average radiance.
+static float estimatePower(const LightDefinition &light, const optix::float3 &environmentAverage, float sceneRadius)
+{
+    float emission = (light.emission.x + light.emission.y + light.emission.z) / 3.0f;
+    const float discArea = M_PIf * sceneRadius * sceneRadius;
+    switch (light.type) {
+    case LightType::ENVIRONMENT: {
+        optix::float3 average = light.emission * environmentAverage;
+        return discArea * M_PIf * (average.x + average.y + average.z) / 3.0f;
+    }
+    case LightType::DIRECTIONAL:
+        return discArea * emission;
+    case LightType::POINT:
+        return 4.0f * M_PIf * emission;
+    case LightType::MESH:
+        // diffuse emitter radiating from one side
+        return M_PIf * emission * light.area;
+    default:
+        return emission;
+    }
+}
+
+// Light hierarchy leaf bounding a single finite light.
+static LightBVHNode lightBVHLeaf(const LightDefinition &light, int index)
+{
+    LightBVHNode leaf;
+    leaf.boundsMin = light.position;
+    leaf.boundsMax = light.position;
+    leaf.power = estimatePower(light, optix::make_float3(1.0f), 0.0f);
+    // point lights emit in all directions
+    leaf.axis = optix::make_float3(0.0f, 0.0f, 1.0f);
+    leaf.cosTheta0 = -1.0f;
+    leaf.cosThetaE = 0.0f;
+    leaf.left = index;
+    leaf.right = -1;
+    leaf.unused0 = 0.0f;
+    leaf.unused1 = 0.0f;
+    return leaf;
+}
+
+static bool isInfiniteLight(const LightDefinition &light)
+{
+    return light.type == LightType::ENVIRONMENT || light.type == LightType::DIRECTIONAL;
+}
+
+// Transforms triangles of the mesh to world space and builds their area distribution and bounds.
+// Returns total area.
+static float buildMeshEmitter(const std::vector<VertexAttributes> &attributes, const optix::Matrix4x4 &transform,
+    MeshEmitter &emitter)
+{
+    // world space normals follow the inverse transpose, which flips the winding of mirroring transforms
+    const float *m = transform.getData();
+    const float determinant = m[0] * (m[5] * m[10] - m[6] * m[9]) - m[1] * (m[4] * m[10] - m[6] * m[8]) +
+        m[2] * (m[4] * m[9] - m[5] * m[8]);
+    const bool flip = determinant < 0.0f;
+
+    std::vector<float> areas;
+    double totalArea = 0.0;
+    emitter.triangles.clear();
+    for (size_t i = 0; i + 2 < attributes.size(); i += 3) {
+        const optix::float3 p0 = optix::make_float3(transform * optix::make_float4(attributes[i].vertex, 1.0f));
+        const optix::float3 p1 = optix::make_float3(transform * optix::make_float4(attributes[i + 1].vertex, 1.0f));
+        const optix::float3 p2 = optix::make_float3(transform * optix::make_float4(attributes[i + 2].vertex, 1.0f));
+
+        // degenerate triangles are kept so that primitive indices still match
+        EmitterTriangle triangle;
+        triangle.vertex0 = p0;
+        triangle.edge1 = flip ? p2 - p0 : p1 - p0;
+        triangle.edge2 = flip ? p1 - p0 : p2 - p0;
+        const optix::float3 normal = optix::cross(triangle.edge1, triangle.edge2);
+        triangle.area = 0.5f * optix::length(normal);
+        triangle.unused0 = 0.0f;
+        triangle.unused1 = 0.0f;
+        emitter.triangles.push_back(triangle);
+        areas.push_back(triangle.area);
+        if (triangle.area <= 0.0f)
+            continue;
+
+        LightBVHNode node;
+        node.boundsMin = optix::fminf(p0, optix::fminf(p1, p2));
+        node.boundsMax = optix::fmaxf(p0, optix::fmaxf(p1, p2));
+        node.power = triangle.area;
+        node.axis = normal / (2.0f * triangle.area);
+        node.cosTheta0 = 1.0f;
+        node.cosThetaE = 0.0f; // cosine falloff ends at the horizon
+        node.left = -1;
+        node.right = -1;
+        node.unused0 = 0.0f;
+        node.unused1 = 0.0f;
+        emitter.bounds = (totalArea == 0.0) ? node : mergeLightBVHNodes(emitter.bounds, node);
+        totalArea += triangle.area;
+    }
+
+    buildAliasTable(areas, emitter.aliasTable);
+    return float(totalArea);
+}
 
 LightPool::~LightPool()
 {
+    m_bufferLightAlias->destroy();
+    m_bufferLightBVH->destroy();
+    m_bufferEmitterTriangles->destroy();
+    m_bufferEmitterAlias->destroy();
+    m_bufferEnvironmentConditional->destroy();
+    m_bufferEnvironmentMarginal->destroy();
     m_bufferSampleLight->destroy();
     m_bufferLights->destroy();
 
@@ -27,6 +137,8 @@ void LightPool::load(const pugi::xml_node &node)
     std::vector<std::string> new_names;
     new_names.push_back("Environment light");
     clearEnvironmentLight();
+    m_environmentAverage = optix::make_float3(1.0f);
+    const TextureData *environmentDistribution = nullptr;
     for (auto &light_node : node.children("light")) {
         std::string name = light_node.attribute("name").value();
         name = GetUniqueName(new_names, name);
@@ -41,12 +153,27 @@ void LightPool::load(const pugi::xml_node &node)
             light.emission = readSpectrum(light_node.child("color").child("values"), optix::make_float3(1.0f, 1.0f, 1.0f));
             light.environmentTextureID = RT_TEXTURE_ID_NULL;
         }
+        else if (light_type == "point") {
+            light.type = LightType::POINT;
+            light.position = readVector3(light_node.child("position"));
+            light.direction = optix::make_float3(0.0f, 0.0f, 1.0f);
+            light.emission = readSpectrum(light_node.child("color").child("values"), optix::make_float3(1.0f, 1.0f, 1.0f));
+            light.environmentTextureID = RT_TEXTURE_ID_NULL;
+        }
         else if (light_type == "environment") {
 
             LightDefinition &env_light = m_lightMap["Environment light"];
             env_light.emission = readSpectrum(light_node.child("color").child("values"), optix::make_float3(1.0f, 1.0f, 1.0f));
             env_light.environmentTextureID = TexturePool::getInstance(m_context).id(
                 light_node.child("color").child("texture"), env_light.textureScale);
+            if (env_light.environmentTextureID != RT_TEXTURE_ID_NULL) {
+                auto texture_node = light_node.child("color").child("texture");
+                m_environmentAverage = TexturePool::getInstance(m_context).average(texture_node);
+
+                // tiled environment doesn't match the distribution, it's sampled uniformly then
+                if (env_light.textureScale == 1.0f)
+                    environmentDistribution = TexturePool::getInstance(m_context).distribution(texture_node);
+            }
             continue;
         }
         else {
@@ -57,17 +184,210 @@ void LightPool::load(const pugi::xml_node &node)
         new_names.push_back(name);
     }
 
+    loadEmitters(new_names);
+    updatePrimitiveBounds();
+
     // delete all lights from previous loadings that are missing now
     std::vector<std::string> geomToDelete = difference(old_names, new_names);
     for (auto &geom : geomToDelete)
         m_lightMap.erase(geom);
 
+    updateEnvironmentDistribution(environmentDistribution);
     updateLightBuffer();
 }
 
+void LightPool::loadEmitters(std::vector<std::string> &names)
+{
+    m_emitters.clear();
+    m_emissionVersion = MaterialPool::getInstance(m_context).emissionVersion();
+    for (auto &kv : PrimitivePool::getInstance(m_context).primitives()) {
+        optix::GeometryInstance instance = kv.second.instance;
+        if (!instance)
+            continue;
+        instance["lightIndex"]->setInt(-1);
+
+        const optix::float3 emission = MaterialPool::getInstance(m_context).emission(kv.second.materialName);
+        if (emission.x <= 0.0f && emission.y <= 0.0f && emission.z <= 0.0f)
+            continue;
+
+        // reuse geometry that is already loaded, no need to import the mesh again
+        const std::vector<VertexAttributes> *attributes =
+            GeometryPool::getInstance(m_context).attributes(kv.second.geometryName);
+        if (!attributes)
+            continue;
+
+        MeshEmitter emitter;
+        const float area = buildMeshEmitter(*attributes, kv.second.transformMatrix, emitter);
+        if (area <= 0.0f) {
+            LogWarning("Emissive primitive '%s' has zero area, it won't be sampled as a light", kv.first.c_str());
+            continue;
+        }
+        emitter.instance = instance;
+        emitter.materialName = kv.second.materialName;
+
+        LightDefinition light;
+        light.type = LightType::MESH;
+        light.position = (emitter.bounds.boundsMin + emitter.bounds.boundsMax) * 0.5f;
+        light.direction = emitter.bounds.axis;
+        light.emission = emission;
+        light.area = area;
+        light.environmentTextureID = RT_TEXTURE_ID_NULL;
+        light.textureScale = 1.0f;
+
+        std::string name = GetUniqueName(names, kv.first + " (emitter)");
+        m_lightMap[name] = light;
+        m_emitters[name] = emitter;
+        names.push_back(name);
+
+        LogInfo("Primitive '%s' is an area light. (%d triangles)", kv.first.c_str(), int(emitter.triangles.size()));
+    }
+}
+
+// Emitters whose material stopped emitting are dropped, new ones are gathered from the primitives.
+void LightPool::reloadEmitters()
+{
+    for (auto &kv : m_emitters)
+        m_lightMap.erase(kv.first);
+
+    std::vector<std::string> names = extract_keys(m_lightMap);
+    loadEmitters(names);
+}
+
+void LightPool::updatePrimitiveBounds()
+{
+    m_primitivesEmpty = true;
+    m_primitivesMin = optix::make_float3(0.0f);
+    m_primitivesMax = optix::make_float3(0.0f);
+
+    // corners of the object space bounds of every primitive, which bound its transformed vertices as well
+    for (auto &kv : PrimitivePool::getInstance(m_context).primitives()) {
+        const std::vector<VertexAttributes> *attributes =
+            GeometryPool::getInstance(m_context).attributes(kv.second.geometryName);
+        if (!attributes || attributes->empty())
+            continue;
+
+        optix::float3 localMin = (*attributes)[0].vertex, localMax = (*attributes)[0].vertex;
+        for (auto &attribute : *attributes) {
+            localMin = optix::fminf(localMin, attribute.vertex);
+            localMax = optix::fmaxf(localMax, attribute.vertex);
+        }
+        for (int corner = 0; corner < 8; corner++) {
+            const optix::float3 point = optix::make_float3((corner & 1) ? localMax.x : localMin.x,
+                                                           (corner & 2) ? localMax.y : localMin.y,
+                                                           (corner & 4) ? localMax.z : localMin.z);
+            const optix::float3 world = optix::make_float3(kv.second.transformMatrix * optix::make_float4(point, 1.0f));
+            m_primitivesMin = m_primitivesEmpty ? world : optix::fminf(m_primitivesMin, world);
+            m_primitivesMax = m_primitivesEmpty ? world : optix::fmaxf(m_primitivesMax, world);
+            m_primitivesEmpty = false;
+        }
+    }
+}
+
+// Point lights can be moved in the GUI, so the radius is updated with every light buffer.
+void LightPool::updateSceneRadius()
+{
+    bool empty = m_primitivesEmpty;
+    optix::float3 boundsMin = m_primitivesMin, boundsMax = m_primitivesMax;
+    for (auto &kv : m_lightMap) {
+        if (kv.second.type != LightType::POINT)
+            continue;
+        boundsMin = empty ? kv.second.position : optix::fminf(boundsMin, kv.second.position);
+        boundsMax = empty ? kv.second.position : optix::fmaxf(boundsMax, kv.second.position);
+        empty = false;
+    }
+
+    // an empty scene still needs nonzero power for its infinite lights
+    m_sceneRadius = empty ? 1.0f : fmaxf(0.5f * optix::length(boundsMax - boundsMin), 1e-3f);
+}
+
+void LightPool::updateEnvironmentDistribution(const TextureData *texture)
+{
+    try {
+        if (!texture) {
+            m_bufferEnvironmentConditional->setSize(0);
+            m_bufferEnvironmentMarginal->setSize(0);
+            m_context["sysEnvironmentDistributionSize"]->setInt(0, 0);
+            return;
+        }
+
+        m_bufferEnvironmentConditional->setSize(texture->conditionalCdf.size());
+        void *dst = m_bufferEnvironmentConditional->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(dst, texture->conditionalCdf.data(), sizeof(float) * texture->conditionalCdf.size());
+        m_bufferEnvironmentConditional->unmap();
+
+        m_bufferEnvironmentMarginal->setSize(texture->marginalCdf.size());
+        dst = m_bufferEnvironmentMarginal->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(dst, texture->marginalCdf.data(), sizeof(float) * texture->marginalCdf.size());
+        m_bufferEnvironmentMarginal->unmap();
+
+        m_context["sysEnvironmentDistributionSize"]->setInt(texture->distributionSize);
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Error while updating environment distribution: %s",
+                                               e.getErrorString().c_str()));
+    }
+}
+
 void LightPool::updateLightBuffer()
 {
-    std::vector<LightDefinition> lights = extract_values(m_lightMap);
+    updateSceneRadius();
+
+    // environment light always goes first, miss program relies on it
+    // then other infinite lights (alias table) followed by finite lights (light hierarchy)
+    std::vector<std::string> names;
+    names.push_back("Environment light");
+    for (auto &kv : m_lightMap)
+        if (kv.first != "Environment light" && isInfiniteLight(kv.second))
+            names.push_back(kv.first);
+    const int numInfiniteLights = int(names.size());
+    for (auto &kv : m_lightMap)
+        if (!isInfiniteLight(kv.second))
+            names.push_back(kv.first);
+
+    std::vector<LightDefinition> lights;
+    for (auto &name : names) {
+        lights.push_back(m_lightMap[name]);
+        lights.back().triangleOffset = 0;
+        lights.back().triangleCount = 0;
+    }
+
+    std::vector<float> powers;
+    for (int i = 0; i < numInfiniteLights; i++)
+        powers.push_back(estimatePower(lights[i], m_environmentAverage, m_sceneRadius));
+    std::vector<AliasEntry> aliasTable;
+    if (!buildAliasTable(powers, aliasTable))
+        LogWarning("All lights have zero power. Sampling them uniformly");
+
+    // triangles of all mesh lights share one buffer
+    std::vector<EmitterTriangle> emitterTriangles;
+    std::vector<AliasEntry> emitterAliasTable;
+    std::vector<LightBVHNode> leaves;
+    for (int i = numInfiniteLights; i < int(lights.size()); i++) {
+        if (lights[i].type != LightType::MESH) {
+            leaves.push_back(lightBVHLeaf(lights[i], i));
+            continue;
+        }
+
+        MeshEmitter &emitter = m_emitters[names[i]];
+        lights[i].triangleOffset = int(emitterTriangles.size());
+        lights[i].triangleCount = int(emitter.triangles.size());
+        emitterTriangles.insert(emitterTriangles.end(), emitter.triangles.begin(), emitter.triangles.end());
+        emitterAliasTable.insert(emitterAliasTable.end(), emitter.aliasTable.begin(), emitter.aliasTable.end());
+        if (emitter.instance)
+            emitter.instance["lightIndex"]->setInt(i);
+
+        LightBVHNode leaf = emitter.bounds;
+        leaf.power = estimatePower(lights[i], m_environmentAverage, m_sceneRadius);
+        leaf.left = i;
+        leaf.right = -1;
+        leaves.push_back(leaf);
+    }
+
+    std::vector<LightBVHNode> bvhNodes;
+    std::vector<unsigned int> trails;
+    buildLightBVH(leaves, bvhNodes, trails, int(lights.size()));
+    for (size_t i = 0; i < lights.size(); i++)
+        lights[i].bvhTrail = trails[i];
 
     try {
         m_bufferLights->setSize(lights.size()); // This can be zero.
@@ -76,7 +396,28 @@ void LightPool::updateLightBuffer()
         memcpy(dst, lights.data(), sizeof(LightDefinition) * lights.size());
         m_bufferLights->unmap();
 
+        m_bufferLightAlias->setSize(aliasTable.size());
+        dst = m_bufferLightAlias->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(dst, aliasTable.data(), sizeof(AliasEntry) * aliasTable.size());
+        m_bufferLightAlias->unmap();
+
+        m_bufferLightBVH->setSize(bvhNodes.size());
+        dst = m_bufferLightBVH->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(dst, bvhNodes.data(), sizeof(LightBVHNode) * bvhNodes.size());
+        m_bufferLightBVH->unmap();
+
+        m_bufferEmitterTriangles->setSize(emitterTriangles.size());
+        dst = m_bufferEmitterTriangles->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(dst, emitterTriangles.data(), sizeof(EmitterTriangle) * emitterTriangles.size());
+        m_bufferEmitterTriangles->unmap();
+
+        m_bufferEmitterAlias->setSize(emitterAliasTable.size());
+        dst = m_bufferEmitterAlias->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        memcpy(dst, emitterAliasTable.data(), sizeof(AliasEntry) * emitterAliasTable.size());
+        m_bufferEmitterAlias->unmap();
+
         m_context["sysNumLights"]->setInt(int(lights.size()));
+        m_context["sysNumInfiniteLights"]->setInt(numInfiniteLights);
     }
     catch (optix::Exception &e) {
         throw std::runtime_error(string_format("Error while updating light buffer: %s",
@@ -96,13 +437,26 @@ void LightPool::updateParameters()
         for (auto &name : lightNames)
             names.push_back(name.c_str());
 
+        // emitters come and go with the emission of their materials
+        selectedLight = std::min(selectedLight, int(names.size()) - 1);
+
         ImGui::PushItemWidth(ImGui::GetWindowWidth() - 10);
         ImGui::ListBox("", &selectedLight, &names[0], names.size());
         ImGui::PopItemWidth();
 
         LightDefinition &light = m_lightMap[lightNames[selectedLight]];
 
-        if (ImGui::ColorEdit3("Emission", (float *) &light.emission)) {
+        if (light.type == LightType::MESH) {
+            // the emission belongs to the material, the light follows it once the material is updated
+            const MeshEmitter &emitter = m_emitters[lightNames[selectedLight]];
+            optix::float3 emission = light.emission;
+            if (ImGui::ColorEdit3("Emission", (float *) &emission,
+                                  ImGuiColorEditFlags_HDR | ImGuiColorEditFlags_Float))
+                MaterialPool::getInstance(m_context).setEmission(emitter.materialName, emission);
+            ImGui::Text("Material '%s', %d triangles, area %g", emitter.materialName.c_str(),
+                        int(emitter.triangles.size()), light.area);
+        }
+        else if (ImGui::ColorEdit3("Emission", (float *) &light.emission)) {
             m_lightsChanged = true;
         }
         if (light.type == LightType::ENVIRONMENT) {
@@ -118,13 +472,20 @@ void LightPool::updateParameters()
             }
         }
         else if (light.type == LightType::POINT) {
-
+            if (ImGui::DragFloat3("Position", (float *) &light.position, 0.01f)) {
+                m_lightsChanged = true;
+            }
         }
 
     }
 }
 bool LightPool::update()
 {
+    if (MaterialPool::getInstance(m_context).emissionVersion() != m_emissionVersion) {
+        reloadEmitters();
+        m_lightsChanged = true;
+    }
+
     if (m_lightsChanged) {
         updateLightBuffer();
         m_lightsChanged = false;
@@ -146,11 +507,37 @@ void LightPool::setContext(optix::Context context)
             // create light buffer
             m_bufferLights = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
             m_bufferLights->setElementSize(sizeof(LightDefinition));
+
+            // create alias table for light selection proportional to power
+            m_bufferLightAlias = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+            m_bufferLightAlias->setElementSize(sizeof(AliasEntry));
+
+            // create light hierarchy for finite lights
+            m_bufferLightBVH = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+            m_bufferLightBVH->setElementSize(sizeof(LightBVHNode));
+
+            // create triangles of mesh lights
+            m_bufferEmitterTriangles = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+            m_bufferEmitterTriangles->setElementSize(sizeof(EmitterTriangle));
+            m_bufferEmitterAlias = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+            m_bufferEmitterAlias->setElementSize(sizeof(AliasEntry));
+
             updateLightBuffer();
+            m_context["sysEmitterTriangles"]->setBuffer(m_bufferEmitterTriangles);
+            m_context["sysEmitterAliasTable"]->setBuffer(m_bufferEmitterAlias);
             m_context["sysLightDefinitions"]->setBuffer(m_bufferLights);
+            m_context["sysLightAliasTable"]->setBuffer(m_bufferLightAlias);
+            m_context["sysLightBVH"]->setBuffer(m_bufferLightBVH);
+
+            // create importance sampling distribution of the environment (empty means uniform sampling)
+            m_bufferEnvironmentConditional = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, 0);
+            m_bufferEnvironmentMarginal = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT, 0);
+            m_context["sysEnvironmentConditional"]->setBuffer(m_bufferEnvironmentConditional);
+            m_context["sysEnvironmentMarginal"]->setBuffer(m_bufferEnvironmentMarginal);
+            updateEnvironmentDistribution(nullptr);
 
             // create sampling program for each
-            m_bufferSampleLight = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_PROGRAM_ID, 3);
+            m_bufferSampleLight = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_PROGRAM_ID, 4);
             int *sampleLight = (int *) m_bufferSampleLight->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
 
             m_programMap["light_env"] = m_context->createProgramFromPTXFile(
@@ -161,6 +548,14 @@ void LightPool::setContext(optix::Context context)
                 shaderFolder + "light_sampling.ptx", "sample_directional_light");
             sampleLight[LightType::DIRECTIONAL] = m_programMap["light_dir"]->getId();
 
+            m_programMap["light_point"] = m_context->createProgramFromPTXFile(
+                shaderFolder + "light_sampling.ptx", "sample_point_light");
+            sampleLight[LightType::POINT] = m_programMap["light_point"]->getId();
+
+            m_programMap["light_mesh"] = m_context->createProgramFromPTXFile(
+                shaderFolder + "light_sampling.ptx", "sample_mesh_light");
+            sampleLight[LightType::MESH] = m_programMap["light_mesh"]->getId();
+
             m_bufferSampleLight->unmap();
             m_context["sysSampleLight"]->setBuffer(m_bufferSampleLight);
 
@@ -191,6 +586,7 @@ void LightPool::clearEnvironmentLight()
     env_light.emission = optix::make_float3(1.0f);
     env_light.direction = optix::make_float3(0.0f, 0.0f, 0.0f);
     env_light.environmentTextureID = RT_TEXTURE_ID_NULL;
+    env_light.bvhTrail = 0;
     m_lightMap["Environment light"] = env_light;
 }
 
@@ -4,6 +4,8 @@
 
 #include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <optixu/optixpp_namespace.h>
 #include <optixu/optixu_math_namespace.h>
@@ -11,8 +13,21 @@
 #include <pugixml.hpp>
 
 #include "lightdata.h"
+#include "../math/distribution.h"
+#include "../math/lightbvh.h"
 
 class TexturePool;
+struct TextureData;
+
+// Triangles of an emissive primitive in world space with the data to sample them.
+struct MeshEmitter
+{
+    std::vector<EmitterTriangle> triangles; // same order as the primitives of the geometry
+    std::vector<AliasEntry> aliasTable;     // triangle selection proportional to area
+    LightBVHNode bounds;                    // light hierarchy leaf, power is filled in later
+    optix::GeometryInstance instance;
+    std::string materialName;               // source of the emission
+};
 
 
 class LightPool
@@ -27,10 +42,17 @@ public:
     static LightPool& getInstance(optix::Context context);
 
 private:
-    LightPool() : m_context(nullptr), m_lightsChanged(true) {}
+    LightPool() : m_context(nullptr), m_lightsChanged(true), m_environmentAverage(optix::make_float3(1.0f)),
+        m_primitivesEmpty(true), m_primitivesMin(optix::make_float3(0.0f)), m_primitivesMax(optix::make_float3(0.0f)),
+        m_sceneRadius(1.0f), m_emissionVersion(0) {}
     void setContext(optix::Context context);
 
+    void loadEmitters(std::vector<std::string> &names);
+    void reloadEmitters();
     void updateLightBuffer();
+    void updatePrimitiveBounds();
+    void updateSceneRadius();
+    void updateEnvironmentDistribution(const TextureData *texture);
     void clearEnvironmentLight();
 
     optix::Context m_context;
@@ -38,11 +60,29 @@ private:
     std::map<std::string, optix::Program> m_programMap;
     optix::Buffer m_bufferLights;
     optix::Buffer m_bufferSampleLight;
+    optix::Buffer m_bufferLightAlias;
+    optix::Buffer m_bufferLightBVH;
+    optix::Buffer m_bufferEnvironmentConditional;
+    optix::Buffer m_bufferEnvironmentMarginal;
+    optix::Buffer m_bufferEmitterTriangles;
+    optix::Buffer m_bufferEmitterAlias;
 
     std::map<std::string, LightDefinition> m_lightMap;
+    std::map<std::string, MeshEmitter> m_emitters;
 
     std::shared_ptr<TexturePool> m_environmentTexture;
     bool m_lightsChanged;
+
+    // average color of the environment texture, used for the light power estimate
+    optix::float3 m_environmentAverage;
+    // world space bounds of the primitives, gathered at load
+    bool m_primitivesEmpty;
+    optix::float3 m_primitivesMin;
+    optix::float3 m_primitivesMax;
+    // radius of the sphere bounding primitives and point lights, infinite lights shine through its disc
+    float m_sceneRadius;
+    // emission of the materials the emitters were built from
+    unsigned int m_emissionVersion;
 };
 
 
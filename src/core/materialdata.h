@@ -4,6 +4,8 @@
 
 #include <optixu/optixu_math_namespace.h>
 
+#include "textureatlas.h"
+
 enum MaterialType
 {
     DIFFUSE = 0,
@@ -27,6 +29,8 @@ struct MaterialParameter
     unsigned int flags = 0;
 
     float unused0;
+
+    optix::float4 atlasTransform = optix::make_float4(1.0f, 1.0f, 0.0f, 0.0f); // Into the atlas page of textureID, see atlasUV.
 };
 
 #endif //RENDERER_GPU_MATERIALDATA_H
@@ -37,12 +37,29 @@ optix::Material MaterialPool::getMaterial(const pugi::xml_node &node, int &mater
         LogWarning("Material '%s' was not found. Setting default (black diffuse)", material_name.c_str());
         material_pos = std::find(names.begin(), names.end(), "Default material");
         materialIndex = (int) (material_pos - names.begin());
-        material_name = "Default material";
+        materialName = "Default material";
     }
 
     return m_material;
 }
 
+optix::float3 MaterialPool::emission(const std::string &materialName) const
+{
+    auto material = m_emissionMap.find(materialName);
+    if (material == m_emissionMap.end())
+        return optix::make_float3(0.0f);
+    return material->second;
+}
+
+void MaterialPool::setEmission(const std::string &materialName, const optix::float3 &emission)
+{
+    auto material = m_emissionMap.find(materialName);
+    if (material == m_emissionMap.end())
+        return;
+    material->second = emission;
+    m_emissionVersion++;
+}
+
 void MaterialPool::updateMaterialBuffer()
 {
     std::vector<MaterialParameter> materials = extract_values(m_materialMap);
@@ -69,6 +86,7 @@ int MaterialPool::loadMaterial(const pugi::xml_node &node, std::vector<std::stri
     names.push_back(name);
 
     MaterialParameter matData;
+    m_emissionMap[name] = readSpectrum(node.child("emission").child("values"));
     std::string material_type = node.attribute("type").value();
     if (m_materialIndices.count(material_type)) {
         matData.indexBSDF = m_materialIndices[material_type];
@@ -86,7 +104,7 @@ int MaterialPool::loadMaterial(const pugi::xml_node &node, std::vector<std::stri
             auto albedo_node = node.child("albedo");
             matData.albedo = readSpectrum(albedo_node.child("values"), optix::make_float3(1.0f));
             matData.textureID = TexturePool::getInstance(m_context).id(
-                albedo_node.child("texture"), matData.textureScale);
+                albedo_node.child("texture"), matData.textureScale, &matData.atlasTransform);
 
             matData.roughness = readFloat(node.child("roughness"), 0.0f);
             matData.anisotropy = readFloat(node.child("anisotropy"), 0.0f);
@@ -117,8 +135,10 @@ void MaterialPool::load(const pugi::xml_node &node)
 
     // delete all lights from previous loadings that are missing now
     std::vector<std::string> matToDelete = difference(old_names, names);
-    for (auto &mat : matToDelete)
+    for (auto &mat : matToDelete) {
         m_materialMap.erase(mat);
+        m_emissionMap.erase(mat);
+    }
 
     updateMaterialBuffer();
 }
@@ -131,6 +151,10 @@ void MaterialPool::updateParameters(const std::string &materialName)
     if (ImGui::ColorEdit3("albedo", (float *) &material.albedo))
         m_changed = true;
 
+    if (ImGui::ColorEdit3("emission", (float *) &m_emissionMap[materialName],
+                          ImGuiColorEditFlags_HDR | ImGuiColorEditFlags_Float))
+        m_emissionVersion++;
+
     if (ImGui::DragFloat("roughness", (float *) &material.roughness, 0.05f, 0.0f, 1.0f))
         m_changed = true;
 
@@ -20,6 +20,10 @@ public:
     ~MaterialPool();
 
     optix::Material getMaterial(const pugi::xml_node &node, int &materialIndex, std::string &materialName);
+    optix::float3 emission(const std::string &materialName) const;
+    void setEmission(const std::string &materialName, const optix::float3 &emission);
+    // Incremented whenever the emission of a material changes, emissive meshes are rebuilt then.
+    unsigned int emissionVersion() const { return m_emissionVersion; }
 
     void load(const pugi::xml_node &node);
 
@@ -29,7 +33,7 @@ public:
     static MaterialPool& getInstance(optix::Context context);
 
 private:
-    MaterialPool() : m_context(nullptr), m_changed(true) {}
+    MaterialPool() : m_context(nullptr), m_changed(true), m_emissionVersion(0) {}
     void setContext(optix::Context context);
 
     int loadMaterial(const pugi::xml_node &node, std::vector<std::string> &names,
@@ -47,10 +51,13 @@ private:
 
     std::map<std::string, unsigned int> m_materialIndices;
     std::map<std::string, MaterialParameter> m_materialMap;
+    // Radiance emitted from the front face, makes primitives area lights. Only the light pool reads it.
+    std::map<std::string, optix::float3> m_emissionMap;
 
     std::vector<const char *> m_materialNames;
 
     bool m_changed;
+    unsigned int m_emissionVersion;
 };
 
 
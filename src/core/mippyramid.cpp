@@ -0,0 +1,207 @@
+
+#include "mippyramid.h"
+
+#include "../utils/threadpool.h"
+
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+MipFilter parseMipFilter(const std::string &name)
+{
+    if (name == "kaiser")
+        return MIP_FILTER_KAISER;
+    return MIP_FILTER_BOX;
+}
+
+const char *mipFilterName(MipFilter filter)
+{
+    return (filter == MIP_FILTER_KAISER) ? "kaiser" : "box";
+}
+
+int fullMipCount(int width, int height)
+{
+    int count = 1;
+    for (int size = std::max(width, height); 1 < size; size /= 2)
+        count++;
+    return count;
+}
+
+size_t mipChainPixels(int width, int height, int mipCount)
+{
+    size_t pixels = 0;
+    for (int level = 0; level < mipCount; level++)
+        pixels += size_t(mipLevelSize(width, level)) * mipLevelSize(height, level);
+    return pixels;
+}
+
+// Source pixels and weights of all pixels along one axis of the result.
+// Source indices are unwrapped in first and wrapped into [0, size) in indices.
+struct FilterTaps
+{
+    int stride;
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<int> indices;
+    std::vector<float> weights;
+};
+
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50 && sum * 1e-12 < term; k++) {
+        const double factor = x / (2.0 * k);
+        term *= factor * factor;
+        sum += term;
+    }
+    return sum;
+}
+
+// Kernel in units of result pixels.
+static double kaiser(double x)
+{
+    const double radius = 3.0;
+    const double alpha = 4.0;
+    if (radius <= fabs(x))
+        return 0.0;
+    const double sinc = (fabs(x) < 1e-6) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    const double t = x / radius;
+    return sinc * besselI0(alpha * sqrt(1.0 - t * t)) / besselI0(alpha);
+}
+
+static FilterTaps filterTaps(int srcSize, int dstSize, MipFilter filter)
+{
+    const double scale = double(srcSize) / double(dstSize);
+    const int maxCount = (filter == MIP_FILTER_KAISER) ? int(ceil(6.0 * scale)) + 2 : int(ceil(scale)) + 1;
+
+    FilterTaps taps;
+    taps.stride = maxCount;
+    taps.first.resize(dstSize);
+    taps.count.resize(dstSize);
+    taps.indices.assign(size_t(dstSize) * maxCount, 0);
+    taps.weights.assign(size_t(dstSize) * maxCount, 0.0f);
+
+    std::vector<double> weights;
+    for (int i = 0; i < dstSize; i++) {
+        int first, last;
+        weights.clear();
+        if (filter == MIP_FILTER_KAISER) {
+            const double center = (i + 0.5) * scale;
+            first = int(ceil(center - 3.0 * scale - 0.5));
+            last = int(floor(center + 3.0 * scale - 0.5));
+            for (int j = first; j <= last; j++)
+                weights.push_back(kaiser((j + 0.5 - center) / scale));
+        }
+        else {
+            // coverage of source pixels by the footprint [begin, end), written so that end is exact for the last pixel
+            const double begin = double(i) * srcSize / dstSize;
+            const double end = double(i + 1) * srcSize / dstSize;
+            first = int(floor(begin));
+            last = std::min(srcSize, int(ceil(end))) - 1;
+            for (int j = first; j <= last; j++)
+                weights.push_back(std::min(j + 1.0, end) - std::max(double(j), begin));
+        }
+
+        double sum = 0.0;
+        for (auto weight : weights)
+            sum += weight;
+        taps.first[i] = first;
+        taps.count[i] = last - first + 1;
+        for (int k = 0; k < taps.count[i]; k++) {
+            taps.indices[size_t(i) * maxCount + k] = ((first + k) % srcSize + srcSize) % srcSize;
+            taps.weights[size_t(i) * maxCount + k] = float(weights[k] / sum);
+        }
+    }
+    return taps;
+}
+
+// Horizontal pass, pixels are four floats so that one pixel is one SSE register.
+static void filterRow(const float *src, float *dst, const FilterTaps &taps, int dstWidth)
+{
+    for (int x = 0; x < dstWidth; x++) {
+        const int *index = taps.indices.data() + size_t(x) * taps.stride;
+        const float *weight = taps.weights.data() + size_t(x) * taps.stride;
+#ifdef __SSE2__
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < taps.count[x]; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + index[k] * 4), _mm_set1_ps(weight[k])));
+        _mm_storeu_ps(dst + x * 4, sum);
+#else
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int k = 0; k < taps.count[x]; k++)
+            for (int c = 0; c < 4; c++)
+                sum[c] += src[index[k] * 4 + c] * weight[k];
+        for (int c = 0; c < 4; c++)
+            dst[x * 4 + c] = sum[c];
+#endif
+    }
+}
+
+// Vertical pass, adds a weighted row to the result row.
+static void accumulateRow(const float *src, float weight, float *dst, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 weight4 = _mm_set1_ps(weight);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), weight4)));
+#endif
+    for (; i < count; i++)
+        dst[i] += src[i] * weight;
+}
+
+void buildMipLevel(const unsigned char *src, int width, int height, unsigned char *dst,
+    const MipLevelFormat &format, MipFilter filter)
+{
+    const int dstWidth = mipLevelSize(width, 1);
+    const int dstHeight = mipLevelSize(height, 1);
+    const FilterTaps tapsX = filterTaps(width, dstWidth, filter);
+    const FilterTaps tapsY = filterTaps(height, dstHeight, filter);
+    const size_t rowFloats = size_t(dstWidth) * 4;
+
+    const int rowsPerTask = 32;
+    const int tasks = (dstHeight + rowsPerTask - 1) / rowsPerTask;
+    parallelFor(tasks, [&](int task) {
+        const int begin = task * rowsPerTask;
+        const int end = std::min(dstHeight, begin + rowsPerTask);
+
+        // source rows needed by this chunk are filtered horizontally once
+        const int low = tapsY.first[begin];
+        int high = low;
+        for (int y = begin; y < end; y++)
+            high = std::max(high, tapsY.first[y] + tapsY.count[y] - 1);
+
+        std::vector<float> decoded(size_t(width) * 4);
+        std::vector<float> filtered(size_t(high - low + 1) * rowFloats);
+        for (int row = low; row <= high; row++) {
+            const int srcRow = (row % height + height) % height;
+            format.decode(src + size_t(srcRow) * width * format.pixelSize, width, decoded.data());
+            filterRow(decoded.data(), filtered.data() + size_t(row - low) * rowFloats, tapsX, dstWidth);
+        }
+
+        std::vector<float> result(rowFloats);
+        for (int y = begin; y < end; y++) {
+            std::fill(result.begin(), result.end(), 0.0f);
+            for (int k = 0; k < tapsY.count[y]; k++)
+                accumulateRow(filtered.data() + size_t(tapsY.first[y] + k - low) * rowFloats,
+                              tapsY.weights[size_t(y) * tapsY.stride + k], result.data(), int(rowFloats));
+            format.encode(result.data(), dstWidth, dst + size_t(y) * dstWidth * format.pixelSize);
+        }
+    });
+}
+
+void buildMipPyramid(unsigned char *pixels, int width, int height, int mipCount,
+    const MipLevelFormat &format, MipFilter filter)
+{
+    unsigned char *level = pixels;
+    for (int i = 1; i < mipCount; i++) {
+        const int levelWidth = mipLevelSize(width, i - 1);
+        const int levelHeight = mipLevelSize(height, i - 1);
+        unsigned char *next = level + size_t(levelWidth) * levelHeight * format.pixelSize;
+        buildMipLevel(level, levelWidth, levelHeight, next, format, filter);
+        level = next;
+    }
+}
@@ -0,0 +1,51 @@
+
+#ifndef RENDERER_GPU_MIPPYRAMID_H
+#define RENDERER_GPU_MIPPYRAMID_H
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+enum MipFilter
+{
+    MIP_FILTER_BOX = 0,   // area average, exact for odd sizes too
+    MIP_FILTER_KAISER = 1 // Kaiser windowed sinc, sharper, wraps around the edges like the sampler does
+};
+
+MipFilter parseMipFilter(const std::string &name);
+const char *mipFilterName(MipFilter filter);
+
+// Converts count pixels of a row between their storage format and linear RGBA floats.
+typedef void (*MipRowDecoder)(const unsigned char *src, int count, float *dst);
+typedef void (*MipRowEncoder)(const float *src, int count, unsigned char *dst);
+
+struct MipLevelFormat
+{
+    int pixelSize;
+    MipRowDecoder decode;
+    MipRowEncoder encode;
+};
+
+// Levels are stored one after another, level i has max(1, size >> i) pixels along each axis.
+inline int mipLevelSize(int size, int level)
+{
+    return std::max(1, size >> level);
+}
+
+// Number of levels down to 1x1.
+int fullMipCount(int width, int height);
+
+// Pixels of all levels of a chain.
+size_t mipChainPixels(int width, int height, int mipCount);
+
+// Filters a level of width x height pixels to the next one, dst receives
+// mipLevelSize(width, 1) x mipLevelSize(height, 1) pixels. Filtering happens in linear space
+// and rows of the result are split into chunks filtered in parallel.
+void buildMipLevel(const unsigned char *src, int width, int height, unsigned char *dst,
+    const MipLevelFormat &format, MipFilter filter);
+
+// Fills levels 1 to mipCount - 1 of a chain whose finest level is set already.
+void buildMipPyramid(unsigned char *pixels, int width, int height, int mipCount,
+    const MipLevelFormat &format, MipFilter filter);
+
+#endif //RENDERER_GPU_MIPPYRAMID_H
@@ -18,6 +18,8 @@
 
 
 #include "optix_renderer.h"
+#include "globalsettings.h"
+#include "tonemapper.h"
 
 
 OpenGLRenderer::OpenGLRenderer(GLFWwindow *window,
@@ -195,18 +197,35 @@ void OpenGLRenderer::display()
     if (!m_renderer->renderingRunning()) {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, m_hdrTexture);
+        // tone mapped on the host, uploading RGBA8 takes a quarter of the bandwidth of the film
+        // the film is smaller than the window while the camera moves and gets stretched over it
+        const GlobalSettings &settings = GlobalSettings::getInstance();
         optix::Buffer renderBuffer = m_renderer->getFilmBuffer();
-        const void *data = renderBuffer->map(0, RT_BUFFER_MAP_READ);
+        RTsize width, height;
+        renderBuffer->getSize(width, height);
+        m_displayPixels.resize(size_t(width) * height * 4);
+        if (settings.denoise.display) {
+            m_renderer->readFilm(m_film);
+            m_denoiser.denoise(m_film, settings.denoise);
+            toneMap(m_film.beauty.data(), int(width), int(height), settings.toneMap, m_displayPixels.data());
+        }
+        else {
+            const void *data = renderBuffer->map(0, RT_BUFFER_MAP_READ);
+            toneMap((const float *) data, int(width), int(height), settings.toneMap, m_displayPixels.data());
+            renderBuffer->unmap();
+        }
+        const bool upscaled = int(width) < m_width || int(height) < m_height;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, upscaled ? GL_LINEAR : GL_NEAREST);
         glTexImage2D(GL_TEXTURE_2D,
                      0,
-                     GL_RGBA32F,
-                     (GLsizei) m_width,
-                     (GLsizei) m_height,
+                     GL_RGBA8,
+                     (GLsizei) width,
+                     (GLsizei) height,
                      0,
                      GL_RGBA,
-                     GL_FLOAT,
-                     data); // RGBA32F
-        renderBuffer->unmap();
+                     GL_UNSIGNED_BYTE,
+                     m_displayPixels.data()); // RGBA8, already sRGB
+        m_renderer->framePresented();
     }
 
     glBindTexture(GL_TEXTURE_2D, m_hdrTexture);
@@ -3,6 +3,7 @@
 #define RENDERER_GPU_RENDERER_H
 
 #include <memory>
+#include <vector>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -10,6 +11,8 @@
 #include <optix.h>
 #include <optixu/optixpp_namespace.h>
 
+#include "denoiser.h"
+
 
 class OptixRenderer;
 
@@ -39,6 +42,9 @@ private:
     bool m_isGuiVisible;
 
     GLuint m_hdrTexture;
+    std::vector<unsigned char> m_displayPixels; // Tone mapped film.
+    FilmLayers m_film;                          // Read back with its guides when the display is denoised.
+    Denoiser m_denoiser;
     GLuint m_glslProgram;
     GLuint m_glslVS, m_glslFS;
 
@@ -101,9 +101,20 @@ optix::Buffer OptixRenderer::getFilmBuffer()
     return Scene::getInstance().getFilmBuffer();
 }
 
-void OptixRenderer::renderToFile(const std::string &filename)
+void OptixRenderer::readFilm(FilmLayers &image)
 {
-    Scene::getInstance().renderToFile(filename);
+    Scene::getInstance().readFilm(image);
+}
+
+void OptixRenderer::framePresented()
+{
+    Scene::getInstance().framePresented();
+}
+
+void OptixRenderer::renderToFile(const std::string &filename, const ImageWriter::Callback &written,
+                                 const RenderTarget &target)
+{
+    Scene::getInstance().renderToFile(filename, written, target);
 }
 
 void OptixRenderer::update()
@@ -7,6 +7,9 @@
 
 #include <optixu/optixpp_namespace.h>
 
+#include "globalsettings.h"
+#include "imagewriter.h"
+
 class OptixRenderer
 {
 public:
@@ -20,10 +23,13 @@ public:
     void resize(int w, int h);
 
     void render();
-    void renderToFile(const std::string &filename);
+    void renderToFile(const std::string &filename, const ImageWriter::Callback &written = nullptr,
+                      const RenderTarget &target = RenderTarget());
     bool renderingRunning();
 
     optix::Buffer getFilmBuffer();
+    void readFilm(FilmLayers &image);
+    void framePresented();
 
 private:
     std::vector<std::string> m_stats;
@@ -39,6 +39,15 @@ struct PerRayData
     optix::float3 extinction;     // The current volume's extinction coefficient. (Only absorption in this implementation.)
 
     unsigned int  seed;           // Random number generator input.
+
+    float         coneWidth;      // Ray cone for texture level of detail, width at the current position in world space.
+    float         coneSpread;     // Spread angle of the ray cone in radians.
+
+    optix::float3 aovAlbedo;      // First hit of the camera path, only written when FLAG_AOV is set.
+    int           aovPrimitiveID;
+    optix::float3 aovNormal;
+    int           aovMaterialID;
+    float         aovDepth;
 };
 
 struct PerRayData_shadow
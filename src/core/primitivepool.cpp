@@ -63,8 +63,11 @@ bool PrimitivePool::loadPrimitive(const pugi::xml_node &node, const std::string
         }
 
         // create GeometryGroup, acceleration and transform
-        if (!data.instance)
+        if (!data.instance) {
             data.instance = m_context->createGeometryInstance();
+            data.instance["lightIndex"]->setInt(-1); // set by LightPool for emissive primitives
+            data.instance["primitiveID"]->setInt(m_nextPrimitiveID++); // written to the id AOV
+        }
 
         if (!data.acceleration)
             data.acceleration = m_context->createAcceleration("Trbvh");
@@ -58,10 +58,12 @@ public:
     void updateParameters();
     bool update();
 
+    const std::map<std::string, PrimitiveData> &primitives() const { return m_primitives; }
+
     static PrimitivePool& getInstance(optix::Context context);
 
 private:
-    PrimitivePool() : m_context(nullptr) {}
+    PrimitivePool() : m_context(nullptr), m_nextPrimitiveID(0) {}
     void setContext(optix::Context context);
 
 
@@ -74,6 +76,7 @@ private:
     std::map<std::string, optix::Program> m_programMap;
 
     std::map<std::string, PrimitiveData> m_primitives;
+    int m_nextPrimitiveID; // IDs aren't reused, so a removed primitive can't be confused with a new one
 //
 //    GeometryPool m_geometryPool;
 //    MaterialPool m_materialPool;
@@ -4,19 +4,35 @@
 
 #include "camera.h"
 #include "primitivepool.h"
+#include "globalsettings.h"
+#include "sharedframes.h"
 #include "../utils/log.h"
-#include "image.h"
 
+#include <algorithm>
 #include <chrono>
 
 REGISTER_DYNAMIC_STATISTIC(float, renderingTime, 0.0f, "Rendering time");
 REGISTER_PERMANENT_STATISTIC(float, totalRenderingTime, 0.0f, "Total rendering time");
 REGISTER_DYNAMIC_STATISTIC(int, tileNumber, 0, "Number of tiles");
 REGISTER_PERMANENT_STATISTIC(int, sampleNumber, 0, "Sample number");
+REGISTER_PERMANENT_STATISTIC(int, bucketNumber, 0, "Rendered buckets");
+REGISTER_PERMANENT_STATISTIC(int, passTileSize, 0, "Tile size");
+REGISTER_PERMANENT_STATISTIC(float, launchCost, 0.0f, "Launch cost per pixel (ns)");
+REGISTER_PERMANENT_STATISTIC(int, pixelsSaved, 0, "Pixels saved per iteration");
+REGISTER_PERMANENT_STATISTIC(float, noiseLevel, 0.0f, "Noise (largest block error)");
+REGISTER_PERMANENT_STATISTIC(float, motionLatency, 0.0f, "Input to photon latency in motion (ms)");
+REGISTER_PERMANENT_STATISTIC(float, fullLatency, 0.0f, "Input to photon latency at full quality (ms)");
+
+// renderToFile reports its progress at most this often, in seconds.
+static const float PROGRESS_INTERVAL = 0.5f;
+
+// Blocks are evaluated every few samples only, reading the film back isn't free.
+#define ADAPTIVE_UPDATE_INTERVAL 4
 
 Scene::Scene()
-    : m_running(false), currentTileOffset(optix::make_uint2(0, 0)), m_tileSize(128), m_nextTileSize(m_tileSize),
-    m_iterationIndex(0), m_sceneChanged(false), m_maxDepth(6)
+    : m_running(false), m_nextTile(0), m_tileSize(128), m_nextTileSize(m_tileSize), m_adaptiveTiles(true),
+    m_samplesPerLaunch(1), m_passSamples(1), m_motion(false), m_iterationIndex(0), m_sceneChanged(false),
+    m_maxDepth(6)
 {
     try {
 
@@ -60,6 +76,7 @@ Scene::Scene()
 
         m_context["sysSceneEpsilon"]->setFloat(500 * 1e-7f);
         m_context["sysPathLengths"]->setInt(3, m_maxDepth);
+        m_context["sysSamplesPerLaunch"]->setInt(1);
 
         reset();
 
@@ -85,84 +102,205 @@ void Scene::render()
     m_running = true;
 
     int nTiles = 0;
-    float time = 0.0f;
+    float time = 0.0f; // microseconds
     try {
-        optix::int2 resolution = Camera::getInstance(m_context).resolution();
+        const optix::int2 resolution = Camera::getInstance(m_context).resolution();
 
-        bool increase_Y = false;
-        auto startTime = std::chrono::high_resolution_clock::now();
-
-        bool stopRendering = false;
         /*
             if OptiX rendering is running for too long GUI starts lagging,
                 because OptiX and OpenGL both use graphics card to render
-            to prevent this we set maximum rendering time (<16ms)
-            this is done by rendering only small tiles, which can be rendered in real time
-            tile size if determined at compile time
+            to prevent this a frame only renders tiles until maxRenderingTime (<16ms) is used up
+            the controller sizes tiles from measured launch costs, so that a few of them fill a frame
+            and stops before a launch that is predicted to overshoot
          */
-        while (time < maxRenderingTime && !stopRendering) {
-            int valueX = resolution.x - currentTileOffset.x;
-            int valueY = resolution.y - currentTileOffset.y;
-            int tileSizeX = m_tileSize, tileSizeY = m_tileSize;
-            if (valueX <= m_tileSize) {
-                tileSizeX = valueX;
-                increase_Y = true;
-            }
-            if (valueY <= m_tileSize) {
-                tileSizeY = valueY;
-            }
-            if (valueX <= m_tileSize && valueY <= m_tileSize){
-                // rendering finished
-                m_running = false;
-                stopRendering = true;
-                //time = maxRenderingTime;
-            }
+        m_tileController.setBudget(maxRenderingTime * 1000.0f);
+        if (m_nextTile == 0)
+            startPass(resolution);
 
-            m_context["tileOffset"]->setUint(currentTileOffset);
+        auto startTime = std::chrono::high_resolution_clock::now();
+        while (m_nextTile < m_tiles.size()) {
+            const optix::int2 origin = m_tiles[m_nextTile];
+            const int tileSizeX = std::min(m_tileSize, resolution.x - origin.x);
+            const int tileSizeY = std::min(m_tileSize, resolution.y - origin.y);
+            // the first launch always runs, so that every frame makes progress
+            const int work = tileSizeX * tileSizeY * m_passSamples;
+            if (0 < nTiles && !m_tileController.fits(work, time))
+                break;
+
+            m_context["tileOffset"]->setUint(unsigned(origin.x), unsigned(origin.y));
             m_context->launch(0, tileSizeX, tileSizeY);
 
-            if (increase_Y) {
-                currentTileOffset.x = 0;
-                currentTileOffset.y += m_tileSize;
-                increase_Y = false;
-            }
-            else
-                currentTileOffset.x += m_tileSize;
-
             auto endTime = std::chrono::high_resolution_clock::now();
-            time += std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
+            const float launchTime = std::chrono::duration<float, std::micro>(endTime - startTime).count();
             startTime = endTime;
+            m_tileController.record(work, launchTime);
+            time += launchTime;
 
+            m_nextTile++;
             nTiles++;
         }
+        // rendering finished when all tiles of the pass are done
+        m_running = m_nextTile < m_tiles.size();
     }
     catch (optix::Exception &e) {
         throw std::runtime_error(e.getErrorString());
     }
 
-    renderingTime += time;
-    totalRenderingTime += time / 1000.f;
+    renderingTime += time / 1000.0f;
+    totalRenderingTime += time / 1000000.0f;
     tileNumber+= nTiles;
+    launchCost = m_tileController.model().costPerPixel() * 1000.0f;
 
     if (!m_running) {
-        currentTileOffset = optix::make_uint2(0, 0);
+        m_nextTile = 0;
+        m_inputLatency.passFinished();
 
         sampleNumber = m_iterationIndex;
-        m_iterationIndex++;
+        publishFrame();
+        updateAdaptiveSampling();
+        m_iterationIndex += m_passSamples;
         m_context["sysIterationIndex"]->setInt(m_iterationIndex);
     }
 
 }
+
+void Scene::startPass(optix::int2 resolution)
+{
+    m_tileSize = m_adaptiveTiles ? m_tileController.tileSize(resolution.x, resolution.y) : m_nextTileSize;
+    m_tiles = orderTiles(resolution.x, resolution.y, m_tileSize, GlobalSettings::getInstance().tileOrder);
+    m_nextTile = 0;
+    passTileSize = m_tileSize;
+    m_passSamples = m_samplesPerLaunch;
+    m_context["sysSamplesPerLaunch"]->setInt(m_passSamples);
+    // the pass shows all camera input up to now
+    m_inputLatency.passStarted();
+
+    Camera &camera = Camera::getInstance(m_context);
+    pixelsSaved = 0;
+    if (!camera.adaptiveSampling())
+        return;
+    if (m_adaptiveSampler.width() != resolution.x || m_adaptiveSampler.height() != resolution.y) {
+        m_adaptiveSampler.resize(resolution.x, resolution.y);
+        m_activeBlocksChanged = true;
+    }
+    if (m_activeBlocksChanged) {
+        camera.setActiveBlocks(m_adaptiveSampler);
+        m_activeBlocksChanged = false;
+    }
+    // tiles of retired blocks only aren't launched, the others skip retired pixels on the device
+    const int tileSize = m_tileSize;
+    m_tiles.erase(std::remove_if(m_tiles.begin(), m_tiles.end(), [&](const optix::int2 &origin) {
+        return !m_adaptiveSampler.regionActive(origin, optix::make_int2(std::min(tileSize, resolution.x - origin.x),
+                                                                        std::min(tileSize, resolution.y - origin.y)));
+    }), m_tiles.end());
+    pixelsSaved = m_adaptiveSampler.retiredPixels();
+    m_samplesSaved += double(pixelsSaved) * m_passSamples;
+}
+
+void Scene::updateAdaptiveSampling()
+{
+    Camera &camera = Camera::getInstance(m_context);
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    const int samples = m_iterationIndex + m_passSamples;
+    if (!camera.adaptiveSampling() || samples < settings.adaptiveMinSamples ||
+        samples - m_adaptiveUpdateSamples < ADAPTIVE_UPDATE_INTERVAL)
+        return;
+    m_adaptiveUpdateSamples = samples;
+
+    try {
+        optix::Buffer film = camera.getFilmBuffer();
+        optix::Buffer secondMoment = camera.getSecondMomentBuffer();
+        const float *beauty = (const float *) film->map(0, RT_BUFFER_MAP_READ);
+        const float *moments = (const float *) secondMoment->map(0, RT_BUFFER_MAP_READ);
+        m_adaptiveSampler.update(beauty, moments, samples, settings.noiseThreshold, settings.adaptiveMinSamples);
+        secondMoment->unmap();
+        film->unmap();
+        camera.setActiveBlocks(m_adaptiveSampler);
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(e.getErrorString());
+    }
+    noiseLevel = m_adaptiveSampler.maxError();
+}
+
+void Scene::publishFrame()
+{
+    const std::string &name = GlobalSettings::getInstance().sharedFrames;
+    if (name.empty())
+        return;
+
+    try {
+        optix::Buffer buffer = Camera::getInstance(m_context).getFilmBuffer();
+        optix::int2 resolution = Camera::getInstance(m_context).resolution();
+        const void *data = buffer->map(0, RT_BUFFER_MAP_READ);
+        SharedFramePublisher::getInstance().publish(name, (const float *) data, resolution.x, resolution.y,
+                                                    m_iterationIndex);
+        buffer->unmap();
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(e.getErrorString());
+    }
+}
+
 optix::Buffer Scene::getFilmBuffer() const
 {
     return Camera::getInstance(m_context).getFilmBuffer();
 }
 
+void Scene::readFilm(FilmLayers &image)
+{
+    Camera &camera = Camera::getInstance(m_context);
+    const optix::int2 resolution = camera.resolution();
+    try {
+        optix::Buffer buffer = camera.getFilmBuffer();
+        const float *data = (const float *) buffer->map(0, RT_BUFFER_MAP_READ);
+        image.beauty.assign(data, data + size_t(resolution.x) * resolution.y * 4);
+        buffer->unmap();
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(e.getErrorString());
+    }
+    image.width = resolution.x;
+    image.height = resolution.y;
+    image.mask = 0;
+    if (camera.aovMask())
+        camera.readAovs(image);
+}
+
 void Scene::updateParameters()
 {
     if (ImGui::CollapsingHeader("System")) {
-        ImGui::DragInt("Tile size", &m_nextTileSize, 1, 16, 3000);
+        static const char *orders[] = {"Rows", "Hilbert", "Center out"};
+        int tileOrder = int(GlobalSettings::getInstance().tileOrder);
+        ImGui::DragFloat("Frame budget (ms)", &maxRenderingTime, 0.5f, 1.0f, 1000.0f, "%.1f");
+        ImGui::DragFloat("Noise threshold", &GlobalSettings::getInstance().noiseThreshold, 0.001f, 0.0f, 1.0f, "%.3f");
+        ImGui::Checkbox("Adaptive tile size", &m_adaptiveTiles);
+        if (!m_adaptiveTiles)
+            ImGui::DragInt("Tile size", &m_nextTileSize, 1, 16, 3000);
+        if (ImGui::Combo("Tile order", &tileOrder, orders, IM_ARRAYSIZE(orders)))
+            GlobalSettings::getInstance().tileOrder = TileOrder(tileOrder);
         ImGui::DragInt("Maximum depth", &m_maxDepth, 1, 1, 20);
+        ImGui::DragInt("Motion scale", &GlobalSettings::getInstance().motionScale, 1, 1, 8);
+        ImGui::DragInt("Motion max depth", &GlobalSettings::getInstance().motionMaxDepth, 1, 0, 20);
+        ImGui::DragFloat("Motion idle time (s)", &GlobalSettings::getInstance().motionIdleTime, 0.01f, 0.0f, 5.0f, "%.2f");
+    }
+    if (ImGui::CollapsingHeader("Tone mapping")) {
+        ToneMapSettings &toneMap = GlobalSettings::getInstance().toneMap;
+        static const char *operators[] = {"Clamp", "Reinhard", "ACES", "Filmic"};
+        int toneOperator = int(toneMap.toneOperator);
+        ImGui::DragFloat("Exposure", &toneMap.exposure, 0.05f, -10.0f, 10.0f, "%.2f");
+        if (ImGui::Combo("Operator", &toneOperator, operators, IM_ARRAYSIZE(operators)))
+            toneMap.toneOperator = ToneMapOperator(toneOperator);
+        ImGui::Checkbox("Dithering", &toneMap.dither);
+    }
+    if (ImGui::CollapsingHeader("Denoiser")) {
+        DenoiseSettings &denoise = GlobalSettings::getInstance().denoise;
+        ImGui::Checkbox("Denoise display", &denoise.display);
+        ImGui::Checkbox("Denoise files", &denoise.files);
+        ImGui::DragInt("Passes", &denoise.iterations, 1, 1, 8);
+        ImGui::DragFloat("Color sigma", &denoise.colorSigma, 0.1f, 0.1f, 100.0f, "%.1f");
+        ImGui::DragFloat("Normal sigma", &denoise.normalSigma, 0.01f, 0.01f, 2.0f, "%.2f");
+        ImGui::DragFloat("Albedo sigma", &denoise.albedoSigma, 0.01f, 0.01f, 2.0f, "%.2f");
     }
 
     Camera::getInstance(m_context).updateParameters();
@@ -199,49 +337,236 @@ void Scene::reset()
 {
     m_context["sysIterationIndex"]->setInt(0);
     m_iterationIndex = 0;
+    m_nextTile = 0;
     sampleNumber = 0;
+    m_adaptiveSampler.reset();
+    m_activeBlocksChanged = true;
+    m_samplesSaved = 0.0;
+    m_adaptiveUpdateSamples = 0;
 
     m_sceneChanged = false;
 }
 
-void Scene::renderToFile(const std::string &filename)
+void Scene::renderToFile(const std::string &filename, const ImageWriter::Callback &written,
+                         const RenderTarget &target)
 {
-    int oldTime = maxRenderingTime;
+    // layers of a job are accumulated from its first sample, adaptive sampling isn't used for buckets
+    Camera &camera = Camera::getInstance(m_context);
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    const bool buckets = 0 < settings.bucketSize && TiledImageFile::supportsFormat(filename);
+    const bool adaptive = 0.0f < settings.noiseThreshold && !buckets;
+    const int aovMask = settings.aovLayers | (settings.denoise.files && !buckets ? AOV_ALBEDO | AOV_NORMAL : 0);
+    bool changed = setMotionMode(false);
+    if (camera.aovMask() != aovMask || camera.adaptiveSampling() != adaptive) {
+        camera.setAovMask(aovMask);
+        camera.setAdaptiveSampling(adaptive);
+        changed = true;
+    }
+    if (changed)
+        reset();
+
+    if (0 < settings.bucketSize) {
+        if (buckets) {
+            if (camera.aovMask())
+                LogWarning("AOV layers aren't rendered in buckets, %s gets the beauty only", filename.c_str());
+            if (settings.denoise.files)
+                LogWarning("Buckets aren't denoised, %s is written as rendered", filename.c_str());
+            renderBuckets(filename, written, 0 < target.samples ? target.samples : settings.bucketSamples,
+                          target.samplesPerLaunch);
+            return;
+        }
+        LogWarning("Buckets are only written to exr files, %s is rendered in one piece", filename.c_str());
+    }
+
+    const float oldTime = maxRenderingTime;
     maxRenderingTime = INFINITY;
 
-    render();
+    const auto startTime = std::chrono::high_resolution_clock::now();
+    auto progressTime = startTime;
+    const int startSamples = m_iterationIndex;
+    float seconds = 0.0f;
+    while (m_running || !targetReached(target, startSamples, seconds)) {
+        // the last pass only takes the samples still missing
+        m_samplesPerLaunch = std::max(1, target.samplesPerLaunch);
+        if (0 < target.samples)
+            m_samplesPerLaunch = std::max(1, std::min(m_samplesPerLaunch, target.samples - m_iterationIndex));
+        render();
+
+        const auto now = std::chrono::high_resolution_clock::now();
+        seconds = std::chrono::duration<float>(now - startTime).count();
+        if (target.progress && PROGRESS_INTERVAL <= std::chrono::duration<float>(now - progressTime).count()) {
+            target.progress(m_iterationIndex, seconds);
+            progressTime = now;
+        }
+    }
+    m_samplesPerLaunch = 1;
+    if (target.progress)
+        target.progress(m_iterationIndex, seconds);
+
+    if (adaptive) {
+        const double pixelSamples = double(camera.resolution().x) * camera.resolution().y * m_iterationIndex;
+        LogInfo("Adaptive sampling stopped after %d samples with %d noisy blocks, %.1f%% of the pixel samples saved",
+                m_iterationIndex, m_adaptiveSampler.activeBlockCount(),
+                0.0 < pixelSamples ? 100.0 * m_samplesSaved / pixelSamples : 0.0);
+    }
 
-    Image image;
-    optix::Buffer buffer = Camera::getInstance(m_context).getFilmBuffer();
-    optix::int2 resolution = Camera::getInstance(m_context).resolution();
-    const void *data = buffer->map(0, RT_BUFFER_MAP_READ);
-    image.load((float*)data, resolution.x, resolution.y);
-    image.write(filename);
-    buffer->unmap();
+    // the film is copied to a staging buffer and encoded on the writer thread
+    optix::Buffer buffer = camera.getFilmBuffer();
+    optix::int2 resolution = camera.resolution();
+    try {
+        if (camera.aovMask()) {
+            FilmLayers image;
+            readFilm(image);
+            if (settings.denoise.files) {
+                m_denoiser.denoise(image, settings.denoise);
+                // guides that were only rendered for the denoiser aren't written
+                maskFilmLayers(image, settings.aovLayers);
+            }
+            ImageWriter::getInstance().write(std::move(image), filename, written);
+        }
+        else {
+            const float *data = (const float *) buffer->map(0, RT_BUFFER_MAP_READ);
+            ImageWriter::getInstance().write(data, resolution.x, resolution.y, filename, written);
+            buffer->unmap();
+        }
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(e.getErrorString());
+    }
 
-    image.clear();
     maxRenderingTime = oldTime;
 }
 
-void Scene::update()
+bool Scene::setMotionMode(bool motion)
 {
-    if (!m_running) {
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    Camera &camera = Camera::getInstance(m_context);
+    m_motion = motion;
+
+    bool changed = false;
+    const int scale = motion ? std::max(1, settings.motionScale) : 1;
+    if (camera.renderScale() != scale) {
+        camera.setRenderScale(scale);
+        changed = true;
+    }
+    optix::int2 pathLengths = m_context["sysPathLengths"]->getInt2();
+    const int depth = (motion && 0 < settings.motionMaxDepth) ? std::min(m_maxDepth, settings.motionMaxDepth) : m_maxDepth;
+    if (pathLengths.y != depth) {
+        pathLengths.y = depth;
+        m_context["sysPathLengths"]->setInt(pathLengths);
+        changed = true;
+    }
+    return changed;
+}
 
-        if (m_tileSize != m_nextTileSize) {
-            m_tileSize = m_nextTileSize;
-            m_sceneChanged = true;
-        }
+void Scene::framePresented()
+{
+    const float latency = m_inputLatency.presented(std::chrono::high_resolution_clock::now());
+    if (latency < 0.0f)
+        return;
+    if (m_motion)
+        motionLatency = latency;
+    else
+        fullLatency = latency;
+}
 
-        optix::int2 oldDepth = m_context["sysPathLengths"]->getInt2();
-        if (oldDepth.y != m_maxDepth){
-            oldDepth.y = m_maxDepth;
-            m_context["sysPathLengths"]->setInt(oldDepth);
-            m_sceneChanged = true;
-        }
+bool Scene::targetReached(const RenderTarget &target, int startSamples, float seconds) const
+{
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    const bool adaptive = Camera::getInstance(m_context).adaptiveSampling();
+    if (0 < target.samples && target.samples <= m_iterationIndex)
+        return true;
+    if (0.0f < target.seconds && target.seconds <= seconds)
+        return true;
+    if (adaptive && (m_adaptiveSampler.activeBlockCount() == 0 ||
+                     (target.samples <= 0 && settings.adaptiveMaxSamples <= m_iterationIndex)))
+        return true;
+    // without any limit a single pass is added to the film
+    return target.samples <= 0 && target.seconds <= 0.0f && !adaptive && startSamples < m_iterationIndex;
+}
+
+void Scene::renderBuckets(const std::string &filename, const ImageWriter::Callback &written, int samples,
+                          int samplesPerLaunch)
+{
+    Camera &camera = Camera::getInstance(m_context);
+    const optix::int2 resolution = camera.resolution();
+    const int bucketSize = GlobalSettings::getInstance().bucketSize;
+    samples = std::max(1, samples);
+    samplesPerLaunch = std::max(1, samplesPerLaunch);
+    // every bucket uses the same film, edge buckets only fill a part of it
+    const optix::int2 filmSize = optix::make_int2(std::min(bucketSize, resolution.x),
+                                                  std::min(bucketSize, resolution.y));
+
+    TiledImageFile file;
+    bool success = file.open(filename, resolution.x, resolution.y, bucketSize);
+    std::vector<float> pixels;
+    try {
+        for (int bucketY = 0; success && bucketY < file.tilesY(); bucketY++)
+            for (int bucketX = 0; success && bucketX < file.tilesX(); bucketX++) {
+                const optix::int2 origin = file.tileOrigin(bucketX, bucketY);
+                const optix::int2 extent = file.tileExtent(bucketX, bucketY);
+                camera.setFilmWindow(origin, filmSize);
+
+                for (int sample = 0; sample < samples; sample += samplesPerLaunch) {
+                    m_context["sysIterationIndex"]->setInt(sample);
+                    m_context["sysSamplesPerLaunch"]->setInt(std::min(samplesPerLaunch, samples - sample));
+                    for (int y = 0; y < extent.y; y += m_tileSize)
+                        for (int x = 0; x < extent.x; x += m_tileSize) {
+                            m_context["tileOffset"]->setUint(origin.x + x, origin.y + y);
+                            m_context->launch(0, std::min(m_tileSize, extent.x - x),
+                                              std::min(m_tileSize, extent.y - y));
+                        }
+                }
+
+                optix::Buffer buffer = camera.getFilmBuffer();
+                const float *data = (const float *) buffer->map(0, RT_BUFFER_MAP_READ);
+                pixels.resize(size_t(extent.x) * extent.y * 4);
+                for (int y = 0; y < extent.y; y++)
+                    std::copy(data + size_t(y) * filmSize.x * 4, data + (size_t(y) * filmSize.x + extent.x) * 4,
+                              pixels.begin() + size_t(y) * extent.x * 4);
+                buffer->unmap();
+
+                success = file.writeTile(bucketX, bucketY, pixels.data());
+                bucketNumber++;
+            }
+    }
+    catch (optix::Exception &e) {
+        camera.setFilmWindow(optix::make_int2(0, 0), resolution);
+        throw std::runtime_error(e.getErrorString());
+    }
+    success = file.close() && success;
+
+    // the film covers the image again, its memory is only allocated by the next launch
+    camera.setFilmWindow(optix::make_int2(0, 0), resolution);
+    reset();
+    if (written)
+        written(success);
+}
+
+void Scene::update()
+{
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    const auto lastMotion = Camera::getInstance(m_context).lastMotion();
+    const float idleTime = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - lastMotion).count();
+    const bool motion = (1 < settings.motionScale || 0 < settings.motionMaxDepth) && idleTime < settings.motionIdleTime;
+    // a full quality pass of the old view would take several frames, the first reduced one shows the input sooner
+    if (m_running && motion && !m_motion) {
+        m_running = false;
+        m_nextTile = 0;
+        m_inputLatency.passDropped();
+    }
+
+    if (!m_running) {
+        m_sceneChanged |= setMotionMode(motion);
+        m_inputLatency.motion(lastMotion);
 
+        Camera::getInstance(m_context).setAovMask(settings.aovLayers |
+                                                  (settings.denoise.display ? AOV_ALBEDO | AOV_NORMAL : 0));
+        Camera::getInstance(m_context).setAdaptiveSampling(0.0f < settings.noiseThreshold);
         m_sceneChanged |= Camera::getInstance(m_context).update();
         m_sceneChanged |= PrimitivePool::getInstance(m_context).update();
         m_sceneChanged |= LightPool::getInstance(m_context).update();
+        m_sceneChanged |= TexturePool::getInstance(m_context).update();
 
         if (m_sceneChanged)
             reset();
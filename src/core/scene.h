@@ -9,6 +9,12 @@
 #include <memory>
 
 #include "lightpool.h"
+#include "imagewriter.h"
+#include "tilescheduler.h"
+#include "adaptivesampler.h"
+#include "denoiser.h"
+#include "inputlatency.h"
+#include "globalsettings.h"
 
 class Camera;
 class PrimitivePool;
@@ -22,8 +28,15 @@ public:
     void setResolution(int width, int height);
 
     void render();
-    void renderToFile(const std::string &filename);
+    // Renders until the target is reached and returns once the film is staged, written is called when the
+    // file is complete.
+    void renderToFile(const std::string &filename, const ImageWriter::Callback &written = nullptr,
+                      const RenderTarget &target = RenderTarget());
     bool renderingRunning() const { return m_running;}
+    // Copies the film and the enabled AOV layers.
+    void readFilm(FilmLayers &image);
+    // Called when a finished iteration is handed to the display, measures the latency of camera input.
+    void framePresented();
 
     void updateParameters();
     void processInputs();
@@ -39,16 +52,44 @@ private:
     Scene();
 
     void reset();
+    // Sizes and orders the tiles of the next pass over the image.
+    void startPass(optix::int2 resolution);
+    // Retires converged blocks after an iteration, when adaptive sampling is on.
+    void updateAdaptiveSampling();
+    // Copies a finished iteration into the shared memory ring, when one is set up.
+    void publishFrame();
+    // Renders the image bucket by bucket into a tiled file, the film only holds one bucket at a time.
+    void renderBuckets(const std::string &filename, const ImageWriter::Callback &written, int samples,
+                       int samplesPerLaunch);
+    bool targetReached(const RenderTarget &target, int startSamples, float seconds) const;
+    // Reduces resolution and path length while the camera moves. Returns true when the film has to be reset.
+    bool setMotionMode(bool motion);
 
     optix::Context m_context;
 
-    optix::uint2 currentTileOffset;
+    std::vector<optix::int2> m_tiles; // Lower left pixels of the tiles of the current pass, in launch order.
+    size_t m_nextTile;
 
     bool m_running;
-    int m_tileSize;
-    int m_nextTileSize;
+    int m_tileSize;                   // Of the current pass.
+    int m_nextTileSize;               // Used by the next pass when tiles aren't sized adaptively.
+    bool m_adaptiveTiles;
+    TileSizeController m_tileController;
     float maxRenderingTime = 15.0f;
 
+    AdaptiveSampler m_adaptiveSampler;
+    bool m_activeBlocksChanged;       // Blocks have to be uploaded before the next pass.
+    double m_samplesSaved;            // Pixel samples skipped since the last reset.
+    int m_adaptiveUpdateSamples;      // Samples at the last update of the blocks.
+
+    Denoiser m_denoiser;              // Of files, the display has its own.
+
+    int m_samplesPerLaunch;           // Used by the next pass.
+    int m_passSamples;                // Samples every pixel gets from the current pass.
+
+    bool m_motion;
+    InputLatency m_inputLatency;
+
     int m_iterationIndex;
     bool m_sceneChanged;
     int m_maxDepth;
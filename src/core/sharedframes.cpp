@@ -0,0 +1,241 @@
+
+#include "sharedframes.h"
+
+#include "../utils/log.h"
+
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(SharedFrameRing) <= SHARED_FRAMES_RING_SIZE, "ring header doesn't fit");
+static_assert(sizeof(SharedFrameHeader) <= SHARED_FRAMES_HEADER_SIZE, "frame header doesn't fit");
+
+// Readers copying the newest frame are only disturbed when the renderer is this many frames ahead.
+static const uint32_t SHARED_FRAME_SLOTS = 3;
+
+// Names of POSIX shared memory objects start with a slash.
+static std::string segmentName(const std::string &name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+static SharedFrameHeader *frameSlot(unsigned char *memory, uint64_t sequence)
+{
+    const SharedFrameRing *ring = (const SharedFrameRing *) memory;
+    return (SharedFrameHeader *) (memory + SHARED_FRAMES_RING_SIZE + (sequence % ring->slotCount) * ring->slotSize);
+}
+
+static float *framePixels(SharedFrameHeader *frame)
+{
+    return (float *) ((unsigned char *) frame + SHARED_FRAMES_HEADER_SIZE);
+}
+
+SharedFramePublisher::SharedFramePublisher()
+    : m_memory(nullptr), m_size(0), m_sequence(0)
+{
+}
+
+SharedFramePublisher::~SharedFramePublisher()
+{
+    close();
+}
+
+bool SharedFramePublisher::create(const std::string &name, uint32_t capacity, uint32_t slotCount)
+{
+    close();
+
+    const uint64_t slotSize = SHARED_FRAMES_HEADER_SIZE + uint64_t(capacity) * 4 * sizeof(float);
+    const size_t size = size_t(SHARED_FRAMES_RING_SIZE + slotCount * slotSize);
+    const std::string segment = segmentName(name);
+
+    // a previous segment of the same name belongs to a finished run, readers of it are told to reopen
+    shm_unlink(segment.c_str());
+    const int descriptor = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (descriptor < 0) {
+        LogError("Unable to create shared memory %s", segment.c_str());
+        return false;
+    }
+    if (ftruncate(descriptor, off_t(size)) != 0) {
+        LogError("Unable to resize shared memory %s to %zu bytes", segment.c_str(), size);
+        ::close(descriptor);
+        shm_unlink(segment.c_str());
+        return false;
+    }
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (memory == MAP_FAILED) {
+        LogError("Unable to map shared memory %s", segment.c_str());
+        shm_unlink(segment.c_str());
+        return false;
+    }
+
+    // the new segment is zeroed, so all slots start out empty, and its sequence numbers start again at 1
+    m_name = segment;
+    m_memory = (unsigned char *) memory;
+    m_size = size;
+    m_sequence = 0;
+    SharedFrameRing *ring = new (m_memory) SharedFrameRing;
+    ring->slotCount = slotCount;
+    ring->capacity = capacity;
+    ring->slotSize = slotSize;
+    ring->latest.store(0, std::memory_order_relaxed);
+    ring->replaced.store(0, std::memory_order_relaxed);
+    ring->version = SHARED_FRAMES_VERSION;
+    for (uint32_t i = 0; i < slotCount; i++)
+        new (frameSlot(m_memory, i)) SharedFrameHeader;
+    // readers check the magic number last
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->magic = SHARED_FRAMES_MAGIC;
+    return true;
+}
+
+void SharedFramePublisher::close()
+{
+    if (!m_memory)
+        return;
+    ((SharedFrameRing *) m_memory)->replaced.store(1, std::memory_order_release);
+    munmap(m_memory, m_size);
+    shm_unlink(m_name.c_str());
+    m_memory = nullptr;
+    m_size = 0;
+    m_name.clear();
+}
+
+bool SharedFramePublisher::publish(const std::string &name, const float *pixels, int width, int height,
+                                   int iteration)
+{
+    const uint32_t pixelCount = uint32_t(width) * uint32_t(height);
+    if (!m_memory || m_name != segmentName(name) || ((SharedFrameRing *) m_memory)->capacity < pixelCount) {
+        if (!create(name, pixelCount, SHARED_FRAME_SLOTS))
+            return false;
+    }
+
+    SharedFrameRing *ring = (SharedFrameRing *) m_memory;
+    const uint64_t sequence = ++m_sequence;
+    SharedFrameHeader *frame = frameSlot(m_memory, sequence);
+
+    frame->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    frame->width = uint32_t(width);
+    frame->height = uint32_t(height);
+    frame->iteration = iteration;
+    memcpy(framePixels(frame), pixels, size_t(pixelCount) * 4 * sizeof(float));
+    frame->sequence.store(sequence, std::memory_order_release);
+    ring->latest.store(sequence, std::memory_order_release);
+    return true;
+}
+
+SharedFramePublisher &SharedFramePublisher::getInstance()
+{
+    static SharedFramePublisher publisher;
+    return publisher;
+}
+
+SharedFrameReader::SharedFrameReader()
+    : m_memory(nullptr), m_size(0)
+{
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+    close();
+}
+
+bool SharedFrameReader::open(const std::string &name)
+{
+    close();
+    const std::string segment = segmentName(name);
+    const int descriptor = shm_open(segment.c_str(), O_RDONLY, 0);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || size_t(status.st_size) < SHARED_FRAMES_RING_SIZE) {
+        ::close(descriptor);
+        return false;
+    }
+    void *memory = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (memory == MAP_FAILED)
+        return false;
+
+    m_name = segment;
+    m_memory = (unsigned char *) memory;
+    m_size = size_t(status.st_size);
+
+    const SharedFrameRing *ring = (const SharedFrameRing *) m_memory;
+    const bool valid = ring->magic == SHARED_FRAMES_MAGIC && ring->version == SHARED_FRAMES_VERSION;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!valid || m_size < SHARED_FRAMES_RING_SIZE + ring->slotCount * ring->slotSize) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SharedFrameReader::close()
+{
+    if (m_memory)
+        munmap(m_memory, m_size);
+    m_memory = nullptr;
+    m_size = 0;
+}
+
+uint64_t SharedFrameReader::latestSequence() const
+{
+    return m_memory ? ((const SharedFrameRing *) m_memory)->latest.load(std::memory_order_acquire) : 0;
+}
+
+const SharedFrameHeader *SharedFrameReader::latestFrame(uint64_t &sequence, const float *&pixels) const
+{
+    sequence = latestSequence();
+    if (sequence == 0)
+        return nullptr;
+    SharedFrameHeader *frame = frameSlot(m_memory, sequence);
+    if (!stillValid(frame, sequence))
+        return nullptr;
+    pixels = framePixels(frame);
+    return frame;
+}
+
+bool SharedFrameReader::stillValid(const SharedFrameHeader *frame, uint64_t sequence)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return frame->sequence.load(std::memory_order_acquire) == sequence;
+}
+
+bool SharedFrameReader::read(uint64_t &sequence, int &width, int &height, int &iteration, std::vector<float> &pixels)
+{
+    if (!m_memory || ((const SharedFrameRing *) m_memory)->replaced.load(std::memory_order_acquire)) {
+        if (!open(m_name))
+            return false;
+        sequence = 0; // sequence numbers start again in a new segment
+    }
+
+    uint64_t latest;
+    const float *source;
+    const SharedFrameHeader *frame = latestFrame(latest, source);
+    if (!frame || latest <= sequence)
+        return false;
+
+    const int frameWidth = int(frame->width);
+    const int frameHeight = int(frame->height);
+    const int frameIteration = frame->iteration;
+    const size_t count = size_t(frameWidth) * frameHeight * 4;
+    if (((const SharedFrameRing *) m_memory)->capacity * size_t(4) < count)
+        return false;
+    pixels.resize(count);
+    memcpy(pixels.data(), source, count * sizeof(float));
+    if (!stillValid(frame, latest))
+        return false;
+
+    sequence = latest;
+    width = frameWidth;
+    height = frameHeight;
+    iteration = frameIteration;
+    return true;
+}
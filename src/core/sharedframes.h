@@ -0,0 +1,96 @@
+
+#ifndef RENDERER_GPU_SHAREDFRAMES_H
+#define RENDERER_GPU_SHAREDFRAMES_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Progressive frames are published into a POSIX shared memory ring, so that clients can map the film without
+// copies and poll for new iterations. The segment starts with a SharedFrameRing followed by slotCount slots of
+// slotSize bytes, each one a SharedFrameHeader and linear RGBA32F pixels, bottom row first like the film.
+//
+// The renderer never waits for readers. A frame is written into the slot of its sequence number modulo
+// slotCount, whose sequence is 0 while the pixels change. Readers check the sequence of the slot before and
+// after reading the pixels and drop the frame when it differs. Sequence numbers start at 1 in every segment,
+// a reader that opens a new one starts counting again.
+#define SHARED_FRAMES_MAGIC   0x52465352u // "RSFR"
+#define SHARED_FRAMES_VERSION 1
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "shared frame sequences need lock free 64-bit atomics");
+
+struct SharedFrameRing
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t capacity;               // Pixels per slot.
+    uint64_t slotSize;               // Bytes per slot, header included.
+    std::atomic<uint64_t> latest;    // Sequence number of the newest complete frame, 0 before the first one.
+    std::atomic<uint32_t> replaced;  // Set when the renderer moved to a larger segment, readers open it again.
+};
+
+struct SharedFrameHeader
+{
+    std::atomic<uint64_t> sequence; // Starts at 1 in a segment and grows with every frame, 0 while the slot is written.
+    uint32_t width;
+    uint32_t height;
+    int32_t iteration;              // Samples accumulated in the frame minus one.
+    uint32_t reserved;
+};
+
+// Offset of the first slot and of the pixels in a slot, both keep 64 byte alignment.
+#define SHARED_FRAMES_RING_SIZE   64
+#define SHARED_FRAMES_HEADER_SIZE 64
+
+class SharedFramePublisher
+{
+public:
+    ~SharedFramePublisher();
+
+    // Copies the film into the next slot of the segment called name, which is created or grown when needed.
+    bool publish(const std::string &name, const float *pixels, int width, int height, int iteration);
+    void close();
+
+    static SharedFramePublisher &getInstance();
+
+private:
+    SharedFramePublisher();
+
+    bool create(const std::string &name, uint32_t capacity, uint32_t slotCount);
+
+    std::string m_name;
+    unsigned char *m_memory;
+    size_t m_size;
+    uint64_t m_sequence;
+};
+
+// Reference reader of the ring, for clients and tests.
+class SharedFrameReader
+{
+public:
+    SharedFrameReader();
+    ~SharedFrameReader();
+
+    bool open(const std::string &name);
+    void close();
+
+    // Sequence number of the newest frame, 0 when nothing was published yet.
+    uint64_t latestSequence() const;
+    // Zero-copy access to the newest frame. The pixels are valid while stillValid() holds afterwards.
+    const SharedFrameHeader *latestFrame(uint64_t &sequence, const float *&pixels) const;
+    static bool stillValid(const SharedFrameHeader *frame, uint64_t sequence);
+
+    // Copies the newest frame when it is newer than sequence and updates sequence. Returns false when there
+    // is no newer frame or it was overwritten while copying. Opens the segment again when it was replaced.
+    bool read(uint64_t &sequence, int &width, int &height, int &iteration, std::vector<float> &pixels);
+
+private:
+    std::string m_name;
+    unsigned char *m_memory;
+    size_t m_size;
+};
+
+#endif //RENDERER_GPU_SHAREDFRAMES_H
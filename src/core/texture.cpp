@@ -4,10 +4,67 @@
 #include "../utils/log.h"
 #include "../utils/fileutil.h"
 
+#include "globalsettings.h"
 #include "image.h"
+#include "imagestore.h"
+#include "texturecache.h"
+#include "../math/distribution.h"
+#include "../utils/stats.h"
+#include "../utils/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+
+REGISTER_PERMANENT_STATISTIC(float, textureLoadTime, 0.0f, "Texture loading time (ms)");
+REGISTER_PERMANENT_STATISTIC(float, hostTextureMemory, 0.0f, "Host texture memory (MB)");
+REGISTER_PERMANENT_STATISTIC(int, atlasPages, 0, "Texture atlas pages");
+REGISTER_PERMANENT_STATISTIC(float, atlasOccupancy, 0.0f, "Texture atlas occupancy (%)");
+REGISTER_PERMANENT_STATISTIC(int, residentTiles, 0, "Resident virtual texture tiles");
+REGISTER_DYNAMIC_STATISTIC(int, streamedTiles, 0, "Streamed virtual texture tiles");
+REGISTER_DYNAMIC_STATISTIC(int, uploadedSheets, 0, "Uploaded virtual texture atlas sheets");
+
+// Rows summed by one task for the average color.
+#define AVERAGE_ROWS_PER_TASK 64
+
+// most tiles streamed per frame, feedback of later frames asks for the rest
+static const int maxTileLoads = 256;
+
+static bool isVirtual(const pugi::xml_node &node)
+{
+    return readString(node.child("virtual")) == "true";
+}
+
+// Small 8-bit textures are packed into atlas pages instead of getting their own sampler.
+static bool fitsAtlas(const Image &image, BlockFormat compression)
+{
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    const int maxSize = std::min(settings.atlasTextureSize, settings.atlasPageSize - 2 * ATLAS_BORDER);
+    return image.format() == Image::RGBA8_SRGB && compression == BLOCK_NONE &&
+        image.width() <= maxSize && image.height() <= maxSize;
+}
 
+// Virtual textures always have the full chain, so that their coarsest level is a single tile.
+static int requestedMipCount(const pugi::xml_node &node)
+{
+    return isVirtual(node) ? 0 : readInt(node.child("mipCount"), 1);
+}
 
-std::map<std::string, Image> imageCache;
+#if OPTIX_VERSION >= 60000
+static RTformat blockBufferFormat(BlockFormat format)
+{
+    switch (format) {
+    case BLOCK_BC1:
+        return RT_FORMAT_UNSIGNED_BC1;
+    case BLOCK_BC4:
+        return RT_FORMAT_UNSIGNED_BC4;
+    case BLOCK_BC5:
+        return RT_FORMAT_UNSIGNED_BC5;
+    default:
+        return RT_FORMAT_UNSIGNED_BC7;
+    }
+}
+#endif
 
 
 TexturePool::~TexturePool()
@@ -15,10 +72,49 @@ TexturePool::~TexturePool()
     std::vector<std::string> names = extract_keys(m_textureMap);
     for (auto &name : names)
         unloadTexture(name);
+    for (auto &sampler : m_pageSamplers)
+        sampler->destroy();
+    for (auto &buffer : m_pageBuffers)
+        buffer->destroy();
+    for (auto &sampler : m_sheetSamplers)
+        sampler->destroy();
+    for (auto &buffer : m_sheetBuffers)
+        buffer->destroy();
+}
 
-    for (auto &kv : imageCache)
-        kv.second.clear();
+// Texture was loaded from the same file with the same settings already.
+bool TexturePool::upToDate(const pugi::xml_node &node, const std::string &name) const
+{
+    auto found = m_textureMap.find(name);
+    if (found == m_textureMap.end())
+        return false;
+
+    const TextureData &data = found->second;
+    return data.image_filename == node.child("filename").child_value() &&
+        data.mipCount == requestedMipCount(node) &&
+        data.mipFilter == parseMipFilter(readString(node.child("mipFilter"))) &&
+        data.compression == parseBlockFormat(readString(node.child("compression"))) &&
+        data.virtualTexture == isVirtual(node);
+}
+
+// Another texture uses the same sampler and buffer.
+bool TexturePool::sharesDeviceData(const std::string &name, const TextureData &data) const
+{
+    if (!data.sampler || !data.sampler->get())
+        return false;
+    for (auto &kv : m_textureMap)
+        if (kv.first != name && kv.second.sampler && kv.second.sampler->get() == data.sampler->get())
+            return true;
+    return false;
+}
 
+// Destroys the sampler and buffer of a texture unless other textures still use them.
+void TexturePool::releaseDeviceData(const std::string &name, TextureData &data) const
+{
+    if (!sharesDeviceData(name, data))
+        data.destroy();
+    data.sampler = nullptr;
+    data.buffer = nullptr;
 }
 
 bool TexturePool::loadTexture(const pugi::xml_node &node, const std::string &name)
@@ -29,34 +125,99 @@ bool TexturePool::loadTexture(const pugi::xml_node &node, const std::string &nam
     }
 
     // TODO cubemaps
-    // TODO different input and output data encodings
     // TODO texture scale
     std::string filename = node.child("filename").child_value();
     if (filename.empty()){
         return false;
     }
-    int input_mip = readInt(node.child("mipCount"), 1);
+    int input_mip = requestedMipCount(node);
+    const MipFilter mipFilter = parseMipFilter(readString(node.child("mipFilter")));
+    const BlockFormat compression = parseBlockFormat(readString(node.child("compression")));
+    bool virtualTexture = isVirtual(node);
 
-    if (data.image_filename == filename && data.mipCount == input_mip)
+    if (upToDate(node, name))
         return true;
 
-    Image image(input_mip);
-    if (imageCache.find(filename) != imageCache.end()) {
-        image = imageCache[filename];
-    }
-    else {
-        if (!image.load(filename))
-            return false;
-    }
+    std::shared_ptr<const Image> imagePointer = ImageStore::getInstance().acquire(filename, input_mip, mipFilter);
+    if (!imagePointer)
+        return false;
+    const Image &image = *imagePointer;
+    uint64_t contentHash = 0;
+    ImageStore::getInstance().contentHash(filename, contentHash);
     data.image_filename = filename;
+    data.contentHash = contentHash;
     data.mipCount = input_mip;
+    data.mipFilter = mipFilter;
+    data.compression = compression;
+    data.distributionSize = optix::make_int2(0, 0);
+    data.conditionalCdf.clear();
+    data.marginalCdf.clear();
+
+    data.averageValid = false;
+
+    if (virtualTexture && image.format() != Image::RGBA8_SRGB) {
+        LogWarning("Only 8-bit textures can be virtual. Texture '%s' is loaded as a whole", name.c_str());
+        virtualTexture = false;
+    }
+    data.virtualTexture = virtualTexture;
+    data.atlasPage = -1;
+    data.atlasTransform = atlasIdentity();
+    if (virtualTexture || fitsAtlas(image, compression)) {
+        // pages are assigned after all textures are loaded, tiles or atlas pages are copied from the image
+        releaseDeviceData(name, data);
+        data.atlasPage = virtualTexture ? -1 : 0;
+        data.image = imagePointer;
+        m_textureMap[name] = data;
+        return true;
+    }
 
-    float *pixels = image.pixelData();
-    int width = image.width();
-    int height = image.height();
-    int mipCount = image.mipCount();
+    // the same content with the same settings is uploaded once
+    for (auto &kv : m_textureMap) {
+        const TextureData &other = kv.second;
+        if (kv.first == name || !other.sampler || other.contentHash != contentHash || other.mipCount != input_mip ||
+            other.mipFilter != mipFilter || other.compression != compression)
+            continue;
+
+        if (data.sampler && data.sampler->get() != other.sampler->get())
+            releaseDeviceData(name, data);
+        data.sampler = other.sampler;
+        data.buffer = other.buffer;
+        data.image = GlobalSettings::getInstance().keepHostTextures ? imagePointer : nullptr;
+        m_textureMap[name] = data;
+        m_deduplicatedBytes += image.byteSize();
+        LogInfo("Texture '%s' has the same content as texture '%s', they share device memory", name.c_str(),
+                kv.first.c_str());
+        return true;
+    }
+
+    if (!uploadTexture(name, image, data))
+        return false;
+
+    // host pixels are read again when they are needed later
+    data.image = GlobalSettings::getInstance().keepHostTextures ? imagePointer : nullptr;
+    m_textureMap[name] = data;
+
+    return true;
+}
+
+// Gives the texture a sampler of its own with all levels of the image.
+bool TexturePool::uploadTexture(const std::string &name, const Image &image, TextureData &data) const
+{
+    const unsigned char *pixels = image.data();
+    const size_t pixelSize = size_t(image.pixelSize());
+    const int width = image.width();
+    const int height = image.height();
+    const int mipCount = image.mipCount();
+    const BlockFormat compression = data.compression;
+    const std::string &filename = data.image_filename;
 
     try {
+        // textures sharing the old image keep it
+        if (sharesDeviceData(name, data)) {
+            data.sampler = nullptr;
+            data.buffer = nullptr;
+        }
+
         if (!data.sampler) {
             data.sampler = m_context->createTextureSampler();
             data.sampler->setWrapMode(0, RT_WRAP_REPEAT);
@@ -74,22 +235,77 @@ bool TexturePool::loadTexture(const pugi::xml_node &node, const std::string &nam
             data.buffer = nullptr;
         }
 
+        // 8-bit textures are stored in sRGB and converted to linear by the texture unit
+        RTformat format = RT_FORMAT_FLOAT4;
+        RTtexturereadmode readMode = RT_TEXTURE_READ_NORMALIZED_FLOAT;
+        if (image.format() == Image::RGBA16F)
+            format = RT_FORMAT_HALF4;
+        else if (image.format() == Image::RGBA8_SRGB) {
+            format = RT_FORMAT_UNSIGNED_BYTE4;
+            readMode = RT_TEXTURE_READ_NORMALIZED_FLOAT_SRGB;
+        }
+
+        // mip levels to upload, buffer size is in elements (texels or 4x4 blocks)
+        std::vector<const unsigned char *> levels;
+        std::vector<size_t> levelSizes;
+        size_t offset = 0;
+        for (int mipLevel = 0; mipLevel < mipCount; mipLevel++) {
+            levels.push_back(pixels + offset);
+            levelSizes.push_back(size_t(mipLevelSize(width, mipLevel)) * mipLevelSize(height, mipLevel) * pixelSize);
+            offset += levelSizes.back();
+        }
+        int bufferWidth = width, bufferHeight = height;
+
+        CompressedImage compressed;
+        if (compression != BLOCK_NONE) {
+#if OPTIX_VERSION >= 60000
+            // block counts of the levels are derived from the block count of the finest one,
+            // some non power of two sizes round differently than the texel counts do
+            bool blockAligned = true;
+            for (int mipLevel = 0; mipLevel < mipCount; mipLevel++)
+                blockAligned &= (mipLevelSize(width, mipLevel) + 3) / 4 == mipLevelSize((width + 3) / 4, mipLevel) &&
+                    (mipLevelSize(height, mipLevel) + 3) / 4 == mipLevelSize((height + 3) / 4, mipLevel);
+            if (!blockAligned)
+                LogWarning("Mip levels of texture '%s' (%dx%d) don't match its 4x4 blocks, it is left uncompressed",
+                           name.c_str(), width, height);
+            else if (compressImage(image, filename, compression, compressed)) {
+                format = blockBufferFormat(compression);
+                if (compression == BLOCK_BC4 || compression == BLOCK_BC5)
+                    readMode = RT_TEXTURE_READ_NORMALIZED_FLOAT; // scalar data isn't sRGB encoded
+                bufferWidth = (width + 3) / 4;
+                bufferHeight = (height + 3) / 4;
+                for (int mipLevel = 0; mipLevel < mipCount; mipLevel++) {
+                    levels[mipLevel] = compressed.data.data() + compressed.levelOffsets[mipLevel];
+                    const size_t end = (mipLevel + 1 < mipCount) ? compressed.levelOffsets[mipLevel + 1]
+                                                                 : compressed.data.size();
+                    levelSizes[mipLevel] = end - compressed.levelOffsets[mipLevel];
+                }
+            }
+#else
+            LogWarning("Block compressed textures need OptiX 6 or newer. Texture '%s' is left uncompressed",
+                       name.c_str());
+#endif
+        }
+
         if (!data.buffer) {
-            data.buffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_FLOAT4, width, height);
+            data.buffer = m_context->createBuffer(RT_BUFFER_INPUT, format, bufferWidth, bufferHeight);
         }
 
         data.buffer->setMipLevelCount(mipCount);
-        int offset = 0;
         for (int mipLevel = 0; mipLevel < mipCount; mipLevel++) {
             void *dst = data.buffer->map(mipLevel, RT_BUFFER_MAP_WRITE_DISCARD);
-            memcpy(dst, pixels + offset, width * height * sizeof(float) * 4);
+            memcpy(dst, levels[mipLevel], levelSizes[mipLevel]);
             data.buffer->unmap(mipLevel);
-
-            offset += width * height * 4;
-            width /= 2;
-            height /= 2;
         }
+        data.sampler->setReadMode(readMode);
         data.sampler->setBuffer(data.buffer);
+
+        size_t deviceSize = 0;
+        for (auto size : levelSizes)
+            deviceSize += size;
+        const double megabyte = 1024.0 * 1024.0;
+        LogInfo("Texture '%s' takes %.2f MB (%.2f MB as RGBA32F)", name.c_str(), double(deviceSize) / megabyte,
+                double(image.byteSize()) / double(pixelSize) * 4.0 * sizeof(float) / megabyte);
     }
     catch(optix::Exception& e)
     {
@@ -97,9 +313,6 @@ bool TexturePool::loadTexture(const pugi::xml_node &node, const std::string &nam
         return false;
     }
 
-    imageCache[filename] = image;
-    m_textureMap[name] = data;
-
     return true;
 }
 
@@ -108,9 +321,8 @@ bool TexturePool::unloadTexture(const std::string &name)
     TextureData &data = m_textureMap[name];
 
     LogInfo("Image '%s' was unloaded.", data.image_filename.c_str());
-    imageCache[data.image_filename].clear();
-    imageCache.erase(data.image_filename);
-    data.destroy();
+    if (!sharesDeviceData(name, data))
+        data.destroy();
     m_textureMap.erase(name);
 
     return true;
@@ -118,14 +330,87 @@ bool TexturePool::unloadTexture(const std::string &name)
 
 bool TexturePool::load(const pugi::xml_node &node)
 {
+    const auto start = std::chrono::high_resolution_clock::now();
     std::vector<std::string> old_names = extract_keys(m_textureMap);
 
     std::vector<std::string> new_names;
+    std::vector<std::pair<pugi::xml_node, std::string>> textures;
     for (auto &texture_node : node.children("texture")) {
         std::string name = texture_node.attribute("name").value();
         name = GetUniqueName(new_names, name);
-        if (loadTexture(texture_node, name))
-            new_names.push_back(name);
+        new_names.push_back(name);
+        textures.emplace_back(texture_node, name);
+    }
+
+    // decode images of new or changed textures on worker threads, every file once, or map them from the
+    // disk cache of processed images. They are held here until their textures are uploaded.
+    typedef std::tuple<std::string, int, MipFilter> ImageKey;
+    std::vector<ImageKey> keys;
+    for (auto &texture : textures) {
+        if (upToDate(texture.first, texture.second))
+            continue;
+        const ImageKey key(texture.first.child("filename").child_value(), requestedMipCount(texture.first),
+                           parseMipFilter(readString(texture.first.child("mipFilter"))));
+        if (!std::get<0>(key).empty() && std::find(keys.begin(), keys.end(), key) == keys.end())
+            keys.push_back(key);
+    }
+
+    // files with equal content are decoded once, whatever their paths are
+    m_deduplicatedBytes = 0;
+    std::vector<uint64_t> hashes(keys.size(), 0);
+    parallelFor(int(keys.size()), [&](int i) {
+        ImageStore::getInstance().contentHash(std::get<0>(keys[i]), hashes[i]);
+    });
+    std::vector<int> decodeIndices;
+    std::vector<int> firstKey(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        firstKey[i] = int(i);
+        for (int j : decodeIndices)
+            if (hashes[j] != 0 && hashes[j] == hashes[i] && std::get<1>(keys[j]) == std::get<1>(keys[i]) &&
+                std::get<2>(keys[j]) == std::get<2>(keys[i]))
+                firstKey[i] = j;
+        if (firstKey[i] == int(i))
+            decodeIndices.push_back(int(i));
+    }
+
+    std::vector<std::shared_ptr<const Image>> images(keys.size());
+    std::vector<double> decodeTimes(keys.size(), 0.0);
+    parallelFor(int(decodeIndices.size()), [&](int task) {
+        const int i = decodeIndices[task];
+        const auto decodeStart = std::chrono::high_resolution_clock::now();
+        images[i] = ImageStore::getInstance().acquire(std::get<0>(keys[i]), std::get<1>(keys[i]),
+                                                      std::get<2>(keys[i]));
+        decodeTimes[i] = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - decodeStart).count();
+    });
+    for (size_t i = 0; i < keys.size(); i++)
+        if (firstKey[i] != int(i) && images[firstKey[i]]) {
+            images[i] = images[firstKey[i]];
+            LogInfo("Image '%s' has the same content as '%s', it is decoded once", std::get<0>(keys[i]).c_str(),
+                    std::get<0>(keys[firstKey[i]]).c_str());
+        }
+    if (!keys.empty())
+        trimTextureCache();
+
+    // upload in declaration order
+    new_names.clear();
+    for (auto &texture : textures) {
+        const ImageKey key(texture.first.child("filename").child_value(), requestedMipCount(texture.first),
+                           parseMipFilter(readString(texture.first.child("mipFilter"))));
+        auto decodedImage = std::find(keys.begin(), keys.end(), key);
+        if (decodedImage != keys.end() && !images[decodedImage - keys.begin()])
+            continue;
+
+        const auto uploadStart = std::chrono::high_resolution_clock::now();
+        if (!loadTexture(texture.first, texture.second))
+            continue;
+        new_names.push_back(texture.second);
+
+        const double uploadTime = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - uploadStart).count();
+        if (decodedImage != keys.end())
+            LogInfo("Texture '%s' was decoded in %.1f ms and uploaded in %.1f ms", texture.second.c_str(),
+                    decodeTimes[decodedImage - keys.begin()], uploadTime);
     }
 
     // delete all textures from previous loadings that are missing now
@@ -133,10 +418,25 @@ bool TexturePool::load(const pugi::xml_node &node)
     for (auto &tex : texToDelete) {
         unloadTexture(tex);
     }
+
+    updateVirtualTextures();
+    updateAtlasPages();
+
+    // images only held above are freed now, unless kept by the textures
+    images.clear();
+    hostTextureMemory = float(double(ImageStore::getInstance().hostBytes()) / (1024.0 * 1024.0));
+    if (0 < m_deduplicatedBytes)
+        LogInfo("Deduplicated %.2f MB of textures", double(m_deduplicatedBytes) / (1024.0 * 1024.0));
+
+    textureLoadTime = float(std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count());
+    return true;
 }
 
-int TexturePool::id(const pugi::xml_node &node, float &scale)
+int TexturePool::id(const pugi::xml_node &node, float &scale, optix::float4 *atlasTransform)
 {
+    if (atlasTransform)
+        *atlasTransform = atlasIdentity();
     scale = readFloat(node.child("scale"), 1.0f);
 
     std::string name = node.attribute("name").value();
@@ -148,16 +448,474 @@ int TexturePool::id(const pugi::xml_node &node, float &scale)
         return RT_TEXTURE_ID_NULL;
     }
 
+    if (m_textureMap[name].virtualTexture)
+        return virtualTextureID(m_textureMap[name].virtualIndex);
+
+    TextureData &data = m_textureMap[name];
+    if (0 <= data.atlasPage && atlasTransform && data.atlasPage < int(m_pageSamplers.size())) {
+        *atlasTransform = data.atlasTransform;
+        return m_pageSamplers[data.atlasPage]->getId();
+    }
+    // callers that can't apply the transform, like environment lights, get a sampler of the whole image
+    if (0 <= data.atlasPage && !(data.sampler && data.sampler->get())) {
+        std::shared_ptr<const Image> image = data.image;
+        if (!image)
+            image = ImageStore::getInstance().acquire(data.image_filename, data.mipCount, data.mipFilter);
+        if (!image || !uploadTexture(name, *image, data))
+            return RT_TEXTURE_ID_NULL;
+        LogInfo("Texture '%s' is packed into an atlas, it got its own sampler as well", name.c_str());
+    }
+
     optix::TextureSampler sampler = m_textureMap[name].sampler;
-    if (sampler->get())
+    if (sampler && sampler->get())
         return sampler->getId();
     return RT_TEXTURE_ID_NULL;
 }
 
+optix::float3 TexturePool::average(const pugi::xml_node &node)
+{
+    std::string name = node.attribute("name").value();
+    if (name.empty() || m_textureMap.find(name) == m_textureMap.end())
+        return optix::make_float3(1.0f);
+
+    TextureData &data = m_textureMap[name];
+    if (data.averageValid)
+        return data.average;
+
+    // only environment lights ask for it, so it isn't computed while loading
+    std::shared_ptr<const Image> imagePointer = data.image;
+    if (!imagePointer)
+        imagePointer = ImageStore::getInstance().acquire(data.image_filename, data.mipCount, data.mipFilter);
+    if (!imagePointer)
+        return optix::make_float3(1.0f);
+    const Image &image = *imagePointer;
+
+    const int width = image.width();
+    const int height = image.height();
+    const int tasks = (height + AVERAGE_ROWS_PER_TASK - 1) / AVERAGE_ROWS_PER_TASK;
+    // rows are summed in float, rows and tasks in double
+    std::vector<double> sums(size_t(tasks) * 3, 0.0);
+    parallelFor(tasks, [&](int task) {
+        std::vector<float> row(size_t(width) * 4);
+        const int end = std::min(height, (task + 1) * AVERAGE_ROWS_PER_TASK);
+        for (int y = task * AVERAGE_ROWS_PER_TASK; y < end; y++) {
+            image.decodeRow(y, row.data());
+            float rowSum[3] = {0.0f, 0.0f, 0.0f};
+            for (int x = 0; x < width * 4; x += 4) {
+                rowSum[0] += row[x];
+                rowSum[1] += row[x + 1];
+                rowSum[2] += row[x + 2];
+            }
+            for (int c = 0; c < 3; c++)
+                sums[size_t(task) * 3 + c] += rowSum[c];
+        }
+    });
+    double sum[3] = {0.0, 0.0, 0.0};
+    for (int task = 0; task < tasks; task++)
+        for (int c = 0; c < 3; c++)
+            sum[c] += sums[size_t(task) * 3 + c];
+    data.average = optix::make_float3(float(sum[0]), float(sum[1]), float(sum[2])) / float(width * height);
+    data.averageValid = true;
+    return data.average;
+}
+
+const TextureData *TexturePool::distribution(const pugi::xml_node &node)
+{
+    std::string name = node.attribute("name").value();
+    if (name.empty() || m_textureMap.find(name) == m_textureMap.end())
+        return nullptr;
+
+    TextureData &data = m_textureMap[name];
+    if (data.distributionSize.x != 0)
+        return &data;
+
+    // pixels are read again when the texture didn't keep them, they are freed after building
+    std::shared_ptr<const Image> imagePointer = data.image;
+    if (!imagePointer) {
+        LogInfo("Reading texture '%s' again for its importance sampling distribution", name.c_str());
+        imagePointer = ImageStore::getInstance().acquire(data.image_filename, data.mipCount, data.mipFilter);
+        if (!imagePointer)
+            return nullptr;
+    }
+    const Image &image = *imagePointer;
+
+    // Distribution doesn't need full resolution of big environment maps.
+    const int maxWidth = 1024;
+    const int width = std::min(image.width(), maxWidth);
+    const int height = std::max(1, image.height() * width / image.width());
+
+    std::vector<float> function(width * height, 0.0f);
+    std::vector<float> pixels(size_t(image.width()) * 4);
+    for (int y = 0; y < image.height(); y++) {
+        const int row = y * height / image.height();
+        image.decodeRow(y, pixels.data());
+        for (int x = 0; x < image.width(); x++) {
+            const float *pixel = pixels.data() + x * 4;
+            function[row * width + x * width / image.width()] +=
+                0.2126f * pixel[0] + 0.7152f * pixel[1] + 0.0722f * pixel[2];
+        }
+    }
+
+    // Rows near the poles cover less solid angle in latitude-longitude mapping.
+    for (int y = 0; y < height; y++) {
+        const float sinTheta = sinf(M_PIf * (float(y) + 0.5f) / float(height));
+        for (int x = 0; x < width; x++)
+            function[y * width + x] *= sinTheta;
+    }
+
+    if (!buildDistribution2D(function, width, height, data.conditionalCdf, data.marginalCdf)) {
+        LogWarning("Texture '%s' is black, it can't be importance sampled", name.c_str());
+        return nullptr;
+    }
+    data.distributionSize = optix::make_int2(width, height);
+
+    LogInfo("Built importance sampling distribution for texture '%s' (%dx%d)", name.c_str(), width, height);
+    return &data;
+}
+
+void TexturePool::updateVirtualTextures()
+{
+    m_virtualImages.clear();
+    m_pages.clear();
+    std::vector<VirtualTextureDefinition> definitions;
+    std::map<const Image *, int> indices; // textures with the same image share their pages
+    for (auto &kv : m_textureMap) {
+        TextureData &data = kv.second;
+        if (!data.virtualTexture)
+            continue;
+
+        const Image &image = *data.image;
+        auto shared = indices.find(&image);
+        if (shared != indices.end()) {
+            data.virtualIndex = shared->second;
+            m_deduplicatedBytes += image.byteSize();
+            continue;
+        }
+        indices[&image] = int(definitions.size());
+        VirtualTextureDefinition definition;
+        definition.width = image.width();
+        definition.height = image.height();
+        definition.mipCount = image.mipCount();
+        definition.pageOffset = int(m_pages.size());
+        for (int level = 0; level < definition.mipCount; level++)
+            for (int y = 0; y < virtualTileCount(definition.height, level); y++)
+                for (int x = 0; x < virtualTileCount(definition.width, level); x++)
+                    m_pages.push_back(optix::make_int4(int(definitions.size()), level, x, y));
+
+        data.virtualIndex = int(definitions.size());
+        definitions.push_back(definition);
+        m_virtualImages.push_back(data.image);
+    }
+
+    // sheets of slots within the budget, none without virtual textures
+    const size_t sheetBytes = size_t(VIRTUAL_SHEET_SIZE) * VIRTUAL_SHEET_SIZE * 4;
+    const size_t budget = size_t(std::max(GlobalSettings::getInstance().virtualTextureBudget, 1)) * 1024 * 1024;
+    const int sheetCount = definitions.empty() ? 0 : std::max(1, int(budget / sheetBytes));
+    m_residency.reset(sheetCount * VIRTUAL_SHEET_SLOTS * VIRTUAL_SHEET_SLOTS);
+
+    // coarsest level of every texture stays resident, lookups fall back to it
+    std::vector<std::pair<int, int>> pinned;
+    for (auto &definition : definitions) {
+        const int page = definition.pageOffset +
+            virtualPageCount(definition.width, definition.height, definition.mipCount) - 1;
+        const int slot = m_residency.pin(page);
+        if (slot < 0) {
+            LogWarning("Virtual texture budget of %d MB is too small for all textures",
+                       GlobalSettings::getInstance().virtualTextureBudget);
+            break;
+        }
+        pinned.emplace_back(page, slot);
+    }
+
+    try {
+        for (auto &sampler : m_sheetSamplers)
+            sampler->destroy();
+        for (auto &buffer : m_sheetBuffers)
+            buffer->destroy();
+        m_sheetSamplers.clear();
+        m_sheetBuffers.clear();
+
+        // 8-bit sRGB like the textures themselves, lookups never leave the border of a slot
+        for (int i = 0; i < sheetCount; i++) {
+            optix::Buffer buffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_BYTE4,
+                                                           VIRTUAL_SHEET_SIZE, VIRTUAL_SHEET_SIZE);
+            optix::TextureSampler sampler = m_context->createTextureSampler();
+            sampler->setWrapMode(0, RT_WRAP_CLAMP_TO_EDGE);
+            sampler->setWrapMode(1, RT_WRAP_CLAMP_TO_EDGE);
+            sampler->setWrapMode(2, RT_WRAP_CLAMP_TO_EDGE);
+            sampler->setFilteringModes(RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_NONE);
+            sampler->setMaxAnisotropy(1.0f);
+            sampler->setReadMode(RT_TEXTURE_READ_NORMALIZED_FLOAT_SRGB);
+            sampler->setIndexingMode(RT_TEXTURE_INDEX_NORMALIZED_COORDINATES);
+            sampler->setBuffer(buffer);
+            m_sheetBuffers.push_back(buffer);
+            m_sheetSamplers.push_back(sampler);
+        }
+
+        m_bufferAtlasSheets->setSize(std::max(sheetCount, 1));
+        int *samplers = (int *) m_bufferAtlasSheets->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        samplers[0] = RT_TEXTURE_ID_NULL;
+        for (int i = 0; i < sheetCount; i++)
+            samplers[i] = m_sheetSamplers[i]->getId();
+        m_bufferAtlasSheets->unmap();
+        streamTiles(pinned);
+
+        m_bufferVirtualTextures->setSize(definitions.size());
+        if (!definitions.empty()) {
+            void *dst = m_bufferVirtualTextures->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+            memcpy(dst, definitions.data(), sizeof(VirtualTextureDefinition) * definitions.size());
+            m_bufferVirtualTextures->unmap();
+        }
+
+        const size_t pageCount = std::max(m_pages.size(), size_t(1));
+        m_bufferPageTable->setSize(pageCount);
+        int *pageTable = (int *) m_bufferPageTable->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        std::fill(pageTable, pageTable + pageCount, -1);
+        for (auto &page : pinned)
+            pageTable[page.first] = page.second;
+        m_bufferPageTable->unmap();
+
+        // the device stamps requests, stamps of earlier updates are stale and never have to be cleared
+        m_bufferTileFeedback->setSize(pageCount);
+        int *feedback = (int *) m_bufferTileFeedback->map(0, RT_BUFFER_MAP_WRITE_DISCARD);
+        std::fill(feedback, feedback + pageCount, 0);
+        m_bufferTileFeedback->unmap();
+        m_feedbackStamp = 1;
+        m_context["sysTileFeedbackStamp"]->setInt(m_feedbackStamp);
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Virtual texture error: %s", e.getErrorString().c_str()));
+    }
+
+    residentTiles = m_residency.residentCount();
+    if (!definitions.empty())
+        LogInfo("%d virtual textures with %d tiles, atlas of %d slots in %d sheets (%.1f MB)",
+                int(definitions.size()), int(m_pages.size()), m_residency.slotCount(), sheetCount,
+                double(sheetBytes) * sheetCount / (1024.0 * 1024.0));
+}
+
+// Copies a page with its border into a slot of the sheet it belongs to, texels outside of the level wrap around.
+void TexturePool::loadTile(int page, int slot, unsigned char *sheet) const
+{
+    const optix::int4 tile = m_pages[page];
+    const Image &image = *m_virtualImages[tile.x];
+
+    const unsigned char *level = image.data();
+    for (int i = 0; i < tile.y; i++)
+        level += size_t(mipLevelSize(image.width(), i)) * mipLevelSize(image.height(), i) * 4;
+    const int width = mipLevelSize(image.width(), tile.y);
+    const int height = mipLevelSize(image.height(), tile.y);
+
+    const int sheetSlot = slot % (VIRTUAL_SHEET_SLOTS * VIRTUAL_SHEET_SLOTS);
+    const int originX = (sheetSlot % VIRTUAL_SHEET_SLOTS) * VIRTUAL_SLOT_SIZE;
+    const int originY = (sheetSlot / VIRTUAL_SHEET_SLOTS) * VIRTUAL_SLOT_SIZE;
+    for (int y = 0; y < VIRTUAL_SLOT_SIZE; y++) {
+        const int sourceY = ((tile.w * VIRTUAL_TILE_SIZE - VIRTUAL_TILE_BORDER + y) % height + height) % height;
+        unsigned char *dst = sheet + (size_t(originY + y) * VIRTUAL_SHEET_SIZE + originX) * 4;
+        for (int x = 0; x < VIRTUAL_SLOT_SIZE; x++) {
+            const int sourceX = ((tile.z * VIRTUAL_TILE_SIZE - VIRTUAL_TILE_BORDER + x) % width + width) % width;
+            memcpy(dst + x * 4, level + (size_t(sourceY) * width + sourceX) * 4, 4);
+        }
+    }
+}
+
+// Copies (page, slot) pairs into the atlas. Every sheet that receives tiles is mapped once, OptiX has no partial
+// buffer updates, so the other sheets aren't uploaded again.
+void TexturePool::streamTiles(const std::vector<std::pair<int, int>> &tiles)
+{
+    const int slotsPerSheet = VIRTUAL_SHEET_SLOTS * VIRTUAL_SHEET_SLOTS;
+    std::vector<std::pair<int, int>> sorted(tiles);
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<int, int> &a, const std::pair<int, int> &b) {
+        return a.second < b.second;
+    });
+
+    for (size_t i = 0; i < sorted.size();) {
+        const int sheet = sorted[i].second / slotsPerSheet;
+        unsigned char *pixels = (unsigned char *) m_sheetBuffers[sheet]->map(0, RT_BUFFER_MAP_WRITE);
+        for (; i < sorted.size() && sorted[i].second / slotsPerSheet == sheet; i++)
+            loadTile(sorted[i].first, sorted[i].second, pixels);
+        m_sheetBuffers[sheet]->unmap();
+        uploadedSheets++;
+    }
+}
+
+// Packs all small textures into pages again, there are few of them and they are rebuilt on every load.
+void TexturePool::updateAtlasPages()
+{
+    std::vector<TextureData *> textures;
+    std::vector<std::shared_ptr<const Image>> images;
+    std::vector<optix::int2> sizes;
+    std::vector<std::pair<TextureData *, size_t>> duplicates; // textures with the same image share its placement
+    for (auto &kv : m_textureMap) {
+        TextureData &data = kv.second;
+        if (data.atlasPage < 0)
+            continue;
+
+        std::shared_ptr<const Image> image = data.image;
+        if (!image)
+            image = ImageStore::getInstance().acquire(data.image_filename, data.mipCount, data.mipFilter);
+        if (!image) {
+            data.atlasPage = -1;
+            continue;
+        }
+        auto shared = std::find(images.begin(), images.end(), image);
+        if (shared != images.end()) {
+            duplicates.emplace_back(&data, size_t(shared - images.begin()));
+            m_deduplicatedBytes += image->byteSize();
+            continue;
+        }
+        textures.push_back(&data);
+        images.push_back(image);
+        sizes.push_back(optix::make_int2(image->width(), image->height()));
+    }
+
+    const int pageSize = GlobalSettings::getInstance().atlasPageSize;
+    std::vector<AtlasPlacement> placements;
+    const int pageCount = packAtlas(sizes, pageSize, placements);
+
+    try {
+        for (auto &sampler : m_pageSamplers)
+            sampler->destroy();
+        for (auto &buffer : m_pageBuffers)
+            buffer->destroy();
+        m_pageSamplers.clear();
+        m_pageBuffers.clear();
+
+        // pages are filtered like 8-bit textures, the border keeps neighbours apart on all levels
+        std::vector<unsigned char> pixels(mipChainPixels(pageSize, pageSize, ATLAS_MIP_COUNT) * 4);
+        double usedTexels = 0.0;
+        for (int page = 0; page < pageCount; page++) {
+            std::fill(pixels.begin(), pixels.end(), 0);
+            int count = 0;
+            double texels = 0.0;
+            for (size_t i = 0; i < textures.size(); i++) {
+                if (placements[i].page != page)
+                    continue;
+                copyToAtlas(images[i]->data(), sizes[i].x, sizes[i].y, placements[i], pixels.data(), pageSize);
+                count++;
+                texels += double(sizes[i].x) * sizes[i].y;
+            }
+            buildMipPyramid(pixels.data(), pageSize, pageSize, ATLAS_MIP_COUNT,
+                            Image::levelFormat(Image::RGBA8_SRGB), MIP_FILTER_BOX);
+
+            optix::Buffer buffer = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_UNSIGNED_BYTE4,
+                                                           pageSize, pageSize);
+            buffer->setMipLevelCount(ATLAS_MIP_COUNT);
+            size_t offset = 0;
+            for (int level = 0; level < ATLAS_MIP_COUNT; level++) {
+                const size_t levelSize = size_t(mipLevelSize(pageSize, level)) * mipLevelSize(pageSize, level) * 4;
+                memcpy(buffer->map(level, RT_BUFFER_MAP_WRITE_DISCARD), pixels.data() + offset, levelSize);
+                buffer->unmap(level);
+                offset += levelSize;
+            }
+
+            // atlasUV wraps the coordinates, the sampler never has to
+            optix::TextureSampler sampler = m_context->createTextureSampler();
+            sampler->setWrapMode(0, RT_WRAP_CLAMP_TO_EDGE);
+            sampler->setWrapMode(1, RT_WRAP_CLAMP_TO_EDGE);
+            sampler->setWrapMode(2, RT_WRAP_CLAMP_TO_EDGE);
+            sampler->setFilteringModes(RT_FILTER_LINEAR, RT_FILTER_LINEAR, RT_FILTER_LINEAR);
+            sampler->setMaxAnisotropy(1.0f);
+            sampler->setReadMode(RT_TEXTURE_READ_NORMALIZED_FLOAT_SRGB);
+            sampler->setBuffer(buffer);
+            m_pageBuffers.push_back(buffer);
+            m_pageSamplers.push_back(sampler);
+
+            usedTexels += texels;
+            LogInfo("Atlas page %d holds %d textures, %.1f%% of it is used by texels", page, count,
+                    100.0 * texels / (double(pageSize) * pageSize));
+        }
+
+        atlasPages = pageCount;
+        atlasOccupancy = (0 < pageCount) ? float(100.0 * usedTexels / (double(pageSize) * pageSize * pageCount))
+                                         : 0.0f;
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Texture atlas error: %s", e.getErrorString().c_str()));
+    }
+
+    for (size_t i = 0; i < textures.size(); i++) {
+        textures[i]->atlasPage = placements[i].page;
+        textures[i]->atlasTransform = atlasTransform(sizes[i].x, sizes[i].y, placements[i], pageSize);
+        textures[i]->image = GlobalSettings::getInstance().keepHostTextures ? images[i] : nullptr;
+    }
+    for (auto &duplicate : duplicates) {
+        const TextureData &original = *textures[duplicate.second];
+        duplicate.first->atlasPage = original.atlasPage;
+        duplicate.first->atlasTransform = original.atlasTransform;
+        duplicate.first->image = original.image;
+    }
+}
+
+bool TexturePool::update()
+{
+    if (m_pages.empty())
+        return false;
+
+    try {
+        // read only, so the feedback isn't uploaded again, requests of this interval carry the current stamp
+        std::vector<int> requested;
+        const int *feedback = (const int *) m_bufferTileFeedback->map(0, RT_BUFFER_MAP_READ);
+        for (size_t page = 0; page < m_pages.size(); page++)
+            if (feedback[page] == m_feedbackStamp)
+                requested.push_back(int(page));
+        m_bufferTileFeedback->unmap();
+        m_feedbackStamp++;
+        m_context["sysTileFeedbackStamp"]->setInt(m_feedbackStamp);
+        if (requested.empty())
+            return false;
+
+        std::vector<std::pair<int, int>> loads;
+        std::vector<int> evictions;
+        m_residency.update(requested, maxTileLoads, loads, evictions);
+        if (loads.empty())
+            return false;
+
+        streamTiles(loads);
+
+        int *pageTable = (int *) m_bufferPageTable->map(0, RT_BUFFER_MAP_WRITE);
+        for (auto page : evictions)
+            pageTable[page] = -1;
+        for (auto &load : loads)
+            pageTable[load.first] = load.second;
+        m_bufferPageTable->unmap();
+
+        streamedTiles += int(loads.size());
+        residentTiles = m_residency.residentCount();
+    }
+    catch (optix::Exception &e) {
+        throw std::runtime_error(string_format("Virtual texture error: %s", e.getErrorString().c_str()));
+    }
+    return true;
+}
+
 void TexturePool::setContext(optix::Context context)
 {
-    if (m_context != context)
-        m_context = context;
+    if (m_context != context) {
+        try {
+            m_context = context;
+
+            // sampler IDs of the sheets holding resident tiles of virtual textures
+            m_bufferAtlasSheets = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT, 1);
+            m_context["sysVirtualAtlasSheets"]->setBuffer(m_bufferAtlasSheets);
+
+            m_bufferVirtualTextures = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_USER);
+            m_bufferVirtualTextures->setElementSize(sizeof(VirtualTextureDefinition));
+            m_bufferVirtualTextures->setSize(0);
+            m_context["sysVirtualTextures"]->setBuffer(m_bufferVirtualTextures);
+
+            // written by the device for requested tiles that are missing
+            m_bufferPageTable = m_context->createBuffer(RT_BUFFER_INPUT, RT_FORMAT_INT, 1);
+            m_bufferTileFeedback = m_context->createBuffer(RT_BUFFER_INPUT_OUTPUT, RT_FORMAT_INT, 1);
+            m_context["sysPageTable"]->setBuffer(m_bufferPageTable);
+            m_context["sysTileFeedback"]->setBuffer(m_bufferTileFeedback);
+
+            updateVirtualTextures();
+        }
+        catch (optix::Exception &e) {
+            throw std::runtime_error(string_format("Texture pool error: %s", e.getErrorString().c_str()));
+        }
+    }
 }
 
 TexturePool &TexturePool::getInstance(optix::Context context)
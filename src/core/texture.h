@@ -7,7 +7,18 @@
 
 #include <pugixml.hpp>
 
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <vector>
+
+#include "blockcompression.h"
+#include "mippyramid.h"
+#include "textureatlas.h"
+#include "tileresidency.h"
+#include "virtualtexture.h"
+
+class Image;
 
 struct TextureData
 {
@@ -15,15 +26,34 @@ struct TextureData
     optix::Buffer buffer;
 
     std::string image_filename;
+    uint64_t contentHash;  // Of the image file, textures with equal content and settings share device data.
     int mipCount;
-
-    TextureData() : sampler(nullptr), buffer(nullptr), image_filename(), mipCount(1) {}
+    MipFilter mipFilter;
+    BlockFormat compression;
+    bool virtualTexture;   // Tiles are streamed into the atlas on demand, there is no sampler then.
+    int virtualIndex;      // Into sysVirtualTextures.
+    int atlasPage;         // Page of small textures packed into an atlas, -1 for textures with their own sampler.
+                           // Packed textures get a sampler as well when they are used without the atlas.
+    optix::float4 atlasTransform;
+    optix::float3 average; // Average color of the finest mip level, computed on the first request.
+    bool averageValid;
+    std::shared_ptr<const Image> image; // Host pixels of virtual textures, of the others only with keep_host_textures.
+
+    // luminance distribution for importance sampling, built on demand
+    optix::int2 distributionSize;
+    std::vector<float> conditionalCdf;
+    std::vector<float> marginalCdf;
+
+    TextureData() : sampler(nullptr), buffer(nullptr), image_filename(), contentHash(0), mipCount(1), mipFilter(MIP_FILTER_BOX),
+        compression(BLOCK_NONE), virtualTexture(false), virtualIndex(-1),
+        atlasPage(-1), atlasTransform(atlasIdentity()),
+        average(optix::make_float3(0.0f)), averageValid(false), distributionSize(optix::make_int2(0, 0)) {}
 
     void destroy()
     {
-        if (sampler->get())
+        if (sampler && sampler->get())
             sampler->destroy();
-        if (buffer->get())
+        if (buffer && buffer->get())
             buffer->destroy();
     }
 };
@@ -35,20 +65,55 @@ public:
     ~TexturePool();
 
     bool load(const pugi::xml_node &node);
-    int id(const pugi::xml_node &node, float &scale);
+    // Textures packed into an atlas are found in their page with atlasTransform, callers without it get a sampler
+    // of their own for them.
+    int id(const pugi::xml_node &node, float &scale, optix::float4 *atlasTransform = nullptr);
+    optix::float3 average(const pugi::xml_node &node);
+    const TextureData *distribution(const pugi::xml_node &node);
+
+    // Streams tiles of virtual textures requested by the last frame into the atlas.
+    // Returns true when tiles were loaded, the image changes then.
+    bool update();
 
     static TexturePool& getInstance(optix::Context context);
 
 private:
-    TexturePool() : m_context(nullptr) {}
+    TexturePool() : m_context(nullptr), m_deduplicatedBytes(0), m_feedbackStamp(1) {}
     void setContext(optix::Context context);
 
     optix::Context m_context;
 
+    bool upToDate(const pugi::xml_node &node, const std::string &name) const;
     bool loadTexture(const pugi::xml_node &node, const std::string &name);
+    bool uploadTexture(const std::string &name, const Image &image, TextureData &data) const;
     bool unloadTexture(const std::string &name);
+    bool sharesDeviceData(const std::string &name, const TextureData &data) const;
+    void releaseDeviceData(const std::string &name, TextureData &data) const;
+
+    void updateVirtualTextures();
+    void loadTile(int page, int slot, unsigned char *sheet) const;
+    void streamTiles(const std::vector<std::pair<int, int>> &tiles);
+
+    void updateAtlasPages();
 
     std::map<std::string, TextureData> m_textureMap;
+    size_t m_deduplicatedBytes; // Image bytes not uploaded again during the current load.
+
+    // virtual textures
+    std::vector<std::shared_ptr<const Image>> m_virtualImages;
+    std::vector<optix::int4> m_pages; // Texture, level, tile x and y of every page.
+    TileResidency m_residency;
+    int m_feedbackStamp;
+    optix::Buffer m_bufferVirtualTextures;
+    optix::Buffer m_bufferPageTable;
+    optix::Buffer m_bufferTileFeedback;
+    optix::Buffer m_bufferAtlasSheets;
+    std::vector<optix::Buffer> m_sheetBuffers;
+    std::vector<optix::TextureSampler> m_sheetSamplers;
+
+    // pages of packed small textures
+    std::vector<optix::Buffer> m_pageBuffers;
+    std::vector<optix::TextureSampler> m_pageSamplers;
 
 };
 
@@ -0,0 +1,78 @@
+
+#include "textureatlas.h"
+
+#include <cstring>
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imgui/stb_rect_pack.h"
+
+// Size of a texture with its border, in grid cells.
+static int atlasCells(int size)
+{
+    return (size + 2 * ATLAS_BORDER + ATLAS_BORDER - 1) / ATLAS_BORDER;
+}
+
+int packAtlas(const std::vector<optix::int2> &sizes, int pageSize, std::vector<AtlasPlacement> &placements)
+{
+    // the packer works on the grid, so that positions stay aligned
+    const int cellsPerRow = pageSize / ATLAS_BORDER;
+    placements.assign(sizes.size(), AtlasPlacement{-1, 0, 0});
+
+    std::vector<stbrp_rect> remaining;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        stbrp_rect rect = {};
+        rect.id = int(i);
+        rect.w = stbrp_coord(atlasCells(sizes[i].x));
+        rect.h = stbrp_coord(atlasCells(sizes[i].y));
+        if (rect.w <= cellsPerRow && rect.h <= cellsPerRow)
+            remaining.push_back(rect);
+    }
+
+    int pages = 0;
+    std::vector<stbrp_node> nodes(cellsPerRow);
+    while (!remaining.empty()) {
+        stbrp_context context;
+        stbrp_init_target(&context, cellsPerRow, cellsPerRow, nodes.data(), int(nodes.size()));
+        stbrp_pack_rects(&context, remaining.data(), int(remaining.size()));
+
+        std::vector<stbrp_rect> rest;
+        for (auto &rect : remaining) {
+            if (!rect.was_packed) {
+                rest.push_back(rect);
+                continue;
+            }
+            placements[rect.id].page = pages;
+            placements[rect.id].x = rect.x * ATLAS_BORDER + ATLAS_BORDER;
+            placements[rect.id].y = rect.y * ATLAS_BORDER + ATLAS_BORDER;
+        }
+        remaining.swap(rest);
+        pages++;
+    }
+    return pages;
+}
+
+void copyToAtlas(const unsigned char *pixels, int width, int height, const AtlasPlacement &placement,
+    unsigned char *page, int pageSize)
+{
+    const int cellsX = atlasCells(width) * ATLAS_BORDER;
+    const int cellsY = atlasCells(height) * ATLAS_BORDER;
+    const int originX = placement.x - ATLAS_BORDER;
+    const int originY = placement.y - ATLAS_BORDER;
+    for (int y = 0; y < cellsY; y++) {
+        const int sourceY = ((y - ATLAS_BORDER) % height + height) % height;
+        const unsigned char *src = pixels + size_t(sourceY) * width * 4;
+        unsigned char *dst = page + (size_t(originY + y) * pageSize + originX) * 4;
+        for (int x = 0; x < cellsX; x++) {
+            const int sourceX = ((x - ATLAS_BORDER) % width + width) % width;
+            memcpy(dst + x * 4, src + sourceX * 4, 4);
+        }
+    }
+}
+
+optix::float4 atlasTransform(int width, int height, const AtlasPlacement &placement, int pageSize)
+{
+    const float size = float(pageSize);
+    return optix::make_float4(float(width) / size, float(height) / size,
+                              float(placement.x) / size, float(placement.y) / size);
+}
@@ -0,0 +1,55 @@
+
+#ifndef RENDERER_GPU_TEXTUREATLAS_H
+#define RENDERER_GPU_TEXTUREATLAS_H
+
+#include "../utils/config.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+// Small textures can share atlas pages. Every texture is placed on a grid of ATLAS_BORDER texels and surrounded
+// by ATLAS_BORDER texels of its own wrapped content, so that its region stays aligned and keeps a border of
+// at least one texel on all ATLAS_MIP_COUNT levels of the page.
+#define ATLAS_MIP_COUNT 5
+#define ATLAS_BORDER    (1 << (ATLAS_MIP_COUNT - 1))
+
+// Identity transform of textures that aren't in an atlas, scale in xy and offset in zw.
+RT_FUNCTION optix::float4 atlasIdentity()
+{
+    return optix::make_float4(1.0f, 1.0f, 0.0f, 0.0f);
+}
+
+// Wraps uv into the texture and maps it into its region of the page.
+RT_FUNCTION optix::float2 atlasUV(const optix::float4 &transform, const optix::float2 uv)
+{
+    return optix::make_float2(transform.z + transform.x * (uv.x - floorf(uv.x)),
+                              transform.w + transform.y * (uv.y - floorf(uv.y)));
+}
+
+RT_FUNCTION optix::float2 atlasFootprint(const optix::float4 &transform, const optix::float2 footprint)
+{
+    return optix::make_float2(transform.x * footprint.x, transform.y * footprint.y);
+}
+
+#ifndef __CUDACC__
+#include <vector>
+
+struct AtlasPlacement
+{
+    int page; // -1 when the texture doesn't fit into a page
+    int x;    // Texel position of the texture in its page, its border is around it.
+    int y;
+};
+
+// Packs textures of the given sizes into as few square pages of pageSize texels as possible.
+// Returns the number of pages.
+int packAtlas(const std::vector<optix::int2> &sizes, int pageSize, std::vector<AtlasPlacement> &placements);
+
+// Copies an RGBA8 image to its placement on a page and fills the border around it with wrapped texels.
+void copyToAtlas(const unsigned char *pixels, int width, int height, const AtlasPlacement &placement,
+    unsigned char *page, int pageSize);
+
+// Transform of the texture coordinates of a placed texture, see atlasUV.
+optix::float4 atlasTransform(int width, int height, const AtlasPlacement &placement, int pageSize);
+#endif
+
+#endif //RENDERER_GPU_TEXTUREATLAS_H
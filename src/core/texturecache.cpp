@@ -0,0 +1,198 @@
+
+#include "texturecache.h"
+
+#include "image.h"
+#include "globalsettings.h"
+#include "../utils/hash.h"
+#include "../utils/log.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+struct TextureCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t contentHash;
+    int32_t requestedMipCount;
+    uint32_t mipFilter;
+    uint32_t format;
+    int32_t width;
+    int32_t height;
+    int32_t mipCount;
+    uint64_t dataSize;
+};
+
+static const char textureCacheMagic[4] = {'T', 'X', 'C', 'H'};
+static const uint32_t textureCacheVersion = 1;
+static const char *textureCacheExtension = ".tex";
+
+// pixels start on a page boundary, so that the mapped levels are aligned
+static const size_t textureCacheDataOffset = 4096;
+
+static bool cacheEnabled()
+{
+    const GlobalSettings &settings = GlobalSettings::getInstance();
+    return 0 < settings.textureCacheSize && !settings.textureCacheDirectory.empty();
+}
+
+static std::string cacheFilename(uint64_t contentHash, int mipCount, MipFilter mipFilter)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-m%d-%s", (unsigned long long) contentHash, mipCount,
+             mipFilterName(mipFilter));
+    return GlobalSettings::getInstance().textureCacheDirectory + "/" + name + textureCacheExtension;
+}
+
+static bool readCache(const std::string &cacheFile, uint64_t contentHash, Image &image)
+{
+    MappedFile file;
+    if (!mapFile(cacheFile, file))
+        return false;
+
+    TextureCacheHeader header;
+    bool valid = textureCacheDataOffset <= file.size;
+    if (valid) {
+        memcpy(&header, file.data, sizeof(header));
+        valid = memcmp(header.magic, textureCacheMagic, sizeof(textureCacheMagic)) == 0 &&
+            header.version == textureCacheVersion && header.contentHash == contentHash &&
+            header.requestedMipCount == image.mipCount() && header.mipFilter == uint32_t(image.mipFilter()) &&
+            header.format <= uint32_t(Image::RGBA8_SRGB) && 0 < header.width && 0 < header.height &&
+            0 < header.mipCount && textureCacheDataOffset + header.dataSize <= file.size;
+    }
+    if (valid) {
+        image.load(file, textureCacheDataOffset, Image::Format(header.format), header.width, header.height,
+                   header.mipCount);
+        valid = image.byteSize() == header.dataSize;
+        if (!valid) {
+            image.clear();
+            image = Image(header.requestedMipCount, MipFilter(header.mipFilter));
+        }
+    }
+    else
+        unmapFile(file);
+    if (!valid)
+        return false;
+
+    // modification time orders the files for cleanup
+    utime(cacheFile.c_str(), nullptr);
+    return true;
+}
+
+static void writeCache(const std::string &cacheFile, uint64_t contentHash, int requestedMipCount,
+    const Image &image)
+{
+    mkdir(GlobalSettings::getInstance().textureCacheDirectory.c_str(), 0755);
+
+    TextureCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, textureCacheMagic, sizeof(textureCacheMagic));
+    header.version = textureCacheVersion;
+    header.contentHash = contentHash;
+    header.requestedMipCount = requestedMipCount;
+    header.mipFilter = uint32_t(image.mipFilter());
+    header.format = uint32_t(image.format());
+    header.width = image.width();
+    header.height = image.height();
+    header.mipCount = image.mipCount();
+    header.dataSize = image.byteSize();
+
+    // written under a temporary name, other threads or processes never map a partial file
+    const std::string temporaryFile =
+        cacheFile + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    {
+        std::vector<char> headerPage(textureCacheDataOffset, 0);
+        memcpy(headerPage.data(), &header, sizeof(header));
+        std::ofstream file(temporaryFile, std::ios::out | std::ios::binary);
+        file.write(headerPage.data(), headerPage.size());
+        file.write((const char *) image.data(), image.byteSize());
+        if (!file) {
+            LogWarning("Couldn't write texture cache '%s'", cacheFile.c_str());
+            file.close();
+            remove(temporaryFile.c_str());
+            return;
+        }
+    }
+    if (rename(temporaryFile.c_str(), cacheFile.c_str()) != 0)
+        remove(temporaryFile.c_str());
+}
+
+bool loadCachedImage(const std::string &filename, uint64_t contentHash, Image &image)
+{
+    if (!cacheEnabled())
+        return image.load(filename);
+
+    const int requestedMipCount = image.mipCount();
+    const std::string cacheFile = cacheFilename(contentHash, requestedMipCount, image.mipFilter());
+    if (readCache(cacheFile, contentHash, image)) {
+        LogInfo("Image '%s' was mapped from texture cache '%s'", filename.c_str(), cacheFile.c_str());
+        return true;
+    }
+
+    if (!image.load(filename))
+        return false;
+    writeCache(cacheFile, contentHash, requestedMipCount, image);
+    return true;
+}
+
+void trimTextureCache()
+{
+    if (!cacheEnabled())
+        return;
+
+    const std::string &directory = GlobalSettings::getInstance().textureCacheDirectory;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+        return;
+
+    struct CacheFile
+    {
+        std::string path;
+        size_t size;
+        time_t time;
+    };
+    std::vector<CacheFile> files;
+    size_t totalSize = 0;
+    const size_t extensionLength = strlen(textureCacheExtension);
+    while (dirent *entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() <= extensionLength ||
+            name.compare(name.size() - extensionLength, extensionLength, textureCacheExtension) != 0)
+            continue;
+        const std::string path = directory + "/" + name;
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0)
+            continue;
+        files.push_back({path, size_t(status.st_size), status.st_mtime});
+        totalSize += size_t(status.st_size);
+    }
+    closedir(dir);
+
+    // mapped files stay readable after they are removed
+    const size_t limit = size_t(GlobalSettings::getInstance().textureCacheSize) * 1024 * 1024;
+    std::sort(files.begin(), files.end(), [](const CacheFile &a, const CacheFile &b) { return a.time < b.time; });
+    size_t removedSize = 0;
+    int removedCount = 0;
+    for (auto &file : files) {
+        if (totalSize <= limit)
+            break;
+        if (remove(file.path.c_str()) != 0)
+            continue;
+        totalSize -= file.size;
+        removedSize += file.size;
+        removedCount++;
+    }
+    if (removedCount)
+        LogInfo("Removed %d least recently used files (%.2f MB) from texture cache '%s'", removedCount,
+                double(removedSize) / (1024.0 * 1024.0), directory.c_str());
+}
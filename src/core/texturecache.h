@@ -0,0 +1,20 @@
+
+#ifndef RENDERER_GPU_TEXTURECACHE_H
+#define RENDERER_GPU_TEXTURECACHE_H
+
+#include <cstdint>
+#include <string>
+
+class Image;
+
+// Disk cache of processed mip pyramids, keyed by a hash of the source file content and the
+// requested mip count and filter. Cached pixels are memory mapped and uploaded from the mapping.
+
+// Loads image from the cache, or decodes it and adds it to the cache. contentHash is the hashFile of filename,
+// mip count and filter requested in the constructor of image are part of the key. Safe to call from several threads.
+bool loadCachedImage(const std::string &filename, uint64_t contentHash, Image &image);
+
+// Removes least recently used files until the cache fits into its size limit.
+void trimTextureCache();
+
+#endif //RENDERER_GPU_TEXTURECACHE_H
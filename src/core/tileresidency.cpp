@@ -0,0 +1,102 @@
+
+#include "tileresidency.h"
+
+TileResidency::TileResidency(int slotCount)
+{
+    reset(slotCount);
+}
+
+void TileResidency::reset(int slotCount)
+{
+    m_slotCount = slotCount;
+    m_frame = 0;
+    m_pages.clear();
+    m_recent.clear();
+    m_freeSlots.clear();
+    for (int slot = slotCount - 1; 0 <= slot; slot--)
+        m_freeSlots.push_back(slot);
+}
+
+int TileResidency::pin(int page)
+{
+    auto found = m_pages.find(page);
+    if (found != m_pages.end()) {
+        if (!found->second.pinned) {
+            m_recent.erase(found->second.position);
+            found->second.pinned = true;
+        }
+        return found->second.slot;
+    }
+    if (m_freeSlots.empty())
+        return -1;
+
+    Entry entry;
+    entry.slot = m_freeSlots.back();
+    entry.frame = m_frame;
+    entry.pinned = true;
+    m_freeSlots.pop_back();
+    m_pages[page] = entry;
+    return entry.slot;
+}
+
+void TileResidency::update(const std::vector<int> &requested, int maxLoads,
+    std::vector<std::pair<int, int>> &loads, std::vector<int> &evictions)
+{
+    loads.clear();
+    evictions.clear();
+    m_frame++;
+
+    // resident pages first, so that none of them is evicted for a missing one
+    std::vector<int> missing;
+    for (auto page : requested) {
+        auto found = m_pages.find(page);
+        if (found == m_pages.end()) {
+            missing.push_back(page);
+            continue;
+        }
+        Entry &entry = found->second;
+        entry.frame = m_frame;
+        if (!entry.pinned)
+            m_recent.splice(m_recent.begin(), m_recent, entry.position);
+    }
+
+    for (auto page : missing) {
+        if (int(loads.size()) == maxLoads)
+            break;
+        if (m_pages.find(page) != m_pages.end())
+            continue; // requested twice
+
+        int slot;
+        if (!m_freeSlots.empty()) {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        else {
+            if (m_recent.empty())
+                break;
+            const int victim = m_recent.back();
+            Entry &victimEntry = m_pages[victim];
+            if (victimEntry.frame == m_frame)
+                break; // everything resident is in use
+            slot = victimEntry.slot;
+            m_recent.pop_back();
+            m_pages.erase(victim);
+            evictions.push_back(victim);
+        }
+
+        m_recent.push_front(page);
+        Entry entry;
+        entry.slot = slot;
+        entry.frame = m_frame;
+        entry.pinned = false;
+        entry.position = m_recent.begin();
+        m_pages[page] = entry;
+        loads.emplace_back(page, slot);
+    }
+}
+
+int TileResidency::slot(int page) const
+{
+    auto found = m_pages.find(page);
+    return (found == m_pages.end()) ? -1 : found->second.slot;
+}
@@ -0,0 +1,49 @@
+
+#ifndef RENDERER_GPU_TILERESIDENCY_H
+#define RENDERER_GPU_TILERESIDENCY_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Assigns pages of virtual textures to a fixed number of physical slots.
+// Pages requested by the feedback of a frame are loaded into free slots, or into slots of the least recently
+// used pages. Pinned pages are never evicted. Doesn't depend on OptiX, pages and slots are plain indices.
+class TileResidency
+{
+public:
+    explicit TileResidency(int slotCount = 0);
+
+    void reset(int slotCount);
+
+    // Makes page resident for good. Returns its slot, or -1 when there is no free slot.
+    int pin(int page);
+
+    // Marks requested pages as used in a new frame and assigns slots to missing ones, at most maxLoads of them.
+    // Pages used in this frame are never evicted for others of the same frame, those requests wait.
+    // loads receives (page, slot) pairs to stream in, evictions the pages whose slots were taken.
+    void update(const std::vector<int> &requested, int maxLoads, std::vector<std::pair<int, int>> &loads,
+        std::vector<int> &evictions);
+
+    int slot(int page) const;
+    int slotCount() const { return m_slotCount; }
+    int residentCount() const { return int(m_pages.size()); }
+
+private:
+    struct Entry
+    {
+        int slot;
+        int frame;
+        bool pinned;
+        std::list<int>::iterator position;
+    };
+
+    int m_slotCount;
+    int m_frame;
+    std::vector<int> m_freeSlots;
+    std::unordered_map<int, Entry> m_pages;
+    std::list<int> m_recent; // Unpinned resident pages, most recently used first.
+};
+
+#endif //RENDERER_GPU_TILERESIDENCY_H
@@ -0,0 +1,168 @@
+
+#include "tilescheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Tile sizes are multiples of this, launches of odd sizes waste threads of partial warps.
+#define TILE_SIZE_STEP 16
+#define MIN_TILE_SIZE 32
+// Used until the first launches are measured, also the old fixed size.
+#define INITIAL_TILE_SIZE 128
+// A frame is filled by about this many launches, so that the last one doesn't overshoot by much.
+#define TILES_PER_FRAME 4
+
+// Weight of the previous launches against a new one.
+static const double COST_DECAY = 0.9;
+
+TileOrder parseTileOrder(const std::string &name)
+{
+    if (name == "hilbert")
+        return TILE_ORDER_HILBERT;
+    if (name == "center")
+        return TILE_ORDER_CENTER;
+    return TILE_ORDER_ROWS;
+}
+
+const char *tileOrderName(TileOrder order)
+{
+    switch (order) {
+    case TILE_ORDER_HILBERT: return "hilbert";
+    case TILE_ORDER_CENTER: return "center";
+    default: return "rows";
+    }
+}
+
+// Cell d along the Hilbert curve through an n x n grid, n is a power of two.
+static optix::int2 hilbertCell(int n, int d)
+{
+    int x = 0, y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        const int rx = 1 & (d / 2);
+        const int ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+    return optix::make_int2(x, y);
+}
+
+std::vector<optix::int2> orderTiles(int width, int height, int tileSize, TileOrder order)
+{
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<optix::int2> tiles;
+    tiles.reserve(size_t(tilesX) * tilesY);
+
+    if (order == TILE_ORDER_HILBERT) {
+        // the curve covers the next power of two, cells outside of the image are skipped
+        int n = 1;
+        while (n < tilesX || n < tilesY)
+            n *= 2;
+        for (int d = 0; d < n * n; d++) {
+            const optix::int2 cell = hilbertCell(n, d);
+            if (cell.x < tilesX && cell.y < tilesY)
+                tiles.push_back(optix::make_int2(cell.x * tileSize, cell.y * tileSize));
+        }
+        return tiles;
+    }
+
+    for (int y = 0; y < tilesY; y++)
+        for (int x = 0; x < tilesX; x++)
+            tiles.push_back(optix::make_int2(x * tileSize, y * tileSize));
+
+    if (order == TILE_ORDER_CENTER) {
+        // distances of tile centers, rows order is kept for tiles at the same distance
+        auto distance = [&](const optix::int2 &tile) {
+            const float x = tile.x + 0.5f * std::min(tileSize, width - tile.x) - 0.5f * width;
+            const float y = tile.y + 0.5f * std::min(tileSize, height - tile.y) - 0.5f * height;
+            return x * x + y * y;
+        };
+        std::stable_sort(tiles.begin(), tiles.end(), [&](const optix::int2 &a, const optix::int2 &b) {
+            return distance(a) < distance(b);
+        });
+    }
+    return tiles;
+}
+
+LaunchCostModel::LaunchCostModel()
+    : m_weight(0.0), m_pixels(0.0), m_time(0.0), m_pixelsSquared(0.0), m_pixelsTime(0.0),
+    m_overhead(0.0f), m_costPerPixel(0.0f)
+{
+}
+
+void LaunchCostModel::record(int pixels, float microseconds)
+{
+    if (pixels <= 0 || !(0.0f <= microseconds))
+        return;
+    const double x = pixels;
+    const double y = microseconds;
+    m_weight = m_weight * COST_DECAY + 1.0;
+    m_pixels = m_pixels * COST_DECAY + x;
+    m_time = m_time * COST_DECAY + y;
+    m_pixelsSquared = m_pixelsSquared * COST_DECAY + x * x;
+    m_pixelsTime = m_pixelsTime * COST_DECAY + x * y;
+    fit();
+}
+
+void LaunchCostModel::fit()
+{
+    const double meanPixels = m_pixels / m_weight;
+    const double meanTime = m_time / m_weight;
+    const double variance = m_pixelsSquared / m_weight - meanPixels * meanPixels;
+    const double covariance = m_pixelsTime / m_weight - meanPixels * meanTime;
+
+    // launches of a pass mostly have the same size, then only the cost per pixel can be fitted
+    // and the overhead of the last fit is kept
+    if (1e-4 * meanPixels * meanPixels < variance) {
+        const double cost = covariance / variance;
+        const double overhead = meanTime - cost * meanPixels;
+        if (0.0 < cost && 0.0 <= overhead) {
+            m_costPerPixel = float(cost);
+            m_overhead = float(overhead);
+            return;
+        }
+    }
+    m_overhead = float(std::min(double(m_overhead), meanTime));
+    m_costPerPixel = float((meanTime - m_overhead) / meanPixels);
+}
+
+float LaunchCostModel::predict(int pixels) const
+{
+    return m_overhead + m_costPerPixel * float(pixels);
+}
+
+TileSizeController::TileSizeController()
+    : m_budget(INFINITY)
+{
+}
+
+int TileSizeController::tileSize(int width, int height) const
+{
+    // a single launch covers the whole image
+    const int largest = (std::max(width, height) + TILE_SIZE_STEP - 1) / TILE_SIZE_STEP * TILE_SIZE_STEP;
+    if (std::isinf(m_budget))
+        return largest;
+    if (!m_model.valid())
+        return std::min(INITIAL_TILE_SIZE, largest);
+    if (m_model.costPerPixel() <= 0.0f)
+        return largest;
+
+    const float pixels = (m_budget / TILES_PER_FRAME - m_model.overhead()) / m_model.costPerPixel();
+    const int size = int(sqrtf(std::max(pixels, 0.0f)) / TILE_SIZE_STEP) * TILE_SIZE_STEP;
+    return std::max(std::min(size, largest), std::min(MIN_TILE_SIZE, largest));
+}
+
+bool TileSizeController::fits(int pixels, float elapsed) const
+{
+    if (std::isinf(m_budget) || !m_model.valid())
+        return elapsed < m_budget;
+    return elapsed + m_model.predict(pixels) <= m_budget;
+}
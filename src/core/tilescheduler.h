@@ -0,0 +1,76 @@
+
+#ifndef RENDERER_GPU_TILESCHEDULER_H
+#define RENDERER_GPU_TILESCHEDULER_H
+
+#include <optixu/optixu_math_namespace.h>
+
+#include <string>
+#include <vector>
+
+enum TileOrder
+{
+    TILE_ORDER_ROWS = 0,    // row by row from the bottom left
+    TILE_ORDER_HILBERT = 1, // along a Hilbert curve, neighbouring launches touch neighbouring pixels
+    TILE_ORDER_CENTER = 2   // from the center of the image outwards, the region of interest converges first
+};
+
+TileOrder parseTileOrder(const std::string &name);
+const char *tileOrderName(TileOrder order);
+
+// Lower left pixels of the tiles covering a width x height image, in launch order. Tiles at the right
+// and top edges are cut off by the image.
+std::vector<optix::int2> orderTiles(int width, int height, int tileSize, TileOrder order);
+
+// Launch time modelled as overhead + cost * pixels, fitted by least squares over recent launches.
+// Older launches fade out, so the model follows changes of the scene and the view.
+class LaunchCostModel
+{
+public:
+    LaunchCostModel();
+
+    void record(int pixels, float microseconds);
+    float predict(int pixels) const;
+
+    float overhead() const { return m_overhead; }
+    float costPerPixel() const { return m_costPerPixel; }
+    bool valid() const { return 0.0f < m_weight; }
+
+private:
+    void fit();
+
+    // Exponentially weighted sums of the launches.
+    double m_weight;
+    double m_pixels;
+    double m_time;
+    double m_pixelsSquared;
+    double m_pixelsTime;
+
+    float m_overhead;
+    float m_costPerPixel;
+};
+
+// Picks the tile size of the next pass over the image so that a frame budget is filled by a few launches,
+// and decides whether another launch still fits into the current frame.
+class TileSizeController
+{
+public:
+    TileSizeController();
+
+    // Budget of one frame in microseconds, infinite when a frame may take any time.
+    void setBudget(float microseconds) { m_budget = microseconds; }
+    float budget() const { return m_budget; }
+
+    // Tile size of the next pass, a multiple of TILE_SIZE_STEP. Without measurements the initial size is kept.
+    int tileSize(int width, int height) const;
+    // Whether a launch of pixels, started after elapsed microseconds of the frame, ends within the budget.
+    bool fits(int pixels, float elapsed) const;
+    void record(int pixels, float microseconds) { m_model.record(pixels, microseconds); }
+
+    const LaunchCostModel &model() const { return m_model; }
+
+private:
+    LaunchCostModel m_model;
+    float m_budget;
+};
+
+#endif //RENDERER_GPU_TILESCHEDULER_H
@@ -0,0 +1,241 @@
+
+#include "tonemapper.h"
+
+#include "../utils/threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Dither noise repeats every DITHER_SIZE pixels.
+#define DITHER_SIZE 64
+// Rows converted by one task.
+#define TONEMAP_ROWS_PER_TASK 16
+
+static const float FILMIC_WHITE = 11.2f;
+
+// Above the linear segment sRGB is 1.055 x^(1/2.4) - 0.055, which is smooth in y = x^(1/4). A polynomial of
+// degree 5 in u = SRGB_SCALE * y + SRGB_OFFSET, fitted for 255 * sRGB, stays within 0.005 codes of the exact
+// encoding, so no table lookups are needed.
+static const float SRGB_LINEAR_END = 0.0031308f;
+static const float SRGB_SCALE = 2.6196699f;
+static const float SRGB_OFFSET = -1.6196699f;
+static const float SRGB_POLYNOMIAL[6] = {106.690467f, 124.215511f, 25.5433304f, -1.73985509f, 0.419920252f,
+                                         -0.132185419f};
+
+ToneMapOperator parseToneMapOperator(const std::string &name)
+{
+    if (name == "reinhard")
+        return TONEMAP_REINHARD;
+    if (name == "aces")
+        return TONEMAP_ACES;
+    if (name == "filmic")
+        return TONEMAP_FILMIC;
+    return TONEMAP_CLAMP;
+}
+
+const char *toneMapOperatorName(ToneMapOperator toneOperator)
+{
+    switch (toneOperator) {
+    case TONEMAP_REINHARD: return "reinhard";
+    case TONEMAP_ACES: return "aces";
+    case TONEMAP_FILMIC: return "filmic";
+    default: return "clamp";
+    }
+}
+
+// White noise in [-0.5, 0.5) from an integer hash, alpha isn't dithered.
+struct DitherNoise
+{
+    float values[DITHER_SIZE * DITHER_SIZE * 4];
+
+    DitherNoise()
+    {
+        for (uint32_t i = 0; i < DITHER_SIZE * DITHER_SIZE * 4; i++) {
+            uint32_t hash = i * 0x9e3779b9u;
+            hash ^= hash >> 16;
+            hash *= 0x85ebca6bu;
+            hash ^= hash >> 13;
+            hash *= 0xc2b2ae35u;
+            hash ^= hash >> 16;
+            values[i] = (i % 4 == 3) ? 0.0f : float(hash >> 8) / float(1 << 24) - 0.5f;
+        }
+    }
+};
+
+static const DitherNoise &ditherNoise()
+{
+    static const DitherNoise noise;
+    return noise;
+}
+
+static float hable(float x)
+{
+    const float A = 0.15f, B = 0.50f, C = 0.10f, D = 0.20f, E = 0.02f, F = 0.30f;
+    return (x * (A * x + C * B) + D * E) / (x * (A * x + B) + D * F) - E / F;
+}
+
+// Tone curve of one channel, x is exposed and not negative. Result is in [0, 1].
+static float toneCurve(float x, ToneMapOperator toneOperator)
+{
+    switch (toneOperator) {
+    case TONEMAP_REINHARD:
+        x = x / (1.0f + x);
+        break;
+    case TONEMAP_ACES:
+        x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+        break;
+    case TONEMAP_FILMIC:
+        x = hable(2.0f * x) / hable(FILMIC_WHITE);
+        break;
+    default:
+        break;
+    }
+    return (x < 1.0f) ? x : 1.0f;
+}
+
+// sRGB code of a value in [0, 1], not rounded.
+static float encodeSrgb(float value)
+{
+    if (value <= SRGB_LINEAR_END)
+        return 255.0f * 12.92f * value;
+    const float u = SRGB_SCALE * sqrtf(sqrtf(value)) + SRGB_OFFSET;
+    float code = SRGB_POLYNOMIAL[5];
+    for (int i = 4; 0 <= i; i--)
+        code = code * u + SRGB_POLYNOMIAL[i];
+    return code;
+}
+
+static unsigned char quantize(float code)
+{
+    code = (0.0f < code) ? code : 0.0f;
+    return (unsigned char) ((code < 255.0f) ? code + 0.5f : 255.5f);
+}
+
+static void toneMapPixel(const float *src, float scale, ToneMapOperator toneOperator,
+                         const float *dither, unsigned char *dst)
+{
+    for (int c = 0; c < 3; c++) {
+        const float x = src[c] * scale;
+        const float value = toneCurve((0.0f < x) ? x : 0.0f, toneOperator); // also removes NaNs
+        dst[c] = quantize(encodeSrgb(value) + dither[c]);
+    }
+    const float alpha = (0.0f < src[3]) ? src[3] : 0.0f;
+    dst[3] = quantize(((alpha < 1.0f) ? alpha : 1.0f) * 255.0f);
+}
+
+#ifdef __SSE2__
+static __m128 hable(__m128 x)
+{
+    const __m128 A = _mm_set1_ps(0.15f), B = _mm_set1_ps(0.50f), CB = _mm_set1_ps(0.10f * 0.50f);
+    const __m128 DE = _mm_set1_ps(0.20f * 0.02f), DF = _mm_set1_ps(0.20f * 0.30f);
+    const __m128 EF = _mm_set1_ps(0.02f / 0.30f);
+    const __m128 numerator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(A, x), CB)), DE);
+    const __m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(A, x), B)), DF);
+    return _mm_sub_ps(_mm_div_ps(numerator, denominator), EF);
+}
+
+// Same as toneCurve for four values.
+static __m128 toneCurve(__m128 x, ToneMapOperator toneOperator)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    switch (toneOperator) {
+    case TONEMAP_REINHARD:
+        x = _mm_div_ps(x, _mm_add_ps(one, x));
+        break;
+    case TONEMAP_ACES:
+        x = _mm_div_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f))),
+                       _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))),
+                                  _mm_set1_ps(0.14f)));
+        break;
+    case TONEMAP_FILMIC:
+        x = _mm_mul_ps(hable(_mm_add_ps(x, x)), _mm_set1_ps(1.0f / hable(FILMIC_WHITE)));
+        break;
+    default:
+        break;
+    }
+    return _mm_min_ps(x, one);
+}
+
+// Same as encodeSrgb for four values.
+static __m128 encodeSrgb(__m128 value)
+{
+    const __m128 u = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(SRGB_SCALE), _mm_sqrt_ps(_mm_sqrt_ps(value))),
+                                _mm_set1_ps(SRGB_OFFSET));
+    __m128 code = _mm_set1_ps(SRGB_POLYNOMIAL[5]);
+    for (int i = 4; 0 <= i; i--)
+        code = _mm_add_ps(_mm_mul_ps(code, u), _mm_set1_ps(SRGB_POLYNOMIAL[i]));
+    const __m128 linear = _mm_mul_ps(value, _mm_set1_ps(255.0f * 12.92f));
+    const __m128 isLinear = _mm_cmple_ps(value, _mm_set1_ps(SRGB_LINEAR_END));
+    return _mm_or_ps(_mm_and_ps(isLinear, linear), _mm_andnot_ps(isLinear, code));
+}
+
+// Four pixels at once, channels are transposed so that every vector holds one channel of all pixels.
+static void toneMapPixels4(const float *src, __m128 scale, ToneMapOperator toneOperator,
+                           const float *dither, unsigned char *dst)
+{
+    __m128 r = _mm_loadu_ps(src);
+    __m128 g = _mm_loadu_ps(src + 4);
+    __m128 b = _mm_loadu_ps(src + 8);
+    __m128 a = _mm_loadu_ps(src + 12);
+    _MM_TRANSPOSE4_PS(r, g, b, a);
+
+    // max with the value second turns NaNs into zero
+    const __m128 zero = _mm_setzero_ps();
+    __m128 channels[3] = {r, g, b};
+    __m128 codes[4];
+    for (int c = 0; c < 3; c++) {
+        const __m128 value = toneCurve(_mm_max_ps(_mm_mul_ps(channels[c], scale), zero), toneOperator);
+        codes[c] = encodeSrgb(value);
+    }
+    codes[3] = _mm_mul_ps(_mm_min_ps(_mm_max_ps(a, zero), _mm_set1_ps(1.0f)), _mm_set1_ps(255.0f));
+
+    // back to pixels, add the dither noise and round, saturation clamps the codes
+    _MM_TRANSPOSE4_PS(codes[0], codes[1], codes[2], codes[3]);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128i pixels[4];
+    for (int i = 0; i < 4; i++)
+        pixels[i] = _mm_cvttps_epi32(_mm_max_ps(_mm_add_ps(_mm_add_ps(codes[i], _mm_loadu_ps(dither + i * 4)), half),
+                                                zero));
+    const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(pixels[0], pixels[1]),
+                                            _mm_packs_epi32(pixels[2], pixels[3]));
+    _mm_storeu_si128((__m128i *) dst, packed);
+}
+#endif
+
+static void toneMapRow(const DitherNoise &noise, const float *src, int width, int y,
+                       const ToneMapSettings &settings, unsigned char *dst)
+{
+    static const float noDither[DITHER_SIZE * 4] = {};
+    const float scale = exp2f(settings.exposure);
+    const float *dither = settings.dither ? noise.values + (y % DITHER_SIZE) * DITHER_SIZE * 4 : noDither;
+
+    int x = 0;
+#ifdef __SSE2__
+    // groups of four never cross the end of a dither row, its size is a multiple of four
+    const __m128 scale4 = _mm_set1_ps(scale);
+    for (; x + 4 <= width; x += 4)
+        toneMapPixels4(src + x * 4, scale4, settings.toneOperator, dither + (x % DITHER_SIZE) * 4,
+                       dst + x * 4);
+#endif
+    for (; x < width; x++)
+        toneMapPixel(src + x * 4, scale, settings.toneOperator, dither + (x % DITHER_SIZE) * 4, dst + x * 4);
+}
+
+void toneMap(const float *src, int width, int height, const ToneMapSettings &settings, unsigned char *dst,
+             bool flipRows)
+{
+    const DitherNoise &noise = ditherNoise();
+    const int tasks = (height + TONEMAP_ROWS_PER_TASK - 1) / TONEMAP_ROWS_PER_TASK;
+    parallelFor(tasks, [&](int task) {
+        const int end = std::min(height, (task + 1) * TONEMAP_ROWS_PER_TASK);
+        for (int y = task * TONEMAP_ROWS_PER_TASK; y < end; y++) {
+            const int dstY = flipRows ? height - 1 - y : y;
+            toneMapRow(noise, src + size_t(y) * width * 4, width, dstY, settings, dst + size_t(dstY) * width * 4);
+        }
+    });
+}
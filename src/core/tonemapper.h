@@ -0,0 +1,31 @@
+
+#ifndef RENDERER_GPU_TONEMAPPER_H
+#define RENDERER_GPU_TONEMAPPER_H
+
+#include <string>
+
+enum ToneMapOperator
+{
+    TONEMAP_CLAMP = 0,    // no compression, values above 1 clip
+    TONEMAP_REINHARD = 1, // x / (1 + x) per channel
+    TONEMAP_ACES = 2,     // Narkowicz' fit of the ACES reference rendering transform
+    TONEMAP_FILMIC = 3    // Hable's filmic curve with a white point of 11.2
+};
+
+ToneMapOperator parseToneMapOperator(const std::string &name);
+const char *toneMapOperatorName(ToneMapOperator toneOperator);
+
+struct ToneMapSettings
+{
+    float exposure = 0.0f;                        // In stops, colors are scaled by 2^exposure first.
+    ToneMapOperator toneOperator = TONEMAP_CLAMP;
+    bool dither = true;                           // Adds up to half a code of noise before rounding, hides banding.
+};
+
+// Converts linear RGBA32F pixels to 8-bit sRGB for display and LDR files, on the shared thread pool.
+// Alpha is only clamped. With flipRows the first row of src ends up last in dst, film rows are stored
+// bottom first while image files start at the top.
+void toneMap(const float *src, int width, int height, const ToneMapSettings &settings, unsigned char *dst,
+             bool flipRows = false);
+
+#endif //RENDERER_GPU_TONEMAPPER_H
@@ -0,0 +1,140 @@
+
+#ifndef RENDERER_GPU_VIRTUALTEXTURE_H
+#define RENDERER_GPU_VIRTUALTEXTURE_H
+
+#include "../utils/config.h"
+#include "../math/raycone.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+// Virtual textures are split into tiles (pages) of VIRTUAL_TILE_SIZE texels on every mip level. Resident pages
+// are stored in slots of the physical atlas, with VIRTUAL_TILE_BORDER texels copied from the neighbours around
+// them so that bilinear filtering doesn't need the adjacent tiles. Levels smaller than a tile are one page.
+// The atlas is split into sheets of VIRTUAL_SHEET_SLOTS x VIRTUAL_SHEET_SLOTS slots with a buffer and sampler
+// each, so that streaming a tile uploads its sheet only.
+#define VIRTUAL_TILE_SIZE   128
+#define VIRTUAL_TILE_BORDER 4
+#define VIRTUAL_SLOT_SIZE   (VIRTUAL_TILE_SIZE + 2 * VIRTUAL_TILE_BORDER)
+#define VIRTUAL_SHEET_SLOTS 4
+#define VIRTUAL_SHEET_SIZE  (VIRTUAL_SHEET_SLOTS * VIRTUAL_SLOT_SIZE)
+
+// Texture IDs of virtual textures are negative, bindless sampler IDs are positive.
+RT_FUNCTION int virtualTextureID(const int index)
+{
+    return -1 - index;
+}
+
+RT_FUNCTION int virtualTextureIndex(const int textureID)
+{
+    return -1 - textureID;
+}
+
+struct VirtualTextureDefinition
+{
+    int width;
+    int height;
+    int mipCount;
+    int pageOffset; // First entry of the texture in the page table, levels follow each other row by row.
+};
+
+RT_FUNCTION int virtualLevelSize(const int size, const int level)
+{
+    return (size >> level) < 1 ? 1 : (size >> level);
+}
+
+RT_FUNCTION int virtualTileCount(const int size, const int level)
+{
+    return (virtualLevelSize(size, level) + VIRTUAL_TILE_SIZE - 1) / VIRTUAL_TILE_SIZE;
+}
+
+// Pages of all levels of a texture.
+RT_FUNCTION int virtualPageCount(const int width, const int height, const int mipCount)
+{
+    int count = 0;
+    for (int level = 0; level < mipCount; level++)
+        count += virtualTileCount(width, level) * virtualTileCount(height, level);
+    return count;
+}
+
+// Finds the finest resident page at or above the requested level of detail, the sheet holding it and
+// the coordinates of uv in that sheet (normalized, texture wraps around). requestedPage receives the page of
+// the requested level, which is reported in the feedback buffer when it isn't resident. Page table holds slot
+// indices or -1, slots are numbered sheet by sheet.
+template <typename PageTable>
+RT_FUNCTION bool translateVirtualTexture(const VirtualTextureDefinition &texture, const PageTable &pageTable,
+    const optix::float2 uv, const float lod, int &sheet, optix::float2 &atlasUV, int &requestedPage)
+{
+    const float u = uv.x - floorf(uv.x);
+    const float v = uv.y - floorf(uv.y);
+    int requestedLevel = (0.0f < lod) ? int(lod) : 0;
+    requestedLevel = (requestedLevel < texture.mipCount) ? requestedLevel : texture.mipCount - 1;
+
+    int page = texture.pageOffset;
+    requestedPage = -1;
+    for (int level = 0; level < texture.mipCount; level++) {
+        const int tilesX = virtualTileCount(texture.width, level);
+        const int tilesY = virtualTileCount(texture.height, level);
+        if (level < requestedLevel) {
+            page += tilesX * tilesY;
+            continue;
+        }
+
+        const float x = u * float(virtualLevelSize(texture.width, level));
+        const float y = v * float(virtualLevelSize(texture.height, level));
+        int tileX = int(x) / VIRTUAL_TILE_SIZE;
+        int tileY = int(y) / VIRTUAL_TILE_SIZE;
+        tileX = (tileX < tilesX) ? tileX : tilesX - 1;
+        tileY = (tileY < tilesY) ? tileY : tilesY - 1;
+        const int tilePage = page + tileY * tilesX + tileX;
+        if (level == requestedLevel)
+            requestedPage = tilePage;
+
+        const int slot = pageTable[tilePage];
+        if (0 <= slot) {
+            const int sheetSlot = slot % (VIRTUAL_SHEET_SLOTS * VIRTUAL_SHEET_SLOTS);
+            sheet = slot / (VIRTUAL_SHEET_SLOTS * VIRTUAL_SHEET_SLOTS);
+            atlasUV.x = (float((sheetSlot % VIRTUAL_SHEET_SLOTS) * VIRTUAL_SLOT_SIZE + VIRTUAL_TILE_BORDER) +
+                x - float(tileX * VIRTUAL_TILE_SIZE)) / float(VIRTUAL_SHEET_SIZE);
+            atlasUV.y = (float((sheetSlot / VIRTUAL_SHEET_SLOTS) * VIRTUAL_SLOT_SIZE + VIRTUAL_TILE_BORDER) +
+                y - float(tileY * VIRTUAL_TILE_SIZE)) / float(VIRTUAL_SHEET_SIZE);
+            return true;
+        }
+        page += tilesX * tilesY;
+    }
+    return false;
+}
+
+#ifdef __CUDACC__
+#include <optix.h>
+
+// Context global variables of virtual texturing, set by TexturePool.
+rtBuffer<VirtualTextureDefinition> sysVirtualTextures;
+rtBuffer<int> sysPageTable;
+rtBuffer<int> sysTileFeedback;  // Stamp of the last update interval that requested the page, read by the host.
+rtBuffer<int> sysVirtualAtlasSheets; // Sampler IDs.
+rtDeclareVariable(int, sysTileFeedbackStamp, , );
+
+// Looks up a bindless texture or a virtual one with the mip level of footprint, the extent of the lookup
+// along u and v in texture coordinates. Missing tiles of virtual textures are reported in the feedback buffer
+// and a coarser resident level is used meanwhile.
+RT_FUNCTION optix::float4 sampleTexture(const int textureID, const optix::float2 uv, const optix::float2 footprint)
+{
+    if (0 <= textureID)
+        return optix::rtTex2DGrad<optix::float4>(textureID, uv.x, uv.y, optix::make_float2(footprint.x, 0.0f),
+                                                 optix::make_float2(0.0f, footprint.y));
+
+    const VirtualTextureDefinition texture = sysVirtualTextures[virtualTextureIndex(textureID)];
+    optix::float2 atlasUV;
+    int sheet, requestedPage;
+    const bool resident = translateVirtualTexture(texture, sysPageTable, uv,
+                                                  textureLod(footprint, texture.width, texture.height),
+                                                  sheet, atlasUV, requestedPage);
+    if (0 <= requestedPage && sysPageTable[requestedPage] < 0)
+        sysTileFeedback[requestedPage] = sysTileFeedbackStamp;
+    if (!resident)
+        return optix::make_float4(1.0f);
+    return optix::rtTex2D<optix::float4>(sysVirtualAtlasSheets[sheet], atlasUV.x, atlasUV.y);
+}
+#endif
+
+#endif //RENDERER_GPU_VIRTUALTEXTURE_H
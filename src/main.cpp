@@ -3,9 +3,15 @@
 #include <stdexcept>
 #include <algorithm>
 #include <future>
+#include <sstream>
+#include <mutex>
+#include <cctype>
 
 #include "core/opengl_renderer.h"
 #include "core/optix_renderer.h"
+#include "core/globalsettings.h"
+#include "core/imagewriter.h"
+#include "core/aov.h"
 #include <GLFW/glfw3.h>
 
 #include "utils/log.h"
@@ -24,6 +30,14 @@ bool cmdOptionExists(char** begin, char** end, const std::string& option)
     return std::find(begin, end, option) != end;
 }
 
+// Lines of the stdin protocol come from the main thread and from the image writer, one at a time.
+static void WriteProtocolLine(const std::string &line)
+{
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << line << std::endl;
+}
+
 std::string GetLineFromCin() {
     std::string line;
     std::getline(std::cin, line);
@@ -118,9 +132,27 @@ int main(int argc, char *argv[])
             auto line = future.get();
 
             try {
-                if (line == "start") {
-                    sceneRenderer->renderToFile("result.img");
-                    std::cout << "finished" << std::endl;
+                if (line.compare(0, 5, "start") == 0 && (line.size() == 5 || isspace((unsigned char) line[5]))) {
+                    // start [samples [seconds [samples per launch]]], missing values come from the settings
+                    RenderTarget target = GlobalSettings::getInstance().renderTarget;
+                    std::istringstream arguments(line.substr(5));
+                    int samples, samplesPerLaunch;
+                    float seconds;
+                    if (arguments >> samples)
+                        target.samples = samples;
+                    if (arguments >> seconds)
+                        target.seconds = seconds;
+                    if (arguments >> samplesPerLaunch)
+                        target.samplesPerLaunch = samplesPerLaunch;
+                    target.progress = [](int samples, float seconds) {
+                        std::ostringstream progress;
+                        progress << "progress " << samples << " " << seconds;
+                        WriteProtocolLine(progress.str());
+                    };
+                    // reported once the file is complete, commands are read meanwhile
+                    sceneRenderer->renderToFile(GlobalSettings::getInstance().outputFile, [](bool) {
+                        WriteProtocolLine("finished");
+                    }, target);
                 }
                 else if (line == "resize") {
                     int x = std::stoi(GetLineFromCin());
@@ -130,6 +162,11 @@ int main(int argc, char *argv[])
                     windowWidth = x;
                     windowHeight = y;
                 }
+                else if (line == "aov") {
+                    // layer names for the next renderToFile, an empty line turns them off
+                    GlobalSettings::getInstance().aovLayers = parseAovMask(GetLineFromCin());
+                    sceneRenderer->update();
+                }
                 else if (line == "reload") {
                     std::string filename;
                     if (sceneFile)
@@ -151,6 +188,7 @@ int main(int argc, char *argv[])
             future = std::async(std::launch::async, GetLineFromCin);
         }
     }
+    ImageWriter::getInstance().flush();
     delete sceneRenderer;
 
     return 0;
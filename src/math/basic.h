@@ -281,4 +281,22 @@ RT_FUNCTION void unitSquareToSphere(const float u, const float v, float3& p, flo
     pdf = 0.25f * M_1_PIf;  // == 1.0f / (4.0f * M_PIf)
 }
 
+// Latitude-longitude mapping of the environment texture.
+// The seam u == 0.0 == 1.0 is in positive z-axis direction, v == 0.0f is north pole (top row of the image).
+// rotation is added to u to rotate the environment around the y-axis.
+RT_FUNCTION float2 environmentDirectionToUV(float3 const& R, const float rotation)
+{
+    const float u     = (atan2f(R.x, -R.z) + M_PIf) * 0.5f * M_1_PIf + rotation;
+    const float theta = acosf(-R.y); // theta == 0.0f is south pole, theta == M_PIf is north pole.
+    return make_float2(u, 1.0f - theta * M_1_PIf);
+}
+
+RT_FUNCTION float3 environmentUVToDirection(float2 const& uv, const float rotation, float& sinTheta)
+{
+    const float phi   = (uv.x - rotation) * 2.0f * M_PIf - M_PIf;
+    const float theta = (1.0f - uv.y) * M_PIf;
+    sinTheta = sinf(theta);
+    return make_float3(sinTheta * sinf(phi), -cosf(theta), -sinTheta * cosf(phi));
+}
+
 #endif //RENDERER_GPU_BASIC_H
@@ -0,0 +1,103 @@
+
+#include "distribution.h"
+
+#include <cmath>
+
+bool buildAliasTable(const std::vector<float> &weights, std::vector<AliasEntry> &table)
+{
+    const size_t count = weights.size();
+    table.resize(count);
+    if (count == 0)
+        return false;
+
+    double sum = 0.0;
+    for (auto &weight : weights)
+        if (std::isfinite(weight) && weight > 0.0f)
+            sum += weight;
+
+    if (sum <= 0.0) {
+        for (size_t i = 0; i < count; i++)
+            table[i] = {1.0f, int(i), 1.0f / float(count), 0.0f};
+        return false;
+    }
+
+    // Vose's method: split slots into under- and overfull ones and
+    // let every underfull slot borrow the rest of its probability from an overfull one.
+    std::vector<double> scaled(count);
+    std::vector<int> small, large;
+    small.reserve(count);
+    large.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        const float weight = (std::isfinite(weights[i]) && weights[i] > 0.0f) ? weights[i] : 0.0f;
+        table[i].pdf = float(weight / sum);
+        table[i].unused0 = 0.0f;
+        scaled[i] = weight / sum * double(count);
+        if (scaled[i] < 1.0)
+            small.push_back(int(i));
+        else
+            large.push_back(int(i));
+    }
+
+    while (!small.empty() && !large.empty()) {
+        int less = small.back();
+        small.pop_back();
+        int more = large.back();
+        large.pop_back();
+
+        table[less].threshold = float(scaled[less]);
+        table[less].alias = more;
+
+        scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+        if (scaled[more] < 1.0)
+            small.push_back(more);
+        else
+            large.push_back(more);
+    }
+
+    // whatever is left is full up to rounding errors
+    for (auto index : large) {
+        table[index].threshold = 1.0f;
+        table[index].alias = index;
+    }
+    for (auto index : small) {
+        table[index].threshold = 1.0f;
+        table[index].alias = index;
+    }
+    return true;
+}
+
+float buildCdf(const float *function, int count, float *cdf)
+{
+    double sum = 0.0;
+    cdf[0] = 0.0f;
+    for (int i = 0; i < count; i++) {
+        const float value = function[i];
+        if (std::isfinite(value) && value > 0.0f)
+            sum += value;
+        cdf[i + 1] = float(sum);
+    }
+
+    if (sum <= 0.0) {
+        for (int i = 1; i <= count; i++)
+            cdf[i] = float(i) / float(count);
+        return 0.0f;
+    }
+
+    for (int i = 1; i < count; i++)
+        cdf[i] = float(cdf[i] / sum);
+    cdf[count] = 1.0f;
+    return float(sum / count);
+}
+
+bool buildDistribution2D(const std::vector<float> &function, int width, int height,
+    std::vector<float> &conditional, std::vector<float> &marginal)
+{
+    conditional.resize(size_t(height) * (width + 1));
+    marginal.resize(height + 1);
+
+    std::vector<float> rowIntegrals(height);
+    for (int y = 0; y < height; y++)
+        rowIntegrals[y] = buildCdf(&function[size_t(y) * width], width, &conditional[size_t(y) * (width + 1)]);
+
+    return buildCdf(rowIntegrals.data(), height, marginal.data()) > 0.0f;
+}
@@ -0,0 +1,131 @@
+
+#ifndef RENDERER_GPU_DISTRIBUTION_H
+#define RENDERER_GPU_DISTRIBUTION_H
+
+#include "../utils/config.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#ifndef __CUDACC__
+#include <vector>
+#endif
+
+// One slot of a Walker alias table. A sample falling into slot i keeps i if the remaining
+// uniform value is below threshold, otherwise it is redirected to alias.
+// pdf is the discrete probability of picking this slot as a final result.
+struct AliasEntry
+{
+    float threshold;
+    int   alias;
+    float pdf;
+
+    // Manual padding to 16 bytes.
+    float unused0;
+};
+
+// Picks an index in [0, count) in O(1) from an alias table stored at offset (aliases are relative to it).
+// Table can be anything indexable (rtBuffer on the device, std::vector or pointer on the host).
+// remapped is the part of the sample not used by the decision, uniform in [0, 1) again.
+template<typename Table>
+RT_FUNCTION int sampleAlias(const Table &table, const int offset, const int count, const float sample,
+    float &pdf, float &remapped)
+{
+    const float scaled = sample * float(count);
+    int index = int(scaled);
+    index = (index < count - 1) ? index : count - 1;
+
+    const AliasEntry entry = table[offset + index];
+    const float u = scaled - float(index);
+    if (entry.threshold <= u) {
+        remapped = (u - entry.threshold) / (1.0f - entry.threshold);
+        index = entry.alias;
+    }
+    else
+        remapped = u / entry.threshold;
+    remapped = fminf(remapped, 0.99999994f);
+
+    pdf = table[offset + index].pdf;
+    return index;
+}
+
+template<typename Table>
+RT_FUNCTION int sampleAlias(const Table &table, const int count, const float sample, float &pdf)
+{
+    float remapped;
+    return sampleAlias(table, 0, count, sample, pdf, remapped);
+}
+
+// Piecewise-constant distributions are stored as normalized CDFs with count + 1 entries.
+// Picks segment of the CDF starting at offset with binary search.
+// remapped is the sample position in [0, 1) reused inside the segment, pdf is density over [0, 1).
+template<typename Buffer>
+RT_FUNCTION int sampleCdf(const Buffer &cdf, const int offset, const int count, const float sample,
+    float &remapped, float &pdf)
+{
+    // invariant: cdf[first] <= sample < cdf[last]
+    int first = 0;
+    int last = count;
+    while (first + 1 < last) {
+        const int middle = (first + last) / 2;
+        if (cdf[offset + middle] <= sample)
+            first = middle;
+        else
+            last = middle;
+    }
+
+    const float c0 = cdf[offset + first];
+    const float c1 = cdf[offset + first + 1];
+    pdf = (c1 - c0) * float(count);
+
+    float delta = sample - c0;
+    if (0.0f < c1 - c0)
+        delta /= c1 - c0;
+    // rounding may reach one in the last segment
+    remapped = fminf((float(first) + delta) / float(count), 0.99999994f);
+    return first;
+}
+
+// 2D distribution over [0, 1)^2: conditional holds height rows of width + 1 CDF values (one per row along u),
+// marginal holds height + 1 values along v.
+template<typename Buffer>
+RT_FUNCTION optix::float2 sampleDistribution2D(const Buffer &conditional, const Buffer &marginal,
+    const int width, const int height, const optix::float2 &sample, float &pdf)
+{
+    float u, v, pdfU, pdfV;
+    const int row = sampleCdf(marginal, 0, height, sample.y, v, pdfV);
+    sampleCdf(conditional, row * (width + 1), width, sample.x, u, pdfU);
+
+    pdf = pdfU * pdfV;
+    return optix::make_float2(u, v);
+}
+
+template<typename Buffer>
+RT_FUNCTION float pdfDistribution2D(const Buffer &conditional, const Buffer &marginal,
+    const int width, const int height, const optix::float2 &uv)
+{
+    int x = int(uv.x * float(width));
+    int y = int(uv.y * float(height));
+    x = (x < 0) ? 0 : ((x < width) ? x : width - 1);
+    y = (y < 0) ? 0 : ((y < height) ? y : height - 1);
+
+    const int offset = y * (width + 1) + x;
+    return (marginal[y + 1] - marginal[y]) * float(height) *
+        (conditional[offset + 1] - conditional[offset]) * float(width);
+}
+
+#ifndef __CUDACC__
+// Builds alias table proportional to weights (negative and non-finite weights count as zero).
+// Falls back to uniform table if all weights are zero and returns false in that case.
+bool buildAliasTable(const std::vector<float> &weights, std::vector<AliasEntry> &table);
+
+// Builds normalized CDF (count + 1 values) of a piecewise-constant function and returns its integral over [0, 1).
+// Zero function gets uniform CDF.
+float buildCdf(const float *function, int count, float *cdf);
+
+// Builds 2D distribution from width x height function values (row-major, rows along v).
+// Returns false if function is zero everywhere.
+bool buildDistribution2D(const std::vector<float> &function, int width, int height,
+    std::vector<float> &conditional, std::vector<float> &marginal);
+#endif
+
+#endif //RENDERER_GPU_DISTRIBUTION_H
@@ -0,0 +1,117 @@
+
+#include "lightbvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Rotates v around unit axis by angle (Rodrigues' formula).
+static optix::float3 rotate(const optix::float3 &v, const optix::float3 &axis, float angle)
+{
+    const float cosAngle = std::cos(angle);
+    const float sinAngle = std::sin(angle);
+    return v * cosAngle + optix::cross(axis, v) * sinAngle + axis * (optix::dot(axis, v) * (1.0f - cosAngle));
+}
+
+// Smallest cone containing both cones.
+static void coneUnion(const LightBVHNode &a, const LightBVHNode &b, optix::float3 &axis, float &cosTheta0)
+{
+    const float thetaA = std::acos(optix::clamp(a.cosTheta0, -1.0f, 1.0f));
+    const float thetaB = std::acos(optix::clamp(b.cosTheta0, -1.0f, 1.0f));
+    const float thetaD = std::acos(optix::clamp(optix::dot(a.axis, b.axis), -1.0f, 1.0f));
+
+    if (std::min(thetaD + thetaB, M_PIf) <= thetaA) {
+        axis = a.axis;
+        cosTheta0 = a.cosTheta0;
+        return;
+    }
+    if (std::min(thetaD + thetaA, M_PIf) <= thetaB) {
+        axis = b.axis;
+        cosTheta0 = b.cosTheta0;
+        return;
+    }
+
+    const float theta0 = (thetaA + thetaD + thetaB) * 0.5f;
+    const optix::float3 rotationAxis = optix::cross(a.axis, b.axis);
+    if (M_PIf <= theta0 || optix::dot(rotationAxis, rotationAxis) == 0.0f) {
+        axis = a.axis;
+        cosTheta0 = -1.0f;
+        return;
+    }
+
+    axis = optix::normalize(rotate(a.axis, optix::normalize(rotationAxis), theta0 - thetaA));
+    cosTheta0 = std::cos(theta0);
+}
+
+LightBVHNode mergeLightBVHNodes(const LightBVHNode &a, const LightBVHNode &b)
+{
+    LightBVHNode node;
+    node.boundsMin = optix::fminf(a.boundsMin, b.boundsMin);
+    node.boundsMax = optix::fmaxf(a.boundsMax, b.boundsMax);
+    node.power = a.power + b.power;
+    coneUnion(a, b, node.axis, node.cosTheta0);
+    node.cosThetaE = std::min(a.cosThetaE, b.cosThetaE);
+    node.left = -1;
+    node.right = -1;
+    node.unused0 = 0.0f;
+    node.unused1 = 0.0f;
+    return node;
+}
+
+static int buildRecursive(std::vector<LightBVHNode> &leaves, int begin, int end, unsigned int trail, int depth,
+    std::vector<LightBVHNode> &nodes, std::vector<unsigned int> &trails)
+{
+    const int index = int(nodes.size());
+    nodes.emplace_back();
+
+    if (end - begin == 1) {
+        nodes[index] = leaves[begin];
+        nodes[index].right = -1;
+        trails[leaves[begin].left] = trail;
+        return index;
+    }
+
+    // split at the median of the centroids along the longest axis, keeps depth within 32 bits of the trail
+    optix::float3 centroidMin = optix::make_float3(INFINITY);
+    optix::float3 centroidMax = optix::make_float3(-INFINITY);
+    for (int i = begin; i < end; i++) {
+        const optix::float3 centroid = (leaves[i].boundsMin + leaves[i].boundsMax) * 0.5f;
+        centroidMin = optix::fminf(centroidMin, centroid);
+        centroidMax = optix::fmaxf(centroidMax, centroid);
+    }
+    const optix::float3 extent = centroidMax - centroidMin;
+    int axis = 0;
+    if (extent.y > extent.x && extent.y >= extent.z)
+        axis = 1;
+    else if (extent.z > extent.x && extent.z > extent.y)
+        axis = 2;
+
+    auto centroid = [axis](const LightBVHNode &node) {
+        const optix::float3 c = (node.boundsMin + node.boundsMax) * 0.5f;
+        return (axis == 0) ? c.x : ((axis == 1) ? c.y : c.z);
+    };
+    const int middle = (begin + end) / 2;
+    std::nth_element(leaves.begin() + begin, leaves.begin() + middle, leaves.begin() + end,
+                     [&centroid](const LightBVHNode &a, const LightBVHNode &b) { return centroid(a) < centroid(b); });
+
+    const int left = buildRecursive(leaves, begin, middle, trail, depth + 1, nodes, trails);
+    const int right = buildRecursive(leaves, middle, end, trail | (1u << depth), depth + 1, nodes, trails);
+
+    LightBVHNode node = mergeLightBVHNodes(nodes[left], nodes[right]);
+    node.left = left;
+    node.right = right;
+    nodes[index] = node;
+    return index;
+}
+
+bool buildLightBVH(std::vector<LightBVHNode> leaves, std::vector<LightBVHNode> &nodes,
+    std::vector<unsigned int> &trails, int lightCount)
+{
+    nodes.clear();
+    trails.assign(lightCount, 0u);
+    if (leaves.empty())
+        return false;
+
+    nodes.reserve(2 * leaves.size() - 1);
+    buildRecursive(leaves, 0, int(leaves.size()), 0u, 0, nodes, trails);
+    return true;
+}
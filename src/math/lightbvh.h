@@ -0,0 +1,184 @@
+
+#ifndef RENDERER_GPU_LIGHTBVH_H
+#define RENDERER_GPU_LIGHTBVH_H
+
+#include "../utils/config.h"
+#include "distribution.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+#ifndef __CUDACC__
+#include <vector>
+#endif
+
+// Node of the light hierarchy. Every node bounds its lights in space (box),
+// in emitted directions (cone around axis with spread cosTheta0 plus emission falloff cosThetaE) and by total power.
+// Leaves have right < 0 and left holds index into sysLightDefinitions.
+struct LightBVHNode
+{
+    optix::float3 boundsMin;
+    float         power;
+    optix::float3 boundsMax;
+    float         cosTheta0;  // -1 means all directions
+    optix::float3 axis;
+    float         cosThetaE;  // cos of the emission falloff angle outside of the normal cone
+    int           left;
+    int           right;
+
+    // Manual padding to float4 alignment.
+    float         unused0;
+    float         unused1;
+};
+
+// cos(a - b) and sin(a - b) clamped to zero angle when b > a
+RT_FUNCTION float cosSubClamped(const float sinA, const float cosA, const float sinB, const float cosB)
+{
+    return (cosA > cosB) ? 1.0f : cosA * cosB + sinA * sinB;
+}
+
+RT_FUNCTION float sinSubClamped(const float sinA, const float cosA, const float sinB, const float cosB)
+{
+    return (cosA > cosB) ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+// Conservative estimate of the contribution of all lights of a node to a point (after Conty and Kulla).
+// The surface normal at the point is intentionally not used, so the same value can be recomputed for MIS
+// from the position stored in the per ray data only.
+RT_FUNCTION float lightBVHImportance(const LightBVHNode &node, const optix::float3 &point)
+{
+    const optix::float3 center = (node.boundsMin + node.boundsMax) * 0.5f;
+    const optix::float3 diagonal = node.boundsMax - node.boundsMin;
+    const optix::float3 toPoint = point - center;
+
+    float distance2 = optix::dot(toPoint, toPoint);
+    distance2 = fmaxf(distance2, fmaxf(optix::length(diagonal) * 0.5f, 1e-4f));
+
+    // angle between the cone axis and the direction to the point
+    float cosThetaW = optix::dot(node.axis, toPoint) / sqrtf(fmaxf(optix::dot(toPoint, toPoint), 1e-12f));
+    cosThetaW = fminf(fmaxf(cosThetaW, -1.0f), 1.0f);
+    const float sinThetaW = sqrtf(fmaxf(0.0f, 1.0f - cosThetaW * cosThetaW));
+
+    // angle subtended by the bounding sphere of the node
+    const float radius2 = optix::dot(diagonal, diagonal) * 0.25f;
+    float cosThetaB = -1.0f;
+    if (radius2 < optix::dot(toPoint, toPoint))
+        cosThetaB = sqrtf(fmaxf(0.0f, 1.0f - radius2 / optix::dot(toPoint, toPoint)));
+    const float sinThetaB = sqrtf(fmaxf(0.0f, 1.0f - cosThetaB * cosThetaB));
+
+    // minimal angle between the point and any emitted direction
+    const float sinTheta0 = sqrtf(fmaxf(0.0f, 1.0f - node.cosTheta0 * node.cosTheta0));
+    const float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinTheta0, node.cosTheta0);
+    const float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinTheta0, node.cosTheta0);
+    const float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+    if (cosThetaP <= node.cosThetaE)
+        return 0.0f;
+
+    return node.power * cosThetaP / distance2;
+}
+
+// Stochastic traversal from the root, picking children proportionally to their importance.
+// Returns light index or -1 if no light contributes to the point.
+template<typename Nodes>
+RT_FUNCTION int sampleLightBVH(const Nodes &nodes, const optix::float3 &point, float sample, float &pmf)
+{
+    pmf = 0.0f;
+    LightBVHNode node = nodes[0];
+    if (lightBVHImportance(node, point) <= 0.0f)
+        return -1;
+
+    float probability = 1.0f;
+    while (0 <= node.right) {
+        const LightBVHNode left = nodes[node.left];
+        const LightBVHNode right = nodes[node.right];
+        const float importanceLeft = lightBVHImportance(left, point);
+        const float importanceRight = lightBVHImportance(right, point);
+        if (importanceLeft <= 0.0f && importanceRight <= 0.0f)
+            return -1;
+
+        const float probabilityLeft = importanceLeft / (importanceLeft + importanceRight);
+        if (sample < probabilityLeft) {
+            sample = fminf(sample / probabilityLeft, 0.99999994f);
+            probability *= probabilityLeft;
+            node = left;
+        }
+        else {
+            sample = fminf((sample - probabilityLeft) / (1.0f - probabilityLeft), 0.99999994f);
+            probability *= 1.0f - probabilityLeft;
+            node = right;
+        }
+    }
+
+    pmf = probability;
+    return node.left;
+}
+
+// Probability of sampleLightBVH returning the light reached by trail (bit per level, 1 = right child).
+template<typename Nodes>
+RT_FUNCTION float pmfLightBVH(const Nodes &nodes, const optix::float3 &point, unsigned int trail)
+{
+    LightBVHNode node = nodes[0];
+    if (lightBVHImportance(node, point) <= 0.0f)
+        return 0.0f;
+
+    float probability = 1.0f;
+    while (0 <= node.right) {
+        const LightBVHNode left = nodes[node.left];
+        const LightBVHNode right = nodes[node.right];
+        const float importanceLeft = lightBVHImportance(left, point);
+        const float importanceRight = lightBVHImportance(right, point);
+        if (importanceLeft <= 0.0f && importanceRight <= 0.0f)
+            return 0.0f;
+
+        const float probabilityLeft = importanceLeft / (importanceLeft + importanceRight);
+        if (trail & 1u) {
+            probability *= 1.0f - probabilityLeft;
+            node = right;
+        }
+        else {
+            probability *= probabilityLeft;
+            node = left;
+        }
+        trail >>= 1;
+    }
+    return probability;
+}
+
+// Infinite lights come first in the light array and are picked with the alias table,
+// finite lights are picked with the light hierarchy. Both groups get a share proportional to their count,
+// where the whole hierarchy counts as one light.
+RT_FUNCTION float infiniteLightProbability(const int numLights, const int numInfiniteLights)
+{
+    if (numInfiniteLights == numLights)
+        return 1.0f;
+    return float(numInfiniteLights) / float(numInfiniteLights + 1);
+}
+
+template<typename Table, typename Nodes>
+RT_FUNCTION int selectLight(const Table &aliasTable, const Nodes &nodes, const int numLights, const int numInfiniteLights,
+    const optix::float3 &point, float sample, float &pmf)
+{
+    const float probabilityInfinite = infiniteLightProbability(numLights, numInfiniteLights);
+    if (sample < probabilityInfinite) {
+        sample = fminf(sample / probabilityInfinite, 0.99999994f);
+        const int index = sampleAlias(aliasTable, numInfiniteLights, sample, pmf);
+        pmf *= probabilityInfinite;
+        return index;
+    }
+
+    sample = fminf((sample - probabilityInfinite) / (1.0f - probabilityInfinite), 0.99999994f);
+    const int index = sampleLightBVH(nodes, point, sample, pmf);
+    pmf *= 1.0f - probabilityInfinite;
+    return index;
+}
+
+#ifndef __CUDACC__
+// Builds hierarchy over leaves (one per finite light) by median splits along the longest axis.
+// trails receive bit trail of every leaf's light index (resized to lightCount).
+bool buildLightBVH(std::vector<LightBVHNode> leaves, std::vector<LightBVHNode> &nodes,
+    std::vector<unsigned int> &trails, int lightCount);
+
+// Node bounding both nodes (box, cone and power), children are not set.
+LightBVHNode mergeLightBVHNodes(const LightBVHNode &a, const LightBVHNode &b);
+#endif
+
+#endif //RENDERER_GPU_LIGHTBVH_H
@@ -0,0 +1,66 @@
+
+#ifndef RENDERER_GPU_RAYCONE_H
+#define RENDERER_GPU_RAYCONE_H
+
+#include "../utils/config.h"
+
+#include <optixu/optixu_math_namespace.h>
+
+// Ray cones approximate the footprint of a path on the surfaces it hits, so that texture lookups can pick
+// a mip level. A cone starts with the angle one pixel spans and zero width at the camera, grows linearly along
+// every segment and widens at every bounce by the spread of the sampled BSDF lobe. All widths are in world units,
+// angles in radians.
+
+// Largest spread of a cone, past it the footprint covers whole objects anyway.
+#define RAY_CONE_MAX_SPREAD 1.0f
+
+// Angle of one pixel of a pinhole camera, tanHalfFov is the tangent of half the vertical field of view.
+RT_FUNCTION float pixelSpreadAngle(const float tanHalfFov, const int height)
+{
+    return atanf(2.0f * tanHalfFov / float(height > 0 ? height : 1));
+}
+
+// Width of the cone after travelling distance.
+RT_FUNCTION float coneWidthAt(const float width, const float spread, const float distance)
+{
+    return fabsf(width + spread * distance);
+}
+
+// Spread after a bounce with the given BSDF pdf. One sample covers a solid angle of about 1 / pdf,
+// the cone of that solid angle is added to the incoming one. Delta lobes with huge pdfs add nothing.
+RT_FUNCTION float bounceConeSpread(const float spread, const float pdf)
+{
+    if (!(0.0f < pdf))
+        return RAY_CONE_MAX_SPREAD;
+    const float lobe = 2.0f * sqrtf(M_1_PIf / pdf);
+    return fminf(spread + lobe, RAY_CONE_MAX_SPREAD);
+}
+
+// Texture coordinate units per world unit of a triangle, from twice its area in uv and in world space.
+RT_FUNCTION float triangleUVDensity(const float uvArea2, const float worldArea2)
+{
+    return (0.0f < worldArea2) ? sqrtf(fabsf(uvArea2) / worldArea2) : 0.0f;
+}
+
+// Width of the cone footprint in texture coordinates. The footprint stretches by 1 / cos on tilted surfaces,
+// the stretch is applied isotropically.
+RT_FUNCTION float coneUVFootprint(const float width, const float cosTheta, const float uvDensity)
+{
+    return width * uvDensity / fmaxf(fabsf(cosTheta), 0.01f);
+}
+
+// Footprint of a cone in the latitude-longitude mapping of the environment, u spans 2 pi and v pi radians.
+RT_FUNCTION optix::float2 environmentUVFootprint(const float spread)
+{
+    return optix::make_float2(0.5f * spread * M_1_PIf, spread * M_1_PIf);
+}
+
+// Mip level of a footprint on a texture of width x height texels, 0 is the finest.
+// Like the texture unit, the longer axis of the footprint in texels decides.
+RT_FUNCTION float textureLod(const optix::float2 footprint, const int width, const int height)
+{
+    const float texels = fmaxf(footprint.x * float(width), footprint.y * float(height));
+    return (1.0f < texels) ? log2f(texels) : 0.0f;
+}
+
+#endif //RENDERER_GPU_RAYCONE_H
@@ -7,7 +7,12 @@ using namespace optix;
 #include "../core/perraydata.h"
 #include "../core/materialdata.h"
 #include "../core/lightdata.h"
+#include "../core/virtualtexture.h"
+#include "../core/textureatlas.h"
 #include "../math/basic.h"
+#include "../math/distribution.h"
+#include "../math/lightbvh.h"
+#include "../math/raycone.h"
 
 // Context global variables provided by the renderer system.
 rtDeclareVariable(rtObject, sysTopObject, , );
@@ -23,6 +28,8 @@ rtDeclareVariable(optix::float3, varGeoNormal, attribute GEO_NORMAL, );
 rtDeclareVariable(optix::float3, varTangent,   attribute TANGENT, );
 rtDeclareVariable(optix::float3, varNormal, attribute NORMAL, );
 rtDeclareVariable(optix::float3, varTexCoord,  attribute TEXCOORD, );
+rtDeclareVariable(int,           varPrimitiveIndex, attribute PRIMITIVE_INDEX, );
+rtDeclareVariable(float,         varUVDensity, attribute UV_DENSITY, );
 
 // Material parameter definition.
 rtBuffer<MaterialParameter> sysMaterialParameters; // Context global buffer with an array of structures of MaterialParameter.
@@ -30,6 +37,13 @@ rtDeclareVariable(int, materialIndex, , ); // Per Material index into the sysMat
 
 rtBuffer<LightDefinition> sysLightDefinitions;
 rtDeclareVariable(int, sysNumLights, , );     // PERF Used many times and faster to read than sysLightDefinitions.size().
+rtDeclareVariable(int, sysNumInfiniteLights, , );
+rtBuffer<AliasEntry> sysLightAliasTable;      // Infinite light selection proportional to the estimated light power.
+rtBuffer<LightBVHNode> sysLightBVH;           // Hierarchy over finite lights, empty if there are none.
+rtBuffer<EmitterTriangle> sysEmitterTriangles;
+rtBuffer<AliasEntry> sysEmitterAliasTable;
+rtDeclareVariable(int, lightIndex, , );       // Per GeometryInstance index into sysLightDefinitions, -1 if not emissive.
+rtDeclareVariable(int, primitiveID, , );      // Per GeometryInstance unique ID for the id AOV.
 
 rtBuffer< rtCallableProgramId<void(float3 const& point, const float2 sample, LightSample& lightSample)> >
     sysSampleLight;
@@ -45,6 +59,9 @@ RT_PROGRAM void closest_hit()
     if (sysNumLights == 0)
         return;
 
+    // MIS flag of the previous hit, gets overwritten below
+    const bool pathMIS = (thePrd.flags & FLAG_PATH) != 0;
+
     MaterialParameter parameters = sysMaterialParameters[materialIndex];
     float mixFactor = 1.f;
     while (parameters.indexBSDF == MaterialType::MIX) // handle mix materials
@@ -86,29 +103,66 @@ RT_PROGRAM void closest_hit()
 
     thePrd.pos = theRay.origin + theRay.direction * theIntersectionDistance;
     thePrd.distance = theIntersectionDistance;
+    thePrd.coneWidth = coneWidthAt(thePrd.coneWidth, thePrd.coneSpread, theIntersectionDistance);
 
     thePrd.radiance = make_float3(0.0f);
+
+    // --- emission of mesh lights hit by the BSDF sample
+    if (0 <= lightIndex && (thePrd.flags & FLAG_FRONTFACE)) {
+        const LightDefinition light = sysLightDefinitions[lightIndex];
+        const int triangle = light.triangleOffset + varPrimitiveIndex;
+        const float area = sysEmitterTriangles[triangle].area;
+        const float cosLight = dot(thePrd.wo, state.geoNormal);
+
+        float misWeight = 1.0f;
+        if (pathMIS && 0.0f < area && 0.0f < cosLight) {
+            // probability of light sampling from the previous hit picking the same point
+            const float selectionPdf = (1.0f - infiniteLightProbability(sysNumLights, sysNumInfiniteLights)) *
+                pmfLightBVH(sysLightBVH, theRay.origin, light.bvhTrail);
+            const float lightPdf = selectionPdf * sysEmitterAliasTable[triangle].pdf / area *
+                theIntersectionDistance * theIntersectionDistance / cosLight;
+            misWeight = powerHeuristic(thePrd.pdf, lightPdf);
+        }
+        thePrd.radiance += light.emission * misWeight;
+    }
+
     if (parameters.textureID != RT_TEXTURE_ID_NULL)
     {
-        const float3 texColor = make_float3(optix::rtTex2D<float4>(parameters.textureID,
-                                                                   parameters.textureScale * state.texcoord.x, parameters.textureScale * state.texcoord.y));
+        // uv density is in object space, the ratio of the normal lengths is the scale of the transform
+        const float worldScale = length(varGeoNormal) / length(rtTransformNormal(RT_OBJECT_TO_WORLD, varGeoNormal));
+        const float footprint = parameters.textureScale *
+            coneUVFootprint(thePrd.coneWidth, dot(thePrd.wo, state.geoNormal), varUVDensity / worldScale);
+        const float2 uv = atlasUV(parameters.atlasTransform,
+                                  parameters.textureScale * make_float2(state.texcoord.x, state.texcoord.y));
+        const float3 texColor = make_float3(sampleTexture(parameters.textureID, uv,
+            atlasFootprint(parameters.atlasTransform, make_float2(footprint))));
         parameters.albedo *= texColor;
     }
+    if (thePrd.flags & FLAG_AOV)
+    {
+        thePrd.aovAlbedo = parameters.albedo;
+        thePrd.aovNormal = state.normal;
+        thePrd.aovDepth = theIntersectionDistance;
+        thePrd.aovPrimitiveID = primitiveID;
+        thePrd.aovMaterialID = materialIndex;
+    }
     thePrd.f_over_pdf = make_float3(0.0f);
     thePrd.pdf = 0.0f;
-    thePrd.flags = parameters.flags | FLAG_PATH;
+    thePrd.flags = parameters.flags | FLAG_PATH; // also clears FLAG_AOV, only the first hit is recorded
 
     // --- importance sample light source
     const float2 sample = rng2(thePrd.seed);
 
     LightSample lightSample;
-    lightSample.index = optix::clamp(static_cast<int>(
-                                         floorf(rng(thePrd.seed) * sysNumLights)), 0, sysNumLights - 1);
-
-
-    const LightType lightType = sysLightDefinitions[lightSample.index].type;
-    sysSampleLight[lightType](thePrd.pos, sample, lightSample);
-    if (0.0f < lightSample.pdf) {
+    float lightSelectionPdf;
+    lightSample.index = selectLight(sysLightAliasTable, sysLightBVH, sysNumLights, sysNumInfiniteLights,
+                                    thePrd.pos, rng(thePrd.seed), lightSelectionPdf);
+    lightSample.pdf = 0.0f;
+
+    const LightType lightType = (0 <= lightSample.index) ? sysLightDefinitions[lightSample.index].type : ENVIRONMENT;
+    if (0 <= lightSample.index)
+        sysSampleLight[lightType](thePrd.pos, sample, lightSample);
+    if (0.0f < lightSample.pdf && 0.0f < lightSelectionPdf) {
         // handle delta lights
         float4 bsdf_pdf = sysEvalBSDF[parameters.indexBSDF](parameters, state, thePrd, lightSample.direction);
 
@@ -130,14 +184,15 @@ RT_PROGRAM void closest_hit()
                 // don't importance sample delta lights
                 if (lightType == DIRECTIONAL || lightType == POINT) {
                     // TODO solve dark spot problem in transparent material for directional lights
-                    thePrd.radiance += make_float3(bsdf_pdf) * lightSample.emission * float(sysNumLights) *
-                        (dot(lightSample.direction, state.normal) / lightSample.pdf);
+                    thePrd.radiance += make_float3(bsdf_pdf) * lightSample.emission *
+                        (dot(lightSample.direction, state.normal) / (lightSample.pdf * lightSelectionPdf));
                 }
                 else {
-                    const float misWeight = powerHeuristic(lightSample.pdf, bsdf_pdf.w);
+                    const float lightPdf = lightSample.pdf * lightSelectionPdf;
+                    const float misWeight = powerHeuristic(lightPdf, bsdf_pdf.w);
 
-                    thePrd.radiance += make_float3(bsdf_pdf) * lightSample.emission * float(sysNumLights) *
-                        (misWeight * dot(lightSample.direction, state.normal) / lightSample.pdf);
+                    thePrd.radiance += make_float3(bsdf_pdf) * lightSample.emission *
+                        (misWeight * dot(lightSample.direction, state.normal) / lightPdf);
                 }
             }
         }
@@ -148,5 +203,6 @@ RT_PROGRAM void closest_hit()
     sysSampleBSDF[parameters.indexBSDF](parameters, state, thePrd);
     thePrd.pdf /= mixFactor;
     thePrd.f_over_pdf *= mixFactor;
+    thePrd.coneSpread = bounceConeSpread(thePrd.coneSpread, thePrd.pdf);
 
 }
\ No newline at end of file
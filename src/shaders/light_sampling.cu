@@ -6,11 +6,21 @@
 #include "../utils/config.h"
 #include "../core/perraydata.h"
 #include "../core/lightdata.h"
+#include "../core/virtualtexture.h"
 #include "../math/basic.h"
+#include "../math/distribution.h"
 
 rtBuffer<LightDefinition> sysLightDefinitions;
 rtDeclareVariable(int,    sysNumLights, , );
-rtDeclareVariable(float,  sysEnvironmentRotation, , );
+
+// Luminance distribution of the environment texture. Zero size means uniform sampling.
+rtBuffer<float> sysEnvironmentConditional;
+rtBuffer<float> sysEnvironmentMarginal;
+rtDeclareVariable(int2,   sysEnvironmentDistributionSize, , );
+
+// Triangles of mesh lights with per light alias tables proportional to triangle area.
+rtBuffer<EmitterTriangle> sysEmitterTriangles;
+rtBuffer<AliasEntry>      sysEmitterAliasTable;
 
 // Note that all light sampling routines return lightSample.direction and lightSample.distance in world space!
 
@@ -18,21 +28,32 @@ RT_CALLABLE_PROGRAM void sample_environment_light(float3 const& point, const flo
 {
     LightDefinition light = sysLightDefinitions[lightSample.index];
 
-    unitSquareToSphere(sample.x, sample.y, lightSample.direction, lightSample.pdf);
+    // Same rotation as in the miss program. DAR FIXME Use a light.matrix to rotate the environment.
+    const float envRotation = light.direction.z * 0.5f;
+
+    float2 uv;
+    if (0 < sysEnvironmentDistributionSize.x) {
+        // Importance sample the texture luminance and convert pdf from texture space to solid angle.
+        float pdfUV;
+        uv = sampleDistribution2D(sysEnvironmentConditional, sysEnvironmentMarginal,
+            sysEnvironmentDistributionSize.x, sysEnvironmentDistributionSize.y, sample, pdfUV);
+
+        float sinTheta;
+        lightSample.direction = environmentUVToDirection(uv, envRotation, sinTheta);
+        lightSample.pdf = (0.0f < sinTheta) ? pdfUV / (2.0f * M_PIf * M_PIf * sinTheta) : 0.0f;
+    }
+    else {
+        unitSquareToSphere(sample.x, sample.y, lightSample.direction, lightSample.pdf);
+        uv = environmentDirectionToUV(lightSample.direction, envRotation);
+    }
 
     // Environment lights do not set the light sample position!
     lightSample.distance = RT_DEFAULT_MAX; // Environment light.
 
-    const float3 &R = lightSample.direction;
-    // The seam u == 0.0 == 1.0 is in positive z-axis direction.
-    // Compensate for the environment rotation done inside the direct lighting.
-    const float u     = (atan2f(R.x, -R.z) + M_PIf) * 0.5f * M_1_PIf + sysEnvironmentRotation; // DAR FIXME Use a light.matrix to rotate the environment.
-    const float theta = acosf(-R.y);     // theta == 0.0f is south pole, theta == M_PIf is north pole.
-    const float v     = theta * M_1_PIf; // Texture is with origin at lower left, v == 0.0f is south pole.
-
     float3 texColor = make_float3(1.0f);
     if (light.environmentTextureID != RT_TEXTURE_ID_NULL)
-        texColor = make_float3(optix::rtTex2D<float4>(light.environmentTextureID, u, v));
+        texColor = make_float3(sampleTexture(light.environmentTextureID, light.textureScale * uv,
+                                              make_float2(0.0f)));
     lightSample.emission = light.emission * texColor;
 }
 
@@ -47,4 +68,55 @@ RT_CALLABLE_PROGRAM void sample_directional_light(float3 const& point, const flo
     lightSample.pdf = 1;
 
     lightSample.emission = light.emission;
-}
\ No newline at end of file
+}
+RT_CALLABLE_PROGRAM void sample_point_light(float3 const& point, const float2 sample, LightSample& lightSample)
+{
+    LightDefinition light = sysLightDefinitions[lightSample.index];
+
+    const float3 toLight = light.position - point;
+    lightSample.distance = length(toLight);
+    if (lightSample.distance <= 0.0f) {
+        lightSample.pdf = 0.0f;
+        return;
+    }
+
+    lightSample.position = light.position;
+    lightSample.direction = toLight / lightSample.distance;
+    lightSample.pdf = 1;
+
+    // emission of point light is its intensity
+    lightSample.emission = light.emission / (lightSample.distance * lightSample.distance);
+}
+
+RT_CALLABLE_PROGRAM void sample_mesh_light(float3 const& point, const float2 sample, LightSample& lightSample)
+{
+    LightDefinition light = sysLightDefinitions[lightSample.index];
+
+    float trianglePdf, remapped;
+    const int index = sampleAlias(sysEmitterAliasTable, light.triangleOffset, light.triangleCount, sample.x,
+                                  trianglePdf, remapped);
+    const EmitterTriangle triangle = sysEmitterTriangles[light.triangleOffset + index];
+
+    // uniform point on the triangle
+    const float su = sqrtf(remapped);
+    lightSample.position = triangle.vertex0 + triangle.edge1 * (su * (1.0f - sample.y)) + triangle.edge2 * (su * sample.y);
+
+    const float3 toLight = lightSample.position - point;
+    lightSample.distance = length(toLight);
+    if (lightSample.distance <= 0.0f || triangle.area <= 0.0f) {
+        lightSample.pdf = 0.0f;
+        return;
+    }
+    lightSample.direction = toLight / lightSample.distance;
+
+    // only the front face emits, convert area density to solid angle
+    const float3 normal = normalize(cross(triangle.edge1, triangle.edge2));
+    const float cosLight = -dot(lightSample.direction, normal);
+    if (cosLight <= 0.0f) {
+        lightSample.pdf = 0.0f;
+        return;
+    }
+    lightSample.pdf = trianglePdf / triangle.area * lightSample.distance * lightSample.distance / cosLight;
+
+    lightSample.emission = light.emission;
+}
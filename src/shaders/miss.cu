@@ -4,9 +4,20 @@
 
 #include "../core/perraydata.h"
 #include "../core/lightdata.h"
+#include "../core/virtualtexture.h"
 #include "../math/basic.h"
+#include "../math/distribution.h"
+#include "../math/lightbvh.h"
+#include "../math/raycone.h"
 
 rtBuffer<LightDefinition> sysLightDefinitions;
+rtBuffer<AliasEntry> sysLightAliasTable;
+rtDeclareVariable(int, sysNumLights, , );
+rtDeclareVariable(int, sysNumInfiniteLights, , );
+
+rtBuffer<float> sysEnvironmentConditional;
+rtBuffer<float> sysEnvironmentMarginal;
+rtDeclareVariable(int2, sysEnvironmentDistributionSize, , );
 
 rtDeclareVariable(optix::Ray, theRay, rtCurrentRay, );
 rtDeclareVariable(PerRayData, thePrd, rtPayload, );
@@ -21,20 +32,32 @@ RT_PROGRAM void miss_gradient()
     const float envRotation = light.direction.z * 0.5f;
 
     const float3 R = theRay.direction;
-    // The seam u == 0.0 == 1.0 is in positive z-axis direction.
-    // Compensate for the environment rotation done inside the direct lighting.
-    const float u     = (atan2f(R.x, -R.z) + M_PIf) * 0.5f * M_1_PIf + envRotation; // DAR FIXME Use a light.matrix to rotate the environment.
-    const float theta = acosf(-R.y);     // theta == 0.0f is south pole, theta == M_PIf is north pole.
-    const float v     = 1 - theta * M_1_PIf; // Texture is with origin at lower left, v == 0.0f is south pole.
+    // DAR FIXME Use a light.matrix to rotate the environment.
+    const float2 uv = environmentDirectionToUV(R, envRotation);
 
     float3 texColor = make_float3(1.0f);
     if (light.environmentTextureID != RT_TEXTURE_ID_NULL)
-        texColor = make_float3(optix::rtTex2D<float4>(light.environmentTextureID, light.textureScale * u, light.textureScale * v));
-
-    float weightMIS = (thePrd.flags & FLAG_PATH) ? powerHeuristic(thePrd.pdf, 0.25f * M_1_PIf) : 1.f;
+        texColor = make_float3(sampleTexture(light.environmentTextureID, light.textureScale * uv,
+                                              light.textureScale * environmentUVFootprint(thePrd.coneSpread)));
+
+    float weightMIS = 1.0f;
+    if (thePrd.flags & FLAG_PATH) {
+        // Same density as used by sample_environment_light.
+        float envPdf = 0.25f * M_1_PIf;
+        if (0 < sysEnvironmentDistributionSize.x) {
+            const float sinTheta = sqrtf(fmaxf(0.0f, 1.0f - R.y * R.y));
+            const float2 wrapped = make_float2(uv.x - floorf(uv.x), uv.y);
+            envPdf = (0.0f < sinTheta) ? pdfDistribution2D(sysEnvironmentConditional, sysEnvironmentMarginal,
+                sysEnvironmentDistributionSize.x, sysEnvironmentDistributionSize.y, wrapped) /
+                (2.0f * M_PIf * M_PIf * sinTheta) : 0.0f;
+        }
+
+        // environment light is always the first one, its light pdf includes the probability of picking it
+        const float lightPdf = infiniteLightProbability(sysNumLights, sysNumInfiniteLights) *
+            sysLightAliasTable[0].pdf * envPdf;
+        weightMIS = powerHeuristic(thePrd.pdf, lightPdf);
+    }
     thePrd.radiance = make_float3(weightMIS) * light.emission * texColor;
 
-    //TODO proper importance sampling of environment light source
-
     thePrd.flags |= FLAG_TERMINATE;
 }
\ No newline at end of file
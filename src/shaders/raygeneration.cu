@@ -16,6 +16,9 @@
 #include "../math/basic.h"
 
 #include "../core/perraydata.h"
+#include "../core/aov.h"
+#include "../core/adaptivesampler.h"
+#include "../math/raycone.h"
 
 rtBuffer<float4,  2> sysOutputBuffer; // RGBA32F
 
@@ -23,6 +26,7 @@ rtDeclareVariable(rtObject, sysTopObject, , );
 rtDeclareVariable(float,    sysSceneEpsilon, , );
 rtDeclareVariable(int2,     sysPathLengths, , );
 rtDeclareVariable(int,      sysIterationIndex, , );
+rtDeclareVariable(int,      sysSamplesPerLaunch, , ); // Samples every launch adds to a pixel, starting at sysIterationIndex.
 
 rtDeclareVariable(float3, sysCameraPosition, , );
 rtDeclareVariable(float3, sysCameraU, , );
@@ -34,6 +38,7 @@ rtDeclareVariable(uint2, theLaunchIndex, rtLaunchIndex, );
 
 rtDeclareVariable(uint2, tileOffset, , );
 rtDeclareVariable(uint2, resolution, , );
+rtDeclareVariable(uint2, sysFilmOffset, , ); // Pixel of the image at the start of the film, non-zero for buckets.
 
 RT_FUNCTION void integrator(PerRayData& prd, float3& radiance)
 {
@@ -44,7 +49,9 @@ RT_FUNCTION void integrator(PerRayData& prd, float3& radiance)
     while (depth < sysPathLengths.y)
     {
         prd.wo    = -prd.wi;
-        prd.flags = 0;
+        prd.flags &= FLAG_PATH; // Keep only the MIS flag set by the previous closest hit.
+        if (depth == 0 && sysAovMask)
+            prd.flags |= FLAG_AOV; // Layers are off by default and cost only this test.
 
         // Note that the primary rays wouldn't need to offset the ray t_min by sysSceneEpsilon.
         optix::Ray ray = optix::make_Ray(prd.pos, prd.wi, 0, sysSceneEpsilon, RT_DEFAULT_MAX);
@@ -75,13 +82,12 @@ RT_FUNCTION void integrator(PerRayData& prd, float3& radiance)
     }
 }
 
-// Entry point for pinhole camera with manual accumulation, non-VCA.
-RT_PROGRAM void raygeneration()
+// Traces one camera path through the pixel, sampleIndex selects the random sequence.
+RT_FUNCTION float3 pathSample(const uint2 tileLaunchIndex, const uint2 filmIndex, const int sampleIndex)
 {
     PerRayData prd;
 
-    const uint2 tileLaunchIndex = tileOffset + theLaunchIndex;
-    prd.seed = tea<8>(tileLaunchIndex.y * resolution.x + tileLaunchIndex.x, sysIterationIndex);
+    prd.seed = tea<8>(tileLaunchIndex.y * resolution.x + tileLaunchIndex.x, sampleIndex);
 
     const float2 pixel = make_float2(tileLaunchIndex);
     const float2 fragment = pixel + rng2(prd.seed);
@@ -89,42 +95,83 @@ RT_PROGRAM void raygeneration()
     const float2 screen = make_float2(resolution);
     const float2 ndc = (fragment / screen) * 2.0f - 1.0f;
 
-    prd.pos = sysCameraPosition;
-    prd.wi  = optix::normalize(ndc.x * sysCameraU + ndc.y * sysCameraV + sysCameraW);
+    prd.pos   = sysCameraPosition;
+    prd.wi    = optix::normalize(ndc.x * sysCameraU + ndc.y * sysCameraV + sysCameraW);
+    prd.flags = 0; // Primary rays see lights directly without MIS.
+    prd.coneWidth  = 0.0f;
+    prd.coneSpread = pixelSpreadAngle(length(sysCameraV) / length(sysCameraW), resolution.y);
+    prd.aovAlbedo = make_float3(0.0f);
+    prd.aovNormal = make_float3(0.0f);
+    prd.aovDepth = AOV_NO_HIT_DEPTH;
+    prd.aovPrimitiveID = -1;
+    prd.aovMaterialID = -1;
 
     float3 radiance;
     integrator(prd, radiance);
 
+    if (sysAovMask)
+        writeAovs(filmIndex, sampleIndex, prd.aovAlbedo, prd.aovNormal, prd.aovDepth,
+                  prd.aovPrimitiveID, prd.aovMaterialID);
+    return radiance;
+}
+
+// Entry point for pinhole camera with manual accumulation, non-VCA.
+RT_PROGRAM void raygeneration()
+{
+    const uint2 tileLaunchIndex = tileOffset + theLaunchIndex;
+    if (!pixelActive(tileLaunchIndex))
+        return; // converged, the film keeps its average
+    const uint2 filmIndex = tileLaunchIndex - sysFilmOffset;
+
+    // samples of one launch are summed up first, so the film is read and written once
+    float3 sum = make_float3(0.0f);
+    float squaredLuminance = 0.0f;
+    int count = 0;
+    for (int i = 0; i < sysSamplesPerLaunch; ++i)
+    {
+        float3 radiance = pathSample(tileLaunchIndex, filmIndex, sysIterationIndex + i);
+
 #ifdef USE_DEBUG_EXCEPTIONS
-    // DAR DEBUG Highlight numerical errors.
-  if (isnan(radiance.x) || isnan(radiance.y) || isnan(radiance.z))
-  {
-    radiance = make_float3(1000000.0f, 0.0f, 0.0f); // super red
-  }
-  else if (isinf(radiance.x) || isinf(radiance.y) || isinf(radiance.z))
-  {
-    radiance = make_float3(0.0f, 1000000.0f, 0.0f); // super green
-  }
-  else if (radiance.x < 0.0f || radiance.y < 0.0f || radiance.z < 0.0f)
-  {
-    radiance = make_float3(0.0f, 0.0f, 1000000.0f); // super blue
-  }
+        // DAR DEBUG Highlight numerical errors.
+        if (isnan(radiance.x) || isnan(radiance.y) || isnan(radiance.z))
+        {
+            radiance = make_float3(1000000.0f, 0.0f, 0.0f); // super red
+        }
+        else if (isinf(radiance.x) || isinf(radiance.y) || isinf(radiance.z))
+        {
+            radiance = make_float3(0.0f, 1000000.0f, 0.0f); // super green
+        }
+        else if (radiance.x < 0.0f || radiance.y < 0.0f || radiance.z < 0.0f)
+        {
+            radiance = make_float3(0.0f, 0.0f, 1000000.0f); // super blue
+        }
 #else
-    // NaN values will never go away. Filter them out before they can arrive in the output buffer.
-    // This only has an effect if the debug coloring above is off!
-    if (!(isnan(radiance.x) || isnan(radiance.y) || isnan(radiance.z)))
+        // NaN values will never go away. Filter them out before they can arrive in the output buffer.
+        // This only has an effect if the debug coloring above is off!
+        if (isnan(radiance.x) || isnan(radiance.y) || isnan(radiance.z))
+            continue;
 #endif
+        sum += radiance;
+        squaredLuminance += sampleLuminance(radiance) * sampleLuminance(radiance);
+        ++count;
+    }
+
+    if (0 < count)
     {
+        const float3 mean = sum / (float) count;
         if (0 < sysIterationIndex)
         {
-            // lerp sample with previously stored result
-            float4 dst = sysOutputBuffer[tileLaunchIndex];  // RGBA32F
-            sysOutputBuffer[tileLaunchIndex] = optix::lerp(dst, make_float4(radiance, 1.0f), 1.0f / (float) (sysIterationIndex + 1));
+            // lerp samples with previously stored result
+            float4 dst = sysOutputBuffer[filmIndex];  // RGBA32F
+            sysOutputBuffer[filmIndex] = optix::lerp(dst, make_float4(mean, 1.0f),
+                (float) sysSamplesPerLaunch / (float) (sysIterationIndex + sysSamplesPerLaunch));
         }
         else
         {
-            // fill buffer with first sample
-            sysOutputBuffer[tileLaunchIndex] = make_float4(radiance, 1.0f);
+            // fill buffer with first samples
+            sysOutputBuffer[filmIndex] = make_float4(mean, 1.0f);
         }
+        if (sysAdaptiveSampling)
+            writeSecondMoment(filmIndex, sysIterationIndex, sysSamplesPerLaunch, squaredLuminance / (float) count);
     }
 }
@@ -4,6 +4,7 @@
 
 #include "../core/vertexattributes.h"
 #include "../math/basic.h"
+#include "../math/raycone.h"
 
 rtBuffer<VertexAttributes> attributesBuffer;
 
@@ -12,6 +13,8 @@ rtDeclareVariable(optix::float3, varGeoNormal, attribute GEO_NORMAL, );
 rtDeclareVariable(optix::float3, varTangent,   attribute TANGENT, );
 rtDeclareVariable(optix::float3, varNormal,    attribute NORMAL, );
 rtDeclareVariable(optix::float3, varTexCoord,  attribute TEXCOORD, );
+rtDeclareVariable(int,           varPrimitiveIndex, attribute PRIMITIVE_INDEX, );
+rtDeclareVariable(float,         varUVDensity, attribute UV_DENSITY, ); // Texture coordinates per object space unit.
 
 rtDeclareVariable(optix::Ray, theRay, rtCurrentRay, );
 
@@ -65,6 +68,12 @@ RT_PROGRAM void triangle_intersection(int primitiveIndex)
                 varNormal = a0.normal   * alpha + a1.normal   * beta + a2.normal   * gamma;
 
             varTexCoord = a0.texcoord * alpha + a1.texcoord * beta + a2.texcoord * gamma;
+            varPrimitiveIndex = primitiveIndex;
+
+            // n is the unnormalized cross product of two edges, its length is twice the area
+            const float2 uv1 = make_float2(a1.texcoord - a0.texcoord);
+            const float2 uv2 = make_float2(a2.texcoord - a0.texcoord);
+            varUVDensity = triangleUVDensity(uv1.x * uv2.y - uv2.x * uv1.y, length(n));
 
             rtReportIntersection(0);
         }
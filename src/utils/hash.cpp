@@ -0,0 +1,90 @@
+
+#include "hash.h"
+#include "mappedfile.h"
+
+#include <cstring>
+
+static const uint64_t prime1 = 11400714785074694791ULL;
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read64(const unsigned char *data)
+{
+    uint64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline uint64_t mixRound(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * prime2;
+    return rotateLeft(accumulator, 31) * prime1;
+}
+
+static inline uint64_t mergeRound(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= mixRound(0, value);
+    return accumulator * prime1 + prime4;
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+    const unsigned char *end = bytes + size;
+
+    uint64_t hash;
+    if (32 <= size) {
+        // four independent lanes of 8 bytes
+        uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for (; bytes + 32 <= end; bytes += 32)
+            for (int i = 0; i < 4; i++)
+                lanes[i] = mixRound(lanes[i], read64(bytes + 8 * i));
+
+        hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+        for (int i = 0; i < 4; i++)
+            hash = mergeRound(hash, lanes[i]);
+    }
+    else
+        hash = seed + prime5;
+
+    hash += uint64_t(size);
+    for (; bytes + 8 <= end; bytes += 8)
+        hash = rotateLeft(hash ^ mixRound(0, read64(bytes)), 27) * prime1 + prime4;
+    if (bytes + 4 <= end) {
+        hash = rotateLeft(hash ^ (uint64_t(read32(bytes)) * prime1), 23) * prime2 + prime3;
+        bytes += 4;
+    }
+    for (; bytes < end; bytes++)
+        hash = rotateLeft(hash ^ (*bytes * prime5), 11) * prime1;
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+bool hashFile(const std::string &filename, uint64_t &hash)
+{
+    MappedFile file;
+    if (!mapFile(filename, file))
+        return false;
+    hash = hashBytes(file.data, file.size);
+    unmapFile(file);
+    return true;
+}
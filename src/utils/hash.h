@@ -0,0 +1,15 @@
+
+#ifndef RENDERER_GPU_HASH_H
+#define RENDERER_GPU_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit xxHash (XXH64) of a block of memory. Fast, but not meant to resist deliberate collisions.
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+// Hash of the content of a file, which is memory mapped for reading.
+bool hashFile(const std::string &filename, uint64_t &hash);
+
+#endif //RENDERER_GPU_HASH_H
@@ -4,12 +4,14 @@
 
 void Logger::Clear()
 {
+    std::lock_guard<std::mutex> lock(Mutex);
     Buf.clear();
     LineOffsets.clear();
 }
 
 void Logger::AddLog(int logType, const char *fmt, ...)
 {
+    std::lock_guard<std::mutex> lock(Mutex);
 
     int old_size = Buf.size();
 
@@ -42,6 +44,7 @@ void Logger::Draw(const char *title, bool *p_opened)
     ImGui::SetNextWindowSize(ImVec2(400, 100), ImGuiSetCond_FirstUseEver);
     ImGui::Begin(title, p_opened);
     if (ImGui::Button("Clear")) Clear();
+    std::lock_guard<std::mutex> lock(Mutex);
     ImGui::SameLine();
     bool copy = ImGui::Button("Copy");
     ImGui::SameLine();
@@ -7,6 +7,7 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <mutex>
 
 class Logger
 {
@@ -24,6 +25,7 @@ public:
 private:
     Logger() = default;
 
+    std::mutex Mutex; // AddLog is called from texture loading threads too
     ImGuiTextBuffer Buf;
     ImGuiTextFilter Filter;
     ImVector<int> LineOffsets;        // Index to lines offset
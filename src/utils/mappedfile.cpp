@@ -0,0 +1,38 @@
+
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool mapFile(const std::string &filename, MappedFile &file)
+{
+    file = MappedFile();
+    const int descriptor = open(filename.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        close(descriptor);
+        return false;
+    }
+
+    // mapping stays valid after the descriptor is closed
+    void *data = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (data == MAP_FAILED)
+        return false;
+
+    file.data = (const unsigned char *) data;
+    file.size = size_t(status.st_size);
+    return true;
+}
+
+void unmapFile(MappedFile &file)
+{
+    if (file.data)
+        munmap((void *) file.data, file.size);
+    file = MappedFile();
+}
@@ -0,0 +1,20 @@
+
+#ifndef RENDERER_GPU_MAPPEDFILE_H
+#define RENDERER_GPU_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+struct MappedFile
+{
+    const unsigned char *data;
+    size_t size;
+
+    MappedFile() : data(nullptr), size(0) {}
+};
+
+bool mapFile(const std::string &filename, MappedFile &file);
+void unmapFile(MappedFile &file);
+
+#endif //RENDERER_GPU_MAPPEDFILE_H
@@ -0,0 +1,100 @@
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+ThreadPool::ThreadPool(int threadCount)
+    : m_stop(false)
+{
+    for (int i = 0; i < threadCount; i++)
+        m_threads.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (auto &thread : m_threads)
+        thread.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::work()
+{
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty())
+                return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+ThreadPool &ThreadPool::getInstance()
+{
+    static ThreadPool pool(std::max(1, int(std::thread::hardware_concurrency()) - 1));
+    return pool;
+}
+
+void parallelFor(int count, const std::function<void(int)> &function)
+{
+    if (count <= 0)
+        return;
+    if (count == 1) {
+        function(0);
+        return;
+    }
+
+    // shared with helper tasks that may start after this call returned, they find no work left then
+    struct State
+    {
+        std::atomic<int> next;
+        std::atomic<int> done;
+        int count;
+        const std::function<void(int)> *function;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+    state->count = count;
+    state->function = &function;
+
+    auto run = [state]() {
+        for (int index = state->next++; index < state->count; index = state->next++) {
+            (*state->function)(index);
+            if (++state->done == state->count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    ThreadPool &pool = ThreadPool::getInstance();
+    const int helpers = std::min(pool.threadCount(), count - 1);
+    for (int i = 0; i < helpers; i++)
+        pool.enqueue(run);
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state] { return state->done == state->count; });
+}
@@ -0,0 +1,40 @@
+
+#ifndef RENDERER_GPU_THREADPOOL_H
+#define RENDERER_GPU_THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads executing queued tasks in FIFO order.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    void enqueue(std::function<void()> task);
+    int threadCount() const { return int(m_threads.size()); }
+
+    // Shared pool with one worker per hardware thread except the calling one.
+    static ThreadPool &getInstance();
+
+private:
+    void work();
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop;
+};
+
+// Calls function(index) for all indices in [0, count) on the shared pool and returns when all are done.
+// Calling thread takes indices too and only waits for those already running elsewhere,
+// so parallelFor can be nested inside tasks without deadlocks.
+void parallelFor(int count, const std::function<void(int)> &function);
+
+#endif //RENDERER_GPU_THREADPOOL_H
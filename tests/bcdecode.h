@@ -0,0 +1,167 @@
+
+#ifndef RENDERER_GPU_BCDECODE_H
+#define RENDERER_GPU_BCDECODE_H
+
+#include "../src/core/blockcompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Reference decoders written from the format specification, independent of the encoder. Interpolation is exact
+// like the encoder assumes, hardware may round the interpolated values by up to one code.
+
+static void unpack565(unsigned short packed, float *color)
+{
+    const int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = float((r << 3) | (r >> 2));
+    color[1] = float((g << 2) | (g >> 4));
+    color[2] = float((b << 3) | (b >> 2));
+}
+
+// Decodes RGB of 16 pixels, alpha is left alone.
+static void decodeBC1(const unsigned char *block, float (*pixels)[4])
+{
+    const unsigned short color0 = (unsigned short) (block[0] | (block[1] << 8));
+    const unsigned short color1 = (unsigned short) (block[2] | (block[3] << 8));
+    float palette[4][3];
+    unpack565(color0, palette[0]);
+    unpack565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        if (color1 < color0) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+            palette[3][c] = 0.0f;
+        }
+    }
+
+    const uint32_t indices = uint32_t(block[4]) | (uint32_t(block[5]) << 8) | (uint32_t(block[6]) << 16) |
+        (uint32_t(block[7]) << 24);
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            pixels[i][c] = palette[(indices >> (2 * i)) & 3u][c];
+}
+
+static void decodeBC4(const unsigned char *block, int channel, float (*pixels)[4])
+{
+    const float red0 = float(block[0]), red1 = float(block[1]);
+    float palette[8] = {red0, red1};
+    if (red1 < red0)
+        for (int i = 1; i < 7; i++)
+            palette[i + 1] = (float(7 - i) * red0 + float(i) * red1) / 7.0f;
+    else {
+        for (int i = 1; i < 5; i++)
+            palette[i + 1] = (float(5 - i) * red0 + float(i) * red1) / 5.0f;
+        palette[6] = 0.0f;
+        palette[7] = 255.0f;
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+        indices |= uint64_t(block[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; i++)
+        pixels[i][channel] = palette[(indices >> (3 * i)) & 7u];
+}
+
+static unsigned int readBits(const unsigned char *block, int &position, int count)
+{
+    unsigned int value = 0;
+    for (int i = 0; i < count; i++, position++)
+        value |= (unsigned int) ((block[position >> 3] >> (position & 7)) & 1) << i;
+    return value;
+}
+
+// Only mode 6 is decoded, other modes return false.
+static bool decodeBC7(const unsigned char *block, float (*pixels)[4])
+{
+    int position = 0;
+    if (readBits(block, position, 7) != (1u << 6))
+        return false;
+
+    int endpoint[2][4];
+    for (int c = 0; c < 4; c++)
+        for (int e = 0; e < 2; e++)
+            endpoint[e][c] = int(readBits(block, position, 7)) << 1;
+    for (int e = 0; e < 2; e++) {
+        const int pBit = int(readBits(block, position, 1));
+        for (int c = 0; c < 4; c++)
+            endpoint[e][c] |= pBit;
+    }
+
+    static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    for (int i = 0; i < 16; i++) {
+        const int index = int(readBits(block, position, (i == 0) ? 3 : 4));
+        for (int c = 0; c < 4; c++)
+            pixels[i][c] = float(((64 - weights[index]) * endpoint[0][c] + weights[index] * endpoint[1][c] + 32) >> 6);
+    }
+    return true;
+}
+
+// Decodes a block of any format, channels the format drops are zero.
+static bool decodeBlock(const unsigned char *block, BlockFormat format, float (*pixels)[4])
+{
+    memset(pixels, 0, sizeof(float) * 16 * 4);
+    switch (format) {
+    case BLOCK_BC1:
+        decodeBC1(block, pixels);
+        return true;
+    case BLOCK_BC4:
+        decodeBC4(block, 0, pixels);
+        return true;
+    case BLOCK_BC5:
+        decodeBC4(block, 0, pixels);
+        decodeBC4(block + 8, 1, pixels);
+        return true;
+    case BLOCK_BC7:
+        return decodeBC7(block, pixels);
+    default:
+        return false;
+    }
+}
+
+static int blockChannels(BlockFormat format)
+{
+    return (format == BLOCK_BC1) ? 3 : ((format == BLOCK_BC4) ? 1 : ((format == BLOCK_BC5) ? 2 : 4));
+}
+
+// Squared error of a decoded block against 16 RGBA8 pixels, over the channels the format keeps.
+static double blockError(const unsigned char *source, BlockFormat format, const float (*decoded)[4])
+{
+    double error = 0.0;
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < blockChannels(format); c++) {
+            const double difference = double(decoded[i][c]) - double(source[i * 4 + c]);
+            error += difference * difference;
+        }
+    return error;
+}
+
+// PSNR of an encoded level, blocks over the border repeat the last row and column like the encoder does.
+static double levelPsnr(const unsigned char *pixels, int width, int height, BlockFormat format,
+    const unsigned char *blocks)
+{
+    const int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    double error = 0.0;
+    for (int row = 0; row < blocksY; row++)
+        for (int column = 0; column < blocksX; column++) {
+            unsigned char tile[16 * 4];
+            for (int y = 0; y < 4; y++)
+                for (int x = 0; x < 4; x++) {
+                    const int sx = std::min(column * 4 + x, width - 1), sy = std::min(row * 4 + y, height - 1);
+                    memcpy(tile + (y * 4 + x) * 4, pixels + (size_t(sy) * width + sx) * 4, 4);
+                }
+            float decoded[16][4];
+            if (!decodeBlock(blocks + (size_t(row) * blocksX + column) * blockBytes(format), format, decoded))
+                return 0.0;
+            error += blockError(tile, format, decoded);
+        }
+
+    const double meanError = error / (double(blocksX) * blocksY * 16 * blockChannels(format));
+    return (0.0 < meanError) ? 10.0 * std::log10(255.0 * 255.0 / meanError) : INFINITY;
+}
+
+#endif //RENDERER_GPU_BCDECODE_H
@@ -0,0 +1,64 @@
+
+#include "bcdecode.h"
+
+#include "../src/core/image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+// Encode throughput and quality of all formats on the bundled textures, full mip chains included.
+// PSNR of the finest level comes from the reference decoders. Usage: bench_blockcompression [directory]
+int main(int argc, char **argv)
+{
+    const std::string directory = (1 < argc) ? argv[1] : RENDERER_RESOURCE_DIR "/textures";
+    std::vector<std::string> names;
+    if (DIR *dir = opendir(directory.c_str())) {
+        while (dirent *entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            const size_t dot = name.rfind('.');
+            const std::string extension = (dot == std::string::npos) ? "" : name.substr(dot);
+            if (extension == ".png" || extension == ".jpg")
+                names.push_back(name);
+        }
+        closedir(dir);
+    }
+    std::sort(names.begin(), names.end());
+
+#ifdef __SSE2__
+    printf("index search: SSE2\n");
+#else
+    printf("index search: scalar\n");
+#endif
+    printf("%-24s %-11s %-5s %10s %12s %9s\n", "texture", "size", "format", "ms", "Mpixel/s", "PSNR dB");
+
+    const BlockFormat formats[] = {BLOCK_BC1, BLOCK_BC4, BLOCK_BC5, BLOCK_BC7};
+    for (auto &name : names) {
+        Image image(0);
+        if (!image.load(directory + "/" + name) || image.format() != Image::RGBA8_SRGB)
+            continue;
+        const double megapixels = double(image.byteSize()) / 4.0 / 1e6;
+
+        for (BlockFormat format : formats) {
+            // best of three, the source name doesn't exist so the cache is never used
+            double milliseconds = 1e30;
+            CompressedImage result;
+            for (int run = 0; run < 3; run++) {
+                const auto start = std::chrono::high_resolution_clock::now();
+                compressImage(image, "bench_blockcompression_uncached", format, result);
+                milliseconds = std::min(milliseconds, std::chrono::duration<double, std::milli>(
+                    std::chrono::high_resolution_clock::now() - start).count());
+            }
+
+            const double psnr = levelPsnr(image.data(), image.width(), image.height(), format, result.data.data());
+            const std::string size = std::to_string(image.width()) + "x" + std::to_string(image.height());
+            printf("%-24s %-11s %-5s %10.1f %12.1f %9.2f\n", name.c_str(), size.c_str(), blockFormatName(format),
+                   milliseconds, megapixels / (milliseconds * 1e-3), psnr);
+        }
+    }
+    return 0;
+}
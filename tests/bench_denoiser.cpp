@@ -0,0 +1,138 @@
+
+#include "../src/core/denoiser.h"
+#include "../src/utils/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Quality and latency of the denoiser on a synthetic render at 1080p and 4K. A pixel is albedo times a smooth
+// illumination with a shadow, samples scatter around it like path traced ones. The mean of n samples is drawn
+// from its gamma distribution at once, so a 4096 spp reference is as cheap as the noisy film. Prints the RMSE
+// against the reference of the noisy film and of the denoised one with and without guides, and the time of
+// a denoise. Usage: bench_denoiser
+
+static double bestOf(int runs, const std::function<void()> &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+struct SyntheticRender
+{
+    int width, height;
+    std::vector<float> albedo, normal, radiance; // RGB, the expected value of every pixel
+
+    SyntheticRender(int width, int height)
+        : width(width), height(height)
+    {
+        albedo.resize(size_t(width) * height * 3);
+        normal.resize(size_t(width) * height * 3);
+        radiance.resize(size_t(width) * height * 3);
+        const float scale = 1080.0f / float(height);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++) {
+                const size_t p = size_t(y) * width + x;
+                const float u = float(x) * scale, v = float(y) * scale;
+                // a floor with a checker texture below a wall with stripes, a sphere in front
+                const float dx = u - 900.0f, dy = v - 600.0f;
+                const bool sphere = dx * dx + dy * dy < 250.0f * 250.0f;
+                const bool floor = v < 400.0f;
+                float a[3], n[3];
+                if (sphere) {
+                    const float nz = sqrtf(std::max(0.0f, 1.0f - (dx * dx + dy * dy) / (250.0f * 250.0f)));
+                    a[0] = 0.7f, a[1] = 0.2f, a[2] = 0.1f;
+                    n[0] = dx / 250.0f, n[1] = dy / 250.0f, n[2] = nz;
+                } else if (floor) {
+                    const bool checker = (int(u / 40.0f) + int(v / 40.0f)) % 2 == 0;
+                    a[0] = a[1] = a[2] = checker ? 0.8f : 0.05f;
+                    n[0] = 0.0f, n[1] = 1.0f, n[2] = 0.0f;
+                } else {
+                    const bool stripe = int(u / 7.0f) % 2 == 0;
+                    a[0] = 0.3f, a[1] = stripe ? 0.6f : 0.4f, a[2] = 0.5f;
+                    n[0] = 0.0f, n[1] = 0.0f, n[2] = 1.0f;
+                }
+                // light from the top left, the sphere shadows the floor to its right
+                float light = 0.3f + 2.0f * std::max(0.0f, 0.5f * n[1] + 0.5f * n[2] - 0.3f * n[0]);
+                if (floor && !sphere && 1000.0f < u && u < 1400.0f && 250.0f < v)
+                    light *= 0.15f;
+                for (int c = 0; c < 3; c++) {
+                    albedo[p * 3 + c] = a[c];
+                    normal[p * 3 + c] = n[c];
+                    radiance[p * 3 + c] = a[c] * light;
+                }
+            }
+    }
+
+    // Film of spp samples per pixel, RGBA. Samples of a pixel share their noise over the channels.
+    std::vector<float> film(int spp, unsigned seed) const
+    {
+        std::vector<float> pixels(size_t(width) * height * 4);
+        const int tasks = (height + 15) / 16;
+        parallelFor(tasks, [&](int task) {
+            std::mt19937 generator(seed * 7919u + unsigned(task));
+            std::gamma_distribution<float> mean(float(spp), 1.0f / float(spp));
+            const size_t end = std::min(size_t(width) * height, size_t(task + 1) * 16 * width);
+            for (size_t p = size_t(task) * 16 * width; p < end; p++) {
+                const float noise = mean(generator);
+                for (int c = 0; c < 3; c++)
+                    pixels[p * 4 + c] = radiance[p * 3 + c] * noise;
+                pixels[p * 4 + 3] = 1.0f;
+            }
+        });
+        return pixels;
+    }
+};
+
+static double rmse(const std::vector<float> &a, const std::vector<float> &b)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < a.size(); i++)
+        if (i % 4 != 3)
+            sum += double(a[i] - b[i]) * (a[i] - b[i]);
+    return sqrt(sum / double(a.size() / 4 * 3));
+}
+
+int main()
+{
+#ifdef __SSE2__
+    printf("denoiser: SSE2, %d threads\n", ThreadPool::getInstance().threadCount());
+#else
+    printf("denoiser: scalar, %d threads\n", ThreadPool::getInstance().threadCount());
+#endif
+    const int sizes[2][2] = {{1920, 1080}, {3840, 2160}};
+    for (auto &size : sizes) {
+        const SyntheticRender render(size[0], size[1]);
+        const std::vector<float> reference = render.film(4096, 1);
+        printf("%dx%d, RMSE against 4096 spp\n", size[0], size[1]);
+        printf("%5s %10s %10s %10s %12s %12s\n", "spp", "noisy", "denoised", "guided", "denoise ms", "guided ms");
+
+        DenoiseSettings settings;
+        Denoiser denoiser;
+        std::vector<float> result(reference.size());
+        for (int spp : {1, 4, 16, 64}) {
+            const std::vector<float> noisy = render.film(spp, 2 + spp);
+            const double plainTime = bestOf(3, [&] {
+                denoiser.denoise(noisy.data(), nullptr, nullptr, size[0], size[1], settings, result.data());
+            });
+            const double plain = rmse(result, reference);
+            const double guidedTime = bestOf(3, [&] {
+                denoiser.denoise(noisy.data(), render.albedo.data(), render.normal.data(), size[0], size[1], settings,
+                                 result.data());
+            });
+            printf("%5d %10.4f %10.4f %10.4f %12.1f %12.1f\n", spp, rmse(noisy, reference), plain,
+                   rmse(result, reference), plainTime, guidedTime);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+
+#include "../src/core/image.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+// Loading of the bundled large LDR textures: the previous route (stbi_loadf, which converts every sample with
+// pow(x, 2.2), and a clamp over the whole float image) against Image::load keeping 8-bit sRGB, and the
+// conversions alone. Half rows are timed as well. Usage: bench_image [directory]
+
+static double bestOf(int runs, const std::function<void()> &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    const std::string directory = (1 < argc) ? argv[1] : RENDERER_RESOURCE_DIR "/textures";
+    std::vector<std::string> names;
+    if (DIR *dir = opendir(directory.c_str())) {
+        while (dirent *entry = readdir(dir)) {
+            const std::string name = entry->d_name;
+            const size_t dot = name.rfind('.');
+            const std::string extension = (dot == std::string::npos) ? "" : name.substr(dot);
+            if (extension == ".png" || extension == ".jpg")
+                names.push_back(name);
+        }
+        closedir(dir);
+    }
+    std::sort(names.begin(), names.end());
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    printf("half rows: %s\n", __builtin_cpu_supports("f16c") ? "F16C" : "scalar");
+#endif
+    printf("%-24s %-11s %12s %12s %12s %12s\n", "texture", "size", "stbi_loadf", "Image::load", "pow 2.2",
+           "sRGB rows");
+
+    for (auto &name : names) {
+        const std::string filename = directory + "/" + name;
+        int width, height;
+        if (!stbi_info(filename.c_str(), &width, &height, nullptr) || std::max(width, height) < 1700)
+            continue;
+
+        const double loadf = bestOf(3, [&] {
+            float *data = stbi_loadf(filename.c_str(), &width, &height, nullptr, 4);
+            for (size_t i = 0; i < size_t(width) * height * 4; i++)
+                data[i] = std::max(data[i], 0.0f);
+            stbi_image_free(data);
+        });
+        Image image(1);
+        const double load = bestOf(3, [&] { image.load(filename); });
+
+        // conversions of the decoded 8-bit samples to linear floats
+        std::vector<float> linear(size_t(width) * height * 4);
+        const double power = bestOf(3, [&] {
+            const unsigned char *pixels = image.data();
+            for (size_t i = 0; i < linear.size(); i++)
+                linear[i] = (i % 4 == 3) ? pixels[i] / 255.0f : powf(pixels[i] / 255.0f, 2.2f);
+        });
+        const double rows = bestOf(3, [&] {
+            for (int y = 0; y < height; y++)
+                image.decodeRow(y, linear.data() + size_t(y) * width * 4);
+        });
+
+        const std::string size = std::to_string(width) + "x" + std::to_string(height);
+        printf("%-24s %-11s %9.1f ms %9.1f ms %9.1f ms %9.1f ms\n", name.c_str(), size.c_str(), loadf, load, power,
+               rows);
+
+        // the same pixels through half rows, both ways
+        const MipLevelFormat half = Image::levelFormat(Image::RGBA16F);
+        std::vector<unsigned char> halves(size_t(width) * height * half.pixelSize);
+        const double encode = bestOf(3, [&] { half.encode(linear.data(), width * height, halves.data()); });
+        const double decode = bestOf(3, [&] { half.decode(halves.data(), width * height, linear.data()); });
+        const double megapixels = double(width) * height / 1e6;
+        printf("%-24s %-11s half encode %.1f Mpixel/s, decode %.1f Mpixel/s\n", "", "", megapixels / (encode * 1e-3),
+               megapixels / (decode * 1e-3));
+    }
+    return 0;
+}
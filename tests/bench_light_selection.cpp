@@ -0,0 +1,49 @@
+
+#include "../src/math/distribution.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Build time of the alias table and O(1) selection throughput for many lights with power spread over
+// several orders of magnitude. Usage: bench_light_selection [lights]
+int main(int argc, char **argv)
+{
+    const int count = (1 < argc) ? atoi(argv[1]) : 100000;
+    const int samples = 10000000;
+
+    std::mt19937 generator(42);
+    std::lognormal_distribution<float> power(0.0f, 3.0f);
+    std::vector<float> weights(count);
+    for (auto &weight : weights)
+        weight = power(generator);
+
+    std::vector<AliasEntry> table;
+    const int builds = 20;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < builds; i++)
+        buildAliasTable(weights, table);
+    const double buildTime = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - start).count() / builds;
+
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> randoms(4096);
+    for (auto &random : randoms)
+        random = uniform(generator);
+
+    float pdfSum = 0.0f;
+    int indexSum = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int s = 0; s < samples; s++) {
+        float pdf;
+        indexSum += sampleAlias(table, count, randoms[s & 4095], pdf);
+        pdfSum += pdf;
+    }
+    const double sampleTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    printf("%d lights: build %.2f ms, %.1f M samples/s (checksum %d %g)\n", count, buildTime,
+           samples / sampleTime * 1e-6, indexSum, pdfSum);
+    return 0;
+}
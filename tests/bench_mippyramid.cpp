@@ -0,0 +1,72 @@
+
+#include "../src/core/image.h"
+#include "../src/core/mippyramid.h"
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb_image_resize.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <vector>
+
+// Full mip chain of a size x size texture: the previous route (RGBA32F levels resized one from another with
+// stbir_resize_float) against the pyramid builder on 8-bit sRGB and half float storage.
+// Usage: bench_mippyramid [size]
+
+static double bestOf(int runs, const std::function<void()> &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    const int size = (1 < argc) ? atoi(argv[1]) : 2048;
+    const int mipCount = fullMipCount(size, size);
+    const size_t chainPixels = mipChainPixels(size, size, mipCount);
+
+    std::vector<float> linear(chainPixels * 4);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            for (int c = 0; c < 4; c++)
+                linear[(size_t(y) * size + x) * 4 + c] = float((x * 7 + y * 3 + c * 50) & 255) / 255.0f;
+
+    const double stbir = bestOf(3, [&] {
+        float *level = linear.data();
+        for (int i = 1; i < mipCount; i++) {
+            const int width = mipLevelSize(size, i - 1), height = mipLevelSize(size, i - 1);
+            float *next = level + size_t(width) * height * 4;
+            stbir_resize_float(level, width, height, 0, next, mipLevelSize(width, 1), mipLevelSize(height, 1), 0, 4);
+            level = next;
+        }
+    });
+    printf("%dx%d full chain (%d levels)\n", size, size, mipCount);
+    printf("  stbir RGBA32F       %8.1f ms\n", stbir);
+
+    const Image::Format formats[] = {Image::RGBA8_SRGB, Image::RGBA16F};
+    const char *formatNames[] = {"RGBA8 sRGB", "RGBA16F"};
+    for (int f = 0; f < 2; f++) {
+        const MipLevelFormat format = Image::levelFormat(formats[f]);
+        std::vector<unsigned char> chain(chainPixels * format.pixelSize);
+        for (int y = 0; y < size; y++)
+            format.encode(linear.data() + size_t(y) * size * 4, size,
+                          chain.data() + size_t(y) * size * format.pixelSize);
+
+        for (MipFilter filter : {MIP_FILTER_BOX, MIP_FILTER_KAISER}) {
+            const double time = bestOf(3, [&] {
+                buildMipPyramid(chain.data(), size, size, mipCount, format, filter);
+            });
+            printf("  %-6s %-12s %8.1f ms (%.2fx)\n", mipFilterName(filter), formatNames[f], time, stbir / time);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+
+#include "../src/core/tonemapper.h"
+#include "../src/utils/threadpool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// Tone mapping throughput on a 4K film of every operator, with and without dithering, against a plain per pixel
+// loop with powf. Without dither the codes are compared with the exact curve as well.
+// Usage: bench_tonemapper [width height]
+
+static double bestOf(int runs, const std::function<void()> &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - start).count());
+    }
+    return best;
+}
+
+static float referenceCurve(float x, ToneMapOperator toneOperator)
+{
+    const auto hable = [](float v) {
+        return (v * (0.15f * v + 0.05f) + 0.004f) / (v * (0.15f * v + 0.5f) + 0.06f) - 0.02f / 0.3f;
+    };
+    switch (toneOperator) {
+    case TONEMAP_REINHARD:
+        return x / (1.0f + x);
+    case TONEMAP_ACES:
+        return std::min(1.0f, (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f));
+    case TONEMAP_FILMIC:
+        return std::min(1.0f, hable(2.0f * x) / hable(11.2f));
+    default:
+        return std::min(1.0f, x);
+    }
+}
+
+// The straightforward version: exposure, curve and powf for every channel.
+static void referenceToneMap(const float *src, int width, int height, const ToneMapSettings &settings,
+                             unsigned char *dst)
+{
+    const float scale = exp2f(settings.exposure);
+    for (size_t i = 0; i < size_t(width) * height; i++) {
+        for (int c = 0; c < 3; c++) {
+            const float value = referenceCurve(std::max(src[i * 4 + c] * scale, 0.0f), settings.toneOperator);
+            const float srgb = (value <= 0.0031308f) ? 12.92f * value : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+            dst[i * 4 + c] = (unsigned char) (std::min(std::max(srgb, 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+        dst[i * 4 + 3] = (unsigned char) (std::min(std::max(src[i * 4 + 3], 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int width = (2 < argc) ? atoi(argv[1]) : 3840;
+    const int height = (2 < argc) ? atoi(argv[2]) : 2160;
+    const double megapixels = double(width) * height / 1e6;
+
+    // a render-like spread of radiance, most of it below 1 with highlights up to 100
+    std::vector<float> film(size_t(width) * height * 4);
+    std::mt19937 generator(1);
+    std::lognormal_distribution<float> radiance(-1.5f, 1.5f);
+    for (size_t i = 0; i < film.size(); i++)
+        film[i] = (i % 4 == 3) ? 1.0f : std::min(radiance(generator), 100.0f);
+
+    std::vector<unsigned char> pixels(film.size()), reference(film.size());
+#ifdef __SSE2__
+    printf("tone mapping: SSE2, %d threads\n", ThreadPool::getInstance().threadCount());
+#else
+    printf("tone mapping: scalar, %d threads\n", ThreadPool::getInstance().threadCount());
+#endif
+    printf("%dx%d, %.1f MB of RGBA32F per frame\n", width, height, double(film.size()) * 4.0 / 1e6);
+    printf("%-9s %-7s %10s %12s %10s %14s\n", "operator", "dither", "ms", "Mpixel/s", "powf ms", "max difference");
+
+    for (ToneMapOperator toneOperator : {TONEMAP_CLAMP, TONEMAP_REINHARD, TONEMAP_ACES, TONEMAP_FILMIC}) {
+        ToneMapSettings settings;
+        settings.toneOperator = toneOperator;
+        settings.exposure = 0.5f;
+        const double powfTime = bestOf(2, [&] {
+            referenceToneMap(film.data(), width, height, settings, reference.data());
+        });
+
+        for (bool dither : {false, true}) {
+            settings.dither = dither;
+            const double time = bestOf(5, [&] { toneMap(film.data(), width, height, settings, pixels.data()); });
+            // dithering moves codes by design, only the plain codes are compared
+            int difference = 0;
+            for (size_t i = 0; !dither && i < pixels.size(); i++)
+                difference = std::max(difference, std::abs(int(pixels[i]) - int(reference[i])));
+            const std::string compared = dither ? "-" : std::to_string(difference);
+            printf("%-9s %-7s %10.2f %12.1f %10.2f %14s\n", toneMapOperatorName(toneOperator), dither ? "yes" : "no",
+                   time, megapixels / (time * 1e-3), powfTime, compared.c_str());
+        }
+    }
+    return 0;
+}
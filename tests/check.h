@@ -0,0 +1,39 @@
+
+#ifndef RENDERER_GPU_CHECK_H
+#define RENDERER_GPU_CHECK_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal assertions of the host tests. A failed check prints its location and the test continues,
+// checkResult() at the end of main turns the failures into the exit code seen by ctest.
+
+static int checkFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            checkFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+    do { \
+        const double checkValue = double(value), checkExpected = double(expected); \
+        if (!(std::fabs(checkValue - checkExpected) <= double(tolerance))) { \
+            fprintf(stderr, "%s:%d: check failed: %s is %g, expected %g +- %g\n", __FILE__, __LINE__, #value, \
+                    checkValue, checkExpected, double(tolerance)); \
+            checkFailures++; \
+        } \
+    } while (0)
+
+static int checkResult()
+{
+    if (checkFailures)
+        fprintf(stderr, "%d checks failed\n", checkFailures);
+    return checkFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif //RENDERER_GPU_CHECK_H
@@ -0,0 +1,151 @@
+
+#include "check.h"
+
+#include "../src/core/adaptivesampler.h"
+
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+// Both edges end in partial blocks, 4 pixels wide at the right and 6 high at the top.
+static const int WIDTH = 100, HEIGHT = 70;
+
+// Film and second moment averaged over grey samples, as the camera accumulates them. Luminance weights sum to
+// one, so the luminance of a pixel is its sample value.
+struct SimulatedFilm
+{
+    std::vector<float> beauty = std::vector<float>(size_t(WIDTH) * HEIGHT * 4, 0.0f);
+    std::vector<float> secondMoment = std::vector<float>(size_t(WIDTH) * HEIGHT, 0.0f);
+    int samples = 0;
+
+    void sample(const std::function<float(int, int)> &value)
+    {
+        const float weight = 1.0f / float(samples + 1);
+        for (int y = 0; y < HEIGHT; y++)
+            for (int x = 0; x < WIDTH; x++) {
+                const size_t pixel = size_t(y) * WIDTH + x;
+                const float v = value(x, y);
+                for (int c = 0; c < 3; c++)
+                    beauty[pixel * 4 + c] += (v - beauty[pixel * 4 + c]) * weight;
+                beauty[pixel * 4 + 3] = 1.0f;
+                secondMoment[pixel] += (v * v - secondMoment[pixel]) * weight;
+            }
+        samples++;
+    }
+};
+
+static void testPixelError()
+{
+    CHECK(std::isinf(AdaptiveSampler::pixelError(1.0f, 1.0f, 0)));
+    CHECK(std::isinf(AdaptiveSampler::pixelError(1.0f, 2.0f, 1)));
+    CHECK(!std::isinf(AdaptiveSampler::pixelError(1.0f, 2.0f, 2)));
+    // variance 0.25 of 5 samples, Bessel corrected 0.0625 for the mean
+    CHECK_NEAR(AdaptiveSampler::pixelError(1.0f, 1.25f, 5), 0.25, 1e-6);
+    CHECK_NEAR(AdaptiveSampler::pixelError(2.0f, 5.0f, 5), 0.25, 1e-6);
+    // dark pixels are measured against the floor
+    CHECK_NEAR(AdaptiveSampler::pixelError(0.01f, 0.0001f + 0.0004f, 5), 0.01 / 0.05, 1e-4);
+    CHECK(AdaptiveSampler::pixelError(1.0f, 0.5f, 10) == 0.0f);
+}
+
+// Without noise every block retires as soon as minSamples are taken, not before.
+static void testFlatImage()
+{
+    AdaptiveSampler sampler;
+    sampler.resize(WIDTH, HEIGHT);
+    CHECK(sampler.blocksX() == 7 && sampler.blocksY() == 5);
+    CHECK(sampler.activeBlockCount() == 35 && sampler.retiredPixels() == 0);
+
+    const int minSamples = 8;
+    SimulatedFilm film;
+    film.sample([](int, int) { return 0.7f; });
+    // a single sample has no error estimate
+    CHECK(sampler.update(film.beauty.data(), film.secondMoment.data(), film.samples, 0.05f, 1) == 35);
+    CHECK(std::isinf(sampler.maxError()));
+    while (film.samples < minSamples) {
+        film.sample([](int, int) { return 0.7f; });
+        const int active = sampler.update(film.beauty.data(), film.secondMoment.data(), film.samples, 0.05f,
+                                          minSamples);
+        CHECK(active == (film.samples < minSamples ? 35 : 0));
+        CHECK(sampler.blockError(3, 2) < 1e-3f);
+    }
+    CHECK(sampler.retiredPixels() == WIDTH * HEIGHT);
+    CHECK(!sampler.regionActive(optix::make_int2(0, 0), optix::make_int2(WIDTH, HEIGHT)));
+
+    sampler.reset();
+    CHECK(sampler.activeBlockCount() == 35 && sampler.blockActive(6, 4) && sampler.retiredPixels() == 0);
+}
+
+// A block of strong noise stays active with its error as the largest one, its flat neighbours retire.
+static void testNoisyBlock()
+{
+    AdaptiveSampler sampler;
+    sampler.resize(WIDTH, HEIGHT);
+    std::mt19937 generator(7);
+    std::bernoulli_distribution coin(0.5);
+    SimulatedFilm film;
+    const auto value = [&](int x, int y) {
+        if (x / ADAPTIVE_BLOCK_SIZE == 2 && y / ADAPTIVE_BLOCK_SIZE == 1)
+            return coin(generator) ? 20.0f : 0.0f;
+        return 0.7f;
+    };
+    for (int i = 0; i < 64; i++) {
+        film.sample(value);
+        sampler.update(film.beauty.data(), film.secondMoment.data(), film.samples, 0.05f, 8);
+    }
+    CHECK(sampler.activeBlockCount() == 1 && sampler.blockActive(2, 1));
+    // about 1 / sqrt(63)
+    printf("noisy block error %.3f after %d samples\n", sampler.blockError(2, 1), film.samples);
+    CHECK(0.05f < sampler.blockError(2, 1) && sampler.blockError(2, 1) < 0.2f);
+    CHECK(sampler.maxError() == sampler.blockError(2, 1));
+    CHECK(sampler.retiredPixels() == WIDTH * HEIGHT - ADAPTIVE_BLOCK_SIZE * ADAPTIVE_BLOCK_SIZE);
+    CHECK(sampler.regionActive(optix::make_int2(40, 20), optix::make_int2(1, 1)));
+    CHECK(!sampler.regionActive(optix::make_int2(0, 0), optix::make_int2(32, 70)));
+}
+
+// Partial blocks at the edges count only their pixels, regions overlapping them or the edge of the image find them.
+static void testEdgeBlocks()
+{
+    // only the top right corner block, 4 x 6 pixels, stays noisy
+    AdaptiveSampler sampler;
+    sampler.resize(WIDTH, HEIGHT);
+    std::mt19937 generator(11);
+    std::bernoulli_distribution coin(0.5);
+    SimulatedFilm film;
+    for (int i = 0; i < 16; i++) {
+        film.sample([&](int x, int y) { return (96 <= x && 64 <= y) ? (coin(generator) ? 5.0f : 0.0f) : 0.3f; });
+        sampler.update(film.beauty.data(), film.secondMoment.data(), film.samples, 0.05f, 4);
+    }
+    CHECK(sampler.activeBlockCount() == 1 && sampler.blockActive(6, 4));
+    CHECK(sampler.retiredPixels() == WIDTH * HEIGHT - 4 * 6);
+    CHECK(sampler.regionActive(optix::make_int2(96, 64), optix::make_int2(4, 6)));
+    CHECK(sampler.regionActive(optix::make_int2(99, 69), optix::make_int2(1, 1)));
+    CHECK(sampler.regionActive(optix::make_int2(95, 63), optix::make_int2(2, 2)));
+    CHECK(!sampler.regionActive(optix::make_int2(95, 63), optix::make_int2(1, 1)));
+    CHECK(!sampler.regionActive(optix::make_int2(0, 0), optix::make_int2(96, 70)));
+    // launches of fixed size reach over the edge of the image
+    CHECK(sampler.regionActive(optix::make_int2(64, 64), optix::make_int2(128, 128)));
+    CHECK(!sampler.regionActive(optix::make_int2(0, 64), optix::make_int2(96, 128)));
+
+    // the other way around: only the corner block retires
+    sampler.reset();
+    SimulatedFilm noisy;
+    for (int i = 0; i < 16; i++) {
+        noisy.sample([&](int x, int y) { return (96 <= x && 64 <= y) ? 0.3f : (coin(generator) ? 5.0f : 0.0f); });
+        sampler.update(noisy.beauty.data(), noisy.secondMoment.data(), noisy.samples, 0.05f, 4);
+    }
+    CHECK(sampler.activeBlockCount() == 34 && !sampler.blockActive(6, 4));
+    CHECK(sampler.retiredPixels() == 4 * 6);
+    CHECK(!sampler.regionActive(optix::make_int2(96, 64), optix::make_int2(128, 128)));
+    CHECK(sampler.regionActive(optix::make_int2(95, 64), optix::make_int2(128, 128)));
+}
+
+int main()
+{
+    testPixelError();
+    testFlatImage();
+    testNoisyBlock();
+    testEdgeBlocks();
+    return checkResult();
+}
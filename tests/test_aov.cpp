@@ -0,0 +1,217 @@
+
+#include "check.h"
+
+#include "../src/core/aov.h"
+#include "../src/core/image.h"
+#include "../src/core/imagewriter.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+static const int WIDTH = 5, HEIGHT = 3;
+
+// Device layout of the layer buffers with a value of its own in every element, padding included.
+struct DeviceAovs
+{
+    std::vector<optix::float4> albedo, normal;
+    std::vector<float> depth;
+    std::vector<optix::int2> ids;
+    std::vector<unsigned int> samples;
+
+    DeviceAovs()
+    {
+        for (int i = 0; i < WIDTH * HEIGHT; i++) {
+            albedo.push_back(optix::make_float4(0.1f * i, 0.2f * i, 0.3f * i, 1.0f));
+            normal.push_back(optix::make_float4(-0.5f, 0.25f * i, -1.0f / float(i + 1), 0.0f));
+            depth.push_back(i == 4 ? AOV_NO_HIT_DEPTH : 1.5f * i);
+            ids.push_back(optix::make_int2(i == 4 ? -1 : 100 + i, i == 4 ? -1 : i % 3));
+            samples.push_back(unsigned(16 + i));
+        }
+    }
+
+    MappedAovs mapped() const
+    {
+        MappedAovs aovs;
+        aovs.albedo = albedo.data();
+        aovs.normal = normal.data();
+        aovs.depth = depth.data();
+        aovs.ids = ids.data();
+        aovs.samples = samples.data();
+        return aovs;
+    }
+};
+
+// Beauty values that halves hold exactly.
+static float beautyValue(int x, int y, int channel)
+{
+    return float(x + y * WIDTH) * 0.5f + float(channel) * 0.125f;
+}
+
+static void testMaskNames()
+{
+    CHECK(parseAovMask("albedo depth samples") == (AOV_ALBEDO | AOV_DEPTH | AOV_SAMPLES));
+    CHECK(parseAovMask("") == 0);
+    CHECK(parseAovMask("normal unknown id") == (AOV_NORMAL | AOV_ID));
+    CHECK(aovMaskNames(AOV_ALBEDO | AOV_NORMAL | AOV_DEPTH | AOV_ID | AOV_SAMPLES) == "albedo normal depth id samples");
+    CHECK(aovMaskNames(0).empty());
+}
+
+// The padding of the device formats is dropped, disabled or unmapped layers stay empty and out of the mask.
+static void testPack()
+{
+    const DeviceAovs device;
+    FilmLayers layers;
+    packFilmLayers(device.mapped(), AOV_ALBEDO | AOV_NORMAL | AOV_DEPTH | AOV_ID | AOV_SAMPLES, WIDTH, HEIGHT,
+                   layers);
+    CHECK(layers.width == WIDTH && layers.height == HEIGHT);
+    CHECK(layers.mask == (AOV_ALBEDO | AOV_NORMAL | AOV_DEPTH | AOV_ID | AOV_SAMPLES));
+    CHECK(layers.albedo.size() == WIDTH * HEIGHT * 3 && layers.normal.size() == WIDTH * HEIGHT * 3);
+    CHECK(layers.depth.size() == WIDTH * HEIGHT && layers.samples.size() == WIDTH * HEIGHT);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        CHECK(layers.albedo[i * 3] == device.albedo[i].x && layers.albedo[i * 3 + 2] == device.albedo[i].z);
+        CHECK(layers.normal[i * 3 + 1] == device.normal[i].y && layers.normal[i * 3 + 2] == device.normal[i].z);
+        CHECK(layers.depth[i] == device.depth[i]);
+        CHECK(layers.primitiveID[i] == device.ids[i].x && layers.materialID[i] == device.ids[i].y);
+        CHECK(layers.samples[i] == device.samples[i]);
+    }
+
+    MappedAovs partial = device.mapped();
+    partial.normal = nullptr;
+    packFilmLayers(partial, AOV_NORMAL | AOV_DEPTH, WIDTH, HEIGHT, layers);
+    CHECK(layers.mask == AOV_DEPTH);
+    CHECK(layers.albedo.empty() && layers.normal.empty() && layers.primitiveID.empty() && layers.samples.empty());
+
+    packFilmLayers(device.mapped(), AOV_ALBEDO | AOV_ID, WIDTH, HEIGHT, layers);
+    maskFilmLayers(layers, AOV_ID);
+    CHECK(layers.mask == AOV_ID && layers.albedo.empty() && layers.primitiveID.size() == WIDTH * HEIGHT);
+}
+
+template<typename T>
+static T readValue(const std::vector<unsigned char> &bytes, size_t &position)
+{
+    T value;
+    memcpy(&value, bytes.data() + position, sizeof(T));
+    position += sizeof(T);
+    return value;
+}
+
+static float halfValue(uint16_t half)
+{
+    const uint16_t pixel[4] = {half, 0, 0, 0};
+    float values[4];
+    Image::levelFormat(Image::RGBA16F).decode((const unsigned char *) pixel, 1, values);
+    return values[0];
+}
+
+// Bits of a packed layer value at a pixel, rows bottom first.
+static uint32_t layerBits(const FilmLayers &layers, const std::string &channel, int x, int y)
+{
+    const size_t i = size_t(y) * WIDTH + x;
+    const float *value = nullptr;
+    if (channel.compare(0, 7, "albedo.") == 0)
+        value = &layers.albedo[i * 3 + std::string("RGB").find(channel[7])];
+    else if (channel.compare(0, 7, "normal.") == 0)
+        value = &layers.normal[i * 3 + std::string("XYZ").find(channel[7])];
+    else if (channel == "depth.Z")
+        value = &layers.depth[i];
+    uint32_t bits = 0;
+    if (value)
+        memcpy(&bits, value, sizeof(bits));
+    else if (channel == "id.primitive")
+        bits = uint32_t(layers.primitiveID[i]);
+    else if (channel == "id.material")
+        bits = uint32_t(layers.materialID[i]);
+    else if (channel == "samples")
+        bits = layers.samples[i];
+    return bits;
+}
+
+// The multi-layer file holds the half beauty and every layer channel with its type, sorted by name, and the
+// values come back bit for bit with the top row first.
+static void testMultiLayerEXR()
+{
+    const DeviceAovs device;
+    FilmLayers layers;
+    packFilmLayers(device.mapped(), AOV_ALBEDO | AOV_NORMAL | AOV_DEPTH | AOV_ID | AOV_SAMPLES, WIDTH, HEIGHT,
+                   layers);
+    for (int y = 0; y < HEIGHT; y++)
+        for (int x = 0; x < WIDTH; x++)
+            for (int c = 0; c < 4; c++)
+                layers.beauty.push_back(beautyValue(x, y, c));
+    const FilmLayers expected = layers;
+
+    const char *filename = "test_aov.exr";
+    bool written = false;
+    ImageWriter::getInstance().write(std::move(layers), filename, [&](bool success) { written = success; });
+    ImageWriter::getInstance().flush();
+    CHECK(written);
+
+    std::ifstream stream(filename, std::ios::binary);
+    const std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(stream)),
+                                           std::istreambuf_iterator<char>());
+    CHECK(8 < bytes.size());
+    size_t position = 0;
+    CHECK(readValue<uint32_t>(bytes, position) == 20000630);
+    CHECK(readValue<uint32_t>(bytes, position) == 2);
+
+    std::vector<std::pair<std::string, int32_t>> channels;
+    int32_t window[4] = {};
+    while (bytes[position]) {
+        const std::string name((const char *) bytes.data() + position);
+        position += name.size() + 1;
+        position += strlen((const char *) bytes.data() + position) + 1;
+        const int32_t size = readValue<int32_t>(bytes, position);
+        if (name == "channels") {
+            size_t entry = position;
+            while (bytes[entry]) {
+                const std::string channel((const char *) bytes.data() + entry);
+                entry += channel.size() + 1;
+                channels.push_back({channel, readValue<int32_t>(bytes, entry)});
+                entry += 12;
+            }
+        }
+        if (name == "dataWindow")
+            memcpy(window, bytes.data() + position, sizeof(window));
+        position += size_t(size);
+    }
+    position++;
+    CHECK(window[2] == WIDTH - 1 && window[3] == HEIGHT - 1);
+
+    const std::vector<std::pair<std::string, int32_t>> expectedChannels = {
+        {"A", 1}, {"B", 1}, {"G", 1}, {"R", 1}, {"albedo.B", 2}, {"albedo.G", 2}, {"albedo.R", 2}, {"depth.Z", 2},
+        {"id.material", 0}, {"id.primitive", 0}, {"normal.X", 2}, {"normal.Y", 2}, {"normal.Z", 2}, {"samples", 0}};
+    CHECK(channels == expectedChannels);
+
+    std::vector<uint64_t> offsets(HEIGHT);
+    for (auto &offset : offsets)
+        offset = readValue<uint64_t>(bytes, position);
+    int mismatches = 0;
+    for (int line = 0; line < HEIGHT; line++) {
+        position = offsets[line];
+        CHECK(readValue<int32_t>(bytes, position) == line);
+        CHECK(readValue<int32_t>(bytes, position) == WIDTH * (4 * 2 + 10 * 4));
+        const int y = HEIGHT - 1 - line;
+        for (int c = 0; c < 4; c++)
+            for (int x = 0; x < WIDTH; x++)
+                mismatches += halfValue(readValue<uint16_t>(bytes, position)) != beautyValue(x, y, 3 - c);
+        for (size_t c = 4; c < channels.size(); c++)
+            for (int x = 0; x < WIDTH; x++)
+                mismatches += readValue<uint32_t>(bytes, position) != layerBits(expected, channels[c].first, x, y);
+    }
+    CHECK(mismatches == 0);
+    CHECK(position == bytes.size());
+    remove(filename);
+}
+
+int main()
+{
+    testMaskNames();
+    testPack();
+    testMultiLayerEXR();
+    return checkResult();
+}
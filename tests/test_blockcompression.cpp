@@ -0,0 +1,127 @@
+
+#include "check.h"
+#include "bcdecode.h"
+
+#include "../src/core/image.h"
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <vector>
+
+static const BlockFormat formats[] = {BLOCK_BC1, BLOCK_BC4, BLOCK_BC5, BLOCK_BC7};
+
+static double encodeBlock(const unsigned char *pixels, BlockFormat format, unsigned char *block)
+{
+    switch (format) {
+    case BLOCK_BC1:
+        return encodeBC1Block(pixels, block);
+    case BLOCK_BC4:
+        return encodeBC4Block(pixels, 0, block);
+    case BLOCK_BC5:
+        return encodeBC4Block(pixels, 0, block) + encodeBC4Block(pixels, 1, block + 8);
+    default:
+        return encodeBC7Block(pixels, block);
+    }
+}
+
+// The error reported by the encoders is the one of the blocks as a decoder sees them.
+static void testBlocksMatchReportedError()
+{
+    std::mt19937 generator(3);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (int kind = 0; kind < 3; kind++)
+        for (int n = 0; n < 500; n++) {
+            unsigned char pixels[16 * 4];
+            const int base = byte(generator), slope = byte(generator) / 16;
+            for (int i = 0; i < 16 * 4; i++) {
+                if (kind == 0) // noise
+                    pixels[i] = (unsigned char) byte(generator);
+                else if (kind == 1) // smooth gradient
+                    pixels[i] = (unsigned char) std::min(255, base + slope * (i / 4 % 4 + i / 16) + i % 4 * 7);
+                else // flat
+                    pixels[i] = (unsigned char) (base + i % 4);
+            }
+
+            for (BlockFormat format : formats) {
+                unsigned char block[16];
+                const double reported = encodeBlock(pixels, format, block);
+                float decoded[16][4];
+                CHECK(decodeBlock(block, format, decoded));
+                CHECK_NEAR(blockError(pixels, format, decoded), reported, std::max(0.5, 1e-4 * reported));
+                if (kind == 2 && format != BLOCK_BC1)
+                    CHECK(reported <= 16.0 * blockChannels(format));
+            }
+        }
+}
+
+// Quality on a natural texture, levels measured with the reference decoders.
+static void testTexturePsnr()
+{
+    Image image(1);
+    CHECK(image.load(RENDERER_RESOURCE_DIR "/textures/brick.png"));
+    const double minimumPsnr[] = {36.0, 42.5, 43.0, 44.5};
+    for (int i = 0; i < 4; i++) {
+        // the source name doesn't exist, so there is no cache to read or write
+        CompressedImage result;
+        CHECK(compressImage(image, "test_blockcompression_uncached.png", formats[i], result));
+        CHECK(result.data.size() == size_t(image.width() / 4) * (image.height() / 4) * blockBytes(formats[i]));
+
+        const double psnr = levelPsnr(image.data(), image.width(), image.height(), formats[i], result.data.data());
+        printf("brick.png %s: %.2f dB\n", blockFormatName(formats[i]), psnr);
+        CHECK_NEAR(psnr, result.psnr, 0.01);
+        CHECK(minimumPsnr[i] <= psnr);
+    }
+}
+
+static bool copyFile(const std::string &from, const std::string &to)
+{
+    std::ifstream source(from, std::ios::binary);
+    std::ofstream destination(to, std::ios::binary);
+    destination << source.rdbuf();
+    return bool(source) && bool(destination);
+}
+
+// Full NPOT mip chain is encoded level by level and read back from the cache next to the source.
+static void testMipChainCache()
+{
+    const std::string filename = "test_blockcompression_source.png";
+    CHECK(copyFile(RENDERER_RESOURCE_DIR "/textures/checkerboard_small.png", filename));
+    Image image(0);
+    CHECK(image.load(filename));
+
+    CompressedImage encoded;
+    CHECK(compressImage(image, filename, BLOCK_BC7, encoded));
+    CHECK(int(encoded.levelOffsets.size()) == image.mipCount());
+    size_t size = 0;
+    for (int level = 0; level < image.mipCount(); level++) {
+        CHECK(encoded.levelOffsets[level] == size);
+        size += size_t((mipLevelSize(image.width(), level) + 3) / 4) * ((mipLevelSize(image.height(), level) + 3) / 4) *
+            blockBytes(BLOCK_BC7);
+    }
+    CHECK(encoded.data.size() == size);
+
+    // every level decodes, the last one is a single block
+    const unsigned char *pixels = image.data();
+    for (int level = 0; level < image.mipCount(); level++) {
+        const int width = mipLevelSize(image.width(), level), height = mipLevelSize(image.height(), level);
+        CHECK(30.0 < levelPsnr(pixels, width, height, BLOCK_BC7, encoded.data.data() + encoded.levelOffsets[level]));
+        pixels += size_t(width) * height * 4;
+    }
+
+    CompressedImage cached;
+    CHECK(compressImage(image, filename, BLOCK_BC7, cached));
+    CHECK(cached.data == encoded.data);
+    CHECK(cached.psnr == encoded.psnr);
+
+    remove((filename + ".bc7.cache").c_str());
+    remove(filename.c_str());
+}
+
+int main()
+{
+    testBlocksMatchReportedError();
+    testTexturePsnr();
+    testMipChainCache();
+    return checkResult();
+}
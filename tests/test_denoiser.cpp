@@ -0,0 +1,148 @@
+
+#include "check.h"
+
+#include "../src/core/denoiser.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+// Noisy beauty with albedo and normal guides, a few regions with edges between them.
+struct NoisyFilm
+{
+    int width, height;
+    std::vector<float> beauty, albedo, normal;
+
+    NoisyFilm(int width, int height, unsigned seed)
+        : width(width), height(height)
+    {
+        std::mt19937 generator(seed);
+        std::exponential_distribution<float> noise(1.0f);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++) {
+                const bool checker = ((x / 5) + (y / 3)) % 2 == 0;
+                const float light = 0.2f + 2.0f * float(x) / float(width);
+                const float a[3] = {checker ? 0.8f : 0.1f, 0.5f, checker ? 0.2f : 0.6f};
+                for (int c = 0; c < 3; c++) {
+                    beauty.push_back(a[c] * light * noise(generator));
+                    albedo.push_back(a[c]);
+                }
+                beauty.push_back(1.0f);
+                const float n = (y < height / 2) ? 1.0f : -1.0f;
+                normal.insert(normal.end(), {0.0f, n * 0.6f, 0.8f});
+            }
+    }
+
+    // Albedo columns alternating between 0.25 and 1.25 in red, neighbours differ by exactly 1.
+    NoisyFilm &stripes()
+    {
+        for (size_t p = 0; p < size_t(width) * height; p++)
+            albedo[p * 3] = (p % width) % 2 ? 1.25f : 0.25f;
+        return *this;
+    }
+
+    // The same film with columns of zeros in front, everything else moves right by shift.
+    NoisyFilm shifted(int shift) const
+    {
+        NoisyFilm film = *this;
+        film.width = width + shift;
+        film.beauty.clear();
+        film.albedo.clear();
+        film.normal.clear();
+        for (int y = 0; y < height; y++) {
+            film.beauty.insert(film.beauty.end(), size_t(shift) * 4, 0.0f);
+            film.albedo.insert(film.albedo.end(), size_t(shift) * 3, 0.0f);
+            film.normal.insert(film.normal.end(), size_t(shift) * 3, 0.0f);
+            film.beauty.insert(film.beauty.end(), beauty.begin() + size_t(y) * width * 4,
+                               beauty.begin() + size_t(y + 1) * width * 4);
+            film.albedo.insert(film.albedo.end(), albedo.begin() + size_t(y) * width * 3,
+                               albedo.begin() + size_t(y + 1) * width * 3);
+            film.normal.insert(film.normal.end(), normal.begin() + size_t(y) * width * 3,
+                               normal.begin() + size_t(y + 1) * width * 3);
+        }
+        return film;
+    }
+
+    std::vector<float> denoise(const DenoiseSettings &settings, bool guides) const
+    {
+        Denoiser denoiser;
+        std::vector<float> result(beauty.size());
+        denoiser.denoise(beauty.data(), guides ? albedo.data() : nullptr, guides ? normal.data() : nullptr, width,
+                         height, settings, result.data());
+        return result;
+    }
+};
+
+// Pixels away from the left and right edges are filtered four at a time with SSE2, the others one by one.
+// Shifting the film moves pixels between both paths, away from the edges they have to agree bit for bit.
+static int scalarVectorMismatches(const NoisyFilm &film, const DenoiseSettings &settings, bool guides,
+                                  int &compared)
+{
+    // the variance window and the taps of all passes
+    const int margin = 2 + 2 * ((1 << settings.iterations) - 1);
+    int mismatches = 0;
+    const std::vector<float> reference = film.denoise(settings, guides);
+    for (int shift = 1; shift < 4; shift++) {
+        const NoisyFilm moved = film.shifted(shift);
+        const std::vector<float> result = moved.denoise(settings, guides);
+        for (int y = 0; y < film.height; y++)
+            for (int x = margin; x < film.width - margin; x++)
+                for (int c = 0; c < 4; c++) {
+                    const float a = reference[(size_t(y) * film.width + x) * 4 + c];
+                    const float b = result[(size_t(y) * moved.width + x + shift) * 4 + c];
+                    mismatches += (a != b);
+                    compared++;
+                }
+    }
+    return mismatches;
+}
+
+static void testScalarMatchesVector()
+{
+    DenoiseSettings settings;
+    settings.iterations = 3;
+    int compared = 0, mismatches = 0;
+    for (unsigned seed = 1; seed <= 4; seed++)
+        for (bool guides : {false, true})
+            mismatches += scalarVectorMismatches(NoisyFilm(96, 24, seed), settings, guides, compared);
+
+    // only the albedo counts, and with this sigma neighbours differing by 1 have x * log2(e) = 1.5 exactly: the
+    // exponent rounds half way, both paths have to round it the same way
+    DenoiseSettings ties;
+    ties.iterations = 1;
+    ties.colorSigma = INFINITY;
+    ties.albedoSigma = 0.980712354f;
+    mismatches += scalarVectorMismatches(NoisyFilm(40, 8, 5).stripes(), ties, true, compared);
+
+    printf("%d of %d values differ between the scalar and vector paths\n", mismatches, compared);
+    CHECK(mismatches == 0);
+}
+
+// Filtering removes most of the noise of a flat region and keeps the alpha.
+static void testNoiseReduction()
+{
+    const NoisyFilm film(64, 64, 9);
+    DenoiseSettings settings;
+    const std::vector<float> result = film.denoise(settings, true);
+    double noisy = 0.0, denoised = 0.0;
+    for (size_t p = 0; p < size_t(film.width) * film.height; p++) {
+        const int x = int(p % film.width);
+        const float light = 0.2f + 2.0f * float(x) / float(film.width);
+        for (int c = 0; c < 3; c++) {
+            const float expected = film.albedo[p * 3 + c] * light;
+            noisy += double(film.beauty[p * 4 + c] - expected) * (film.beauty[p * 4 + c] - expected);
+            denoised += double(result[p * 4 + c] - expected) * (result[p * 4 + c] - expected);
+        }
+        CHECK(result[p * 4 + 3] == 1.0f);
+    }
+    printf("squared error %.1f noisy, %.1f denoised\n", noisy, denoised);
+    CHECK(denoised < 0.25 * noisy);
+}
+
+int main()
+{
+    testScalarMatchesVector();
+    testNoiseReduction();
+    return checkResult();
+}
@@ -0,0 +1,200 @@
+
+#include "check.h"
+
+#include "../src/math/distribution.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Probability of every slot reached through the table: its own part of the slot plus the rest of the slots
+// that alias to it. Has to match the pdf stored in the table.
+static std::vector<double> aliasProbabilities(const std::vector<AliasEntry> &table)
+{
+    std::vector<double> probabilities(table.size(), 0.0);
+    for (size_t i = 0; i < table.size(); i++) {
+        probabilities[i] += double(table[i].threshold) / double(table.size());
+        probabilities[table[i].alias] += (1.0 - double(table[i].threshold)) / double(table.size());
+    }
+    return probabilities;
+}
+
+static void testAliasTableMatchesWeights()
+{
+    const std::vector<float> weights = {1.0f, 7.0f, 0.5f, 0.0f, 3.0f, 12.0f, 0.25f};
+    double sum = 0.0;
+    for (float weight : weights)
+        sum += weight;
+
+    std::vector<AliasEntry> table;
+    CHECK(buildAliasTable(weights, table));
+    CHECK(table.size() == weights.size());
+
+    const std::vector<double> probabilities = aliasProbabilities(table);
+    for (size_t i = 0; i < weights.size(); i++) {
+        CHECK_NEAR(table[i].pdf, weights[i] / sum, 1e-6);
+        CHECK_NEAR(probabilities[i], weights[i] / sum, 1e-6);
+        CHECK(0.0f <= table[i].threshold && table[i].threshold <= 1.0f);
+        CHECK(0 <= table[i].alias && table[i].alias < int(table.size()));
+    }
+
+    // stratified samples hit every light with its probability, the returned pdf is the one of the result
+    const int samples = 1 << 20;
+    std::vector<int> hits(weights.size(), 0);
+    for (int s = 0; s < samples; s++) {
+        float pdf, remapped;
+        const int index = sampleAlias(table, 0, int(table.size()), (float(s) + 0.5f) / float(samples), pdf, remapped);
+        CHECK(0 <= index && index < int(table.size()));
+        CHECK(pdf == table[index].pdf);
+        CHECK(0.0f <= remapped && remapped < 1.0f);
+        hits[index]++;
+    }
+    for (size_t i = 0; i < weights.size(); i++)
+        CHECK_NEAR(double(hits[i]) / samples, weights[i] / sum, 1e-4);
+    CHECK(hits[3] == 0);
+}
+
+static void testAliasTableOffset()
+{
+    // tables of several emitters share one buffer, aliases are relative to the start of their table
+    std::vector<AliasEntry> first, second;
+    buildAliasTable({1.0f, 3.0f}, first);
+    buildAliasTable({2.0f, 0.0f, 6.0f}, second);
+    std::vector<AliasEntry> shared = first;
+    shared.insert(shared.end(), second.begin(), second.end());
+
+    float pdf, remapped;
+    CHECK(sampleAlias(shared, 2, 3, 0.999f, pdf, remapped) == 2);
+    CHECK_NEAR(pdf, 0.75, 1e-6);
+    for (int s = 0; s < 1000; s++) {
+        const int index = sampleAlias(shared, 2, 3, (float(s) + 0.5f) / 1000.0f, pdf, remapped);
+        CHECK(index == 0 || index == 2);
+    }
+}
+
+static void testAliasTableDegenerateWeights()
+{
+    // all zero falls back to uniform and reports it
+    std::vector<AliasEntry> table;
+    CHECK(!buildAliasTable({0.0f, 0.0f, 0.0f, 0.0f}, table));
+    for (auto &entry : table) {
+        CHECK_NEAR(entry.pdf, 0.25, 1e-7);
+        CHECK(entry.threshold == 1.0f);
+    }
+
+    // negative and non-finite weights are never picked
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    CHECK(buildAliasTable({-1.0f, 2.0f, nan, inf, 2.0f}, table));
+    const std::vector<double> probabilities = aliasProbabilities(table);
+    CHECK_NEAR(probabilities[0] + probabilities[2] + probabilities[3], 0.0, 1e-7);
+    CHECK_NEAR(probabilities[1], 0.5, 1e-6);
+    CHECK_NEAR(probabilities[4], 0.5, 1e-6);
+
+    CHECK(!buildAliasTable({}, table));
+    CHECK(table.empty());
+
+    // the last sample below one stays in the table
+    CHECK(buildAliasTable({1.0f}, table));
+    float pdf;
+    CHECK(sampleAlias(table, 1, 0.99999994f, pdf) == 0);
+    CHECK(pdf == 1.0f);
+}
+
+static void testAliasTableLargeDynamicRange()
+{
+    // a sun next to many dim fill lights, rounding of the partitioning must not lose probability
+    std::vector<float> weights(10000, 1e-3f);
+    weights[1234] = 1e6f;
+    std::vector<AliasEntry> table;
+    CHECK(buildAliasTable(weights, table));
+
+    double sum = 0.0;
+    for (float weight : weights)
+        sum += weight;
+    const std::vector<double> probabilities = aliasProbabilities(table);
+    double total = 0.0;
+    for (size_t i = 0; i < weights.size(); i++) {
+        CHECK_NEAR(probabilities[i], weights[i] / sum, 1e-6);
+        total += probabilities[i];
+    }
+    CHECK_NEAR(total, 1.0, 1e-9);
+}
+
+static void testCdf()
+{
+    const float function[] = {0.0f, 2.0f, 1.0f, 0.0f, 5.0f};
+    float cdf[6];
+    CHECK_NEAR(buildCdf(function, 5, cdf), 8.0 / 5.0, 1e-6);
+    CHECK(cdf[0] == 0.0f && cdf[5] == 1.0f);
+    CHECK_NEAR(cdf[2], 0.25, 1e-7);
+    CHECK_NEAR(cdf[3], 0.375, 1e-7);
+
+    // segments are picked with their share of the function, pdf is a density over [0, 1)
+    float remapped, pdf;
+    CHECK(sampleCdf(cdf, 0, 5, 0.1f, remapped, pdf) == 1);
+    CHECK_NEAR(pdf, 2.0 / 8.0 * 5.0, 1e-5);
+    CHECK_NEAR(remapped, (1.0 + 0.1 / 0.25) / 5.0, 1e-6);
+    CHECK(sampleCdf(cdf, 0, 5, 0.5f, remapped, pdf) == 4);
+    CHECK(sampleCdf(cdf, 0, 5, 0.99999994f, remapped, pdf) == 4);
+    CHECK(remapped < 1.0f);
+
+    // zero function is sampled uniformly
+    const float zero[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    CHECK(buildCdf(zero, 4, cdf) == 0.0f);
+    CHECK(sampleCdf(cdf, 0, 4, 0.6f, remapped, pdf) == 2);
+    CHECK_NEAR(pdf, 1.0, 1e-6);
+    CHECK_NEAR(remapped, 0.6, 1e-6);
+}
+
+static void testDistribution2D()
+{
+    // small environment with a bright sun, rows along v
+    const int width = 16, height = 8;
+    std::vector<float> function(width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            function[y * width + x] = 0.1f + float((x * 7 + y * 3) % 5);
+    function[2 * width + 11] = 500.0f;
+    double sum = 0.0;
+    for (float value : function)
+        sum += value;
+
+    std::vector<float> conditional, marginal;
+    CHECK(buildDistribution2D(function, width, height, conditional, marginal));
+    CHECK(conditional.size() == size_t(height) * (width + 1));
+    CHECK(marginal.size() == size_t(height) + 1);
+
+    // the pdf of a sample matches the evaluation used by MIS and is proportional to the function
+    const int grid = 512;
+    std::vector<int> hits(width * height, 0);
+    for (int j = 0; j < grid; j++)
+        for (int i = 0; i < grid; i++) {
+            const optix::float2 sample = optix::make_float2((float(i) + 0.5f) / grid, (float(j) + 0.5f) / grid);
+            float pdf;
+            const optix::float2 uv = sampleDistribution2D(conditional, marginal, width, height, sample, pdf);
+            CHECK(0.0f <= uv.x && uv.x < 1.0f && 0.0f <= uv.y && uv.y < 1.0f);
+            CHECK_NEAR(pdf, pdfDistribution2D(conditional, marginal, width, height, uv), 1e-3 * pdf);
+
+            const int x = std::min(int(uv.x * width), width - 1), y = std::min(int(uv.y * height), height - 1);
+            CHECK_NEAR(pdf, function[y * width + x] / sum * width * height, 1e-3 * pdf);
+            hits[y * width + x]++;
+        }
+    for (int i = 0; i < width * height; i++)
+        CHECK_NEAR(double(hits[i]) / (grid * grid), function[i] / sum, 2e-3);
+
+    std::vector<float> zero(width * height, 0.0f);
+    CHECK(!buildDistribution2D(zero, width, height, conditional, marginal));
+    CHECK_NEAR(pdfDistribution2D(conditional, marginal, width, height, optix::make_float2(0.3f, 0.7f)), 1.0, 1e-5);
+}
+
+int main()
+{
+    testAliasTableMatchesWeights();
+    testAliasTableOffset();
+    testAliasTableDegenerateWeights();
+    testAliasTableLargeDynamicRange();
+    testCdf();
+    testDistribution2D();
+    return checkResult();
+}
@@ -0,0 +1,111 @@
+
+#include "check.h"
+
+#include "../src/utils/hash.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Bytes hashed by the reference vectors, byte i is ((i * 151 + 29) ^ (i >> 3)) & 255.
+static std::vector<unsigned char> patternBytes()
+{
+    std::vector<unsigned char> bytes(128);
+    for (size_t i = 0; i < bytes.size(); i++)
+        bytes[i] = (unsigned char) (((i * 151 + 29) ^ (i >> 3)) & 255);
+    return bytes;
+}
+
+struct Vector
+{
+    size_t size;
+    uint64_t hash;        // seed 0
+    uint64_t seededHash;  // seed 0x9E3779B97F4A7C15
+};
+
+// XXH64 of the reference implementation (libxxhash 0.8) for prefixes of the pattern. The sizes cover the tail
+// alone, every mix of 8, 4 and 1 byte steps after it, and the 32 byte stripes with and without a tail.
+static const Vector vectors[] = {
+    {0, 0xef46db3751d8e999ULL, 0xc4349fc93c010000ULL},
+    {1, 0x72e2a190a8928fcfULL, 0xe93f0ed58ed70286ULL},
+    {3, 0x4eeaa13910cef6bbULL, 0x3c5c683d31bfb3a6ULL},
+    {4, 0x6aa855c411586c99ULL, 0xe9e96d7ba0cf7a5fULL},
+    {5, 0x292e96ac92c810b7ULL, 0x4e0320de458a9382ULL},
+    {7, 0x9f086ceb489f9d18ULL, 0x03cff124cb4e30feULL},
+    {8, 0x2d7a1f3ae8704e93ULL, 0xfbe547e06dddf1ddULL},
+    {9, 0xc40b671327189d91ULL, 0x2edc3a629a6d5619ULL},
+    {12, 0xee53b60d44a283afULL, 0x9181b5ec17857ba7ULL},
+    {15, 0x2e6fa3143de9ef99ULL, 0xbb276b41c199c1c8ULL},
+    {31, 0x6857fe771446bc06ULL, 0x4b1dac9cec6fbd3dULL},
+    {32, 0x419dffadd7d8e54fULL, 0xf3bdaf6ba64f8112ULL},
+    {33, 0x90eceb4df6ff95bfULL, 0xb6743ae8d8687da6ULL},
+    {39, 0x8b3927f929243746ULL, 0x1acb402eb5d3d9d5ULL},
+    {44, 0xe23a4f5bf7b31e10ULL, 0xe31b158679ef435bULL},
+    {63, 0x4e8a45039c8afd1bULL, 0xe9d79404d2af6862ULL},
+    {64, 0xb34035b33229118eULL, 0x79743d10f03f0573ULL},
+    {65, 0x27f2c86923390966ULL, 0x8de1380b7791bfbeULL},
+    {100, 0xa0bdb96d0222bc93ULL, 0x72ab8e0925452ca8ULL},
+    {127, 0xf5ec53e574ac7c85ULL, 0x731e65013bf3f4d3ULL},
+};
+
+static void testPublishedVectors()
+{
+    CHECK(hashBytes(nullptr, 0) == 0xef46db3751d8e999ULL);
+    CHECK(hashBytes("a", 1) == 0xd24ec4f1a98c6e5bULL);
+    CHECK(hashBytes("abc", 3) == 0x44bc2cf5ad770999ULL);
+    const char *text = "Nobody inspects the spammish repetition";
+    CHECK(hashBytes(text, strlen(text)) == 0xfbcea83c8a378bf1ULL);
+}
+
+static void testReferenceVectors()
+{
+    const std::vector<unsigned char> bytes = patternBytes();
+    for (const Vector &vector : vectors) {
+        const uint64_t hash = hashBytes(bytes.data(), vector.size);
+        const uint64_t seeded = hashBytes(bytes.data(), vector.size, 0x9E3779B97F4A7C15ULL);
+        if (hash != vector.hash || seeded != vector.seededHash)
+            printf("size %zu: %016llx %016llx\n", vector.size, (unsigned long long) hash,
+                   (unsigned long long) seeded);
+        CHECK(hash == vector.hash && seeded == vector.seededHash);
+    }
+}
+
+// Data that doesn't start on an 8 byte boundary hashes the same as an aligned copy of it.
+static void testUnalignedData()
+{
+    const std::vector<unsigned char> bytes = patternBytes();
+    const uint64_t expected[][2] = {{1, 0x4011f059b355d1acULL}, {3, 0xa1ee32e335f45b11ULL},
+                                    {5, 0xdeda7158991da415ULL}};
+    for (auto &offset : expected)
+        CHECK(hashBytes(bytes.data() + offset[0], 100) == offset[1]);
+
+    std::vector<uint64_t> storage(20);
+    unsigned char *aligned = (unsigned char *) storage.data();
+    for (size_t offset = 0; offset < 8; offset++)
+        for (size_t size : {0, 3, 13, 45, 77}) {
+            memmove(aligned + offset, bytes.data(), size);
+            CHECK(hashBytes(aligned + offset, size) == hashBytes(bytes.data(), size));
+        }
+}
+
+static void testFile()
+{
+    const std::vector<unsigned char> bytes = patternBytes();
+    const char *filename = "test_hash.bin";
+    std::ofstream(filename, std::ios::binary).write((const char *) bytes.data(), 100);
+    uint64_t hash = 0;
+    CHECK(hashFile(filename, hash) && hash == 0xa0bdb96d0222bc93ULL);
+    remove(filename);
+    CHECK(!hashFile(filename, hash));
+}
+
+int main()
+{
+    testPublishedVectors();
+    testReferenceVectors();
+    testUnalignedData();
+    testFile();
+    return checkResult();
+}
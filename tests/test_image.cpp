@@ -0,0 +1,207 @@
+
+#include "check.h"
+
+#include "../src/core/image.h"
+
+#include <stb_image_write.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+// Value of a half from its fields, independent of the converters.
+static float referenceHalf(unsigned short bits)
+{
+    const int exponent = (bits >> 10) & 31, mantissa = bits & 1023;
+    double value;
+    if (exponent == 31)
+        value = mantissa ? NAN : INFINITY;
+    else if (exponent == 0)
+        value = std::ldexp(double(mantissa), -24);
+    else
+        value = std::ldexp(double(1024 + mantissa), exponent - 25);
+    return float((bits & 0x8000) ? -value : value);
+}
+
+// Rows of 3 pixels convert 8 values with F16C when the CPU has it and the last 4 with the scalar code. Every
+// value is put in both parts, so that the paths are compared with each other and with the reference.
+static void testHalfRowsExact()
+{
+    const MipLevelFormat format = Image::levelFormat(Image::RGBA16F);
+    for (int bits = 0; bits < 65536; bits++) {
+        unsigned short halves[12] = {};
+        halves[bits % 8] = (unsigned short) bits;
+        halves[8 + bits % 4] = (unsigned short) bits;
+        float decoded[12];
+        format.decode((const unsigned char *) halves, 3, decoded);
+        const float expected = referenceHalf((unsigned short) bits);
+        if (std::isnan(expected)) {
+            CHECK(std::isnan(decoded[bits % 8]) && std::isnan(decoded[8 + bits % 4]));
+            continue;
+        }
+        CHECK(decoded[bits % 8] == expected && decoded[8 + bits % 4] == expected);
+
+        // non-negative finite halves survive the way back, the rest is clamped
+        float values[12] = {};
+        values[bits % 8] = expected;
+        values[8 + bits % 4] = expected;
+        unsigned short encoded[12];
+        format.encode(values, 3, (unsigned char *) encoded);
+        const unsigned short back = (bits & 0x8000) ? 0 : ((bits & 0x7c00) == 0x7c00 ? 0x7bff : bits);
+        CHECK(encoded[bits % 8] == back && encoded[8 + bits % 4] == back);
+    }
+
+    // rounding of values between halves, ties to even
+    std::mt19937 generator(2);
+    std::uniform_real_distribution<float> exponent(-26.0f, 17.0f);
+    for (int n = 0; n < 200000; n++) {
+        float value = std::exp2(exponent(generator));
+        if (n % 7 == 0) {
+            // exactly halfway between two normal halves
+            const unsigned short low = (unsigned short) (0x0400 + n % 0x7000);
+            value = 0.5f * (referenceHalf(low) + referenceHalf((unsigned short) (low + 1)));
+        }
+        float values[12] = {};
+        values[n % 8] = value;
+        values[8 + n % 4] = value;
+        unsigned short encoded[12];
+        Image::levelFormat(Image::RGBA16F).encode(values, 3, (unsigned char *) encoded);
+        CHECK(encoded[n % 8] == encoded[8 + n % 4]);
+
+        const unsigned short half = encoded[n % 8];
+        const double error = std::fabs(double(referenceHalf(half)) - value);
+        if (half < 0x7bff)
+            CHECK(error <= std::fabs(double(referenceHalf((unsigned short) (half + 1))) - value));
+        if (0 < half)
+            CHECK(error <= std::fabs(double(referenceHalf((unsigned short) (half - 1))) - value));
+        if (n % 7 == 0)
+            CHECK((half & 1) == 0);
+    }
+}
+
+static double linearToSrgbReference(double value)
+{
+    return (value <= 0.0031308) ? 12.92 * value : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+}
+
+// 8-bit codes decode to the sRGB curve and back to themselves, linear values encode to the nearest code.
+static void testSrgbRows()
+{
+    const MipLevelFormat format = Image::levelFormat(Image::RGBA8_SRGB);
+    CHECK(format.pixelSize == 4);
+    unsigned char codes[256 * 4];
+    for (int i = 0; i < 256 * 4; i++)
+        codes[i] = (unsigned char) (i / 4);
+    std::vector<float> decoded(256 * 4);
+    format.decode(codes, 256, decoded.data());
+    for (int code = 0; code < 256; code++) {
+        const double srgb = code / 255.0;
+        const double linear = (srgb <= 0.04045) ? srgb / 12.92 : std::pow((srgb + 0.055) / 1.055, 2.4);
+        for (int c = 0; c < 3; c++)
+            CHECK_NEAR(decoded[code * 4 + c], linear, 1e-6);
+        CHECK_NEAR(decoded[code * 4 + 3], srgb, 1e-7);
+    }
+    unsigned char encoded[256 * 4];
+    format.encode(decoded.data(), 256, encoded);
+    CHECK(memcmp(codes, encoded, sizeof(codes)) == 0);
+
+    std::mt19937 generator(4);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int ties = 0;
+    for (int n = 0; n < 100000; n++) {
+        float values[4];
+        for (int c = 0; c < 4; c++)
+            values[c] = (c < 3) ? unit(generator) * unit(generator) : unit(generator);
+        unsigned char pixel[4];
+        format.encode(values, 1, pixel);
+        for (int c = 0; c < 4; c++) {
+            const double exact = 255.0 * ((c < 3) ? linearToSrgbReference(values[c]) : values[c]);
+            if (std::fabs(exact - std::floor(exact) - 0.5) < 1e-3) {
+                ties++;
+                CHECK(std::fabs(double(pixel[c]) - exact) < 0.501);
+                continue;
+            }
+            CHECK(pixel[c] == int(std::floor(exact + 0.5)));
+        }
+    }
+    CHECK(ties < 1000);
+
+    // out of range values clamp, NaN is black
+    const float outside[8] = {-1.0f, 2.0f, std::numeric_limits<float>::quiet_NaN(), 1e30f, 0.0f, 1.0f, -0.0f, 5.0f};
+    unsigned char clamped[8];
+    format.encode(outside, 2, clamped);
+    const unsigned char expected[8] = {0, 255, 0, 255, 0, 255, 0, 255};
+    CHECK(memcmp(clamped, expected, sizeof(expected)) == 0);
+}
+
+static void testHalfRowsClamp()
+{
+    const MipLevelFormat format = Image::levelFormat(Image::RGBA16F);
+    CHECK(format.pixelSize == 8);
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    const float values[12] = {0.5f, 1.0f, 2048.0f, 65504.0f, 65520.0f, 1e6f, inf, 1.0f, -3.0f, nan, 6e-8f, 0.0f};
+    const float expected[12] = {0.5f, 1.0f, 2048.0f, 65504.0f, 65504.0f, 65504.0f, 65504.0f, 1.0f, 0.0f, 0.0f,
+                                5.9604645e-8f, 0.0f};
+    unsigned short halves[12];
+    format.encode(values, 3, (unsigned char *) halves);
+    float decoded[12];
+    format.decode((const unsigned char *) halves, 3, decoded);
+    for (int i = 0; i < 12; i++)
+        CHECK(decoded[i] == expected[i]);
+}
+
+// A half is finite when its exponent isn't all ones and non-negative without its sign bit.
+static bool finiteNonNegative(unsigned short half)
+{
+    return (half & 0x7c00u) != 0x7c00u && (half & 0x8000u) == 0;
+}
+
+// A sky with a sun far brighter than the half range loads clamped to the largest half and stays finite in
+// every mip level.
+static void testHdrSunIsFinite()
+{
+    const int width = 16, height = 8;
+    std::vector<float> pixels(width * height * 3, 0.25f);
+    for (int c = 0; c < 3; c++) {
+        pixels[(3 * width + 5) * 3 + c] = 2e5f;
+        pixels[(3 * width + 6) * 3 + c] = 65536.0f;
+        pixels[(3 * width + 7) * 3 + c] = 2048.0f;
+    }
+    const char *filename = "test_image_sun.hdr";
+    CHECK(stbi_write_hdr(filename, width, height, 3, pixels.data()) != 0);
+
+    Image image(4);
+    CHECK(image.load(filename));
+    remove(filename);
+    CHECK(image.format() == Image::RGBA16F);
+    CHECK(image.mipCount() == 4);
+    CHECK(image.byteSize() == size_t(16 * 8 + 8 * 4 + 4 * 2 + 2 * 1) * 8);
+
+    std::vector<float> row(width * 4);
+    image.decodeRow(3, row.data());
+    CHECK(row[5 * 4] == 65504.0f);
+    CHECK(row[6 * 4 + 1] == 65504.0f);
+    CHECK(row[7 * 4 + 2] == 2048.0f);
+    CHECK(row[5 * 4 + 3] == 1.0f);
+    CHECK_NEAR(row[4 * 4], 0.25, 1e-3);
+
+    // every level, the filtered sun included
+    const unsigned short *halves = (const unsigned short *) image.data();
+    for (size_t i = 0; i < image.byteSize() / sizeof(unsigned short); i++)
+        CHECK(finiteNonNegative(halves[i]));
+    image.clear();
+}
+
+int main()
+{
+    testHalfRowsExact();
+    testSrgbRows();
+    testHalfRowsClamp();
+    testHdrSunIsFinite();
+    return checkResult();
+}
@@ -0,0 +1,103 @@
+
+#include "check.h"
+
+#include "../src/core/imagestore.h"
+#include "../src/core/image.h"
+#include "../src/core/globalsettings.h"
+
+#include <stb_image_write.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <utime.h>
+
+static const int SIZE = 64;
+
+static void writeSource(const std::string &filename, int seed, time_t modified)
+{
+    std::vector<unsigned char> pixels(size_t(SIZE) * SIZE * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = (unsigned char) (i * 5 + seed * 17);
+    CHECK(stbi_write_png(filename.c_str(), SIZE, SIZE, 4, pixels.data(), SIZE * 4) != 0);
+    struct utimbuf times = {modified, modified};
+    CHECK(utime(filename.c_str(), &times) == 0);
+}
+
+// Files with the same content share one image, whatever their names. Mip count and filter are part of the key.
+static void testSharedContent()
+{
+    ImageStore &store = ImageStore::getInstance();
+    writeSource("test_imagestore_a.png", 1, 1000);
+    writeSource("test_imagestore_b.png", 1, 2000);
+    writeSource("test_imagestore_c.png", 2, 1000);
+
+    std::shared_ptr<const Image> a = store.acquire("test_imagestore_a.png", 1, MIP_FILTER_BOX);
+    std::shared_ptr<const Image> b = store.acquire("test_imagestore_b.png", 1, MIP_FILTER_BOX);
+    CHECK(a && a == b);
+    CHECK(a == store.acquire("test_imagestore_a.png", 1, MIP_FILTER_BOX));
+    CHECK(store.hostBytes() == a->byteSize());
+
+    std::shared_ptr<const Image> c = store.acquire("test_imagestore_c.png", 1, MIP_FILTER_BOX);
+    std::shared_ptr<const Image> mipmapped = store.acquire("test_imagestore_a.png", 0, MIP_FILTER_BOX);
+    CHECK(c && c != a);
+    CHECK(mipmapped && mipmapped != a && 1 < mipmapped->mipCount());
+    CHECK(store.hostBytes() == a->byteSize() + c->byteSize() + mipmapped->byteSize());
+
+    CHECK(!store.acquire("test_imagestore_missing.png", 1, MIP_FILTER_BOX));
+}
+
+// The store only holds weak references, dropping the last holder frees the image.
+static void testLifetime()
+{
+    ImageStore &store = ImageStore::getInstance();
+    std::shared_ptr<const Image> a = store.acquire("test_imagestore_a.png", 1, MIP_FILTER_BOX);
+    std::shared_ptr<const Image> b = store.acquire("test_imagestore_b.png", 1, MIP_FILTER_BOX);
+    std::weak_ptr<const Image> weak = a;
+    CHECK(a && a == b && store.hostBytes() == a->byteSize());
+    const size_t bytes = a->byteSize();
+
+    a.reset();
+    CHECK(!weak.expired() && store.hostBytes() == bytes);
+    b.reset();
+    CHECK(weak.expired());
+    CHECK(store.hostBytes() == 0);
+
+    // decoded again on the next request
+    a = store.acquire("test_imagestore_a.png", 1, MIP_FILTER_BOX);
+    CHECK(a && a->width() == SIZE && store.hostBytes() == bytes);
+}
+
+// A file that changed is hashed again and gets an image of its own.
+static void testChangedFile()
+{
+    ImageStore &store = ImageStore::getInstance();
+    std::shared_ptr<const Image> before = store.acquire("test_imagestore_a.png", 1, MIP_FILTER_BOX);
+    uint64_t hashBefore, hashAfter;
+    CHECK(store.contentHash("test_imagestore_a.png", hashBefore));
+
+    writeSource("test_imagestore_a.png", 3, 3000);
+    CHECK(store.contentHash("test_imagestore_a.png", hashAfter));
+    CHECK(hashBefore != hashAfter);
+    std::shared_ptr<const Image> after = store.acquire("test_imagestore_a.png", 1, MIP_FILTER_BOX);
+    CHECK(after && after != before);
+    // the unchanged copy still finds the old image
+    CHECK(store.acquire("test_imagestore_b.png", 1, MIP_FILTER_BOX) == before);
+}
+
+int main()
+{
+    // every image is decoded, nothing is written to the texture cache
+    GlobalSettings::getInstance().textureCacheSize = 0;
+
+    testSharedContent();
+    testLifetime();
+    testChangedFile();
+
+    remove("test_imagestore_a.png");
+    remove("test_imagestore_b.png");
+    remove("test_imagestore_c.png");
+    return checkResult();
+}
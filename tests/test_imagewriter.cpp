@@ -0,0 +1,368 @@
+
+#include "check.h"
+
+#include "../src/core/globalsettings.h"
+#include "../src/core/image.h"
+#include "../src/core/imagewriter.h"
+#include "../src/core/tonemapper.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <string>
+#include <vector>
+
+// Heap bytes in use and their peak, counted by the global allocation functions of this test.
+static std::atomic<size_t> heapBytes(0), heapPeak(0);
+
+void *operator new(size_t size)
+{
+    size_t *block = (size_t *) malloc(size + 16);
+    if (!block)
+        throw std::bad_alloc();
+    block[0] = size;
+    const size_t bytes = heapBytes += size;
+    size_t peak = heapPeak;
+    while (peak < bytes && !heapPeak.compare_exchange_weak(peak, bytes)) {
+    }
+    return (char *) block + 16;
+}
+
+void operator delete(void *pointer) noexcept
+{
+    if (!pointer)
+        return;
+    size_t *block = (size_t *) ((char *) pointer - 16);
+    heapBytes -= block[0];
+    free(block);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+// Film value of a pixel, row 0 at the bottom.
+static float filmValue(int x, int y, int channel)
+{
+    return float((x * 3 + y * 5 + channel * 11) % 1024) * 0.25f;
+}
+
+static std::vector<float> film(int width, int height)
+{
+    std::vector<float> pixels(size_t(width) * height * 4);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 4; c++)
+                pixels[(size_t(y) * width + x) * 4 + c] = filmValue(x, y, c);
+    return pixels;
+}
+
+static std::vector<unsigned char> readFile(const std::string &filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    return std::vector<unsigned char>((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+template<typename T>
+static T readValue(const std::vector<unsigned char> &bytes, size_t &position)
+{
+    T value;
+    memcpy(&value, bytes.data() + position, sizeof(T));
+    position += sizeof(T);
+    return value;
+}
+
+static float halfValue(uint16_t half)
+{
+    const uint16_t pixel[4] = {half, 0, 0, 0};
+    float values[4];
+    Image::levelFormat(Image::RGBA16F).decode((const unsigned char *) pixel, 1, values);
+    return values[0];
+}
+
+// The bucket loop of Scene::renderBuckets on the host: one film of a bucket, filled for every bucket and copied
+// into the staging pixels written to the tiled file. Returns the peak heap bytes it needed.
+static size_t renderBuckets(const std::string &filename, int width, int height, int bucketSize)
+{
+    heapPeak = heapBytes.load();
+    const size_t baseline = heapBytes;
+    {
+        const int filmWidth = std::min(bucketSize, width), filmHeight = std::min(bucketSize, height);
+        std::vector<float> film(size_t(filmWidth) * filmHeight * 4);
+        TiledImageFile file;
+        bool success = file.open(filename, width, height, bucketSize);
+        std::vector<float> pixels;
+        for (int bucketY = 0; success && bucketY < file.tilesY(); bucketY++)
+            for (int bucketX = 0; success && bucketX < file.tilesX(); bucketX++) {
+                const optix::int2 origin = file.tileOrigin(bucketX, bucketY);
+                const optix::int2 extent = file.tileExtent(bucketX, bucketY);
+                for (int y = 0; y < extent.y; y++)
+                    for (int x = 0; x < extent.x; x++)
+                        for (int c = 0; c < 4; c++)
+                            film[(size_t(y) * filmWidth + x) * 4 + c] = filmValue(origin.x + x, origin.y + y, c);
+
+                pixels.resize(size_t(extent.x) * extent.y * 4);
+                for (int y = 0; y < extent.y; y++)
+                    std::copy(film.begin() + size_t(y) * filmWidth * 4,
+                              film.begin() + (size_t(y) * filmWidth + extent.x) * 4,
+                              pixels.begin() + size_t(y) * extent.x * 4);
+                success = file.writeTile(bucketX, bucketY, pixels.data());
+            }
+        CHECK(success);
+        CHECK(file.close());
+    }
+    return heapPeak - baseline;
+}
+
+// Writes pixels through the writer and waits for the file.
+static bool writeImage(const std::vector<float> &pixels, int width, int height, const std::string &filename)
+{
+    bool result = false;
+    ImageWriter::getInstance().write(pixels.data(), width, height, filename, [&result](bool success) {
+        result = success;
+    });
+    ImageWriter::getInstance().flush();
+    return result;
+}
+
+// Raw and PFM files keep the floats and the bottom-up row order of the film.
+static void testFloatFormats()
+{
+    const int width = 7, height = 5;
+    const std::vector<float> pixels = film(width, height);
+
+    CHECK(writeImage(pixels, width, height, "test_imagewriter.img"));
+    std::vector<unsigned char> bytes = readFile("test_imagewriter.img");
+    CHECK(bytes.size() == pixels.size() * sizeof(float));
+    CHECK(memcmp(bytes.data(), pixels.data(), bytes.size()) == 0);
+    remove("test_imagewriter.img");
+
+    CHECK(writeImage(pixels, width, height, "test_imagewriter.pfm"));
+    bytes = readFile("test_imagewriter.pfm");
+    const std::string header = "PF\n7 5\n-1.0\n";
+    CHECK(bytes.size() == header.size() + size_t(width) * height * 3 * sizeof(float));
+    CHECK(std::string(bytes.begin(), bytes.begin() + header.size()) == header);
+    size_t position = header.size();
+    int mismatches = 0;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 3; c++)
+                mismatches += readValue<float>(bytes, position) != filmValue(x, y, c);
+    CHECK(mismatches == 0);
+    remove("test_imagewriter.pfm");
+}
+
+// The EXR file is parsed back: header, offsets and half lines top down with the channels as planes.
+static void testEXR()
+{
+    const int width = 9, height = 4;
+    CHECK(writeImage(film(width, height), width, height, "test_imagewriter.exr"));
+    const std::vector<unsigned char> bytes = readFile("test_imagewriter.exr");
+    CHECK(8 < bytes.size());
+    size_t position = 0;
+    CHECK(readValue<uint32_t>(bytes, position) == 20000630);
+    CHECK(readValue<uint32_t>(bytes, position) == 2);
+
+    int32_t window[4] = {};
+    std::vector<std::string> channels;
+    while (bytes[position]) {
+        const std::string name((const char *) bytes.data() + position);
+        position += name.size() + 1;
+        position += strlen((const char *) bytes.data() + position) + 1;
+        const int32_t size = readValue<int32_t>(bytes, position);
+        if (name == "dataWindow")
+            memcpy(window, bytes.data() + position, sizeof(window));
+        if (name == "channels")
+            for (size_t i = position; bytes[i]; i += strlen((const char *) bytes.data() + i) + 1 + 16)
+                channels.push_back((const char *) bytes.data() + i);
+        position += size_t(size);
+    }
+    position++;
+    CHECK(window[0] == 0 && window[1] == 0 && window[2] == width - 1 && window[3] == height - 1);
+    CHECK((channels == std::vector<std::string>{"A", "B", "G", "R"}));
+
+    std::vector<uint64_t> offsets(height);
+    for (auto &offset : offsets)
+        offset = readValue<uint64_t>(bytes, position);
+    int mismatches = 0;
+    for (int y = 0; y < height; y++) {
+        CHECK(position == offsets[y]);
+        CHECK(readValue<int32_t>(bytes, position) == y);
+        CHECK(readValue<int32_t>(bytes, position) == width * 8);
+        for (int c = 0; c < 4; c++)
+            for (int x = 0; x < width; x++)
+                mismatches += halfValue(readValue<uint16_t>(bytes, position)) != filmValue(x, height - 1 - y, 3 - c);
+    }
+    CHECK(mismatches == 0);
+    CHECK(position == bytes.size());
+    remove("test_imagewriter.exr");
+}
+
+// PNG holds the tone mapped codes, top row first, with the settings of the time the image was queued.
+static void testPNG()
+{
+    const int width = 6, height = 3;
+    std::vector<float> pixels = film(width, height);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = pixels[i] / 32.0f - 0.5f;
+    ToneMapSettings &settings = GlobalSettings::getInstance().toneMap;
+    const ToneMapSettings defaults = settings;
+    settings.exposure = -1.0f;
+    settings.toneOperator = TONEMAP_REINHARD;
+    const ToneMapSettings queued = settings;
+    bool written = false;
+    ImageWriter::getInstance().write(pixels.data(), width, height, "test_imagewriter.png", [&written](bool success) {
+        written = success;
+    });
+    settings = defaults;
+    ImageWriter::getInstance().flush();
+    CHECK(written);
+
+    int loadedWidth, loadedHeight, components;
+    unsigned char *loaded = stbi_load("test_imagewriter.png", &loadedWidth, &loadedHeight, &components, 4);
+    CHECK(loaded && loadedWidth == width && loadedHeight == height);
+    if (loaded) {
+        std::vector<unsigned char> expected(size_t(width) * height * 4);
+        toneMap(pixels.data(), width, height, queued, expected.data(), true);
+        CHECK(memcmp(loaded, expected.data(), expected.size()) == 0);
+        stbi_image_free(loaded);
+    }
+    remove("test_imagewriter.png");
+}
+
+// Writes beyond the pending limit wait for the writer instead of failing, unknown formats fail at once.
+static void testQueue()
+{
+    const int width = 64, height = 64;
+    const std::vector<float> pixels = film(width, height);
+    std::atomic<int> written(0);
+    for (int i = 0; i < 12; i++)
+        ImageWriter::getInstance().write(pixels.data(), width, height,
+                                         "test_imagewriter_" + std::to_string(i % 3) + ".hdr",
+                                         [&written](bool success) { written += success; });
+    ImageWriter::getInstance().flush();
+    CHECK(written == 12);
+    for (int i = 0; i < 3; i++)
+        remove(("test_imagewriter_" + std::to_string(i) + ".hdr").c_str());
+
+    CHECK(!ImageWriter::supportsFormat("test_imagewriter.tga"));
+    CHECK(!writeImage(pixels, width, height, "test_imagewriter.tga"));
+}
+
+// Parses the tiled file back and compares every pixel with the film values.
+static void checkTiledFile(const std::string &filename, int width, int height, int tileSize)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    const std::vector<unsigned char> bytes((std::istreambuf_iterator<char>(stream)),
+                                           std::istreambuf_iterator<char>());
+    CHECK(24 < bytes.size());
+    size_t position = 0;
+    CHECK(readValue<uint32_t>(bytes, position) == 20000630);
+    CHECK(readValue<uint32_t>(bytes, position) == (2 | 0x200));
+
+    int32_t window[4] = {};
+    uint32_t tiles[2] = {};
+    while (bytes[position]) {
+        const std::string name((const char *) bytes.data() + position);
+        position += name.size() + 1;
+        position += strlen((const char *) bytes.data() + position) + 1;
+        const int32_t size = readValue<int32_t>(bytes, position);
+        if (name == "dataWindow")
+            memcpy(window, bytes.data() + position, sizeof(window));
+        if (name == "tiles")
+            memcpy(tiles, bytes.data() + position, sizeof(tiles));
+        position += size_t(size);
+    }
+    position++;
+    CHECK(window[0] == 0 && window[1] == 0 && window[2] == width - 1 && window[3] == height - 1);
+    CHECK(tiles[0] == uint32_t(tileSize) && tiles[1] == uint32_t(tileSize));
+
+    const int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<uint64_t> offsets(size_t(tilesX) * tilesY);
+    for (auto &offset : offsets)
+        offset = readValue<uint64_t>(bytes, position);
+
+    int mismatches = 0;
+    for (int tileY = 0; tileY < tilesY; tileY++)
+        for (int tileX = 0; tileX < tilesX; tileX++) {
+            position = offsets[size_t(tileY) * tilesX + tileX];
+            const int tileWidth = std::min(tileSize, width - tileX * tileSize);
+            const int tileHeight = std::min(tileSize, height - tileY * tileSize);
+            CHECK(readValue<int32_t>(bytes, position) == tileX);
+            CHECK(readValue<int32_t>(bytes, position) == tileY);
+            CHECK(readValue<int32_t>(bytes, position) == 0 && readValue<int32_t>(bytes, position) == 0);
+            CHECK(readValue<int32_t>(bytes, position) == tileWidth * tileHeight * 8);
+            // lines top down, channels A, B, G, R as planes
+            for (int y = 0; y < tileHeight; y++) {
+                const int filmY = height - 1 - (tileY * tileSize + y);
+                for (int c = 0; c < 4; c++)
+                    for (int x = 0; x < tileWidth; x++) {
+                        const float value = halfValue(readValue<uint16_t>(bytes, position));
+                        mismatches += value != filmValue(tileX * tileSize + x, filmY, 3 - c);
+                    }
+            }
+        }
+    CHECK(mismatches == 0);
+    CHECK(position == bytes.size());
+}
+
+// The film and the host staging are sized by the bucket, the output resolution doesn't change the peak.
+static void testBucketPeakMemory()
+{
+    const int bucketSize = 128;
+    const size_t filmBytes = size_t(bucketSize) * bucketSize * 4 * sizeof(float);
+
+    const char *small = "test_imagewriter_small.exr";
+    const size_t smallPeak = renderBuckets(small, 300, 200, bucketSize);
+    checkTiledFile(small, 300, 200, bucketSize);
+    remove(small);
+
+    const int sizes[3][2] = {{1000, 700}, {2048, 2048}, {4096, 2304}};
+    for (auto &size : sizes) {
+        const char *filename = "test_imagewriter_large.exr";
+        const size_t peak = renderBuckets(filename, size[0], size[1], bucketSize);
+        const double imageBytes = double(size[0]) * size[1] * 4 * sizeof(float);
+        printf("%dx%d: peak %.2f MB for a %.1f MB image\n", size[0], size[1], double(peak) / (1024.0 * 1024.0),
+               imageBytes / (1024.0 * 1024.0));
+        CHECK(peak <= smallPeak + 4096);
+        CHECK(peak < 3 * filmBytes);
+        if (size[0] == 1000)
+            checkTiledFile(filename, size[0], size[1], bucketSize);
+        remove(filename);
+    }
+}
+
+static void testTileOrder()
+{
+    TiledImageFile file;
+    CHECK(file.open("test_imagewriter_order.exr", 100, 70, 32));
+    CHECK(file.tilesX() == 4 && file.tilesY() == 3);
+    CHECK(file.tileExtent(3, 2).x == 4 && file.tileExtent(3, 2).y == 6);
+    // the top row of tiles holds the top of the film, row 0 of the film is at the bottom
+    CHECK(file.tileOrigin(0, 0).y == 70 - 32 && file.tileOrigin(1, 2).y == 0 && file.tileOrigin(1, 2).x == 32);
+
+    std::vector<float> pixels(32 * 32 * 4, 1.0f);
+    CHECK(file.writeTile(0, 0, pixels.data()));
+    CHECK(!file.writeTile(2, 0, pixels.data()));
+    CHECK(!file.close());
+    remove("test_imagewriter_order.exr");
+}
+
+int main()
+{
+    testFloatFormats();
+    testEXR();
+    testPNG();
+    testQueue();
+    testTileOrder();
+    testBucketPeakMemory();
+    return checkResult();
+}
@@ -0,0 +1,103 @@
+
+#include "check.h"
+
+#include "../src/core/inputlatency.h"
+
+#include <chrono>
+
+typedef InputLatency::Clock Clock;
+
+static Clock::time_point at(int milliseconds)
+{
+    return Clock::time_point(std::chrono::milliseconds(milliseconds));
+}
+
+// Without input no latency is reported, however many passes are shown.
+static void testNoInput()
+{
+    InputLatency latency;
+    latency.motion(Clock::time_point());
+    for (int i = 0; i < 3; i++) {
+        latency.passStarted();
+        latency.passFinished();
+        CHECK(latency.presented(at(100 * i)) < 0.0f);
+    }
+}
+
+// Input is timed from its first motion, later motions before the pass starts don't restart the clock.
+static void testFirstMotion()
+{
+    InputLatency latency;
+    latency.motion(at(10));
+    latency.motion(at(15));
+    latency.motion(at(15));
+    latency.passStarted();
+    latency.passFinished();
+    CHECK_NEAR(latency.presented(at(40)), 30.0, 1e-3);
+    // reported once only
+    CHECK(latency.presented(at(50)) < 0.0f);
+
+    // a motion seen again after its pass is no new input
+    latency.passStarted();
+    latency.passFinished();
+    latency.motion(at(15));
+    latency.passStarted();
+    latency.passFinished();
+    CHECK(latency.presented(at(60)) < 0.0f);
+}
+
+// Input arriving while a pass runs is shown by the next pass, not by the one already running.
+static void testInputDuringPass()
+{
+    InputLatency latency;
+    latency.passStarted();
+    latency.motion(at(20));
+    latency.passFinished();
+    CHECK(latency.presented(at(30)) < 0.0f);
+    latency.passStarted();
+    latency.passFinished();
+    CHECK_NEAR(latency.presented(at(45)), 25.0, 1e-3);
+}
+
+// A dropped pass hands its input on, the latency still counts from the first motion.
+static void testDroppedPass()
+{
+    InputLatency latency;
+    latency.motion(at(100));
+    latency.passStarted();
+    latency.passDropped();
+    latency.motion(at(120));
+    latency.passStarted();
+    latency.passFinished();
+    CHECK_NEAR(latency.presented(at(150)), 50.0, 1e-3);
+
+    // dropping a pass without input keeps the newer motion
+    latency.passStarted();
+    latency.passDropped();
+    latency.motion(at(200));
+    latency.passStarted();
+    latency.passFinished();
+    CHECK_NEAR(latency.presented(at(210)), 10.0, 1e-3);
+}
+
+// A pass showing input waits for the display, the latency ends when the frame is presented.
+static void testPresentedLater()
+{
+    InputLatency latency;
+    latency.motion(at(5));
+    latency.passStarted();
+    latency.passFinished();
+    latency.passStarted();
+    latency.passFinished();
+    CHECK_NEAR(latency.presented(at(70)), 65.0, 1e-3);
+}
+
+int main()
+{
+    testNoInput();
+    testFirstMotion();
+    testInputDuringPass();
+    testDroppedPass();
+    testPresentedLater();
+    return checkResult();
+}
@@ -0,0 +1,200 @@
+
+#include "check.h"
+
+#include "../src/math/lightbvh.h"
+
+#include <random>
+#include <vector>
+
+// Leaf of a light at position, emitting around axis like the one sided triangles of mesh lights,
+// or in all directions when cosTheta0 is -1 like point lights.
+static LightBVHNode leaf(const optix::float3 &position, float power, const optix::float3 &axis, float cosTheta0,
+    int index)
+{
+    LightBVHNode node;
+    node.boundsMin = position - optix::make_float3(0.05f);
+    node.boundsMax = position + optix::make_float3(0.05f);
+    node.power = power;
+    node.axis = axis;
+    node.cosTheta0 = cosTheta0;
+    node.cosThetaE = 0.0f;
+    node.left = index;
+    node.right = -1;
+    node.unused0 = 0.0f;
+    node.unused1 = 0.0f;
+    return node;
+}
+
+static float angle(const optix::float3 &a, const optix::float3 &b)
+{
+    return std::acos(optix::clamp(optix::dot(a, b), -1.0f, 1.0f));
+}
+
+// Checks bounds, power and cones of the subtree, returns the number of leaves below it.
+static int checkNode(const std::vector<LightBVHNode> &nodes, int index, const std::vector<LightBVHNode> &leaves)
+{
+    const LightBVHNode &node = nodes[index];
+    if (node.right < 0) {
+        const LightBVHNode &original = leaves[node.left];
+        CHECK(node.power == original.power);
+        CHECK(node.boundsMin.x == original.boundsMin.x && node.boundsMax.z == original.boundsMax.z);
+        return 1;
+    }
+
+    const LightBVHNode &left = nodes[node.left];
+    const LightBVHNode &right = nodes[node.right];
+    CHECK_NEAR(node.power, left.power + right.power, 1e-5 * node.power);
+    for (const LightBVHNode *child : {&left, &right}) {
+        CHECK(node.boundsMin.x <= child->boundsMin.x && node.boundsMin.y <= child->boundsMin.y &&
+              node.boundsMin.z <= child->boundsMin.z);
+        CHECK(child->boundsMax.x <= node.boundsMax.x && child->boundsMax.y <= node.boundsMax.y &&
+              child->boundsMax.z <= node.boundsMax.z);
+        // the cone of the node holds the cone of the child
+        if (-1.0f < node.cosTheta0)
+            CHECK(angle(node.axis, child->axis) + std::acos(child->cosTheta0) <= std::acos(node.cosTheta0) + 1e-3f);
+        CHECK(node.cosThetaE <= child->cosThetaE);
+    }
+    return checkNode(nodes, node.left, leaves) + checkNode(nodes, node.right, leaves);
+}
+
+static std::vector<LightBVHNode> randomLeaves(int count, bool oriented, int firstIndex)
+{
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    std::vector<LightBVHNode> leaves;
+    for (int i = 0; i < count; i++) {
+        const optix::float3 position = optix::make_float3(uniform(generator), uniform(generator), uniform(generator)) *
+            10.0f;
+        optix::float3 axis = optix::make_float3(0.0f, 0.0f, 1.0f);
+        if (oriented)
+            axis = optix::normalize(optix::make_float3(uniform(generator), uniform(generator), uniform(generator)));
+        leaves.push_back(leaf(position, 0.5f + 2.0f * (uniform(generator) + 1.0f), axis, oriented ? 1.0f : -1.0f,
+                              firstIndex + i));
+    }
+    return leaves;
+}
+
+static void testBuild()
+{
+    for (bool oriented : {false, true}) {
+        const std::vector<LightBVHNode> leaves = randomLeaves(300, oriented, 0);
+        std::vector<LightBVHNode> nodes;
+        std::vector<unsigned int> trails;
+        CHECK(buildLightBVH(leaves, nodes, trails, int(leaves.size())));
+        CHECK(nodes.size() == 2 * leaves.size() - 1);
+        CHECK(checkNode(nodes, 0, leaves) == int(leaves.size()));
+
+        // the trail of every light leads to its leaf
+        for (size_t light = 0; light < leaves.size(); light++) {
+            int index = 0;
+            unsigned int trail = trails[light];
+            while (0 <= nodes[index].right) {
+                index = (trail & 1u) ? nodes[index].right : nodes[index].left;
+                trail >>= 1;
+            }
+            CHECK(nodes[index].left == int(light));
+        }
+    }
+
+    std::vector<LightBVHNode> nodes;
+    std::vector<unsigned int> trails;
+    CHECK(!buildLightBVH({}, nodes, trails, 3));
+    CHECK(nodes.empty() && trails.size() == 3);
+}
+
+static void testPmfConsistency()
+{
+    // infinite lights come first, their indices are not in the hierarchy
+    const int numInfiniteLights = 2;
+    const std::vector<LightBVHNode> leaves = randomLeaves(64, true, numInfiniteLights);
+    const int numLights = numInfiniteLights + int(leaves.size());
+    std::vector<LightBVHNode> nodes;
+    std::vector<unsigned int> trails;
+    buildLightBVH(leaves, nodes, trails, numLights);
+    std::vector<AliasEntry> aliasTable;
+    buildAliasTable({3.0f, 1.0f}, aliasTable);
+
+    const optix::float3 points[] = {optix::make_float3(0.0f), optix::make_float3(25.0f, -3.0f, 1.0f),
+                                    optix::make_float3(-4.0f, 9.5f, 2.0f)};
+    for (const optix::float3 &point : points) {
+        const float probabilityInfinite = infiniteLightProbability(numLights, numInfiniteLights);
+
+        // pmfs add up to one minus the chance of stopping in a subtree that faces away from the point,
+        // lights that can reach the point are never left out
+        std::vector<double> pmfs(numLights, 0.0);
+        double total = 0.0;
+        for (int light = 0; light < numLights; light++) {
+            if (light < numInfiniteLights)
+                pmfs[light] = probabilityInfinite * aliasTable[light].pdf;
+            else {
+                pmfs[light] = (1.0f - probabilityInfinite) * pmfLightBVH(nodes, point, trails[light]);
+                if (pmfs[light] == 0.0)
+                    CHECK(lightBVHImportance(leaves[light - numInfiniteLights], point) == 0.0f);
+            }
+            total += pmfs[light];
+        }
+        CHECK(total <= 1.0 + 1e-5);
+
+        // sampling returns the pmf evaluated for MIS and picks lights with it
+        const int samples = 200000;
+        std::vector<int> hits(numLights, 0);
+        int misses = 0;
+        for (int s = 0; s < samples; s++) {
+            float pmf;
+            const int light = selectLight(aliasTable, nodes, numLights, numInfiniteLights, point,
+                                          (float(s) + 0.5f) / samples, pmf);
+            CHECK(-1 <= light && light < numLights);
+            if (light < 0) {
+                CHECK(pmf == 0.0f);
+                misses++;
+                continue;
+            }
+            CHECK_NEAR(pmf, pmfs[light], 1e-4 * pmfs[light]);
+            hits[light]++;
+        }
+        for (int light = 0; light < numLights; light++)
+            CHECK_NEAR(double(hits[light]) / samples, pmfs[light], 2e-3);
+        CHECK_NEAR(double(misses) / samples, 1.0 - total, 2e-3);
+    }
+}
+
+static void testImportance()
+{
+    // one sided emitter facing away from the point contributes nothing, facing it does
+    const LightBVHNode away = leaf(optix::make_float3(0.0f), 1.0f, optix::make_float3(0.0f, 0.0f, 1.0f), 1.0f, 0);
+    CHECK(lightBVHImportance(away, optix::make_float3(0.0f, 0.0f, -5.0f)) == 0.0f);
+    CHECK(0.0f < lightBVHImportance(away, optix::make_float3(0.0f, 0.0f, 5.0f)));
+
+    // importance falls off with the squared distance
+    const LightBVHNode point = leaf(optix::make_float3(0.0f), 2.0f, optix::make_float3(0.0f, 0.0f, 1.0f), -1.0f, 0);
+    const float near = lightBVHImportance(point, optix::make_float3(2.0f, 0.0f, 0.0f));
+    const float far = lightBVHImportance(point, optix::make_float3(4.0f, 0.0f, 0.0f));
+    CHECK_NEAR(near / far, 4.0, 1e-3);
+
+    // the hierarchy never picks the light behind the point
+    std::vector<LightBVHNode> leaves = {away, leaf(optix::make_float3(1.0f, 0.0f, -8.0f), 1.0f,
+                                                   optix::make_float3(0.0f, 0.0f, 1.0f), 1.0f, 1)};
+    std::vector<LightBVHNode> nodes;
+    std::vector<unsigned int> trails;
+    buildLightBVH(leaves, nodes, trails, 2);
+    const optix::float3 shadingPoint = optix::make_float3(0.0f, 0.0f, -5.0f);
+    CHECK(pmfLightBVH(nodes, shadingPoint, trails[0]) == 0.0f);
+    CHECK_NEAR(pmfLightBVH(nodes, shadingPoint, trails[1]), 1.0, 1e-6);
+    for (int s = 0; s < 100; s++) {
+        float pmf;
+        CHECK(sampleLightBVH(nodes, shadingPoint, (float(s) + 0.5f) / 100.0f, pmf) == 1);
+    }
+
+    // no light reaches a point behind all of them
+    float pmf;
+    CHECK(sampleLightBVH(nodes, optix::make_float3(0.0f, 0.0f, -20.0f), 0.5f, pmf) == -1);
+    CHECK(pmf == 0.0f);
+}
+
+int main()
+{
+    testBuild();
+    testPmfConsistency();
+    testImportance();
+    return checkResult();
+}
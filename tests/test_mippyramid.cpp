@@ -0,0 +1,139 @@
+
+#include "check.h"
+
+#include "../src/core/image.h"
+#include "../src/core/mippyramid.h"
+
+#include <cstring>
+#include <vector>
+
+// Linear RGBA floats stored as they are, so that the filters are tested without any format conversion.
+static void decodeFloatRow(const unsigned char *src, int count, float *dst)
+{
+    memcpy(dst, src, sizeof(float) * 4 * count);
+}
+
+static void encodeFloatRow(const float *src, int count, unsigned char *dst)
+{
+    memcpy(dst, src, sizeof(float) * 4 * count);
+}
+
+static const MipLevelFormat floatFormat = {int(4 * sizeof(float)), decodeFloatRow, encodeFloatRow};
+
+static void testSizes()
+{
+    CHECK(fullMipCount(1, 1) == 1);
+    CHECK(fullMipCount(2, 1) == 2);
+    CHECK(fullMipCount(1024, 1024) == 11);
+    CHECK(fullMipCount(1025, 77) == 11);
+    CHECK(fullMipCount(3000, 2000) == 12);
+    CHECK(fullMipCount(1, 4097) == 13);
+
+    CHECK(mipLevelSize(1025, 0) == 1025);
+    CHECK(mipLevelSize(1025, 1) == 512);
+    CHECK(mipLevelSize(77, 6) == 1);
+    CHECK(mipLevelSize(77, 10) == 1);
+    CHECK(mipLevelSize(5, 1) == 2);
+
+    CHECK(mipChainPixels(4, 2, 3) == 8 + 2 + 1);
+    CHECK(mipChainPixels(5, 3, 3) == 15 + 2 + 1);
+    size_t pixels = 0;
+    for (int level = 0; level < 11; level++)
+        pixels += size_t(std::max(1, 1025 >> level)) * std::max(1, 77 >> level);
+    CHECK(mipChainPixels(1025, 77, 11) == pixels);
+    // the old power of two formula would have allocated 2 - 1 / 2^10 = 1 times level 0 here
+    CHECK(size_t(1025) * 77 < mipChainPixels(1025, 77, 11));
+}
+
+static void testBoxWeights()
+{
+    // 5 -> 2 pixels: the middle pixel is shared half and half
+    const float row[5] = {1.0f, 2.0f, 4.0f, 8.0f, 16.0f};
+    std::vector<float> src(5 * 4), dst(2 * 4);
+    for (int x = 0; x < 5; x++)
+        for (int c = 0; c < 4; c++)
+            src[x * 4 + c] = row[x];
+    buildMipLevel((const unsigned char *) src.data(), 5, 1, (unsigned char *) dst.data(), floatFormat, MIP_FILTER_BOX);
+    CHECK_NEAR(dst[0], (1.0 + 2.0 + 0.5 * 4.0) / 2.5, 1e-6);
+    CHECK_NEAR(dst[4], (0.5 * 4.0 + 8.0 + 16.0) / 2.5, 1e-6);
+    CHECK(dst[1] == dst[0] && dst[7] == dst[4]);
+
+    // 3 -> 1 and the same vertically
+    std::vector<float> column(3 * 4);
+    for (int y = 0; y < 3; y++)
+        for (int c = 0; c < 4; c++)
+            column[y * 4 + c] = row[y];
+    float one[4];
+    buildMipLevel((const unsigned char *) column.data(), 1, 3, (unsigned char *) one, floatFormat, MIP_FILTER_BOX);
+    CHECK_NEAR(one[0], 7.0 / 3.0, 1e-6);
+}
+
+// Builds a full float chain of width x height, level 0 from fill(x, y, channel).
+template<typename Fill>
+static std::vector<float> floatChain(int width, int height, MipFilter filter, Fill fill)
+{
+    const int mipCount = fullMipCount(width, height);
+    std::vector<float> chain(mipChainPixels(width, height, mipCount) * 4);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            for (int c = 0; c < 4; c++)
+                chain[(size_t(y) * width + x) * 4 + c] = fill(x, y, c);
+    buildMipPyramid((unsigned char *) chain.data(), width, height, mipCount, floatFormat, filter);
+    return chain;
+}
+
+static void testConstantAndMean()
+{
+    const int width = 1025, height = 77;
+    const int mipCount = fullMipCount(width, height);
+    for (MipFilter filter : {MIP_FILTER_BOX, MIP_FILTER_KAISER}) {
+        const std::vector<float> constant = floatChain(width, height, filter, [](int, int, int c) {
+            return 0.25f * float(c + 1);
+        });
+        for (size_t i = 0; i < constant.size(); i++)
+            CHECK_NEAR(constant[i], 0.25 * double(i % 4 + 1), 1e-5);
+
+        // box filtering preserves the mean through every level, kaiser nearly so
+        const std::vector<float> chain = floatChain(width, height, filter, [](int x, int y, int c) {
+            return float((x * 13 + y * 7 + c * 5) % 17) + ((x / 64 + y / 8) % 2 ? 10.0f : 0.0f);
+        });
+        size_t offset = 0;
+        double mean0 = 0.0;
+        for (int level = 0; level < mipCount; level++) {
+            const int levelWidth = mipLevelSize(width, level), levelHeight = mipLevelSize(height, level);
+            double sum = 0.0;
+            for (size_t i = 0; i < size_t(levelWidth) * levelHeight; i++)
+                sum += chain[(offset + i) * 4];
+            const double mean = sum / (double(levelWidth) * levelHeight);
+            if (level == 0)
+                mean0 = mean;
+            CHECK_NEAR(mean, mean0, (filter == MIP_FILTER_BOX) ? 1e-3 : 0.05 * mean0);
+            offset += size_t(levelWidth) * levelHeight;
+        }
+        CHECK(offset * 4 == chain.size());
+    }
+}
+
+// An 8-bit NPOT texture keeps its size and gets the whole chain in one allocation.
+static void testImageChain()
+{
+    Image image(0);
+    CHECK(image.load(RENDERER_RESOURCE_DIR "/textures/checkerboard_small.png"));
+    CHECK(image.width() == 420 && image.height() == 420);
+    CHECK(image.mipCount() == 9);
+    CHECK(image.byteSize() == mipChainPixels(420, 420, 9) * 4);
+
+    Image limited(3);
+    CHECK(limited.load(RENDERER_RESOURCE_DIR "/textures/checkerboard_small.png"));
+    CHECK(limited.mipCount() == 3);
+    CHECK(limited.byteSize() == size_t(420 * 420 + 210 * 210 + 105 * 105) * 4);
+}
+
+int main()
+{
+    testSizes();
+    testBoxWeights();
+    testConstantAndMean();
+    testImageChain();
+    return checkResult();
+}
@@ -0,0 +1,106 @@
+
+#include "check.h"
+
+#include "../src/math/raycone.h"
+
+#include <cmath>
+
+static void testPixelSpread()
+{
+    // 90 degrees over 1000 rows, the angle of a pixel in the middle of the image plane
+    const float spread = pixelSpreadAngle(1.0f, 1000);
+    CHECK_NEAR(spread, std::atan(0.002), 1e-7);
+    CHECK_NEAR(1000.0 * std::tan(spread), 2.0, 1e-5);
+    CHECK(spread < M_PI / 2.0 / 1000.0 * 1.5);
+    CHECK_NEAR(pixelSpreadAngle(1.0f, 2000), 0.5 * spread, 1e-6);
+    CHECK(std::isfinite(pixelSpreadAngle(1.0f, 0)));
+}
+
+static void testConePropagation()
+{
+    CHECK(coneWidthAt(0.0f, 0.01f, 0.0f) == 0.0f);
+    CHECK_NEAR(coneWidthAt(0.0f, 0.01f, 5.0f), 0.05, 1e-7);
+    CHECK_NEAR(coneWidthAt(0.05f, 0.01f, 5.0f), 0.1, 1e-7);
+    // a converging cone passes through zero and keeps a positive width
+    CHECK_NEAR(coneWidthAt(0.05f, -0.01f, 10.0f), 0.05, 1e-7);
+
+    // the added lobe is the cone with the solid angle 1 / pdf of one sample
+    for (float pdf : {10.0f, 100.0f, 1e4f}) {
+        const float lobe = bounceConeSpread(0.0f, pdf);
+        CHECK_NEAR(M_PI * 0.25 * lobe * lobe, 1.0 / pdf, 1e-3 / pdf);
+        CHECK_NEAR(bounceConeSpread(0.001f, pdf), 0.001f + lobe, 1e-6);
+    }
+    CHECK(bounceConeSpread(0.0f, 100.0f) < bounceConeSpread(0.0f, 10.0f));
+
+    // diffuse bounces saturate, delta lobes keep the spread, no pdf means no information
+    CHECK(bounceConeSpread(0.001f, float(M_1_PI)) == RAY_CONE_MAX_SPREAD);
+    CHECK_NEAR(bounceConeSpread(0.001f, 1e12f), 0.001, 1e-5);
+    CHECK(bounceConeSpread(0.001f, 0.0f) == RAY_CONE_MAX_SPREAD);
+    CHECK(bounceConeSpread(0.001f, NAN) == RAY_CONE_MAX_SPREAD);
+}
+
+static void testFootprint()
+{
+    // unit uv square on 2 x 2 world units, either winding
+    CHECK_NEAR(triangleUVDensity(1.0f, 4.0f), 0.5, 1e-7);
+    CHECK_NEAR(triangleUVDensity(-1.0f, 4.0f), 0.5, 1e-7);
+    CHECK(triangleUVDensity(1.0f, 0.0f) == 0.0f);
+
+    CHECK_NEAR(coneUVFootprint(0.1f, 1.0f, 0.5f), 0.05, 1e-7);
+    CHECK_NEAR(coneUVFootprint(0.1f, -0.5f, 0.5f), 0.1, 1e-7);
+    // grazing angles stretch by at most 100
+    CHECK_NEAR(coneUVFootprint(0.1f, 0.0f, 0.5f), 5.0, 1e-5);
+
+    const optix::float2 environment = environmentUVFootprint(float(M_PI));
+    CHECK_NEAR(environment.x, 0.5, 1e-6);
+    CHECK_NEAR(environment.y, 1.0, 1e-6);
+}
+
+static void testLod()
+{
+    CHECK(textureLod(optix::make_float2(0.0f, 0.0f), 1024, 1024) == 0.0f);
+    CHECK(textureLod(optix::make_float2(0.5f / 1024.0f, 0.5f / 1024.0f), 1024, 1024) == 0.0f);
+    CHECK_NEAR(textureLod(optix::make_float2(4.0f / 1024.0f, 4.0f / 1024.0f), 1024, 1024), 2.0, 1e-5);
+    // the longer axis in texels decides
+    CHECK_NEAR(textureLod(optix::make_float2(4.0f / 1024.0f, 1.0f / 1024.0f), 1024, 256), 2.0, 1e-5);
+    CHECK_NEAR(textureLod(optix::make_float2(1.0f / 1024.0f, 16.0f / 1024.0f), 1024, 256), 2.0, 1e-5);
+    CHECK_NEAR(textureLod(optix::make_float2(1.0f, 1.0f), 1024, 512), 10.0, 1e-5);
+}
+
+// A camera looking at a textured plane head-on: a pixel covers a texel of level 0 at the distance where
+// their sizes match, and every doubling of the distance moves one level up.
+static void testCameraToPlane()
+{
+    const int height = 1080, size = 2048;
+    const float spread = pixelSpreadAngle(std::tan(0.5f * float(M_PI) / 3.0f), height);
+    const float density = triangleUVDensity(1.0f, 100.0f); // uv square over 10 x 10 world units
+    const float matching = (10.0f / float(size)) / spread;
+
+    float previous = 0.0f;
+    for (int i = 0; i < 6; i++) {
+        const float distance = matching * float(1 << i);
+        const float width = coneUVFootprint(coneWidthAt(0.0f, spread, distance), 1.0f, density);
+        const float lod = textureLod(optix::make_float2(width, width), size, size);
+        CHECK_NEAR(lod, double(i), 1e-3);
+        if (0 < i)
+            CHECK_NEAR(lod - previous, 1.0, 1e-3);
+        previous = lod;
+    }
+    // closer than that stays on level 0
+    const float width = coneUVFootprint(coneWidthAt(0.0f, spread, 0.5f * matching), 1.0f, density);
+    CHECK(textureLod(optix::make_float2(width, width), size, size) == 0.0f);
+
+    // tilting the plane by 60 degrees needs twice the texels
+    const float tilted = coneUVFootprint(coneWidthAt(0.0f, spread, matching), 0.5f, density);
+    CHECK_NEAR(textureLod(optix::make_float2(tilted, tilted), size, size), 1.0, 1e-3);
+}
+
+int main()
+{
+    testPixelSpread();
+    testConePropagation();
+    testFootprint();
+    testLod();
+    testCameraToPlane();
+    return checkResult();
+}
@@ -0,0 +1,174 @@
+
+#include "check.h"
+
+#include "../src/core/sharedframes.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static std::vector<float> framePixels(int width, int height, int iteration)
+{
+    std::vector<float> pixels(size_t(width) * height * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = float(i % 97) + 1000.0f * float(iteration);
+    return pixels;
+}
+
+static bool publish(const std::string &name, int width, int height, int iteration)
+{
+    const std::vector<float> pixels = framePixels(width, height, iteration);
+    return SharedFramePublisher::getInstance().publish(name, pixels.data(), width, height, iteration);
+}
+
+// Frames come back with their header fields and pixels, a frame is only read once.
+static void testReadBack(const std::string &name)
+{
+    SharedFrameReader reader;
+    CHECK(!reader.open(name));
+    CHECK(publish(name, 7, 5, 0));
+    CHECK(reader.open(name));
+    CHECK(reader.latestSequence() == 1);
+
+    uint64_t sequence = 0;
+    int width = 0, height = 0, iteration = -1;
+    std::vector<float> pixels;
+    CHECK(reader.read(sequence, width, height, iteration, pixels));
+    CHECK(sequence == 1 && width == 7 && height == 5 && iteration == 0);
+    CHECK(pixels == framePixels(7, 5, 0));
+
+    // latest <= sequence: nothing new
+    CHECK(!reader.read(sequence, width, height, iteration, pixels));
+    uint64_t ahead = 5;
+    CHECK(!reader.read(ahead, width, height, iteration, pixels) && ahead == 5);
+
+    // smaller frames fit the slots, readers skip to the newest one
+    CHECK(publish(name, 7, 5, 1));
+    CHECK(publish(name, 3, 2, 2));
+    CHECK(reader.read(sequence, width, height, iteration, pixels));
+    CHECK(sequence == 3 && width == 3 && height == 2 && iteration == 2);
+    CHECK(pixels == framePixels(3, 2, 2));
+
+    uint64_t latest;
+    const float *source = nullptr;
+    const SharedFrameHeader *frame = reader.latestFrame(latest, source);
+    CHECK(frame && latest == 3 && frame->width == 3 && frame->height == 2 && frame->iteration == 2);
+    CHECK(source && source[5] == framePixels(3, 2, 2)[5]);
+}
+
+// A zero-copy frame stays valid until the writer comes back to its slot after lapping the ring.
+static void testLapping(const std::string &name)
+{
+    SharedFrameReader reader;
+    CHECK(reader.open(name));
+    uint64_t sequence;
+    const float *pixels = nullptr;
+    const SharedFrameHeader *frame = reader.latestFrame(sequence, pixels);
+    CHECK(frame != nullptr);
+    CHECK(SharedFrameReader::stillValid(frame, sequence));
+
+    CHECK(publish(name, 7, 5, 10));
+    CHECK(publish(name, 7, 5, 11));
+    CHECK(SharedFrameReader::stillValid(frame, sequence));
+    CHECK(frame->iteration == 2);
+    CHECK(publish(name, 7, 5, 12));
+    CHECK(!SharedFrameReader::stillValid(frame, sequence));
+    CHECK(frame->iteration == 12 && reader.latestSequence() == sequence + 3);
+
+    // a slot in the middle of a write, seen through a writable mapping of the segment
+    const int descriptor = shm_open(("/" + name).c_str(), O_RDWR, 0);
+    CHECK(0 <= descriptor);
+    const size_t size = SHARED_FRAMES_RING_SIZE + 3 * (SHARED_FRAMES_HEADER_SIZE + 7 * 5 * 4 * sizeof(float));
+    unsigned char *memory = (unsigned char *) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    CHECK(memory != MAP_FAILED);
+    const SharedFrameRing *ring = (const SharedFrameRing *) memory;
+    CHECK(ring->slotCount == 3 && ring->capacity == 7 * 5);
+    const uint64_t latest = ring->latest;
+    SharedFrameHeader *writing = (SharedFrameHeader *) (memory + SHARED_FRAMES_RING_SIZE +
+                                                        (latest % ring->slotCount) * ring->slotSize);
+    writing->sequence = 0;
+    uint64_t readSequence = 0;
+    int width, height, iteration;
+    std::vector<float> copy;
+    CHECK(reader.latestFrame(sequence, pixels) == nullptr);
+    CHECK(!reader.read(readSequence, width, height, iteration, copy) && readSequence == 0);
+    writing->sequence = latest;
+    CHECK(reader.read(readSequence, width, height, iteration, copy) && readSequence == latest && iteration == 12);
+    munmap(memory, size);
+}
+
+// Larger frames move the renderer to a new segment, readers notice through replaced and open it again.
+static void testResize(const std::string &name)
+{
+    SharedFrameReader reader;
+    CHECK(reader.open(name));
+    uint64_t sequence = 0;
+    int width, height, iteration;
+    std::vector<float> pixels;
+    CHECK(reader.read(sequence, width, height, iteration, pixels) && width == 7);
+
+    CHECK(publish(name, 16, 9, 20));
+    CHECK(reader.read(sequence, width, height, iteration, pixels));
+    // the first frame of the new segment
+    CHECK(sequence == 1);
+    CHECK(width == 16 && height == 9 && iteration == 20);
+    CHECK(pixels == framePixels(16, 9, 20));
+    CHECK(reader.latestSequence() == sequence);
+
+    // the segment is gone after the renderer closed it
+    SharedFramePublisher::getInstance().close();
+    CHECK(!reader.read(sequence, width, height, iteration, pixels));
+    CHECK(!reader.open(name));
+}
+
+// A writer publishing as fast as it can never hands out a torn frame: every frame that is read completely
+// holds the pixels of a single iteration.
+static void testConcurrentReads(const std::string &name)
+{
+    const int width = 64, height = 64;
+    CHECK(publish(name, width, height, 0));
+    std::atomic<bool> done(false);
+    std::thread writer([&] {
+        std::vector<float> pixels(size_t(width) * height * 4);
+        for (int iteration = 1; iteration < 20000; iteration++) {
+            std::fill(pixels.begin(), pixels.end(), float(iteration));
+            SharedFramePublisher::getInstance().publish(name, pixels.data(), width, height, iteration);
+        }
+        done = true;
+    });
+
+    SharedFrameReader reader;
+    CHECK(reader.open(name));
+    uint64_t sequence = 0;
+    int frameWidth, frameHeight, iteration, reads = 0, torn = 0;
+    std::vector<float> pixels;
+    while (!done) {
+        if (!reader.read(sequence, frameWidth, frameHeight, iteration, pixels))
+            continue;
+        reads++;
+        for (float value : pixels)
+            torn += (value != float(iteration) && 0 < iteration);
+    }
+    writer.join();
+    printf("%d frames read while writing\n", reads);
+    CHECK(0 < reads && torn == 0);
+    SharedFramePublisher::getInstance().close();
+}
+
+int main()
+{
+    const std::string name = "test_sharedframes_" + std::to_string(getpid());
+    testReadBack(name);
+    testLapping(name);
+    testResize(name);
+    testConcurrentReads(name);
+    return checkResult();
+}
@@ -0,0 +1,172 @@
+
+#include "check.h"
+
+#include "../src/core/image.h"
+#include "../src/core/mippyramid.h"
+#include "../src/core/textureatlas.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Size of a texture with its border on the page, a whole number of grid cells.
+static int borderedSize(int size)
+{
+    return (size + 2 * ATLAS_BORDER + ATLAS_BORDER - 1) / ATLAS_BORDER * ATLAS_BORDER;
+}
+
+// Placements are aligned, inside their page and don't overlap with their borders. Pages but the last are
+// well filled, the borders of textures this small take about a third of them.
+static void testPacking()
+{
+    const int pageSize = 2048;
+    std::mt19937 generator(5);
+    std::uniform_int_distribution<int> size(8, 300);
+    std::vector<optix::int2> sizes;
+    for (int i = 0; i < 600; i++)
+        sizes.push_back(optix::make_int2(size(generator), size(generator)));
+    sizes.push_back(optix::make_int2(pageSize, 4));                    // too wide with its border
+    sizes.push_back(optix::make_int2(pageSize - 2 * ATLAS_BORDER, 8)); // just fits
+
+    std::vector<AtlasPlacement> placements;
+    const int pageCount = packAtlas(sizes, pageSize, placements);
+    CHECK(placements.size() == sizes.size());
+    CHECK(placements[600].page == -1);
+    CHECK(0 <= placements[601].page && placements[601].x == ATLAS_BORDER);
+
+    std::vector<std::vector<int>> owners(pageCount, std::vector<int>(size_t(pageSize) * pageSize, -1));
+    std::vector<double> cells(pageCount, 0.0), texels(pageCount, 0.0);
+    bool overlap = false;
+    for (size_t i = 0; i < sizes.size(); i++) {
+        const AtlasPlacement &placement = placements[i];
+        if (placement.page < 0)
+            continue;
+        CHECK(placement.page < pageCount);
+        CHECK(placement.x % ATLAS_BORDER == 0 && placement.y % ATLAS_BORDER == 0);
+        const int x0 = placement.x - ATLAS_BORDER, y0 = placement.y - ATLAS_BORDER;
+        const int width = borderedSize(sizes[i].x), height = borderedSize(sizes[i].y);
+        CHECK(0 <= x0 && 0 <= y0 && x0 + width <= pageSize && y0 + height <= pageSize);
+        for (int y = y0; y < std::min(y0 + height, pageSize); y++)
+            for (int x = x0; x < std::min(x0 + width, pageSize); x++) {
+                int &owner = owners[placement.page][size_t(y) * pageSize + x];
+                overlap |= (0 <= owner);
+                owner = int(i);
+            }
+        cells[placement.page] += double(width) * height;
+        texels[placement.page] += double(sizes[i].x) * sizes[i].y;
+    }
+    CHECK(!overlap);
+
+    const double pageArea = double(pageSize) * pageSize;
+    for (int page = 0; page < pageCount; page++) {
+        printf("page %d: %.1f%% with borders, %.1f%% texels\n", page, 100.0 * cells[page] / pageArea,
+               100.0 * texels[page] / pageArea);
+        CHECK(0.0 < texels[page]);
+        if (page + 1 < pageCount) {
+            CHECK(0.9 < cells[page] / pageArea);
+            CHECK(0.5 < texels[page] / pageArea);
+        }
+    }
+
+    // nothing to pack, or nothing that fits
+    CHECK(packAtlas({}, pageSize, placements) == 0 && placements.empty());
+    CHECK(packAtlas({optix::make_int2(pageSize, pageSize)}, pageSize, placements) == 0);
+    CHECK(placements.size() == 1 && placements[0].page == -1);
+}
+
+// Texels land where the transform maps their centers, the border repeats the wrapped texture.
+static void testCopyAndTransform()
+{
+    const int pageSize = 128, width = 13, height = 7;
+    std::vector<unsigned char> pixels(size_t(width) * height * 4);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++) {
+            unsigned char *texel = pixels.data() + (size_t(y) * width + x) * 4;
+            texel[0] = (unsigned char) x;
+            texel[1] = (unsigned char) y;
+            texel[2] = 200;
+            texel[3] = 255;
+        }
+
+    const AtlasPlacement placement = {0, 2 * ATLAS_BORDER, ATLAS_BORDER};
+    std::vector<unsigned char> page(size_t(pageSize) * pageSize * 4, 0);
+    copyToAtlas(pixels.data(), width, height, placement, page.data(), pageSize);
+
+    for (int y = 0; y < pageSize; y++)
+        for (int x = 0; x < pageSize; x++) {
+            const unsigned char *texel = page.data() + (size_t(y) * pageSize + x) * 4;
+            const int localX = x - placement.x, localY = y - placement.y;
+            const bool inside = -ATLAS_BORDER <= localX && localX < borderedSize(width) - ATLAS_BORDER &&
+                -ATLAS_BORDER <= localY && localY < borderedSize(height) - ATLAS_BORDER;
+            if (!inside) {
+                CHECK(texel[2] == 0);
+                continue;
+            }
+            CHECK(texel[0] == ((localX % width) + width) % width);
+            CHECK(texel[1] == ((localY % height) + height) % height);
+            CHECK(texel[2] == 200);
+        }
+
+    const optix::float4 transform = atlasTransform(width, height, placement, pageSize);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            for (float wrap : {0.0f, 1.0f, -3.0f}) {
+                const optix::float2 texture = optix::make_float2((float(x) + 0.5f) / float(width) + wrap,
+                                                                 (float(y) + 0.5f) / float(height) - wrap);
+                const optix::float2 uv = atlasUV(transform, texture);
+                const int pageX = int(uv.x * float(pageSize)), pageY = int(uv.y * float(pageSize));
+                const unsigned char *texel = page.data() + (size_t(pageY) * pageSize + pageX) * 4;
+                CHECK(texel[0] == x && texel[1] == y);
+            }
+
+    const optix::float2 footprint = atlasFootprint(transform, optix::make_float2(1.0f, 0.5f));
+    CHECK_NEAR(footprint.x, double(width) / pageSize, 1e-7);
+    CHECK_NEAR(footprint.y, 0.5 * height / pageSize, 1e-7);
+    const optix::float2 identity = atlasUV(atlasIdentity(), optix::make_float2(1.25f, -0.25f));
+    CHECK_NEAR(identity.x, 0.25, 1e-6);
+    CHECK_NEAR(identity.y, 0.75, 1e-6);
+}
+
+// On every level of the page, the texels of a texture and one texel around them see only its own content.
+static void testMipBorders()
+{
+    const int pageSize = 256;
+    const std::vector<optix::int2> sizes = {optix::make_int2(37, 50), optix::make_int2(16, 16),
+                                            optix::make_int2(100, 3), optix::make_int2(1, 1),
+                                            optix::make_int2(64, 64), optix::make_int2(17, 90)};
+    std::vector<AtlasPlacement> placements;
+    CHECK(packAtlas(sizes, pageSize, placements) == 1);
+
+    std::vector<unsigned char> page(mipChainPixels(pageSize, pageSize, ATLAS_MIP_COUNT) * 4, 0);
+    for (size_t i = 0; i < sizes.size(); i++) {
+        const unsigned char value = (unsigned char) (40 * (i + 1));
+        std::vector<unsigned char> pixels(size_t(sizes[i].x) * sizes[i].y * 4, value);
+        copyToAtlas(pixels.data(), sizes[i].x, sizes[i].y, placements[i], page.data(), pageSize);
+    }
+    buildMipPyramid(page.data(), pageSize, pageSize, ATLAS_MIP_COUNT, Image::levelFormat(Image::RGBA8_SRGB),
+                    MIP_FILTER_BOX);
+
+    const unsigned char *level = page.data();
+    for (int l = 0; l < ATLAS_MIP_COUNT; l++) {
+        const int levelSize = mipLevelSize(pageSize, l);
+        for (size_t i = 0; i < sizes.size(); i++) {
+            const int value = 40 * int(i + 1);
+            const int x0 = (placements[i].x >> l) - 1, x1 = ((placements[i].x + sizes[i].x - 1) >> l) + 1;
+            const int y0 = (placements[i].y >> l) - 1, y1 = ((placements[i].y + sizes[i].y - 1) >> l) + 1;
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                    CHECK(std::abs(int(level[(size_t(y) * levelSize + x) * 4]) - value) <= 1);
+        }
+        level += size_t(levelSize) * levelSize * 4;
+    }
+}
+
+int main()
+{
+    testPacking();
+    testCopyAndTransform();
+    testMipBorders();
+    return checkResult();
+}
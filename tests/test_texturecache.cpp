@@ -0,0 +1,246 @@
+
+#include "check.h"
+
+#include "../src/core/texturecache.h"
+#include "../src/core/image.h"
+#include "../src/core/globalsettings.h"
+#include "../src/utils/hash.h"
+
+#include <stb_image_write.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+static const int SIZE = 256;
+
+static std::string g_directory;
+
+static std::vector<std::string> listDirectory(const std::string &directory)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir(directory.c_str());
+    if (!dir)
+        return names;
+    while (dirent *entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+    closedir(dir);
+    return names;
+}
+
+static bool fileExists(const std::string &path)
+{
+    struct stat status;
+    return stat(path.c_str(), &status) == 0;
+}
+
+// An 8-bit PNG of SIZE x SIZE pixels with a pattern of its own for every seed.
+static std::string writeSource(const std::string &name, int seed)
+{
+    std::vector<unsigned char> pixels(size_t(SIZE) * SIZE * 4);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = (unsigned char) (i * 7 + seed * 31 + (i >> 10));
+    const std::string path = g_directory + "/" + name;
+    CHECK(stbi_write_png(path.c_str(), SIZE, SIZE, 4, pixels.data(), SIZE * 4) != 0);
+    return path;
+}
+
+// Name the cache gives a source of contentHash with a single mip level, see cacheFilename.
+static std::string cacheFile(uint64_t contentHash, int mipCount = 1)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-m%d-%s.tex", (unsigned long long) contentHash, mipCount,
+             mipFilterName(MIP_FILTER_BOX));
+    return GlobalSettings::getInstance().textureCacheDirectory + "/" + name;
+}
+
+static bool load(const std::string &filename, uint64_t contentHash, int mipCount = 1)
+{
+    Image image(mipCount);
+    return loadCachedImage(filename, contentHash, image);
+}
+
+static std::vector<char> readFile(const std::string &path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    return std::vector<char>((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string &path, const std::vector<char> &content)
+{
+    std::ofstream(path, std::ios::binary).write(content.data(), content.size());
+}
+
+static void setTime(const std::string &path, time_t time)
+{
+    struct utimbuf times = {time, time};
+    CHECK(utime(path.c_str(), &times) == 0);
+}
+
+// Without a size limit the cache is off, images are decoded and nothing is written.
+static void testDisabled()
+{
+    GlobalSettings &settings = GlobalSettings::getInstance();
+    settings.textureCacheSize = 0;
+    const std::string source = writeSource("disabled.png", 1);
+    uint64_t hash;
+    CHECK(hashFile(source, hash));
+    CHECK(load(source, hash));
+    CHECK(!fileExists(settings.textureCacheDirectory));
+    settings.textureCacheSize = 1;
+}
+
+// A miss decodes the source and writes the cache under a temporary name that is renamed afterwards, the
+// directory is created on the way. The next load maps the pixels of the file instead of decoding.
+static void testWriteAndRead()
+{
+    const std::string source = writeSource("write.png", 2);
+    uint64_t hash;
+    CHECK(hashFile(source, hash));
+    Image decoded;
+    CHECK(decoded.load(source));
+
+    CHECK(load(source, hash));
+    const std::vector<std::string> names = listDirectory(GlobalSettings::getInstance().textureCacheDirectory);
+    CHECK(names.size() == 1 && fileExists(cacheFile(hash)));
+    for (auto &name : names)
+        CHECK(name.find(".tmp") == std::string::npos);
+
+    Image cached(1);
+    CHECK(loadCachedImage(source, hash, cached));
+    CHECK(cached.format() == decoded.format() && cached.width() == SIZE && cached.height() == SIZE);
+    CHECK(cached.byteSize() == decoded.byteSize());
+    CHECK(memcmp(cached.data(), decoded.data(), decoded.byteSize()) == 0);
+    cached.clear();
+
+    // a changed pixel in the file shows up, so it really is the file that is mapped
+    std::vector<char> bytes = readFile(cacheFile(hash));
+    bytes[4096] = char(~bytes[4096]);
+    writeFile(cacheFile(hash), bytes);
+    Image patched(1);
+    CHECK(loadCachedImage(source, hash, patched));
+    CHECK(patched.data()[0] == (unsigned char) bytes[4096] && patched.data()[0] != decoded.data()[0]);
+    patched.clear();
+    remove(cacheFile(hash).c_str());
+}
+
+// Files are only used when their header matches the request. Any other file is a miss, which decodes the
+// source again and replaces the file with a valid one.
+static void testValidation()
+{
+    const std::string source = writeSource("validation.png", 3);
+    uint64_t hash;
+    CHECK(hashFile(source, hash));
+    CHECK(load(source, hash));
+    const std::string file = cacheFile(hash);
+    const std::vector<char> bytes = readFile(file);
+    const auto missRewrites = [&](const std::vector<char> &content) {
+        writeFile(file, content);
+        CHECK(load(source, hash));
+        CHECK(readFile(file) == bytes);
+    };
+
+    // other mip counts have files of their own
+    CHECK(load(source, hash, 2));
+    CHECK(fileExists(cacheFile(hash, 2)) && readFile(file) == bytes);
+    remove(cacheFile(hash, 2).c_str());
+
+    // the file of another source under this name holds the wrong content hash
+    const std::string other = writeSource("validation_other.png", 4);
+    uint64_t otherHash;
+    CHECK(hashFile(other, otherHash));
+    CHECK(load(other, otherHash));
+    missRewrites(readFile(cacheFile(otherHash)));
+    remove(cacheFile(otherHash).c_str());
+
+    std::vector<char> corrupt = bytes;
+    corrupt[0] = 'X';
+    missRewrites(corrupt);
+    corrupt = bytes;
+    corrupt[4] = 2; // version
+    missRewrites(corrupt);
+    // pixels cut off
+    missRewrites(std::vector<char>(bytes.begin(), bytes.end() - 1));
+    // shorter than the header page
+    missRewrites(std::vector<char>(bytes.begin(), bytes.begin() + 100));
+    remove(file.c_str());
+}
+
+// Trimming removes the files used longest ago until the rest fits, reading a file makes it the newest.
+static void testTrim()
+{
+    const std::string &directory = GlobalSettings::getInstance().textureCacheDirectory;
+    std::vector<std::string> files;
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < 5; i++) {
+        const std::string source = writeSource("trim" + std::to_string(i) + ".png", 10 + i);
+        uint64_t hash;
+        CHECK(hashFile(source, hash));
+        CHECK(load(source, hash));
+        remove(source.c_str());
+        hashes.push_back(hash);
+        files.push_back(cacheFile(hash));
+        setTime(files.back(), 1000 * (i + 1));
+    }
+    // other files in the directory are left alone
+    const std::string other = directory + "/notes.txt";
+    std::ofstream(other) << std::string(2 * 1024 * 1024, 'x');
+    setTime(other, 1);
+
+    // the oldest file is read again, a hit doesn't need the source
+    CHECK(load("missing.png", hashes[0]));
+
+    // five files of 260 KB against a limit of 1 MB, the two least recently used ones go
+    trimTextureCache();
+    CHECK(fileExists(files[0]));
+    CHECK(!fileExists(files[1]) && !fileExists(files[2]));
+    CHECK(fileExists(files[3]) && fileExists(files[4]));
+    CHECK(fileExists(other));
+
+    // nothing to do when the files fit
+    trimTextureCache();
+    CHECK(fileExists(files[0]) && fileExists(files[3]) && fileExists(files[4]));
+}
+
+static void removeDirectory(const std::string &directory)
+{
+    for (auto &name : listDirectory(directory)) {
+        const std::string path = directory + "/" + name;
+        struct stat status;
+        if (stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode))
+            removeDirectory(path);
+        else
+            remove(path.c_str());
+    }
+    rmdir(directory.c_str());
+}
+
+int main()
+{
+    char directory[] = "test_texturecache_XXXXXX";
+    if (!mkdtemp(directory)) {
+        printf("couldn't create a temporary directory\n");
+        return 1;
+    }
+    g_directory = directory;
+    GlobalSettings &settings = GlobalSettings::getInstance();
+    settings.textureCacheDirectory = g_directory + "/cache";
+    settings.textureCacheSize = 1;
+
+    testDisabled();
+    testWriteAndRead();
+    testValidation();
+    testTrim();
+
+    removeDirectory(g_directory);
+    return checkResult();
+}
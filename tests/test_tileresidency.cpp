@@ -0,0 +1,219 @@
+
+#include "check.h"
+
+#include "../src/core/tileresidency.h"
+#include "../src/core/virtualtexture.h"
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+// Host copy of the page table, updated from loads and evictions the way TexturePool::update does.
+static void applyUpdate(std::vector<int> &pageTable, const std::vector<std::pair<int, int>> &loads,
+    const std::vector<int> &evictions)
+{
+    for (auto page : evictions)
+        pageTable[page] = -1;
+    for (auto &load : loads)
+        pageTable[load.first] = load.second;
+}
+
+// Slots hold at most one page and the page table agrees with the residency.
+static void checkPageTable(const TileResidency &residency, const std::vector<int> &pageTable)
+{
+    std::vector<int> owner(residency.slotCount(), -1);
+    int resident = 0;
+    for (size_t page = 0; page < pageTable.size(); page++) {
+        CHECK(pageTable[page] == residency.slot(int(page)));
+        const int slot = pageTable[page];
+        if (slot < 0)
+            continue;
+        CHECK(slot < residency.slotCount());
+        CHECK(owner[slot] < 0);
+        owner[slot] = int(page);
+        resident++;
+    }
+    CHECK(resident == residency.residentCount());
+    CHECK(resident <= residency.slotCount());
+}
+
+// A drifting working set of requests, like a camera moving over a texture.
+static void testFeedbackStream()
+{
+    const int pageCount = 400, slotCount = 48, maxLoads = 8;
+    TileResidency residency(slotCount);
+    std::vector<int> pageTable(pageCount, -1);
+    const int pinnedPages[] = {399, 250};
+    for (int page : pinnedPages) {
+        pageTable[page] = residency.pin(page);
+        CHECK(0 <= pageTable[page]);
+    }
+    CHECK(residency.pin(399) == pageTable[399]);
+
+    std::mt19937 generator(7);
+    std::vector<int> lastUse(pageCount, -1);
+    std::vector<std::pair<int, int>> loads;
+    std::vector<int> evictions;
+    for (int frame = 0; frame < 2000; frame++) {
+        const int center = (frame / 10) % pageCount;
+        std::vector<int> requested;
+        std::uniform_int_distribution<int> offset(-20, 20);
+        for (int i = 0; i < 30; i++)
+            requested.push_back(((center + offset(generator)) % pageCount + pageCount) % pageCount);
+        std::vector<int> before(pageCount);
+        for (int page = 0; page < pageCount; page++)
+            before[page] = residency.slot(page);
+
+        residency.update(requested, maxLoads, loads, evictions);
+        applyUpdate(pageTable, loads, evictions);
+        checkPageTable(residency, pageTable);
+
+        const std::set<int> requestedSet(requested.begin(), requested.end());
+        CHECK(int(loads.size()) <= maxLoads);
+        std::set<int> loaded;
+        for (auto &load : loads) {
+            CHECK(requestedSet.count(load.first) == 1);
+            CHECK(before[load.first] < 0);
+            CHECK(loaded.insert(load.first).second);
+        }
+        int missing = 0;
+        for (int page : requestedSet)
+            missing += (before[page] < 0);
+        // everything missing is loaded when the limit allows, the working set always fits
+        CHECK(int(loads.size()) == std::min(missing, maxLoads));
+
+        for (int page : evictions) {
+            CHECK(requestedSet.count(page) == 0);
+            CHECK(page != pinnedPages[0] && page != pinnedPages[1]);
+            CHECK(pageTable[page] < 0);
+            // least recently used first: no page left resident from earlier frames was used before the victim
+            for (int other = 0; other < pageCount; other++)
+                if (0 <= pageTable[other] && other != pinnedPages[0] && other != pinnedPages[1] &&
+                    loaded.count(other) == 0 && requestedSet.count(other) == 0)
+                    CHECK(lastUse[page] <= lastUse[other]);
+        }
+        for (int page : requestedSet)
+            lastUse[page] = frame;
+        for (int page : pinnedPages)
+            CHECK(residency.slot(page) == pageTable[page] && 0 <= pageTable[page]);
+    }
+}
+
+// Pages used in the frame aren't evicted for each other, the surplus waits for later frames.
+static void testOversubscribed()
+{
+    TileResidency residency(4);
+    std::vector<int> pageTable(16, -1);
+    std::vector<std::pair<int, int>> loads;
+    std::vector<int> evictions;
+    const std::vector<int> requested = {0, 1, 2, 3, 4, 5, 6, 7};
+    residency.update(requested, 100, loads, evictions);
+    applyUpdate(pageTable, loads, evictions);
+    CHECK(loads.size() == 4 && evictions.empty());
+    residency.update(requested, 100, loads, evictions);
+    CHECK(loads.empty() && evictions.empty());
+    checkPageTable(residency, pageTable);
+
+    // a new working set evicts the old one, oldest first
+    residency.update({8, 9}, 1, loads, evictions);
+    applyUpdate(pageTable, loads, evictions);
+    CHECK(loads.size() == 1 && evictions.size() == 1);
+    checkPageTable(residency, pageTable);
+
+    residency.reset(2);
+    CHECK(residency.residentCount() == 0 && residency.slot(8) < 0);
+    CHECK(0 <= residency.pin(1) && 0 <= residency.pin(2) && residency.pin(3) < 0);
+    residency.update({5}, 1, loads, evictions);
+    CHECK(loads.empty() && evictions.empty());
+}
+
+// The device side of the stream on the host: lookups of a texture at a fixed level stamp missing pages into
+// the feedback buffer, updates read the current stamp only. The view converges with the requested level
+// resident, no feedback is left and every slot lies on one sheet of the atlas.
+static void testTranslateFeedbackLoop()
+{
+    VirtualTextureDefinition texture;
+    texture.width = 1000;
+    texture.height = 300;
+    texture.mipCount = 10;
+    texture.pageOffset = 3;
+    const int pageCount = texture.pageOffset + virtualPageCount(texture.width, texture.height, texture.mipCount);
+    CHECK(virtualPageCount(texture.width, texture.height, texture.mipCount) ==
+          8 * 3 + 4 * 2 + 2 * 1 + 1 * 1 + 6);
+
+    const int slotsPerSheet = VIRTUAL_SHEET_SLOTS * VIRTUAL_SHEET_SLOTS;
+    TileResidency residency(3 * slotsPerSheet);
+    std::vector<int> pageTable(pageCount, -1);
+    pageTable[pageCount - 1] = residency.pin(pageCount - 1);
+
+    std::vector<int> feedback(pageCount, 0);
+    int stamp = 1;
+    std::vector<std::pair<int, int>> loads;
+    std::vector<int> evictions;
+    const float lod = 1.3f;
+    std::mt19937 generator(11);
+    std::uniform_real_distribution<float> coordinate(-2.0f, 2.0f);
+    int frame = 0, sheetUploads = 0;
+    for (; frame < 100; frame++) {
+        int misses = 0;
+        for (int i = 0; i < 2000; i++) {
+            const optix::float2 uv = optix::make_float2(coordinate(generator), coordinate(generator));
+            int sheet = -1, requestedPage = -1;
+            optix::float2 atlasUV = optix::make_float2(0.0f);
+            const bool resident = translateVirtualTexture(texture, pageTable, uv, lod, sheet, atlasUV,
+                                                          requestedPage);
+            CHECK(resident);
+            CHECK(texture.pageOffset + 8 * 3 <= requestedPage && requestedPage < texture.pageOffset + 8 * 3 + 4 * 2);
+            CHECK(0 <= sheet && sheet < 3);
+            // inside the border of a slot, bilinear lookups never reach a neighbour
+            const float x = atlasUV.x * VIRTUAL_SHEET_SIZE, y = atlasUV.y * VIRTUAL_SHEET_SIZE;
+            const float insideX = x - float(int(x / VIRTUAL_SLOT_SIZE) * VIRTUAL_SLOT_SIZE);
+            const float insideY = y - float(int(y / VIRTUAL_SLOT_SIZE) * VIRTUAL_SLOT_SIZE);
+            CHECK(VIRTUAL_TILE_BORDER - 0.5f <= insideX && insideX <= VIRTUAL_SLOT_SIZE - VIRTUAL_TILE_BORDER + 0.5f);
+            CHECK(VIRTUAL_TILE_BORDER - 0.5f <= insideY && insideY <= VIRTUAL_SLOT_SIZE - VIRTUAL_TILE_BORDER + 0.5f);
+            if (pageTable[requestedPage] < 0) {
+                feedback[requestedPage] = stamp;
+                misses++;
+            }
+        }
+
+        std::vector<int> requested;
+        for (int page = 0; page < pageCount; page++)
+            if (feedback[page] == stamp)
+                requested.push_back(page);
+        stamp++;
+        CHECK(int(requested.size()) <= misses);
+        if (requested.empty())
+            break;
+        residency.update(requested, 3, loads, evictions);
+        applyUpdate(pageTable, loads, evictions);
+        checkPageTable(residency, pageTable);
+
+        std::set<int> sheets;
+        for (auto &load : loads)
+            sheets.insert(load.second / slotsPerSheet);
+        sheetUploads += int(sheets.size());
+    }
+    CHECK(frame < 100);
+    for (int page = texture.pageOffset + 8 * 3; page < texture.pageOffset + 8 * 3 + 4 * 2; page++)
+        CHECK(0 <= pageTable[page]);
+    // 8 tiles and the pinned one fit the first sheet, which is the only one ever uploaded
+    CHECK(sheetUploads == 3);
+
+    // a finer request falls back to the resident level
+    int sheet = -1, requestedPage = -1;
+    optix::float2 atlasUV = optix::make_float2(0.0f);
+    CHECK(translateVirtualTexture(texture, pageTable, optix::make_float2(0.5f, 0.5f), 0.0f, sheet, atlasUV,
+                                  requestedPage));
+    CHECK(requestedPage == texture.pageOffset + 1 * 8 + 3);
+    CHECK(pageTable[requestedPage] < 0);
+}
+
+int main()
+{
+    testFeedbackStream();
+    testOversubscribed();
+    testTranslateFeedbackLoop();
+    return checkResult();
+}
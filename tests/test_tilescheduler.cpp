@@ -0,0 +1,170 @@
+
+#include "check.h"
+
+#include "../src/core/tilescheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Every order covers each tile of the grid exactly once with origins on the grid inside the image.
+static void checkCoverage(int width, int height, int tileSize, TileOrder order)
+{
+    const int tilesX = (width + tileSize - 1) / tileSize, tilesY = (height + tileSize - 1) / tileSize;
+    const std::vector<optix::int2> tiles = orderTiles(width, height, tileSize, order);
+    CHECK(tiles.size() == size_t(tilesX) * tilesY);
+    std::set<std::pair<int, int>> seen;
+    for (const optix::int2 &tile : tiles) {
+        CHECK(tile.x % tileSize == 0 && tile.y % tileSize == 0);
+        CHECK(0 <= tile.x && tile.x < width && 0 <= tile.y && tile.y < height);
+        seen.insert(std::make_pair(tile.x, tile.y));
+    }
+    CHECK(seen.size() == tiles.size());
+}
+
+static void testOrders()
+{
+    const int grids[][3] = {{1920, 1080, 128}, {1000, 700, 64}, {700, 1000, 96}, {333, 47, 32}, {47, 333, 32},
+                            {1, 1, 16}, {2000, 16, 16}, {512, 512, 128}};
+    for (auto &grid : grids)
+        for (TileOrder order : {TILE_ORDER_ROWS, TILE_ORDER_HILBERT, TILE_ORDER_CENTER})
+            checkCoverage(grid[0], grid[1], grid[2], order);
+
+    // on a square power of two grid the Hilbert curve only steps to neighbouring tiles
+    const std::vector<optix::int2> hilbert = orderTiles(512, 512, 64, TILE_ORDER_HILBERT);
+    for (size_t i = 1; i < hilbert.size(); i++)
+        CHECK(std::abs(hilbert[i].x - hilbert[i - 1].x) + std::abs(hilbert[i].y - hilbert[i - 1].y) == 64);
+
+    // center out: the first tile holds the center and distances never decrease
+    const int width = 1000, height = 700, tileSize = 64;
+    const std::vector<optix::int2> center = orderTiles(width, height, tileSize, TILE_ORDER_CENTER);
+    CHECK(center[0].x <= width / 2 && width / 2 < center[0].x + tileSize);
+    CHECK(center[0].y <= height / 2 && height / 2 < center[0].y + tileSize);
+    float previous = 0.0f;
+    for (const optix::int2 &tile : center) {
+        const float x = tile.x + 0.5f * std::min(tileSize, width - tile.x) - 0.5f * width;
+        const float y = tile.y + 0.5f * std::min(tileSize, height - tile.y) - 0.5f * height;
+        CHECK(previous <= x * x + y * y);
+        previous = x * x + y * y;
+    }
+
+    CHECK(parseTileOrder(tileOrderName(TILE_ORDER_HILBERT)) == TILE_ORDER_HILBERT);
+    CHECK(parseTileOrder(tileOrderName(TILE_ORDER_CENTER)) == TILE_ORDER_CENTER);
+    CHECK(parseTileOrder("unknown") == TILE_ORDER_ROWS);
+}
+
+// Launches of a simulated device taking overhead + cost * pixels, with relative noise.
+struct SimulatedDevice
+{
+    float overhead;
+    float cost;
+    float noise;
+    std::mt19937 generator;
+
+    float launch(int pixels)
+    {
+        std::uniform_real_distribution<float> jitter(1.0f - noise, 1.0f + noise);
+        return (overhead + cost * float(pixels)) * jitter(generator);
+    }
+};
+
+// Tile size filling the budget with TILES_PER_FRAME launches on the device, as a multiple of the size step.
+static int idealTileSize(const SimulatedDevice &device, float budget)
+{
+    return int(sqrtf((budget / 4.0f - device.overhead) / device.cost) / 16.0f) * 16;
+}
+
+// Renders frames as the scene does: a pass over the image in tiles of the controller's size, launching while
+// the next launch fits. Returns the largest frame time, earlyStops counts frames that ended although their next
+// launch would have fit.
+static float renderFrames(TileSizeController &controller, SimulatedDevice &device, int frames, int &earlyStops,
+                          int &tileSize)
+{
+    const int width = 1920, height = 1080;
+    float longest = 0.0f;
+    std::vector<optix::int2> tiles;
+    size_t next = 0;
+    earlyStops = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        float elapsed = 0.0f;
+        while (true) {
+            if (next == tiles.size()) {
+                tileSize = controller.tileSize(width, height);
+                tiles = orderTiles(width, height, tileSize, TILE_ORDER_ROWS);
+                next = 0;
+            }
+            const optix::int2 &tile = tiles[next];
+            const int pixels = std::min(tileSize, width - tile.x) * std::min(tileSize, height - tile.y);
+            if (!controller.fits(pixels, elapsed)) {
+                // the launch that was held back should really have overshot
+                earlyStops += (elapsed + device.launch(pixels) <= controller.budget() * (1.0f - device.noise));
+                break;
+            }
+            const float time = device.launch(pixels);
+            controller.record(pixels, time);
+            elapsed += time;
+            next++;
+        }
+        longest = std::max(longest, elapsed);
+    }
+    return longest;
+}
+
+static void testController()
+{
+    TileSizeController controller;
+    CHECK(controller.tileSize(1920, 1080) == 1920);
+    CHECK(controller.fits(1920 * 1080, 1e9f));
+    const float budget = 16000.0f;
+    controller.setBudget(budget);
+    CHECK(controller.tileSize(1920, 1080) == 128);
+    CHECK(controller.tileSize(40, 20) == 48);
+    CHECK(!controller.fits(1, budget));
+
+    // without noise the model is exact after a few launches of different sizes and no frame overshoots
+    SimulatedDevice exact = {50.0f, 0.01f, 0.0f, std::mt19937(1)};
+    int earlyStops, tileSize;
+    renderFrames(controller, exact, 10, earlyStops, tileSize);
+    CHECK_NEAR(controller.model().overhead(), exact.overhead, 0.5);
+    CHECK_NEAR(controller.model().costPerPixel(), exact.cost, 1e-5);
+    float longest = renderFrames(controller, exact, 30, earlyStops, tileSize);
+    printf("exact: tile size %d, ideal %d, longest frame %.0f us\n", tileSize, idealTileSize(exact, budget), longest);
+    CHECK(tileSize == idealTileSize(exact, budget));
+    CHECK(longest <= budget);
+    CHECK(earlyStops == 0);
+    // a frame ends only when the next launch wouldn't fit, so it is at least as full as the budget less a tile
+    CHECK(budget - exact.launch(tileSize * tileSize) < longest);
+
+    // the scene gets twice as expensive, the size follows within a few frames
+    SimulatedDevice slower = {50.0f, 0.02f, 0.0f, std::mt19937(2)};
+    renderFrames(controller, slower, 20, earlyStops, tileSize);
+    longest = renderFrames(controller, slower, 20, earlyStops, tileSize);
+    printf("slower: tile size %d, ideal %d, longest frame %.0f us\n", tileSize, idealTileSize(slower, budget),
+           longest);
+    CHECK(tileSize == idealTileSize(slower, budget));
+    CHECK(longest <= budget && earlyStops == 0);
+
+    // with 5% noise the size stays within a step of the ideal one and frames overshoot by no more than the noise
+    TileSizeController noisyController;
+    noisyController.setBudget(budget);
+    SimulatedDevice noisy = {80.0f, 0.005f, 0.05f, std::mt19937(3)};
+    renderFrames(noisyController, noisy, 20, earlyStops, tileSize);
+    longest = renderFrames(noisyController, noisy, 50, earlyStops, tileSize);
+    printf("noisy: tile size %d, ideal %d, longest frame %.0f us\n", tileSize, idealTileSize(noisy, budget),
+           longest);
+    CHECK(std::abs(tileSize - idealTileSize(noisy, budget)) <= 16);
+    CHECK(longest <= budget * (1.0f + noisy.noise));
+    CHECK(earlyStops == 0);
+}
+
+int main()
+{
+    testOrders();
+    testController();
+    return checkResult();
+}
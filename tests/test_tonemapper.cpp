@@ -0,0 +1,191 @@
+
+#include "check.h"
+
+#include "../src/core/image.h"
+#include "../src/core/tonemapper.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+// Gray pixels of the given values with alpha 1, in one row.
+static std::vector<float> grayRow(const std::vector<float> &values)
+{
+    std::vector<float> pixels(values.size() * 4, 1.0f);
+    for (size_t i = 0; i < values.size(); i++)
+        pixels[i * 4] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = values[i];
+    return pixels;
+}
+
+static std::vector<unsigned char> toneMapRow(const std::vector<float> &pixels, const ToneMapSettings &settings)
+{
+    std::vector<unsigned char> codes(pixels.size());
+    toneMap(pixels.data(), int(pixels.size() / 4), 1, settings, codes.data());
+    return codes;
+}
+
+// Without dithering the clamp operator is at most one code off the exact sRGB encoder of textures, in the
+// groups of four and in the scalar tail of a row.
+static void testSrgbAccuracy()
+{
+    std::vector<float> values;
+    for (int i = 0; i <= 8190; i++)
+        values.push_back(float(i) / 8190.0f);
+    const std::vector<float> pixels = grayRow(values);
+    ToneMapSettings settings;
+    settings.dither = false;
+    const std::vector<unsigned char> codes = toneMapRow(pixels, settings);
+
+    std::vector<unsigned char> exact(pixels.size());
+    Image::levelFormat(Image::RGBA8_SRGB).encode(pixels.data(), int(values.size()), exact.data());
+    int worst = 0, mismatches = 0;
+    for (size_t i = 0; i < codes.size(); i++) {
+        worst = std::max(worst, std::abs(int(codes[i]) - int(exact[i])));
+        mismatches += codes[i] != exact[i];
+    }
+    CHECK(worst <= 1);
+    CHECK(mismatches < int(codes.size()) / 100);
+    CHECK(codes[0] == 0 && codes[codes.size() - 4] == 255);
+}
+
+// Values outside [0, 1] clamp, NaNs become black and infinities white. Alpha is clamped but not encoded.
+static void testSpecialValues()
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float inf = std::numeric_limits<float>::infinity();
+    const std::vector<float> pixels = grayRow({-1.0f, 2.0f, nan, inf, -inf});
+    ToneMapSettings settings;
+    settings.dither = false;
+    for (int toneOperator = TONEMAP_CLAMP; toneOperator <= TONEMAP_FILMIC; toneOperator++) {
+        settings.toneOperator = ToneMapOperator(toneOperator);
+        const std::vector<unsigned char> codes = toneMapRow(pixels, settings);
+        CHECK(codes[0] == 0 && codes[8] == 0 && codes[12] == 255 && codes[16] == 0);
+        for (size_t i = 3; i < codes.size(); i += 4)
+            CHECK(codes[i] == 255);
+    }
+
+    std::vector<float> alpha = grayRow({0.5f, 0.5f, 0.5f, 0.5f, 0.5f});
+    alpha[3] = -1.0f;
+    alpha[7] = 0.5f;
+    alpha[11] = 2.0f;
+    alpha[19] = 0.5f;
+    const std::vector<unsigned char> codes = toneMapRow(alpha, settings);
+    CHECK(codes[3] == 0 && codes[7] == 128 && codes[11] == 255 && codes[19] == 128);
+}
+
+// Every operator rises monotonically from black to white, one stop of exposure doubles the input.
+static void testOperators()
+{
+    std::vector<float> values;
+    for (int i = 0; i < 400; i++)
+        values.push_back(float(i) * 0.05f);
+    const std::vector<float> pixels = grayRow(values);
+    std::vector<float> doubled(pixels);
+    for (size_t i = 0; i < doubled.size(); i++)
+        if (i % 4 != 3)
+            doubled[i] *= 2.0f;
+
+    ToneMapSettings settings;
+    settings.dither = false;
+    for (int toneOperator = TONEMAP_CLAMP; toneOperator <= TONEMAP_FILMIC; toneOperator++) {
+        settings.toneOperator = ToneMapOperator(toneOperator);
+        settings.exposure = 0.0f;
+        const std::vector<unsigned char> codes = toneMapRow(pixels, settings);
+        bool monotonic = true;
+        for (size_t i = 4; i < codes.size(); i += 4)
+            monotonic &= codes[i - 4] <= codes[i];
+        CHECK(monotonic);
+        CHECK(codes[0] == 0);
+        CHECK(toneOperator == TONEMAP_REINHARD || codes[codes.size() - 4] == 255);
+
+        settings.exposure = 1.0f;
+        const std::vector<unsigned char> exposed = toneMapRow(pixels, settings);
+        settings.exposure = 0.0f;
+        CHECK(exposed == toneMapRow(doubled, settings));
+    }
+
+    // Reinhard maps 1 to one half, the filmic curve reaches white at its white point
+    settings.toneOperator = TONEMAP_REINHARD;
+    std::vector<unsigned char> exact(4);
+    const std::vector<float> half = grayRow({0.5f});
+    Image::levelFormat(Image::RGBA8_SRGB).encode(half.data(), 1, exact.data());
+    CHECK(std::abs(int(toneMapRow(grayRow({1.0f}), settings)[0]) - int(exact[0])) <= 1);
+    settings.toneOperator = TONEMAP_FILMIC;
+    CHECK(toneMapRow(grayRow({5.6f}), settings)[0] == 255);
+    CHECK(toneMapRow(grayRow({5.0f}), settings)[0] < 255);
+}
+
+// Dithering keeps every code within one of the undithered code, and a flat area between two codes averages
+// to its exact value.
+static void testDither()
+{
+    const int width = 256, height = 64;
+    std::vector<float> pixels(size_t(width) * height * 4, 1.0f);
+    const float value = 0.2f;
+    for (size_t i = 0; i < pixels.size(); i++)
+        if (i % 4 != 3)
+            pixels[i] = value;
+    ToneMapSettings settings;
+    std::vector<unsigned char> dithered(pixels.size()), plain(pixels.size());
+    toneMap(pixels.data(), width, height, settings, dithered.data());
+    settings.dither = false;
+    toneMap(pixels.data(), width, height, settings, plain.data());
+
+    std::vector<unsigned char> exact(4);
+    Image::levelFormat(Image::RGBA8_SRGB).encode(pixels.data(), 1, exact.data());
+    const double target = 255.0 * (1.055 * pow(0.2, 1.0 / 2.4) - 0.055);
+    double sum = 0.0;
+    int worst = 0, alphaMismatches = 0;
+    for (size_t i = 0; i < dithered.size(); i++) {
+        if (i % 4 == 3) {
+            alphaMismatches += dithered[i] != 255;
+            continue;
+        }
+        worst = std::max(worst, std::abs(int(dithered[i]) - int(plain[i])));
+        sum += dithered[i];
+    }
+    CHECK(worst <= 1);
+    CHECK(alphaMismatches == 0);
+    CHECK(plain[0] == exact[0]);
+    CHECK_NEAR(sum / double(width * height * 3), target, 0.02);
+}
+
+// With flipRows the first source row ends up last.
+static void testFlipRows()
+{
+    const int width = 5, height = 37;
+    std::vector<float> pixels(size_t(width) * height * 4, 1.0f);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width * 4; x++)
+            if (x % 4 != 3)
+                pixels[size_t(y) * width * 4 + x] = float(y) / float(height);
+    ToneMapSettings settings;
+    settings.dither = false;
+    std::vector<unsigned char> rows(pixels.size()), flipped(pixels.size());
+    toneMap(pixels.data(), width, height, settings, rows.data());
+    toneMap(pixels.data(), width, height, settings, flipped.data(), true);
+    int mismatches = 0;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width * 4; x++)
+            mismatches += rows[size_t(y) * width * 4 + x] != flipped[size_t(height - 1 - y) * width * 4 + x];
+    CHECK(mismatches == 0);
+}
+
+static void testOperatorNames()
+{
+    for (int toneOperator = TONEMAP_CLAMP; toneOperator <= TONEMAP_FILMIC; toneOperator++)
+        CHECK(parseToneMapOperator(toneMapOperatorName(ToneMapOperator(toneOperator))) == toneOperator);
+    CHECK(parseToneMapOperator("unknown") == TONEMAP_CLAMP);
+}
+
+int main()
+{
+    testSrgbAccuracy();
+    testSpecialValues();
+    testOperators();
+    testDither();
+    testFlipRows();
+    testOperatorNames();
+    return checkResult();
+}